@@ -0,0 +1,753 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* Benchmarks for the kernel's hot paths, they print their results to the screen.
+   Times are measured using the PIT, which ticks every millisecond. */
+
+#include "bench.h"
+
+#include "../include/types.h"
+#include "../include/exit_code.h"
+
+#include "../hardware/timer.h"
+
+#include "../memory/memory.h"
+#include "../memory/paging.h"
+#include "../memory/buddy.h"
+
+#include "../util/util.h"
+
+#include "../cpu/cpu.h"
+
+#include "../screen/screen_basic.h"
+
+#include "../hardware/pci.h"
+#include "../hardware/driver.h"
+
+#include "../drv/COMMANDS.H"
+#include "../drv/IDE_commands.h"
+#include "../drv/VIRTIO_commands.h"
+#include "../drv/FS_commands.h"
+#include "../drv/FS_TYPES.H"
+
+#include "../dsk/diskio.h"
+#include "../dsk/diskdefines.h"
+#include "../dsk/cache.h"
+#include "../dsk/dcache.h"
+
+#include "../drv/FS/iso9660.h"
+
+#include "../exec/elf.h"
+#include "../exec/task.h"
+
+#define BENCH_KMALLOC_RUNTIME   1000 /* ms */
+#define BENCH_KMALLOC_LIVE      64   /* allocations kept alive at the same time */
+
+/* a mix of what the kernel usually asks for: command packets, path strings,
+   sector buffers and the occasional multi-page buffer */
+static const uint32_t bench_kmalloc_sizes[] = {20, 512, 16, 100, 2048, 64, 300, 8, 1000, 4000};
+
+#define BENCH_MEM_RUNTIME       100  /* ms, per size and implementation */
+#define BENCH_MEM_BATCH         16   /* copies between looking at the timer */
+#define BENCH_MEM_BUFFER        0x100000U
+
+/* directory entries, sectors, pages, cluster runs and whole files */
+static const uint32_t bench_mem_sizes[] = {64, 512, 4096, 65536, BENCH_MEM_BUFFER};
+
+#define BENCH_IDE_SECTORS       64   /* ATAPI sectors read per PIO mode */
+#define BENCH_IDE_LBA           16   /* the primary volume descriptor, any disc has it */
+#define BENCH_IDE_RUNTIME       250  /* ms, per transfer size and mode */
+
+/* single sectors, a cluster, and the biggest reads the driver takes */
+static const uint32_t bench_ide_sizes[] = {1, 8, 64, 256};
+
+#define BENCH_SG_PIECES         32   /* sectors of a scatter-gather list, more than one PRD table used to take */
+#define BENCH_SG_STRIDE         2048 /* bytes between them, like the blocks of the cache */
+
+#define BENCH_RA_SECTORS        2048 /* CD sectors, 4 MiB: about the size of a big ELF */
+#define BENCH_RA_CHUNK          2    /* CD sectors per read(), a page at a time like a loader does */
+
+#define BENCH_ISO_PATH          "CD0/BOOT/GRUB/GRUB.CFG" /* the deepest file every boot disc has */
+#define BENCH_ISO_LOOKUPS       100
+
+#define BENCH_ELF_PATH          "CD0/TEST/CONWAY.ELF" /* the binary the kernel runs */
+#define BENCH_PAGE_KB           4    /* KiB per page, buddy_get_free() counts pages */
+
+#define BENCH_COLD              0x01 /* empty the caches first, every sector comes from the drive */
+#define BENCH_VIRTIO            0x02 /* also count what the virtio-blk driver sent */
+
+typedef void (*bench_memcpy_t)(char *, const char *, uint32_t);
+
+/* what a disk benchmark run took. bench_start() takes the counters, bench_stop() turns them into what changed */
+typedef struct
+{
+    uint32_t ms;
+    uint32_t pages;             /* taken from the buddy allocator and not given back (yet) */
+    uint32_t misses;            /* sectors that came from the drive */
+    uint32_t ra_sectors;        /* sectors read ahead */
+    uint32_t ra_hits;           /* sectors read ahead that were asked for */
+    uint32_t requests;          /* commands the scheduler sent to the drive */
+    uint32_t virtio_requests;   /* BENCH_VIRTIO only */
+    uint32_t virtio_notifies;
+    uint8_t flags;
+} BENCH_RUN;
+
+static void bench_memcpy_bytes(char *destination, const char *source, uint32_t size);
+static uint32_t bench_mem_copy(bench_memcpy_t func, char *dst, char *src, uint32_t size);
+static uint32_t bench_ide_set_pio(uint32_t ctrl, uint8_t drive, uint8_t mode);
+static uint32_t bench_ide_ctrl(void);
+static uint8_t bench_ide_drive(uint8_t type);
+static uint8_t bench_drive(uint8_t type);
+static uint8_t bench_ide_set_dma(uint32_t ctrl, uint8_t drive, uint8_t dma);
+static uint32_t bench_disk_read(uint8_t drive, uint32_t sectors, uint8_t *buf);
+static uint32_t bench_ide_latency(uint32_t ctrl, uint8_t drive);
+static uint32_t bench_virtio_info(uint32_t *info);
+static void bench_counters(BENCH_RUN *run, uint8_t drive);
+static void bench_start(BENCH_RUN *run, uint8_t drive, uint8_t flags);
+static void bench_stop(BENCH_RUN *run, uint8_t drive);
+
+void bench_run(void)
+{
+    print("[BENCH] Running benchmarks\n");
+
+    bench_kmalloc();
+    bench_mem();
+    bench_ide_pio();
+    bench_ide_dma();
+    bench_virtio();
+    bench_ahci_sg();
+    bench_readahead();
+    bench_iso_lookup();
+    bench_elf_load();
+
+    print("\n");
+}
+
+void bench_kmalloc(void)
+{
+    void *live[BENCH_KMALLOC_LIVE];
+    const uint32_t nsizes = sizeof(bench_kmalloc_sizes) / sizeof(uint32_t);
+    uint32_t i, n = 0, failed = 0;
+    uint32_t start, end;
+
+    for(i = 0; i < BENCH_KMALLOC_LIVE; ++i)
+        live[i] = NULL;
+
+    start = timer_getCurrentTick();
+    end = start + BENCH_KMALLOC_RUNTIME;
+
+    /* every allocation replaces (and frees) the oldest one still alive */
+    while(timer_getCurrentTick() < end)
+    {
+        i = n % BENCH_KMALLOC_LIVE;
+
+        kfree(live[i]);
+        live[i] = kmalloc(bench_kmalloc_sizes[n % nsizes]);
+
+        if(!live[i])
+            failed++;
+
+        n++;
+    }
+
+    for(i = 0; i < BENCH_KMALLOC_LIVE; ++i)
+        kfree(live[i]);
+
+    print_value("[BENCH] kmalloc (mixed sizes): %i allocations/s", (n * 1000) / BENCH_KMALLOC_RUNTIME);
+    print_value(" (%i failed)\n", failed);
+}
+
+/* memcpy in MB/s: the old byte loop, rep movsd and SSE2 (if the cpu can) */
+void bench_mem(void)
+{
+    const uint32_t nsizes = sizeof(bench_mem_sizes) / sizeof(uint32_t);
+    const uint8_t sse2 = CPU_sse2_usable();
+    char *src = kmalloc(BENCH_MEM_BUFFER);
+    char *dst = kmalloc(BENCH_MEM_BUFFER);
+    uint32_t i;
+
+    if(!src || !dst)
+    {
+        print("[BENCH] mem: out of memory\n");
+        kfree(src);
+        kfree(dst);
+        return;
+    }
+
+    /* make sure all of it is mapped in and cached (as far as it fits) */
+    memset(src, BENCH_MEM_BUFFER, 0x5A);
+    memset(dst, BENCH_MEM_BUFFER, 0x00);
+
+    for(i = 0; i < nsizes; ++i)
+    {
+        print_value("[BENCH] memcpy %i bytes: ", bench_mem_sizes[i]);
+        print_value("bytes %i MB/s, ", bench_mem_copy(bench_memcpy_bytes, dst, src, bench_mem_sizes[i]));
+        print_value("rep %i MB/s", bench_mem_copy(ASM_MEMCPY_REP, dst, src, bench_mem_sizes[i]));
+
+        if(sse2)
+            print_value(", sse2 %i MB/s", bench_mem_copy(ASM_MEMCPY_SSE2, dst, src, bench_mem_sizes[i]));
+
+        print("\n");
+    }
+
+    kfree(src);
+    kfree(dst);
+}
+
+/* timestamp counter cycles per 2048-byte ATAPI sector: the old inw loop, rep insw and rep insd.
+   The IDE driver never picks rep insd by itself, so the sector it reads is checked against the
+   rep insw one: if they differ the controller can't do 32-bit PIO. */
+void bench_ide_pio(void)
+{
+    static const uint8_t modes[] = {IDE_PIO_LOOP, IDE_PIO_16, IDE_PIO_32};
+    static const char *names[] = {"inw loop", "rep insw", "rep insd"};
+    uint8_t drive = bench_ide_drive(DRIVE_TYPE_IDE_PATAPI);
+    uint8_t *buf = kmalloc(2 * 2048);
+    uint8_t *ref = buf + 2048;
+    uint32_t ctrl = bench_ide_ctrl();
+    uint8_t i;
+    uint32_t n;
+
+    if(drive == IDE_DRIVER_MAX_DRIVES || !buf || !CPU_has_feature(CPU_FEATURE_TSC))
+    {
+        print("[BENCH] ide pio: no ATAPI drive or timestamp counter\n");
+        kfree(buf);
+        return;
+    }
+
+    for(i = 0; i < sizeof(modes); ++i)
+    {
+        /* also resets the counters */
+        bench_ide_set_pio(ctrl, drive, modes[i]);
+
+        for(n = 0; n < BENCH_IDE_SECTORS; ++n)
+            diskio_read_device(drive, BENCH_IDE_LBA + n, 1, buf);
+
+        print_value("[BENCH] ide pio %s: ", (uint32_t) names[i]);
+        print_value("%i cycles/sector", bench_ide_set_pio(ctrl, drive, IDE_PIO_AUTO));
+
+        /* the last sector read in each mode is the same one */
+        if(modes[i] == IDE_PIO_16)
+            memcpy((char *) ref, (char *) buf, 2048);
+        else if(modes[i] == IDE_PIO_32 && memcmp(ref, buf, 2048))
+            print(", data differs from rep insw");
+
+        print("\n");
+    }
+
+    kfree(buf);
+}
+
+/* read throughput in KB/s of PIO and bus master DMA on the first PATA drive, and how long
+   the drive took per request */
+void bench_ide_dma(void)
+{
+    const uint32_t nsizes = sizeof(bench_ide_sizes) / sizeof(uint32_t);
+    uint8_t drive = bench_ide_drive(DRIVE_TYPE_IDE_PATA);
+    uint8_t *buf = kmalloc(256 * 512);
+    uint32_t ctrl = bench_ide_ctrl();
+    uint8_t dma;
+    uint32_t i;
+
+    if(drive == IDE_DRIVER_MAX_DRIVES || !buf)
+    {
+        print("[BENCH] ide dma: no PATA drive\n");
+        kfree(buf);
+        return;
+    }
+
+    /* see if the drive can do DMA at all */
+    dma = !bench_ide_set_dma(ctrl, drive, 1);
+
+    for(i = 0; i < nsizes; ++i)
+    {
+        print_value("[BENCH] ide read %i sectors: ", bench_ide_sizes[i]);
+
+        bench_ide_set_dma(ctrl, drive, 0);
+        bench_ide_latency(ctrl, drive);
+        print_value("pio %i KB/s", bench_disk_read(drive, bench_ide_sizes[i], buf));
+        print_value(" (%i us/request)", bench_ide_latency(ctrl, drive));
+
+        if(dma)
+        {
+            bench_ide_set_dma(ctrl, drive, 1);
+            print_value(", dma %i KB/s", bench_disk_read(drive, bench_ide_sizes[i], buf));
+            print_value(" (%i us/request)", bench_ide_latency(ctrl, drive));
+        }
+
+        print("\n");
+    }
+
+    bench_ide_set_dma(ctrl, drive, dma);
+    kfree(buf);
+}
+
+/* read throughput in KB/s of the first virtio-blk drive next to IDE PIO on the first PATA drive.
+   Give both the same raw image (e.g. -drive file=hd.img,if=ide,snapshot=on -drive file=hd.img,if=virtio,snapshot=on)
+   so that they read the same sectors. */
+void bench_virtio(void)
+{
+    const uint32_t nsizes = sizeof(bench_ide_sizes) / sizeof(uint32_t);
+    uint8_t virtio = bench_drive(DRIVE_TYPE_VIRTIO);
+    uint8_t ide = bench_ide_drive(DRIVE_TYPE_IDE_PATA);
+    uint8_t *buf = kmalloc(256 * 512);
+    uint32_t ctrl = 0, dma = 0;
+    uint32_t i;
+    BENCH_RUN run;
+
+    if(virtio == MAX_DRIVES || !buf)
+    {
+        print("[BENCH] virtio: no virtio-blk drive\n");
+        kfree(buf);
+        return;
+    }
+
+    /* the IDE path to compare with: PIO, READ MULTIPLE blocks per IRQ (DMA would hide the driver's overhead) */
+    if(ide != IDE_DRIVER_MAX_DRIVES)
+    {
+        ctrl = bench_ide_ctrl();
+        dma = !bench_ide_set_dma(ctrl, ide, 0);
+    }
+
+    for(i = 0; i < nsizes; ++i)
+    {
+        print_value("[BENCH] virtio read %i sectors: ", bench_ide_sizes[i]);
+
+        if(ide != IDE_DRIVER_MAX_DRIVES)
+            print_value("ide pio %i KB/s, ", bench_disk_read(ide, bench_ide_sizes[i], buf));
+
+        bench_start(&run, virtio, BENCH_VIRTIO);
+        print_value("virtio %i KB/s", bench_disk_read(virtio, bench_ide_sizes[i], buf));
+        bench_stop(&run, virtio);
+
+        print_value(" (%i requests/notify)\n", run.virtio_notifies ? run.virtio_requests / run.virtio_notifies : 0);
+    }
+
+    if(ide != IDE_DRIVER_MAX_DRIVES)
+        bench_ide_set_dma(ctrl, ide, (uint8_t) dma);
+
+    kfree(buf);
+}
+
+/* reads BENCH_SG_PIECES sectors of the first SATA drive into pieces that aren't next to each other (a PRD each)
+   and writes them back the same way, both have to match a plain read of the same sectors */
+void bench_ahci_sg(void)
+{
+    uint8_t drive = bench_drive(DRIVE_TYPE_SATA);
+    uint8_t *buf = kmalloc(BENCH_SG_PIECES * BENCH_SG_STRIDE);
+    uint8_t *ref = kmalloc(BENCH_SG_PIECES * 512);
+    SG_ENTRY sg[BENCH_SG_PIECES];
+    uint8_t error;
+    uint32_t i;
+
+    if(drive == MAX_DRIVES || !buf || !ref)
+    {
+        print("[BENCH] ahci sg: no SATA drive\n");
+        kfree(buf);
+        kfree(ref);
+        return;
+    }
+
+    for(i = 0; i < BENCH_SG_PIECES; ++i)
+    {
+        sg[i].buf = buf + i * BENCH_SG_STRIDE;
+        sg[i].size = 512;
+    }
+
+    memset((char *) buf, BENCH_SG_PIECES * BENCH_SG_STRIDE, 0);
+
+    error = diskio_read_device(drive, 0, BENCH_SG_PIECES, ref);
+    error = error ? error : diskio_read_sg(drive, 0, BENCH_SG_PIECES, sg);
+
+    for(i = 0; i < BENCH_SG_PIECES && !error; ++i)
+        if(memcmp(ref + i * 512, sg[i].buf, 512))
+            error = EXIT_CODE_GLOBAL_GENERAL_FAIL;
+
+    /* the same data goes back, so the drive doesn't change */
+    error = error ? error : diskio_write_sg(drive, 0, BENCH_SG_PIECES, sg);
+    error = error ? error : diskio_read_device(drive, 0, BENCH_SG_PIECES, ref);
+
+    for(i = 0; i < BENCH_SG_PIECES && !error; ++i)
+        if(memcmp(ref + i * 512, sg[i].buf, 512))
+            error = EXIT_CODE_GLOBAL_GENERAL_FAIL;
+
+    print_value("[BENCH] ahci sg: %i pieces ", BENCH_SG_PIECES);
+    print(error ? "FAILED\n" : "ok\n");
+
+    kfree(buf);
+    kfree(ref);
+}
+
+/* loads 4 MiB from CD0 a page at a time, like a loader would, with readahead off and on.
+   The cache is emptied first, so every sector comes from the drive (or from readahead). */
+void bench_readahead(void)
+{
+    uint8_t drive = to_actual_drive(0, DRIVE_TYPE_IDE_PATAPI);
+    uint8_t *buf = kmalloc(BENCH_RA_CHUNK * 2048);
+    uint32_t lba;
+    uint8_t enable, error = 0;
+    BENCH_RUN run;
+
+    if(drive == (uint8_t) MAX || !buf)
+    {
+        print("[BENCH] readahead: no CD drive\n");
+        kfree(buf);
+        return;
+    }
+
+    for(enable = 0; enable < 2 && !error; ++enable)
+    {
+        diskio_set_readahead(enable);
+        bench_start(&run, drive, BENCH_COLD);
+
+        for(lba = 0; lba < BENCH_RA_SECTORS && !error; lba += BENCH_RA_CHUNK)
+            error = read(drive, lba, BENCH_RA_CHUNK, buf);
+
+        bench_stop(&run, drive);
+
+        print_value("[BENCH] readahead %s: ", (uint32_t) (enable ? "on" : "off"));
+        print_value("4 MiB from CD0 in %i ms", run.ms);
+        print_value(" (%i KB/s", run.ms ? (BENCH_RA_SECTORS * 2048) / run.ms : 0);
+        print_value(", window %i sectors", diskio_readahead_window(drive));
+        print_value(", %i% of the sectors read ahead were used)\n", run.ra_sectors ? (run.ra_hits * 100) / run.ra_sectors : 0);
+    }
+
+    if(error)
+        print_value("[BENCH] readahead: read error %x\n", error);
+
+    diskio_set_readahead(1);
+    kfree(buf);
+}
+
+void bench_iso_lookup(void)
+{
+    uint8_t drive = to_actual_drive(0, DRIVE_TYPE_IDE_PATAPI);
+    uint32_t i, flba = 0;
+    char path[] = BENCH_ISO_PATH;
+    size_t fsize;
+    uint8_t index;
+    BENCH_RUN run;
+
+    if(drive == (uint8_t) MAX || !iso_dir_count())
+    {
+        print("[BENCH] ISO lookup: no indexed CD\n");
+        return;
+    }
+
+    /* first the path table on the disc (the old way), then the copy in memory. only the first
+       lookup has to read the directory the file is in, the dentry cache knows it after that */
+    for(index = 0; index < 2; ++index)
+    {
+        iso_set_path_index(index);
+        bench_start(&run, drive, BENCH_COLD);
+
+        for(i = 0; i < BENCH_ISO_LOOKUPS; ++i)
+            flba = iso_traverse(path, &fsize);
+
+        bench_stop(&run, drive);
+
+        print_value("[BENCH] ISO lookup, path table %s: ", (uint32_t) (index ? "in memory" : "on disc"));
+        print_value("%i lookups of " BENCH_ISO_PATH, BENCH_ISO_LOOKUPS);
+        print_value(" in %i ms", run.ms);
+        print_value(", %i disk requests", run.requests);
+        print_value(" (%i sectors from the drive)\n", run.misses);
+    }
+
+    if(!flba)
+        print("[BENCH] ISO lookup: " BENCH_ISO_PATH " not found\n");
+
+    iso_set_path_index(1);
+}
+
+void bench_elf_load(void)
+{
+    uint8_t drive = to_actual_drive(0, DRIVE_TYPE_IDE_PATAPI);
+    uint32_t drv[DRIVER_COMMAND_PACKET_LEN];
+    uint32_t entry, base;
+    char path[] = BENCH_ELF_PATH;
+    void *image = NULL;
+    uint8_t err, pid = task_new_pid();
+    BENCH_RUN run;
+
+    if(drive == (uint8_t) MAX)
+    {
+        print("[BENCH] ELF load: no CD drive\n");
+        return;
+    }
+
+    /* the old way: the whole file in a buffer, then the segments copied out of it */
+    bench_start(&run, drive, BENCH_COLD);
+
+    drv[0] = FS_COMMAND_READ;
+    drv[1] = (uint32_t) path;
+    drv[2] = drv[3] = 0;
+    driver_exec((FS_TYPE_ISO | DRIVER_TYPE_FS), drv);
+
+    err = (uint8_t) drv[4];
+
+    if(!err)
+        err = elf_load_buffer((void *) drv[2], pid, &image, &entry, &base);
+
+    bench_stop(&run, drive);
+
+    kfree((void *) drv[2]);
+    vfree(image);
+    image = NULL;
+
+    if(err)
+    {
+        print_value("[BENCH] ELF load: " BENCH_ELF_PATH " failed with error %x\n", err);
+        return;
+    }
+
+    print_value("[BENCH] ELF load, %i KiB file", drv[3] / 1024);
+    print_value(" read whole and copied: %i ms", run.ms);
+    print_value(", %i KiB peak\n", run.pages * BENCH_PAGE_KB);
+
+    /* the segments read from the CD into the pages they run from */
+    bench_start(&run, drive, BENCH_COLD);
+
+    err = elf_load_file(path, pid, &image, &entry, &base);
+
+    /* the buffer for the headers is freed by now, it's half a page */
+    bench_stop(&run, drive);
+
+    vfree(image);
+
+    if(err)
+    {
+        print_value("[BENCH] ELF load from file: error %x\n", err);
+        return;
+    }
+
+    print_value("[BENCH] ELF load, segments read into place: %i ms", run.ms);
+    print_value(", %i KiB peak\n", run.pages * BENCH_PAGE_KB);
+}
+
+/* returns: the IDE controller, as driver_exec() wants it */
+static uint32_t bench_ide_ctrl(void)
+{
+    uint32_t *devicelist = pciGetDevices(0x01, 0x01);
+    uint32_t ctrl = pciGetInfo(devicelist[1]) | DRIVER_TYPE_PCI;
+
+    kfree(devicelist);
+    return ctrl;
+}
+
+/* returns: the first drive of the type or IDE_DRIVER_MAX_DRIVES */
+static uint8_t bench_ide_drive(uint8_t type)
+{
+    uint8_t *drives = diskio_reportDrives();
+    uint8_t drive;
+
+    for(drive = 0; drive < IDE_DRIVER_MAX_DRIVES; ++drive)
+        if(drives[drive] == type)
+            break;
+
+    kfree(drives);
+    return drive;
+}
+
+/* returns: the first drive of the type or MAX_DRIVES, whatever the controller */
+static uint8_t bench_drive(uint8_t type)
+{
+    uint8_t *drives = diskio_reportDrives();
+    uint8_t drive;
+
+    for(drive = 0; drive < MAX_DRIVES; ++drive)
+        if(drives[drive] == type)
+            break;
+
+    kfree(drives);
+    return drive;
+}
+
+/* returns: non-zero if the drive can't do DMA */
+static uint8_t bench_ide_set_dma(uint32_t ctrl, uint8_t drive, uint8_t dma)
+{
+    uint32_t drv[DRIVER_COMMAND_PACKET_LEN];
+
+    drv[0] = IDE_COMMAND_SET_DMA;
+    drv[1] = drive;
+    drv[2] = dma;
+    drv[3] = 0;
+    drv[4] = 1;
+
+    driver_exec(ctrl, drv);
+
+    return drv[4] == NULL;
+}
+
+/* returns: average microseconds the drive took per request since the last call */
+static uint32_t bench_ide_latency(uint32_t ctrl, uint8_t drive)
+{
+    uint32_t drv[DRIVER_COMMAND_PACKET_LEN];
+    uint32_t latency[IDE_LATENCY_LEN];
+
+    drv[0] = IDE_COMMAND_GET_LATENCY;
+    drv[1] = drive;
+    drv[2] = (uint32_t) latency;
+    drv[3] = 1;
+    drv[4] = 0;
+
+    latency[IDE_LATENCY_AVERAGE] = 0;
+    driver_exec(ctrl, drv);
+
+    return latency[IDE_LATENCY_AVERAGE];
+}
+
+/* returns: KB/s */
+static uint32_t bench_disk_read(uint8_t drive, uint32_t sectors, uint8_t *buf)
+{
+    uint32_t n = 0, end = timer_getCurrentTick() + BENCH_IDE_RUNTIME;
+
+    /* the same sectors over and over, the drive's cache is part of what we measure */
+    while(timer_getCurrentTick() < end)
+    {
+        if(diskio_read_device(drive, 0, sectors, buf))
+            return 0;
+        n++;
+    }
+
+    /* bytes per ms is KB/s */
+    return (n * sectors * 512) / BENCH_IDE_RUNTIME;
+}
+
+/* the virtio-blk driver's numbers, returns: requests sent so far */
+static uint32_t bench_virtio_info(uint32_t *info)
+{
+    uint32_t drv[DRIVER_COMMAND_PACKET_LEN];
+    uint32_t *devicelist = pciGetDevices(0x01, 0x00);
+
+    drv[0] = VIRTIO_COMMAND_GET_DRIVE_INFO;
+    drv[1] = 0;
+    drv[2] = (uint32_t) info;
+    drv[3] = 0;
+    drv[4] = 0;
+
+    info[VIRTIO_INFO_REQUESTS] = 0;
+    info[VIRTIO_INFO_NOTIFIES] = 0;
+    driver_exec(pciGetInfo(devicelist[1]) | DRIVER_TYPE_PCI, drv);
+    kfree(devicelist);
+
+    return info[VIRTIO_INFO_REQUESTS];
+}
+
+/* the counters the disk benchmarks look at, as they are right now */
+static void bench_counters(BENCH_RUN *run, uint8_t drive)
+{
+    uint32_t stats[CACHE_STAT_LEN];
+    uint32_t sched[DISKIO_SCHED_STAT_LEN];
+    uint32_t info[VIRTIO_INFO_LEN];
+
+    sched[DISKIO_SCHED_STAT_DISPATCHED] = 0;
+    cache_get_stats(stats);
+    diskio_get_sched_stats(drive, sched);
+
+    run->ms = timer_getCurrentTick();
+    run->pages = buddy_get_free();
+    run->misses = stats[CACHE_STAT_MISSES];
+    run->ra_sectors = stats[CACHE_STAT_RA_SECTORS];
+    run->ra_hits = stats[CACHE_STAT_RA_HITS];
+    run->requests = sched[DISKIO_SCHED_STAT_DISPATCHED];
+    run->virtio_requests = (run->flags & BENCH_VIRTIO) ? bench_virtio_info(info) : 0;
+    run->virtio_notifies = (run->flags & BENCH_VIRTIO) ? info[VIRTIO_INFO_NOTIFIES] : 0;
+}
+
+/* flags: BENCH_* */
+static void bench_start(BENCH_RUN *run, uint8_t drive, uint8_t flags)
+{
+    /* nothing left over from whatever ran before */
+    diskio_poll();
+
+    if(flags & BENCH_COLD)
+    {
+        cache_invalidate(drive);
+        dcache_invalidate(DCACHE_ALL_MOUNTS);
+    }
+
+    run->flags = flags;
+    bench_counters(run, drive);
+}
+
+static void bench_stop(BENCH_RUN *run, uint8_t drive)
+{
+    BENCH_RUN now;
+
+    now.flags = run->flags;
+    bench_counters(&now, drive);
+
+    run->ms = now.ms - run->ms;
+    run->pages = run->pages - now.pages; /* free pages go down */
+    run->misses = now.misses - run->misses;
+    run->ra_sectors = now.ra_sectors - run->ra_sectors;
+    run->ra_hits = now.ra_hits - run->ra_hits;
+    run->requests = now.requests - run->requests;
+    run->virtio_requests = now.virtio_requests - run->virtio_requests;
+    run->virtio_notifies = now.virtio_notifies - run->virtio_notifies;
+}
+
+/* returns: cycles per 2048 bytes moved before the mode was changed */
+static uint32_t bench_ide_set_pio(uint32_t ctrl, uint8_t drive, uint8_t mode)
+{
+    uint32_t drv[DRIVER_COMMAND_PACKET_LEN];
+
+    drv[0] = IDE_COMMAND_SET_PIO;
+    drv[1] = drive;
+    drv[2] = mode;
+    drv[3] = 0;
+    drv[4] = 0;
+
+    driver_exec(ctrl, drv);
+
+    return drv[3];
+}
+
+/* what memcpy() used to be */
+static void bench_memcpy_bytes(char *destination, const char *source, uint32_t size)
+{
+    uint32_t i;
+
+    for(i = 0; i < size; ++i)
+        destination[i] = source[i];
+}
+
+/* returns: MB/s */
+static uint32_t bench_mem_copy(bench_memcpy_t func, char *dst, char *src, uint32_t size)
+{
+    uint32_t i, n = 0, start, end;
+
+    start = timer_getCurrentTick();
+    end = start + BENCH_MEM_RUNTIME;
+
+    while(timer_getCurrentTick() < end)
+    {
+        for(i = 0; i < BENCH_MEM_BATCH; ++i)
+            func(dst, src, size);
+
+        n += BENCH_MEM_BATCH;
+    }
+
+    /* bytes per ms is kB/s, divided by 1000 is MB/s (fits in 32 bits up to 40 GB/s) */
+    return (n * size) / (BENCH_MEM_RUNTIME * 1000);
+}
@@ -0,0 +1,40 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/* benchmarks are only ran when BENCHMARK is defined (see include/types.h) */
+void bench_run(void);
+
+void bench_kmalloc(void);
+void bench_mem(void);
+void bench_ide_pio(void);
+void bench_ide_dma(void);
+void bench_virtio(void);
+void bench_ahci_sg(void);
+void bench_readahead(void);
+void bench_iso_lookup(void);
+void bench_elf_load(void);
+
+#endif
@@ -124,14 +124,13 @@ global ASM_CPU_INVLPG
 ASM_CPU_INVLPG:
 ; invalidates a page
 ; input:
-;   - physical address where the page table points to
+;   - virtual address of the page
 ; output
 ;   - N/A
     push ebp
     mov ebp, esp
 
-    mov eax, ebp
-    add eax, 8
+    mov eax, [ebp + 8]
 
     invlpg [eax]
 
@@ -139,6 +138,119 @@ ASM_CPU_INVLPG:
     pop ebp
 ret
 
+global ASM_CPU_FLUSH_TLB
+ASM_CPU_FLUSH_TLB:
+; invalidates all (non-global) pages by reloading cr3
+; input:
+;   - N/A
+; output
+;   - N/A
+    mov eax, cr3
+    mov cr3, eax
+ret
+
+global ASM_CPU_GETCR4
+ASM_CPU_GETCR4:
+; returns the contents of cr4
+; input:
+;   - N/A
+; output
+;   - cr4 (in eax)
+    mov eax, cr4
+ret
+
+global ASM_CPU_FPU_ENABLE
+ASM_CPU_FPU_ENABLE:
+; turns on the fpu (and SSE if asked for)
+; input:
+;   - bits to set in cr4 (OSFXSR, OSXMMEXCPT or 0 for just the fpu)
+; output
+;   - N/A
+    push ebp
+    mov ebp, esp
+
+    ; no emulation (EM), monitor (MP) and native exceptions (NE), clear TS
+    mov eax, cr0
+    and eax, ~0x0C
+    or eax, 0x22
+    mov cr0, eax
+
+    mov eax, cr4
+    or eax, [ebp + 8]
+    mov cr4, eax
+
+    fninit
+
+    mov esp, ebp
+    pop ebp
+ret
+
+global ASM_CPU_FXSAVE
+ASM_CPU_FXSAVE:
+; saves the fpu/SSE state
+; input:
+;   - pointer to a 512 byte area (16 byte aligned)
+; output
+;   - N/A
+    mov eax, [esp + 4]
+    fxsave [eax]
+ret
+
+global ASM_CPU_FXRSTOR
+ASM_CPU_FXRSTOR:
+; restores the fpu/SSE state
+; input:
+;   - pointer to a 512 byte area (16 byte aligned)
+; output
+;   - N/A
+    mov eax, [esp + 4]
+    fxrstor [eax]
+ret
+
+global ASM_CPU_CLTS
+ASM_CPU_CLTS:
+; clears cr0.TS, the fpu can be used without a trap (#NM)
+; input:
+;   - N/A
+; output
+;   - N/A
+    clts
+ret
+
+global ASM_CPU_SET_TS
+ASM_CPU_SET_TS:
+; sets cr0.TS, the next fpu/SSE instruction traps (#NM)
+; input:
+;   - N/A
+; output
+;   - N/A
+    mov eax, cr0
+    or eax, 0x08
+    mov cr0, eax
+ret
+
+global ASM_CPU_RDTSC
+ASM_CPU_RDTSC:
+; reads the timestamp counter (check CPU_FEATURE_TSC first)
+; input:
+;   - N/A
+; output
+;   - cycles since reset (in edx:eax)
+    rdtsc
+ret
+
+global ASM_CPU_PSE_ENABLE
+ASM_CPU_PSE_ENABLE:
+; enables 4 MiB pages (cr4.PSE)
+; input:
+;   - N/A
+; output
+;   - N/A
+    mov eax, cr4
+    or eax, 0x10
+    mov cr4, eax
+ret
+
 
 global ASM_CPU_SAVE_STATE
 ASM_CPU_SAVE_STATE:
@@ -200,15 +312,20 @@ ASM_CHECK_CPUID:
 ;   output:
 ;       - 1 if supported, 0 if unsupported (in CPUID_AVAILABLE)
 
+    ; CPUID is supported if we can flip the ID flag (bit 21) in eflags
+    pushfd
+    pushfd
+    xor DWORD [esp], 0x200000
+    popfd
+
     pushfd
-     
-    mov eax, DWORD [esp]
+    pop eax
+    xor eax, [esp]
 
     popfd
 
     and eax, 0x200000
-    cmp eax, 0x200000
-    jne .done
+    jz .done
 
     mov BYTE [CPUID_AVAILABLE], 1
 
@@ -238,6 +355,25 @@ ASM_CPU_GETVENDOR:
 ret
 
 
+global ASM_CPU_GETFEATURES
+ASM_CPU_GETFEATURES:
+; gets the feature flags of the cpu (cpuid leaf 1)
+;   input:
+;       - N/A
+;   output:
+;       - feature flags (in CPUID_FEATURES_EDX and CPUID_FEATURES_ECX)
+
+    push ebx
+
+    mov eax, 1
+    cpuid
+
+    mov DWORD [CPUID_FEATURES_EDX], edx
+    mov DWORD [CPUID_FEATURES_ECX], ecx
+
+    pop ebx
+ret
+
 global ASM_CPU_GETNAME
 ASM_CPU_GETNAME:
 ; gets the cpu name string of the cpu
@@ -288,4 +424,10 @@ CPUID_CPUNAME_STRING dd 0
 CPUID_CPUNAME times 48 db 0
 
 global CPUID_SUPPORTED_FUNCTIONS
-CPUID_SUPPORTED_FUNCTIONS dd 0
\ No newline at end of file
+CPUID_SUPPORTED_FUNCTIONS dd 0
+
+global CPUID_FEATURES_EDX
+CPUID_FEATURES_EDX dd 0
+
+global CPUID_FEATURES_ECX
+CPUID_FEATURES_ECX dd 0
\ No newline at end of file
@@ -29,14 +29,81 @@ SOFTWARE.
 #include "../screen/screen_basic.h"
 #endif
 
+#include "../memory/memory.h"
+
+#include "../util/util.h"
+
+#include "../exec/task.h"
+
+#include "../hardware/timer.h"
+
+/* tasks that never used the fpu and the kernel's interrupt handlers don't 
+   have a state worth saving */
+#define CPU_FPU_NOBODY      PID_RESV
+
+/* PIT ticks (ms) the timestamp counter is measured against */
+#define CPU_TSC_CALIBRATE   10
+
+/* interrupt enable flag */
+#define CPU_EFLAGS_IF       (1U << 9)
+
 extern const uint8_t CPUID_AVAILABLE;
 extern const char *CPUID_VENDOR_STRING;
 extern const char *CPUID_CPUNAME_STRING;
+extern const uint32_t CPUID_SUPPORTED_FUNCTIONS;
+extern const uint32_t CPUID_FEATURES_EDX;
+extern const uint32_t CPUID_FEATURES_ECX;
+
+typedef struct
+{
+    uint8_t feature;
+    const char *name;
+} CPU_FEATURE_NAME;
 
 CPU_STATE state;
 
+/* cpuid leaf 1: edx, ecx */
+uint32_t cpu_feature_t[2] = {0, 0};
+
+static const CPU_FEATURE_NAME cpu_feature_name_t[] = {
+    {CPU_FEATURE_FPU,    "fpu"},
+    {CPU_FEATURE_PSE,    "pse"},
+    {CPU_FEATURE_TSC,    "tsc"},
+    {CPU_FEATURE_APIC,   "apic"},
+    {CPU_FEATURE_PGE,    "pge"},
+    {CPU_FEATURE_FXSR,   "fxsr"},
+    {CPU_FEATURE_SSE,    "sse"},
+    {CPU_FEATURE_SSE2,   "sse2"},
+    {CPU_FEATURE_SSE3,   "sse3"},
+    {CPU_FEATURE_SSE42,  "sse4.2"},
+    {CPU_FEATURE_POPCNT, "popcnt"}
+};
+
+/* timestamp counter cycles per microsecond, measured by CPU_tsc_per_us() */
+uint32_t cpu_tsc_per_us = 0;
+
+/* lazy fpu switching */
+uint8_t cpu_fpu_enabled = 0;
+uint8_t cpu_fpu_owner   = PID_KERNEL;   /* whose state is in the registers */
+uint8_t cpu_fpu_current = PID_KERNEL;   /* who is running */
+uint8_t cpu_fpu_irq_pid = PID_KERNEL;   /* who got interrupted */
+
+/* the fxsave areas, allocated by CPU_fpu_switch() */
+uint8_t *cpu_fpu_state_t[PID_RESV + 1];
+
+/* the state right after fninit, new tasks start with this */
+uint8_t cpu_fpu_clean_state[CPU_FPU_STATE_SIZE] __attribute__((aligned(16)));
+uint8_t cpu_fpu_kernel_state[CPU_FPU_STATE_SIZE] __attribute__((aligned(16)));
+
+static void CPU_fpu_init(void);
+static void CPU_fpu_set_current(uint8_t pid);
+
 void CPU_init(void)
 {
+    #ifndef NO_DEBUG_INFO
+    uint32_t i;
+    #endif
+
     ASM_CHECK_CPUID();
     
     if(!CPUID_AVAILABLE) 
@@ -48,12 +115,31 @@ void CPU_init(void)
     print_value( "[CPU] %s\n", (unsigned int) CPUID_VENDOR_STRING);
     #endif
 
+    if(CPUID_SUPPORTED_FUNCTIONS >= 1)
+    {
+        ASM_CPU_GETFEATURES();
+        cpu_feature_t[0] = CPUID_FEATURES_EDX;
+        cpu_feature_t[1] = CPUID_FEATURES_ECX;
+    }
+
     ASM_CPU_GETNAME();
 
     #ifndef NO_DEBUG_INFO
-    print_value( "[CPU] %s\n\n", (unsigned int) CPUID_CPUNAME_STRING);
+    print_value( "[CPU] %s\n", (unsigned int) CPUID_CPUNAME_STRING);
+    print( "[CPU] Features:");
+
+    for(i = 0; i < sizeof(cpu_feature_name_t) / sizeof(CPU_FEATURE_NAME); ++i)
+        if(CPU_has_feature(cpu_feature_name_t[i].feature))
+            print_value( " %s", (unsigned int) cpu_feature_name_t[i].name);
+
+    print( "\n");
     #endif
 
+    CPU_fpu_init();
+
+    #ifndef NO_DEBUG_INFO
+    print( (cpu_fpu_enabled) ? "[CPU] SSE enabled\n\n" : "\n");
+    #endif
 }
 
 CPU_STATE CPU_get_state(void)
@@ -61,3 +147,183 @@ CPU_STATE CPU_get_state(void)
     return state;
 }
 
+/* feature: one of the CPU_FEATURE_* defines */
+uint8_t CPU_has_feature(uint32_t feature)
+{
+    /* stays zero if there's no cpuid */
+    return (uint8_t) ((cpu_feature_t[(feature >> 5) & 1] >> (feature & 31)) & 1);
+}
+
+/* the cpu has to support it and the kernel must have turned it on (cr4.OSFXSR) */
+uint8_t CPU_sse2_usable(void)
+{
+    if(!CPU_has_feature(CPU_FEATURE_SSE2) || !CPU_has_feature(CPU_FEATURE_FXSR))
+        return 0;
+
+    return (ASM_CPU_GETCR4() & CPU_CR4_OSFXSR) ? 1 : 0;
+}
+
+/* returns: timestamp counter cycles per microsecond, 0 if there's no timestamp counter.
+   The first call measures it against the PIT, so interrupts must be on by then. */
+uint32_t CPU_tsc_per_us(void)
+{
+    uint32_t tick;
+    uint64_t start;
+
+    if(cpu_tsc_per_us || !CPU_has_feature(CPU_FEATURE_TSC))
+        return cpu_tsc_per_us;
+
+    /* start right at a tick */
+    tick = timer_getCurrentTick();
+    while(timer_getCurrentTick() == tick);
+
+    tick = timer_getCurrentTick();
+    start = ASM_CPU_RDTSC();
+
+    while(timer_getCurrentTick() < tick + CPU_TSC_CALIBRATE);
+
+    cpu_tsc_per_us = (uint32_t) ((ASM_CPU_RDTSC() - start) / (CPU_TSC_CALIBRATE * 1000));
+    return cpu_tsc_per_us;
+}
+
+uint32_t CPU_irq_save(void)
+{
+    uint32_t flags;
+
+    __asm__ __volatile__("pushfl; popl %0; cli" : "=r" (flags) : : "memory");
+
+    return flags & CPU_EFLAGS_IF;
+}
+
+void CPU_irq_restore(uint32_t flags)
+{
+    if(flags & CPU_EFLAGS_IF)
+        __asm__ __volatile__("sti" : : : "memory");
+}
+
+/* done() runs with the interrupts off, the IRQ it waits for can't come in between the check
+   and the hlt: sti only takes effect after the hlt started. They're on again while halted,
+   even if the caller had them off. returns: what done() returned last */
+uint8_t CPU_irq_wait(uint8_t (*done)(void *arg), void *arg, uint32_t end, uint8_t poll)
+{
+    uint32_t flags = CPU_irq_save();
+    uint8_t result;
+
+    while(!(result = done(arg)) && timer_getCurrentTick() < end)
+    {
+        if(poll)
+            __asm__ __volatile__("sti; pause; cli" : : : "memory");
+        else
+            __asm__ __volatile__("sti; hlt; cli" : : : "memory");
+    }
+
+    CPU_irq_restore(flags);
+
+    return result;
+}
+
+/* call before running task pid, whoever uses the fpu first after this pays for the switch */
+void CPU_fpu_switch(uint8_t pid)
+{
+    if(!cpu_fpu_enabled)
+        return;
+
+    if(pid != CPU_FPU_NOBODY && !cpu_fpu_state_t[pid])
+    {
+        /* kmalloc() objects of 512 bytes are 16 byte aligned */
+        cpu_fpu_state_t[pid] = kmalloc(CPU_FPU_STATE_SIZE);
+
+        if(cpu_fpu_state_t[pid])
+            memcpy((char *) cpu_fpu_state_t[pid], (char *) cpu_fpu_clean_state, CPU_FPU_STATE_SIZE);
+    }
+
+    CPU_fpu_set_current(pid);
+}
+
+/* the task is gone, so is its fpu state */
+void CPU_fpu_release(uint8_t pid)
+{
+    if(!cpu_fpu_enabled || pid == PID_KERNEL || pid == CPU_FPU_NOBODY)
+        return;
+
+    if(cpu_fpu_owner == pid)
+        cpu_fpu_owner = CPU_FPU_NOBODY;
+
+    kfree(cpu_fpu_state_t[pid]);
+    cpu_fpu_state_t[pid] = NULL;
+}
+
+/* device not available (#NM): somebody else's state is still in the registers */
+void CPU_fpu_trap(void)
+{
+    ASM_CPU_CLTS();
+
+    if(cpu_fpu_owner == cpu_fpu_current)
+        return;
+
+    if(cpu_fpu_owner != CPU_FPU_NOBODY && cpu_fpu_state_t[cpu_fpu_owner])
+        ASM_CPU_FXSAVE(cpu_fpu_state_t[cpu_fpu_owner]);
+
+    /* inside CPU_fpu_irq_enter() nobody is current, an interrupt handler starts with whatever is in there */
+    if(cpu_fpu_current != CPU_FPU_NOBODY && cpu_fpu_state_t[cpu_fpu_current])
+        ASM_CPU_FXRSTOR(cpu_fpu_state_t[cpu_fpu_current]);
+
+    cpu_fpu_owner = cpu_fpu_current;
+}
+
+/* the interrupted task keeps its state in the registers, the first fpu/SSE instruction of the handler
+   traps and saves it. interrupt gates keep these from nesting */
+void CPU_fpu_irq_enter(void)
+{
+    if(!cpu_fpu_enabled)
+        return;
+
+    cpu_fpu_irq_pid = cpu_fpu_current;
+    CPU_fpu_set_current(CPU_FPU_NOBODY);
+}
+
+/* the interrupted task gets its state back the first time it uses the fpu again */
+void CPU_fpu_irq_leave(void)
+{
+    if(!cpu_fpu_enabled)
+        return;
+
+    CPU_fpu_set_current(cpu_fpu_irq_pid);
+}
+
+static void CPU_fpu_init(void)
+{
+    uint32_t i;
+
+    if(!CPU_has_feature(CPU_FEATURE_FPU))
+        return;
+
+    /* lazy switching needs fxsave, without it we just have a plain fpu */
+    if(!CPU_has_feature(CPU_FEATURE_FXSR) || !CPU_has_feature(CPU_FEATURE_SSE))
+    {
+        ASM_CPU_FPU_ENABLE(0);
+        return;
+    }
+
+    ASM_CPU_FPU_ENABLE(CPU_CR4_OSFXSR | CPU_CR4_OSXMMEXCPT);
+    ASM_CPU_FXSAVE(cpu_fpu_clean_state);
+
+    for(i = 0; i <= PID_RESV; ++i)
+        cpu_fpu_state_t[i] = NULL;
+
+    /* the kernel owns the fpu from here on */
+    cpu_fpu_state_t[PID_KERNEL] = cpu_fpu_kernel_state;
+    cpu_fpu_owner = cpu_fpu_current = PID_KERNEL;
+    cpu_fpu_enabled = 1;
+}
+
+/* no kmalloc() in here, this is used by interrupt handlers */
+static void CPU_fpu_set_current(uint8_t pid)
+{
+    cpu_fpu_current = pid;
+
+    if(pid == cpu_fpu_owner)
+        ASM_CPU_CLTS();
+    else
+        ASM_CPU_SET_TS();
+}
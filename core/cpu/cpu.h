@@ -39,14 +39,61 @@ typedef struct
 
 } __attribute__((packed)) CPU_STATE;
 
+/* feature flags (cpuid leaf 1), the number of the bit in edx or 32 + the bit in ecx */
+#define CPU_FEATURE_FPU     0U
+#define CPU_FEATURE_PSE     3U
+#define CPU_FEATURE_TSC     4U
+#define CPU_FEATURE_APIC    9U
+#define CPU_FEATURE_PGE     13U
+#define CPU_FEATURE_FXSR    24U
+#define CPU_FEATURE_SSE     25U
+#define CPU_FEATURE_SSE2    26U
+#define CPU_FEATURE_SSE3    (32U + 0U)
+#define CPU_FEATURE_SSE42   (32U + 20U)
+#define CPU_FEATURE_POPCNT  (32U + 23U)
+
+#define CPU_CR4_OSFXSR      (1U << 9)
+#define CPU_CR4_OSXMMEXCPT  (1U << 10)
+
+/* size of the fxsave area of a task */
+#define CPU_FPU_STATE_SIZE  512U
+
 void CPU_init(void);
 CPU_STATE CPU_get_state(void);
+unsigned char CPU_has_feature(unsigned int feature);
+unsigned char CPU_sse2_usable(void);
+unsigned int CPU_tsc_per_us(void);
+
+/* interrupts, for code that can be called with them on or off. CPU_irq_save() turns them off and
+   returns whether they were on, CPU_irq_restore() puts that back. CPU_irq_wait() halts (or pauses, poll)
+   until done(arg) returns non-zero or the timer reaches end, see cpu.c */
+unsigned int CPU_irq_save(void);
+void CPU_irq_restore(unsigned int flags);
+unsigned char CPU_irq_wait(unsigned char (*done)(void *arg), void *arg, unsigned int end, unsigned char poll);
+
+/* lazy fpu/SSE switching: the state is only saved when another task actually uses the fpu (#NM).
+   ISR_IRQ_HANDLER() wraps the device IRQ handlers in CPU_fpu_irq_enter() and CPU_fpu_irq_leave(),
+   so whatever they use gets saved first. The PIT and keyboard handlers don't touch the fpu */
+void CPU_fpu_switch(unsigned char pid);
+void CPU_fpu_release(unsigned char pid);
+void CPU_fpu_trap(void);
+void CPU_fpu_irq_enter(void);
+void CPU_fpu_irq_leave(void);
 
 extern void ASM_CHECK_CPUID(void);
 extern void ASM_CPU_GETVENDOR(void);
 extern void ASM_CPU_GETNAME(void);
+extern void ASM_CPU_GETFEATURES(void);
 extern void ASM_CPU_GETFREQ(void);
 
 extern void ASM_CPU_SAVE_STATE(void);
+extern unsigned int ASM_CPU_GETCR4(void);
+extern unsigned long long ASM_CPU_RDTSC(void);
+
+extern void ASM_CPU_FPU_ENABLE(unsigned int cr4);
+extern void ASM_CPU_FXSAVE(void *area);
+extern void ASM_CPU_FXRSTOR(void *area);
+extern void ASM_CPU_CLTS(void);
+extern void ASM_CPU_SET_TS(void);
 
 #endif
\ No newline at end of file
@@ -113,6 +113,8 @@ static void IDT_default_list(void)
     IDT_add_handler(0x0C, (uint32_t) ISR_0C);
     IDT_add_handler(0x0D, (uint32_t) ISR_0D);
     IDT_add_handler(0x0E, (uint32_t) ISR_0E);
+    IDT_add_handler(0x10, (uint32_t) ISR_10);
+    IDT_add_handler(0x13, (uint32_t) ISR_13);
     
     IDT_add_handler(0x20, (uint32_t) ISR_20);
     IDT_add_handler(0x21, (uint32_t) ISR_21);
@@ -46,6 +46,8 @@ extern void ISR_0B(void);
 extern void ISR_0C(void);
 extern void ISR_0D(void);
 extern void ISR_0E(void);
+extern void ISR_10(void);
+extern void ISR_13(void);
 
 extern void ISR_20(void);
 extern void ISR_21(void);
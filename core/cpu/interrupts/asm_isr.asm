@@ -68,9 +68,12 @@ popad
 iret
 
 global ISR_07
+extern ISR_07_HANDLER
 ISR_07:
+; device not available (fpu/SSE used after a task switch)
 pushad
-    jmp $ 
+    cld
+    call ISR_07_HANDLER
 popad
 iret
 
@@ -138,6 +141,32 @@ pushad
 popad
 iret
 
+global ISR_10
+extern ISR_10_HANDLER
+ISR_10:
+; x87 floating point exception
+pushad
+    push state
+    call ASM_CPU_SAVE_STATE
+    cld
+    call ISR_10_HANDLER
+    jmp $
+popad
+iret
+
+global ISR_13
+extern ISR_13_HANDLER
+ISR_13:
+; SIMD floating point exception
+pushad
+    push state
+    call ASM_CPU_SAVE_STATE
+    cld
+    call ISR_13_HANDLER
+    jmp $
+popad
+iret
+
 global ISR_20
 extern ISR_20_HANDLER
 ISR_20:
@@ -159,5 +188,57 @@ popad
 iret
 
 
+; IRQs of devices that can share a line (see ISR_add_irq_handler()), the C side runs the chain of the line
+extern ISR_IRQ_HANDLER
+
+%macro ISR_IRQ 1
+global ISR_IRQ_%1
+ISR_IRQ_%1:
+pushad
+    cld
+    push dword %1
+    call ISR_IRQ_HANDLER
+    add esp, 4
+popad
+iret
+%endmacro
+
+ISR_IRQ 0
+ISR_IRQ 1
+ISR_IRQ 2
+ISR_IRQ 3
+ISR_IRQ 4
+ISR_IRQ 5
+ISR_IRQ 6
+ISR_IRQ 7
+ISR_IRQ 8
+ISR_IRQ 9
+ISR_IRQ 10
+ISR_IRQ 11
+ISR_IRQ 12
+ISR_IRQ 13
+ISR_IRQ 14
+ISR_IRQ 15
+
+global ISR_IRQ_TABLE
+ISR_IRQ_TABLE:
+    dd ISR_IRQ_0
+    dd ISR_IRQ_1
+    dd ISR_IRQ_2
+    dd ISR_IRQ_3
+    dd ISR_IRQ_4
+    dd ISR_IRQ_5
+    dd ISR_IRQ_6
+    dd ISR_IRQ_7
+    dd ISR_IRQ_8
+    dd ISR_IRQ_9
+    dd ISR_IRQ_10
+    dd ISR_IRQ_11
+    dd ISR_IRQ_12
+    dd ISR_IRQ_13
+    dd ISR_IRQ_14
+    dd ISR_IRQ_15
+
+
 ; for ignoring values without tampering with the registers
 ignore dd 0x0
@@ -22,11 +22,13 @@ SOFTWARE.
 */
 
 #include "isr.h"
+#include "IDT.h"
 
 #include "../../hardware/pic.h"
 #include "../../hardware/timer.h"
 
 #include "../../include/types.h"
+#include "../../include/exit_code.h"
 
 #include "../../screen/screen_basic.h"
 
@@ -34,6 +36,18 @@ SOFTWARE.
 
 #include "../../kernel/panic.h"
 
+#include "../cpu.h"
+
+#define ISR_IRQ_LINES       16
+#define ISR_IRQ_CHAIN       4   /* handlers per line */
+#define ISR_IRQ_FIRST_FREE  3   /* 0 and 1 are the PIT and the keyboard, the slave PIC is on 2 */
+
+/* the stubs in asm_isr.asm, one per line */
+extern uint32_t ISR_IRQ_TABLE[ISR_IRQ_LINES];
+
+static ISR_IRQ_FUNC isr_irq_chain_t[ISR_IRQ_LINES][ISR_IRQ_CHAIN];
+static uint32_t isr_irq_unclaimed_t[ISR_IRQ_LINES];
+
 void ISR_00_HANDLER(void)
 {
     panic(PANIC_TYPE_EXCEPTION, "DIVIDE_BY_ZERO");
@@ -49,6 +63,11 @@ void ISR_06_HANDLER(void)
     panic(PANIC_TYPE_EXCEPTION, "GENERAL_PROTECTION_FAULT");
 }
 
+void ISR_07_HANDLER(void)
+{
+    CPU_fpu_trap();
+}
+
 void ISR_0D_HANDLER(void)
 {
     panic(PANIC_TYPE_EXCEPTION, "GENERAL_PROTECTION_FAULT");
@@ -93,6 +112,16 @@ void ISR_0E_handler(uint32_t error_code)
     
 }
 
+void ISR_10_HANDLER(void)
+{
+    panic(PANIC_TYPE_EXCEPTION, "X87_FLOATING_POINT_EXCEPTION");
+}
+
+void ISR_13_HANDLER(void)
+{
+    panic(PANIC_TYPE_EXCEPTION, "SIMD_FLOATING_POINT_EXCEPTION");
+}
+
 void ISR_20_HANDLER(void)
 {
     timer_incTicks();
@@ -108,4 +137,53 @@ void ISR_21_HANDLER(void)
     if(character) { /* do something */ }
     
     PIC_EOI(1);
-}
\ No newline at end of file
+}
+
+/* adds the handler to the chain of the line, the first one installs the stub of the line in the IDT */
+uint8_t ISR_add_irq_handler(uint8_t line, ISR_IRQ_FUNC handler)
+{
+    uint8_t i;
+
+    if(line < ISR_IRQ_FIRST_FREE || line >= ISR_IRQ_LINES || !handler)
+        return EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+
+    for(i = 0; i < ISR_IRQ_CHAIN && isr_irq_chain_t[line][i]; ++i)
+        if(isr_irq_chain_t[line][i] == handler)
+            return EXIT_CODE_GLOBAL_SUCCESS;
+
+    if(i == ISR_IRQ_CHAIN)
+        return EXIT_CODE_GLOBAL_GENERAL_FAIL;
+
+    /* the chain is complete before the stub can run it */
+    isr_irq_chain_t[line][i] = handler;
+
+    if(!i)
+        IDT_add_handler((uint8_t) (0x20 + line), ISR_IRQ_TABLE[line]);
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* returns: how many interrupts on the line no handler claimed */
+uint32_t ISR_irq_unclaimed(uint8_t line)
+{
+    return (line < ISR_IRQ_LINES) ? isr_irq_unclaimed_t[line] : 0;
+}
+
+/* every handler gets to look, more than one device can be waiting on a level triggered line */
+void ISR_IRQ_HANDLER(uint32_t line)
+{
+    uint8_t i, claimed = 0;
+
+    /* the drivers finish requests in here, which can end up in the SSE2 mem* functions */
+    CPU_fpu_irq_enter();
+
+    for(i = 0; i < ISR_IRQ_CHAIN && isr_irq_chain_t[line][i]; ++i)
+        claimed |= isr_irq_chain_t[line][i]();
+
+    CPU_fpu_irq_leave();
+
+    if(!claimed)
+        isr_irq_unclaimed_t[line]++;
+
+    PIC_EOI((uint8_t) line);
+}
@@ -27,11 +27,23 @@ SOFTWARE.
 void ISR_00_HANDLER(void);
 void ISR_05_HANDLER(void);
 void ISR_06_HANDLER(void);
+void ISR_07_HANDLER(void);
 void ISR_0D_HANDLER(void);
 void ISR_0E_handler(unsigned int error_code);
+void ISR_10_HANDLER(void);
+void ISR_13_HANDLER(void);
 
 void ISR_20_HANDLER(void);
 void ISR_21_HANDLER(void);
 
+/* PCI devices can share an IRQ line, so every line has a chain of handlers. A handler only looks at 
+   (and acknowledges) its own device and returns 1 if the interrupt was from it, the end of interrupt
+   is sent once the whole chain ran */
+typedef unsigned char (*ISR_IRQ_FUNC)(void);
+
+unsigned char ISR_add_irq_handler(unsigned char line, ISR_IRQ_FUNC handler);
+unsigned int ISR_irq_unclaimed(unsigned char line);
+void ISR_IRQ_HANDLER(unsigned int line);
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1050 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "AHCIController.h"
+
+#include "../AHCI_commands.h"
+#include "../COMMANDS.H"
+
+#include "../../include/exit_code.h"
+#include "../../include/types.h"
+#include "../../dsk/diskdefines.h"
+#include "../../dsk/sglist.h"
+#include "../../dsk/diskcmd.h"
+
+#include "../../cpu/cpu.h"
+#include "../../cpu/interrupts/isr.h"
+
+#ifndef NO_DEBUG_INFO
+#include "../../screen/screen_basic.h"
+#endif
+
+#include "../../hardware/pci.h"
+#include "../../hardware/driver.h"
+#include "../../hardware/timer.h"
+
+#include "../../memory/memory.h"
+#include "../../memory/paging.h"
+
+#include "../../exec/task.h"
+
+#include "../../util/util.h"
+
+#define AHCIController_PCI_CLASS_SUBCLASS   0x106
+
+#define AHCI_DRIVER_VERSION_STRING "[AHCI_DRIVER] Vireo Internal AHCI/SATA Driver Mk. I\n"
+
+#define SECTOR_SIZE         512  // bytes
+#define SECTOR_SIZE_CD      2048 // bytes
+#define PAGE_SIZE           4096 // bytes
+
+#define AHCI_MAX_PORTS      32
+#define AHCI_MAX_SLOTS      32
+#define AHCI_CMD_BYTES      0x10000 /* per command slot */
+#define AHCI_PRD_MAX        136     /* per command table: a PRD per sector of AHCI_CMD_BYTES (scatter-gather lists of
+                                       the cache aren't contiguous) + 1, rounded up to keep the tables 128 byte aligned */
+#define AHCI_TIMEOUT        5000    /* ms, for any command (and starting/stopping a port) */
+#define AHCI_NO_IRQ         0xFF    /* the firmware didn't route the controller to the PIC, so we poll */
+
+/* host capabilities and global host control */
+#define AHCI_CAP_SLOTS(cap) ((((cap) >> 8) & 0x1FU) + 1)
+#define AHCI_CAP_SNCQ       (1U << 30)
+#define AHCI_GHC_IE         (1U << 1)
+#define AHCI_GHC_AE         (1U << 31)
+
+/* port command and status */
+#define AHCI_PxCMD_ST       (1U << 0)   /* start processing the command list */
+#define AHCI_PxCMD_SUD      (1U << 1)   /* spin up */
+#define AHCI_PxCMD_POD      (1U << 2)   /* power on */
+#define AHCI_PxCMD_FRE      (1U << 4)   /* FIS receive enable */
+#define AHCI_PxCMD_FR       (1U << 14)
+#define AHCI_PxCMD_CR       (1U << 15)
+
+/* port interrupt status (and enable) */
+#define AHCI_PxIS_DHRS      (1U << 0)   /* D2H register FIS, a non-queued command is done */
+#define AHCI_PxIS_PSS       (1U << 1)   /* PIO setup FIS */
+#define AHCI_PxIS_DSS       (1U << 2)   /* DMA setup FIS */
+#define AHCI_PxIS_SDBS      (1U << 3)   /* set device bits FIS, queued commands are done */
+#define AHCI_PxIS_ERRORS    0x7D000010U /* task file, host bus, interface, overflow and unknown FIS errors */
+
+#define AHCI_SSTS_DET(ssts) ((ssts) & 0x0FU)
+#define AHCI_SSTS_IPM(ssts) (((ssts) >> 8) & 0x0FU)
+#define AHCI_DET_PRESENT    0x03        /* device there and talking */
+#define AHCI_IPM_ACTIVE     0x01
+#define AHCI_SCTL_DET_RESET 0x01        /* COMRESET */
+
+#define AHCI_SIG_ATA        0x00000101U
+#define AHCI_SIG_ATAPI      0xEB140101U
+
+/* command header flags (the low five bits are the length of the command FIS in dwords) */
+#define AHCI_CMD_ATAPI      (1U << 5)
+#define AHCI_CMD_WRITE      (1U << 6)
+
+#define AHCI_FIS_TYPE_H2D   0x27
+#define AHCI_FIS_COMMAND    0x80
+#define AHCI_DEVICE_LBA     0x40
+#define AHCI_FEATURE_DMA    0x01        /* ATAPI: the data goes through the PRD table */
+
+#define ATA_STAT_ERR        0x01
+#define ATA_STAT_DRQ        0x08
+#define ATA_STAT_BUSY       0x80
+
+#define ATA_COMMAND_DMAREAD         0xC8
+#define ATA_COMMAND_DMAWRITE        0xCA
+#define ATA_COMMAND_DMAREAD_EXT     0x25
+#define ATA_COMMAND_DMAWRITE_EXT    0x35
+#define ATA_COMMAND_FPDMA_READ      0x60 /* native command queuing */
+#define ATA_COMMAND_FPDMA_WRITE     0x61
+#define ATA_COMMAND_FLUSH           0xE7
+#define ATA_COMMAND_FLUSH_EXT       0xEA
+#define ATA_IDENTIFY                0xEC
+
+#define ATAPI_COMMAND_PACKET        0xA0
+#define ATAPI_COMMAND_READ          0xA8
+#define ATAPI_IDENTIFY              0xA1
+
+/* IDENTIFY (PACKET DEVICE) words */
+#define ATA_IDENT_SECTORS       60  /* 60-61: LBA28 capacity */
+#define ATA_IDENT_QUEUE_DEPTH   75  /* bits 0-4: max. queue depth - 1 */
+#define ATA_IDENT_SATA_CAPS     76  /* bit 8: native command queuing */
+#define ATA_IDENT_COMMANDSETS2  83  /* bit 10: LBA48 */
+#define ATA_IDENT_SECTORS48     100 /* 100-103: LBA48 capacity */
+
+/* the registers of one port (memory mapped) */
+typedef volatile struct
+{
+    uint32_t clb;           /* command list, 1 KiB aligned (physical) */
+    uint32_t clbu;
+    uint32_t fb;            /* received FISes, 256 byte aligned (physical) */
+    uint32_t fbu;
+    uint32_t is;
+    uint32_t ie;
+    uint32_t cmd;
+    uint32_t rsv0;
+    uint32_t tfd;           /* the drive's status (low byte) and error (second byte) */
+    uint32_t sig;
+    uint32_t ssts;
+    uint32_t sctl;
+    uint32_t serr;
+    uint32_t sact;          /* queued commands the drive hasn't finished yet */
+    uint32_t ci;            /* issued command slots */
+    uint32_t sntf;
+    uint32_t fbs;
+    uint32_t rsv1[11];
+    uint32_t vendor[4];
+} AHCI_PORT;
+
+/* the HBA's memory (BAR5) */
+typedef volatile struct
+{
+    uint32_t cap;
+    uint32_t ghc;
+    uint32_t is;            /* a bit per port that wants attention */
+    uint32_t pi;            /* ports implemented */
+    uint32_t vs;
+    uint32_t ccc_ctl;
+    uint32_t ccc_ports;
+    uint32_t em_loc;
+    uint32_t em_ctl;
+    uint32_t cap2;
+    uint32_t bohc;
+    uint8_t rsv[0xD4];
+    AHCI_PORT port[AHCI_MAX_PORTS];
+} AHCI_HBA;
+
+typedef struct
+{
+    uint16_t flags;         /* AHCI_CMD_* | FIS length */
+    uint16_t prdtl;         /* entries in the PRD table */
+    volatile uint32_t prdbc;/* bytes moved so far */
+    uint32_t ctba;          /* command table, 128 byte aligned (physical) */
+    uint32_t ctbau;
+    uint32_t rsv[4];
+} __attribute__((packed)) AHCI_CMD_HEADER;
+
+/* physical region descriptor, like IDE's but with 22 bits for the size */
+typedef struct
+{
+    uint32_t addr;          /* physical, word aligned */
+    uint32_t addru;
+    uint32_t rsv;
+    uint32_t size;          /* bytes - 1 */
+} __attribute__((packed)) AHCI_PRD;
+
+typedef struct
+{
+    uint8_t cfis[64];       /* the command FIS */
+    uint8_t acmd[16];       /* the ATAPI packet */
+    uint8_t rsv[48];
+    AHCI_PRD prdt[AHCI_PRD_MAX];
+} __attribute__((packed)) AHCI_CMD_TABLE;
+
+/* register FIS, host to device (the command) */
+typedef struct
+{
+    uint8_t type;
+    uint8_t flags;
+    uint8_t command;
+    uint8_t feature;
+    uint8_t lba0;
+    uint8_t lba1;
+    uint8_t lba2;
+    uint8_t device;
+    uint8_t lba3;
+    uint8_t lba4;
+    uint8_t lba5;
+    uint8_t feature_hi;
+    uint8_t count;
+    uint8_t count_hi;
+    uint8_t icc;
+    uint8_t control;
+    uint8_t rsv[4];
+} __attribute__((packed)) AHCI_FIS_H2D;
+
+/* what every port with a drive gets: the command tables (one per slot), the command list
+   and the received FIS area, in one go so that the alignment comes for free */
+#define AHCI_TABLES_SIZE    (AHCI_MAX_SLOTS * sizeof(AHCI_CMD_TABLE))
+#define AHCI_CMD_LIST_SIZE  (AHCI_MAX_SLOTS * sizeof(AHCI_CMD_HEADER))
+#define AHCI_FIS_SIZE       256
+#define AHCI_PORT_MEM_SIZE  (AHCI_TABLES_SIZE + AHCI_CMD_LIST_SIZE + AHCI_FIS_SIZE)
+
+typedef struct
+{
+    uint8_t type;               /* DRIVE_TYPE_SATA, DRIVE_TYPE_SATAPI or DRIVE_TYPE_UNKNOWN */
+    uint8_t port;
+    uint8_t lba48;
+    uint8_t queue_depth;        /* native command queuing, 0 if the drive or the HBA can't */
+    uint8_t slots;              /* commands given to the drive at once */
+    uint32_t max_sectors;       /* per driver command */
+    uint64_t sectors;           /* capacity (0 for ATAPI) */
+    AHCI_CMD_HEADER *cmd_list;
+    AHCI_CMD_TABLE *cmd_table;
+    volatile uint32_t busy;     /* slots in flight, AHCI_IRQ() clears them when they're done */
+    volatile uint32_t queued;   /* slots of AHCI_COMMAND_SUBMIT, taken until they're done or the port recovered */
+    DISK_CMD *cmds[AHCI_MAX_SLOTS]; /* the submitted command of a queued slot, NULL once its status is set */
+    uint32_t progress;          /* tick of the last queued command that was submitted or finished */
+    volatile uint8_t error;
+} AHCI_DRIVE;
+
+/* functions defined here, because it *should* be private to the driver */
+
+void AHCIController_handler(uint32_t *drv);
+
+static uint8_t AHCI_IRQ(void);
+
+static void AHCIDriverInit(uint32_t device);
+#ifndef NO_DEBUG_INFO
+static void AHCIPrintWelcome(void);
+#endif
+static void AHCI_mapHBA(uint32_t abar);
+static uint8_t AHCI_initPort(uint8_t drive, uint8_t port);
+static uint8_t AHCI_portStop(AHCI_PORT *port);
+static void AHCI_portStart(AHCI_PORT *port);
+static void AHCI_portRecover(uint8_t drive);
+
+static uint8_t AHCI_identify(uint8_t drive, uint16_t *ident);
+static void AHCI_parseIdentify(uint8_t drive, uint16_t *ident);
+
+static AHCI_FIS_H2D *AHCI_prepareSlot(uint8_t drive, uint8_t slot, const SG_POS *pos, uint32_t size, uint16_t flags);
+static void AHCI_setLBA(AHCI_FIS_H2D *fis, uint32_t start, bool lba48);
+static uint8_t AHCI_transfer(uint8_t drive, uint32_t start, uint32_t sctrwrite, SG_POS pos, bool write);
+static uint8_t AHCI_flush(uint8_t drive);
+static void AHCI_drain(uint8_t drive);
+static uint8_t AHCI_issue(uint8_t drive, uint32_t slots, bool queued);
+static uint8_t AHCI_wait(uint8_t drive);
+static uint8_t AHCI_waitDone(void *drive_info);
+static void AHCI_update(uint8_t drive);
+static void AHCI_failQueued(AHCI_DRIVE *info);
+static uint8_t AHCI_submit(uint8_t drive, DISK_CMD *cmd);
+static void AHCI_poll(uint8_t drive);
+
+static void AHCI_reportDrives(uint8_t *drive_list);
+static void AHCI_getDriveInfo(uint32_t *drv);
+
+AHCI_DRIVE ahci_drive_t[AHCI_DRIVER_MAX_DRIVES];
+uint32_t AHCI_PCI_controller;
+
+AHCI_HBA *ahci_hba = NULL;
+uint8_t ahci_slots;         /* per port, what the HBA has */
+uint8_t ahci_irq = AHCI_NO_IRQ;
+uint8_t ahci_init_ran = 0;
+
+/* the indentifier for drivers + information about our driver */
+struct DRIVER AHCI_driver_id = {(uint32_t) 0xB14D05, "VIREODRV", (AHCIController_PCI_CLASS_SUBCLASS | DRIVER_TYPE_PCI), (uint32_t) (AHCIController_handler)};
+
+void AHCIController_handler(uint32_t *drv)
+{
+    uint8_t error = EXIT_CODE_GLOBAL_SUCCESS;
+    SG_ENTRY whole;
+    SG_POS pos;
+    DISK_CMD *cmd;
+
+    /* same as the IDE driver, nothing happens before INIT did its thing */
+    if(drv[0] != DRV_COMMAND_INIT && !ahci_init_ran)
+        return;
+
+    switch(drv[0])
+    {
+        case DRV_COMMAND_INIT:
+            AHCIDriverInit(drv[1]);
+        break;
+
+        case AHCI_COMMAND_READ:
+        case AHCI_COMMAND_WRITE:
+            sg_from_command(&pos, &whole, drv);
+
+            if(drv[1] >= AHCI_DRIVER_MAX_DRIVES || !drv[3] || drv[3] > ahci_drive_t[drv[1]].max_sectors)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            /* CDs are read-only */
+            if(drv[0] == AHCI_COMMAND_WRITE && ahci_drive_t[drv[1]].type != DRIVE_TYPE_SATA)
+            {
+                error = EXIT_CODE_GLOBAL_GENERAL_FAIL;
+                break;
+            }
+
+            error = AHCI_transfer((uint8_t) drv[1], drv[2], drv[3], pos, drv[0] == AHCI_COMMAND_WRITE);
+        break;
+
+        case AHCI_COMMAND_REPORTDRIVES:
+            AHCI_reportDrives((uint8_t *) drv[1]);
+        break;
+
+        case AHCI_COMMAND_GET_MAX_SECTORS:
+            if(drv[1] >= AHCI_DRIVER_MAX_DRIVES)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            drv[2] = ahci_drive_t[drv[1]].max_sectors;
+        break;
+
+        case AHCI_COMMAND_GET_DRIVE_INFO:
+            if(drv[1] >= AHCI_DRIVER_MAX_DRIVES)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            AHCI_getDriveInfo(drv);
+        break;
+
+        case AHCI_COMMAND_SUBMIT:
+            cmd = (DISK_CMD *) drv[4];
+
+            if(drv[1] >= AHCI_DRIVER_MAX_DRIVES || !cmd->sctr || cmd->sctr > AHCI_CMD_BYTES / SECTOR_SIZE)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            /* the tag of a queued command is what lets the drive finish them in any order */
+            if(ahci_drive_t[drv[1]].type != DRIVE_TYPE_SATA || !ahci_drive_t[drv[1]].queue_depth)
+            {
+                error = EXIT_CODE_GLOBAL_UNSUPPORTED;
+                break;
+            }
+
+            error = AHCI_submit((uint8_t) drv[1], cmd);
+        break;
+
+        case AHCI_COMMAND_POLL:
+            if(drv[1] >= AHCI_DRIVER_MAX_DRIVES)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            AHCI_poll((uint8_t) drv[1]);
+        break;
+
+        case AHCI_COMMAND_GET_QUEUE:
+            if(drv[1] >= AHCI_DRIVER_MAX_DRIVES)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            drv[2] = (ahci_drive_t[drv[1]].type == DRIVE_TYPE_SATA && ahci_drive_t[drv[1]].queue_depth) ? ahci_drive_t[drv[1]].slots : 0;
+            drv[3] = AHCI_CMD_BYTES / SECTOR_SIZE;
+        break;
+
+        default:
+            error = EXIT_CODE_GLOBAL_UNSUPPORTED;
+        break;
+    }
+
+    if(!error)
+        return;
+
+    /* else */
+    drv[4] = NULL;
+    drv[1] = error;
+}
+
+// ISR, for every port that has something to say. returns: 1 if the interrupt was from the HBA,
+// the line may be shared with other devices
+static uint8_t AHCI_IRQ(void)
+{
+    uint32_t pending = ahci_hba->is;
+    uint8_t drive;
+
+    if(!pending)
+        return 0;
+
+    for(drive = 0; drive < AHCI_DRIVER_MAX_DRIVES; ++drive)
+        if(ahci_drive_t[drive].type != DRIVE_TYPE_UNKNOWN && (pending & (1U << ahci_drive_t[drive].port)))
+            AHCI_update(drive);
+
+    /* only clears once the ports' own status has been cleared */
+    ahci_hba->is = pending;
+
+    return 1;
+}
+
+static void AHCIDriverInit(uint32_t device)
+{
+    uint8_t bus, dev, func, port, drive = 0;
+    uint32_t abar;
+    uint16_t *ident = kmalloc(256 * sizeof(uint16_t));
+
+    AHCI_PCI_controller = device & (uint32_t)~(DRIVER_TYPE_PCI);
+
+    bus  = (uint8_t) ((AHCI_PCI_controller >> 24) & 0xFF);
+    dev  = (uint8_t) ((AHCI_PCI_controller >> 16) & 0xFF);
+    func = (uint8_t) ((AHCI_PCI_controller >> 8)  & 0xFF);
+
+    for(port = 0; port < AHCI_DRIVER_MAX_DRIVES; ++port)
+        ahci_drive_t[port].type = DRIVE_TYPE_UNKNOWN;
+
+    /* the HBA's registers are memory mapped, somewhere way above the memory we identity mapped */
+    abar = pciGetBar(AHCI_PCI_controller, PCI_BAR5) & 0xFFFFFFF0U;
+
+    if(!abar || !ident)
+    {
+        kfree(ident);
+        return;
+    }
+
+    AHCI_mapHBA(abar);
+    ahci_hba = (AHCI_HBA *) abar;
+
+    pciEnableBusMaster(AHCI_PCI_controller);
+
+    /* no IDE emulation, we speak AHCI */
+    ahci_hba->ghc |= AHCI_GHC_AE;
+    ahci_slots = (uint8_t) AHCI_CAP_SLOTS(ahci_hba->cap);
+
+    /* register our IRQ handler (if there's anything to register it for) */
+    ahci_irq = pciGetInterruptLine(bus, dev, func);
+
+    if(ahci_irq >= 16 || ISR_add_irq_handler(ahci_irq, AHCI_IRQ))
+        ahci_irq = AHCI_NO_IRQ;
+
+    for(port = 0; port < AHCI_MAX_PORTS && drive < AHCI_DRIVER_MAX_DRIVES; ++port)
+        if((ahci_hba->pi & (1U << port)) && !AHCI_initPort(drive, port))
+            ++drive;
+
+    ahci_hba->is = 0xFFFFFFFFU;
+
+    if(ahci_irq != AHCI_NO_IRQ)
+        ahci_hba->ghc |= AHCI_GHC_IE;
+
+    for(drive = 0; drive < AHCI_DRIVER_MAX_DRIVES; ++drive)
+    {
+        if(ahci_drive_t[drive].type == DRIVE_TYPE_UNKNOWN)
+            continue;
+
+        memset((char *) ident, 256 * sizeof(uint16_t), 0);
+
+        if(AHCI_identify(drive, ident))
+        {
+            ahci_drive_t[drive].type = DRIVE_TYPE_UNKNOWN;
+            continue;
+        }
+
+        AHCI_parseIdentify(drive, ident);
+    }
+
+    kfree(ident);
+
+    ahci_init_ran = 1;
+
+#ifndef NO_DEBUG_INFO
+    AHCIPrintWelcome();
+#endif
+}
+
+#ifndef NO_DEBUG_INFO
+static void AHCIPrintWelcome(void)
+{
+    AHCI_DRIVE *info;
+    uint8_t drive;
+
+    print( AHCI_DRIVER_VERSION_STRING);
+    print_value( "[AHCI_DRIVER] Kernel reported PCI controller %x\n", AHCI_PCI_controller);
+    print_value( "[AHCI_DRIVER] HBA memory: %x\n", (uint32_t) ahci_hba);
+    print_value( "[AHCI_DRIVER] Command slots: %i\n", ahci_slots);
+    print_value( "[AHCI_DRIVER] IRQ: %i\n", ahci_irq);
+
+    for(drive = 0; drive < AHCI_DRIVER_MAX_DRIVES; ++drive)
+    {
+        info = &ahci_drive_t[drive];
+
+        if(info->type == DRIVE_TYPE_UNKNOWN)
+            continue;
+
+        print_value( "[AHCI_DRIVER] Drive %i ", drive);
+        print_value( "(port %i): ", info->port);
+        print( (info->type == DRIVE_TYPE_SATA) ? "SATA, " : "SATAPI, ");
+
+        if(info->type == DRIVE_TYPE_SATA)
+            print_value( "%i MiB, ", (uint32_t) (info->sectors / 2048));
+
+        print_value( "%i slots", info->slots);
+        print( info->queue_depth ? ", NCQ" : "");
+        print( "\n");
+    }
+
+    print( "\n");
+}
+#endif
+
+/* identity maps the HBA's registers, uncached */
+static void AHCI_mapHBA(uint32_t abar)
+{
+    PAGE_REQ req = {PID_KERNEL, PAGE_REQ_ATTR_SUPERVISOR | PAGE_REQ_ATTR_READ_WRITE | PAGE_REQ_ATTR_NO_CACHE, 0};
+    uint32_t page;
+
+    for(page = abar & ~(PAGE_SIZE - 1U); page < abar + sizeof(AHCI_HBA); page += PAGE_SIZE)
+        paging_map((void *) page, (void *) page, &req);
+}
+
+/* sets up the port's memory and starts it, drive becomes whatever is connected to the port
+   returns: EXIT_CODE_GLOBAL_SUCCESS if there is a drive we can use */
+static uint8_t AHCI_initPort(uint8_t drive, uint8_t port)
+{
+    PAGE_REQ req = {PID_KERNEL, PAGE_REQ_ATTR_SUPERVISOR | PAGE_REQ_ATTR_READ_WRITE | PAGE_REQ_ATTR_ZERO, AHCI_PORT_MEM_SIZE};
+    AHCI_PORT *p = &ahci_hba->port[port];
+    AHCI_DRIVE *info = &ahci_drive_t[drive];
+    uint8_t *mem, *fis;
+    uint8_t slot;
+
+    if(AHCI_SSTS_DET(p->ssts) != AHCI_DET_PRESENT || AHCI_SSTS_IPM(p->ssts) != AHCI_IPM_ACTIVE)
+        return EXIT_CODE_GLOBAL_GENERAL_FAIL;
+
+    /* port multipliers and the like aren't supported */
+    if(p->sig != AHCI_SIG_ATA && p->sig != AHCI_SIG_ATAPI)
+        return EXIT_CODE_GLOBAL_UNSUPPORTED;
+
+    /* the firmware may have left it running, it can't be touched while it is */
+    if(AHCI_portStop(p))
+        return EXIT_CODE_AHCI_ERROR_READING_DRIVE;
+
+    if(!(mem = valloc(&req)))
+        return EXIT_CODE_OUT_OF_MEMORY;
+
+    info->type = (p->sig == AHCI_SIG_ATA) ? DRIVE_TYPE_SATA : DRIVE_TYPE_SATAPI;
+    info->port = port;
+    info->cmd_table = (AHCI_CMD_TABLE *) mem;
+    info->cmd_list = (AHCI_CMD_HEADER *) (mem + AHCI_TABLES_SIZE);
+    fis = mem + AHCI_TABLES_SIZE + AHCI_CMD_LIST_SIZE;
+
+    for(slot = 0; slot < AHCI_MAX_SLOTS; ++slot)
+        info->cmd_list[slot].ctba = (uint32_t) paging_vptr_to_pptr(&info->cmd_table[slot]);
+
+    p->clb = (uint32_t) paging_vptr_to_pptr(info->cmd_list);
+    p->clbu = 0;
+    p->fb = (uint32_t) paging_vptr_to_pptr(fis);
+    p->fbu = 0;
+
+    p->serr = 0xFFFFFFFFU;
+    p->is = 0xFFFFFFFFU;
+    p->ie = AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_DSS | AHCI_PxIS_SDBS | AHCI_PxIS_ERRORS;
+
+    p->cmd |= AHCI_PxCMD_POD | AHCI_PxCMD_SUD;
+    AHCI_portStart(p);
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+static uint8_t AHCI_portStop(AHCI_PORT *port)
+{
+    uint32_t end = timer_getCurrentTick() + AHCI_TIMEOUT;
+
+    port->cmd &= ~AHCI_PxCMD_ST;
+
+    while((port->cmd & AHCI_PxCMD_CR) && timer_getCurrentTick() < end)
+        __asm__ __volatile__("pause");
+
+    port->cmd &= ~AHCI_PxCMD_FRE;
+
+    while((port->cmd & AHCI_PxCMD_FR) && timer_getCurrentTick() < end)
+        __asm__ __volatile__("pause");
+
+    return (port->cmd & (AHCI_PxCMD_CR | AHCI_PxCMD_FR)) ? EXIT_CODE_AHCI_ERROR_READING_DRIVE : EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+static void AHCI_portStart(AHCI_PORT *port)
+{
+    port->cmd |= AHCI_PxCMD_FRE;
+    port->cmd |= AHCI_PxCMD_ST;
+}
+
+/* after an error the port stops processing commands until it is restarted,
+   a drive that is stuck gets a COMRESET first */
+static void AHCI_portRecover(uint8_t drive)
+{
+    AHCI_DRIVE *info = &ahci_drive_t[drive];
+    AHCI_PORT *port = &ahci_hba->port[info->port];
+    uint32_t end, flags;
+
+    /* stopping the port clears its slots, that mustn't look like the queued commands finished */
+    flags = CPU_irq_save();
+    AHCI_failQueued(info);
+    info->queued = 0;
+    CPU_irq_restore(flags);
+
+    AHCI_portStop(port);
+
+    if(port->tfd & (ATA_STAT_BUSY | ATA_STAT_DRQ))
+    {
+        port->sctl = (port->sctl & ~0x0FU) | AHCI_SCTL_DET_RESET;
+        sleep(1);
+        port->sctl &= ~0x0FU;
+
+        end = timer_getCurrentTick() + AHCI_TIMEOUT;
+        while(AHCI_SSTS_DET(port->ssts) != AHCI_DET_PRESENT && timer_getCurrentTick() < end)
+            __asm__ __volatile__("pause");
+    }
+
+    port->serr = 0xFFFFFFFFU;
+    port->is = 0xFFFFFFFFU;
+
+    info->busy = 0;
+    info->error = 0;
+
+    AHCI_portStart(port);
+}
+
+static uint8_t AHCI_identify(uint8_t drive, uint16_t *ident)
+{
+    SG_ENTRY whole = {ident, 256 * sizeof(uint16_t)};
+    SG_POS pos;
+    AHCI_FIS_H2D *fis;
+
+    sg_start(&pos, &whole);
+    fis = AHCI_prepareSlot(drive, 0, &pos, whole.size, 0);
+
+    if(!fis)
+        return EXIT_CODE_AHCI_ERROR_READING_DRIVE;
+
+    fis->command = (ahci_drive_t[drive].type == DRIVE_TYPE_SATA) ? ATA_IDENTIFY : ATAPI_IDENTIFY;
+
+    return AHCI_issue(drive, 1U, false);
+}
+
+static void AHCI_parseIdentify(uint8_t drive, uint16_t *ident)
+{
+    AHCI_DRIVE *info = &ahci_drive_t[drive];
+    uint32_t sector_size = (info->type == DRIVE_TYPE_SATA) ? SECTOR_SIZE : SECTOR_SIZE_CD;
+
+    info->slots = ahci_slots;
+
+    if(info->type == DRIVE_TYPE_SATA)
+    {
+        info->lba48 = (ident[ATA_IDENT_COMMANDSETS2] & (1U << 10)) != 0;
+
+        if(info->lba48)
+            info->sectors = (uint64_t) ident[ATA_IDENT_SECTORS48] | ((uint64_t) ident[ATA_IDENT_SECTORS48 + 1] << 16)
+                          | ((uint64_t) ident[ATA_IDENT_SECTORS48 + 2] << 32) | ((uint64_t) ident[ATA_IDENT_SECTORS48 + 3] << 48);
+        else
+            info->sectors = (uint64_t) ident[ATA_IDENT_SECTORS] | ((uint64_t) ident[ATA_IDENT_SECTORS + 1] << 16);
+
+        /* 0xFFFF means the word isn't there (not a SATA drive, or an old one) */
+        if((ahci_hba->cap & AHCI_CAP_SNCQ) && ident[ATA_IDENT_SATA_CAPS] != 0xFFFF && (ident[ATA_IDENT_SATA_CAPS] & (1U << 8)))
+            info->queue_depth = (uint8_t) ((ident[ATA_IDENT_QUEUE_DEPTH] & 0x1FU) + 1);
+    }
+
+    /* the tag of a queued command is its slot, so the drive's queue can't be smaller */
+    if(info->queue_depth && info->queue_depth < info->slots)
+        info->slots = info->queue_depth;
+
+    info->max_sectors = info->slots * (AHCI_CMD_BYTES / sector_size);
+}
+
+/* describes size bytes of the scatter-gather list at pos (NULL without data) to the HBA in slot's
+   command table and sets up the command header
+   returns: the slot's command FIS to fill in, or NULL if it takes too many PRDs */
+static AHCI_FIS_H2D *AHCI_prepareSlot(uint8_t drive, uint8_t slot, const SG_POS *pos, uint32_t size, uint16_t flags)
+{
+    SG_POS at;
+    uint8_t *buf;
+    uint32_t left;
+    AHCI_CMD_HEADER *header = &ahci_drive_t[drive].cmd_list[slot];
+    AHCI_CMD_TABLE *table = &ahci_drive_t[drive].cmd_table[slot];
+    AHCI_FIS_H2D *fis = (AHCI_FIS_H2D *) &table->cfis[0];
+    AHCI_PRD *prd = NULL;
+    uint32_t addr, len;
+    uint16_t n = 0;
+
+    memset((char *) table, sizeof(table->cfis) + sizeof(table->acmd), 0);
+
+    if(size)
+        at = *pos;
+
+    while(size)
+    {
+        buf = sg_ptr(&at, &left);
+        addr = (uint32_t) paging_vptr_to_pptr(buf);
+        len = PAGE_SIZE - ((uint32_t) buf & (PAGE_SIZE - 1U));
+        len = (len > left) ? left : len;
+        len = (len > size) ? size : len;
+
+        /* physically contiguous with the previous page, make that descriptor longer */
+        if(prd && prd->addr + prd->size + 1 == addr)
+            prd->size += len;
+        else
+        {
+            if(n == AHCI_PRD_MAX)
+                return NULL;
+
+            prd = &table->prdt[n++];
+            prd->addr = addr;
+            prd->addru = 0;
+            prd->rsv = 0;
+            prd->size = len - 1;
+        }
+
+        sg_advance(&at, len);
+        size -= len;
+    }
+
+    header->flags = (uint16_t) ((sizeof(AHCI_FIS_H2D) / sizeof(uint32_t)) | flags);
+    header->prdtl = n;
+    header->prdbc = 0;
+    header->ctbau = 0;
+
+    fis->type = AHCI_FIS_TYPE_H2D;
+    fis->flags = AHCI_FIS_COMMAND;
+
+    return fis;
+}
+
+static void AHCI_setLBA(AHCI_FIS_H2D *fis, uint32_t start, bool lba48)
+{
+    fis->lba0 = (uint8_t) start;
+    fis->lba1 = (uint8_t) (start >> 8);
+    fis->lba2 = (uint8_t) (start >> 16);
+    fis->device = AHCI_DEVICE_LBA;
+
+    /* LBA28 commands keep the highest four bits in the device register */
+    if(lba48)
+        fis->lba3 = (uint8_t) (start >> 24);
+    else
+        fis->device = (uint8_t) (fis->device | ((start >> 24) & 0x0F));
+}
+
+/* splits the transfer up over the command slots and hands them to the drive all at once
+   sctrwrite: 1 - max_sectors */
+static uint8_t AHCI_transfer(uint8_t drive, uint32_t start, uint32_t sctrwrite, SG_POS pos, bool write)
+{
+    AHCI_DRIVE *info = &ahci_drive_t[drive];
+    bool atapi = (info->type == DRIVE_TYPE_SATAPI);
+    bool queued = (info->queue_depth != 0);
+    uint32_t sector_size = atapi ? SECTOR_SIZE_CD : SECTOR_SIZE;
+    uint32_t per_slot = AHCI_CMD_BYTES / sector_size;
+    uint32_t slots = 0, n;
+    uint16_t flags = (uint16_t) ((write ? AHCI_CMD_WRITE : 0) | (atapi ? AHCI_CMD_ATAPI : 0));
+    AHCI_FIS_H2D *fis;
+    uint8_t slot, error;
+
+    AHCI_drain(drive);
+
+    for(slot = 0; sctrwrite; ++slot)
+    {
+        n = (sctrwrite > per_slot) ? per_slot : sctrwrite;
+
+        if(!(fis = AHCI_prepareSlot(drive, slot, &pos, n * sector_size, flags)))
+            return EXIT_CODE_AHCI_ERROR_READING_DRIVE;
+
+        if(atapi)
+        {
+            uint8_t *packet = &info->cmd_table[slot].acmd[0];
+
+            fis->command = ATAPI_COMMAND_PACKET;
+            fis->feature = AHCI_FEATURE_DMA;
+
+            packet[0] = ATAPI_COMMAND_READ;
+            packet[2] = (uint8_t) (start >> 0x18);
+            packet[3] = (uint8_t) (start >> 0x10);
+            packet[4] = (uint8_t) (start >> 0x08);
+            packet[5] = (uint8_t) (start >> 0x00);
+            packet[8] = (uint8_t) (n >> 0x08);
+            packet[9] = (uint8_t) (n >> 0x00);
+        }
+        else if(queued)
+        {
+            /* for FPDMA the count goes in the features, the tag in the count */
+            AHCI_setLBA(fis, start, true);
+            fis->command = write ? ATA_COMMAND_FPDMA_WRITE : ATA_COMMAND_FPDMA_READ;
+            fis->feature = (uint8_t) n;
+            fis->feature_hi = (uint8_t) (n >> 8);
+            fis->count = (uint8_t) (slot << 3);
+        }
+        else
+        {
+            AHCI_setLBA(fis, start, info->lba48);
+            fis->command = info->lba48 ? (write ? ATA_COMMAND_DMAWRITE_EXT : ATA_COMMAND_DMAREAD_EXT)
+                                       : (write ? ATA_COMMAND_DMAWRITE : ATA_COMMAND_DMAREAD);
+            fis->count = (uint8_t) n;
+            fis->count_hi = (uint8_t) (n >> 8);
+        }
+
+        slots |= 1U << slot;
+        start += n;
+        sctrwrite -= n;
+        sg_advance(&pos, n * sector_size);
+    }
+
+    error = AHCI_issue(drive, slots, queued && !atapi);
+
+    /* same as the IDE driver, writes aren't done until they're out of the drive's cache */
+    if(!error && write)
+        error = AHCI_flush(drive);
+
+    return error;
+}
+
+static uint8_t AHCI_flush(uint8_t drive)
+{
+    AHCI_FIS_H2D *fis = AHCI_prepareSlot(drive, 0, NULL, 0, 0);
+
+    fis->command = ahci_drive_t[drive].lba48 ? ATA_COMMAND_FLUSH_EXT : ATA_COMMAND_FLUSH;
+    fis->device = AHCI_DEVICE_LBA;
+
+    return AHCI_issue(drive, 1U, false);
+}
+
+/* the other commands use slots 0 and up and can't be mixed with queued ones (AHCI_COMMAND_SUBMIT),
+   the drive finishes those first. Whatever happens to them, the port is ready afterwards */
+static void AHCI_drain(uint8_t drive)
+{
+    if(ahci_drive_t[drive].queued || ahci_drive_t[drive].error)
+        AHCI_wait(drive);
+}
+
+/* gives the prepared slots to the drive and waits until it finished all of them */
+static uint8_t AHCI_issue(uint8_t drive, uint32_t slots, bool queued)
+{
+    AHCI_DRIVE *info = &ahci_drive_t[drive];
+    AHCI_PORT *port = &ahci_hba->port[info->port];
+    uint32_t end = timer_getCurrentTick() + AHCI_TIMEOUT;
+
+    while((port->tfd & (ATA_STAT_BUSY | ATA_STAT_DRQ)) && timer_getCurrentTick() < end)
+        __asm__ __volatile__("pause");
+
+    if(port->tfd & (ATA_STAT_BUSY | ATA_STAT_DRQ))
+    {
+        AHCI_portRecover(drive);
+        return EXIT_CODE_AHCI_ERROR_READING_DRIVE;
+    }
+
+    info->error = 0;
+    info->busy = slots;
+
+    /* queued commands are only finished once the drive cleared their tag too */
+    if(queued)
+        port->sact = slots;
+
+    port->ci = slots;
+
+    return AHCI_wait(drive);
+}
+
+/* halts until AHCI_IRQ() saw all slots finish, queued ones included (or AHCI_TIMEOUT ran out), polls without an IRQ */
+static uint8_t AHCI_wait(uint8_t drive)
+{
+    AHCI_DRIVE *info = &ahci_drive_t[drive];
+    uint32_t end = timer_getCurrentTick() + AHCI_TIMEOUT;
+
+    if(CPU_irq_wait(AHCI_waitDone, info, end, ahci_irq == AHCI_NO_IRQ) && !info->error)
+        return EXIT_CODE_GLOBAL_SUCCESS;
+
+    AHCI_portRecover(drive);
+
+    return EXIT_CODE_AHCI_ERROR_READING_DRIVE;
+}
+
+static uint8_t AHCI_waitDone(void *drive_info)
+{
+    AHCI_DRIVE *info = (AHCI_DRIVE *) drive_info;
+
+    if(ahci_irq == AHCI_NO_IRQ)
+        AHCI_update((uint8_t) (info - ahci_drive_t));
+
+    return !(info->busy | info->queued) || info->error;
+}
+
+/* IRQ handler (or AHCI_wait() and AHCI_poll() when there's no IRQ) */
+static void AHCI_update(uint8_t drive)
+{
+    AHCI_DRIVE *info = &ahci_drive_t[drive];
+    AHCI_PORT *port = &ahci_hba->port[info->port];
+    uint32_t status = port->is;
+    uint32_t done;
+    uint8_t slot;
+
+    port->is = status;
+
+    if(status & AHCI_PxIS_ERRORS)
+        info->error = 1;
+
+    info->busy &= port->ci | port->sact;
+
+    /* submitted commands are done once the drive cleared their tag */
+    done = info->queued & ~(port->ci | port->sact);
+    info->queued &= ~done;
+
+    for(slot = 0; done; ++slot)
+    {
+        if(!(done & (1U << slot)))
+            continue;
+
+        done &= ~(1U << slot);
+
+        if(info->cmds[slot])
+            info->cmds[slot]->status = EXIT_CODE_GLOBAL_SUCCESS;
+
+        info->cmds[slot] = NULL;
+        info->progress = timer_getCurrentTick();
+    }
+
+    /* the port stopped at the error, the ones still queued won't finish */
+    if(info->error)
+        AHCI_failQueued(info);
+}
+
+/* sets the status of the submitted commands that didn't finish, their slots stay taken until AHCI_portRecover() */
+static void AHCI_failQueued(AHCI_DRIVE *info)
+{
+    uint8_t slot;
+
+    for(slot = 0; slot < AHCI_MAX_SLOTS; ++slot)
+    {
+        if(!info->cmds[slot])
+            continue;
+
+        info->cmds[slot]->status = EXIT_CODE_AHCI_ERROR_READING_DRIVE;
+        info->cmds[slot] = NULL;
+    }
+}
+
+/* gives the drive a read as a queued command in a free slot and returns, AHCI_update() finishes it */
+static uint8_t AHCI_submit(uint8_t drive, DISK_CMD *cmd)
+{
+    AHCI_DRIVE *info = &ahci_drive_t[drive];
+    AHCI_PORT *port = &ahci_hba->port[info->port];
+    uint32_t all = (info->slots >= AHCI_MAX_SLOTS) ? 0xFFFFFFFFU : (1U << info->slots) - 1U;
+    AHCI_FIS_H2D *fis;
+    SG_POS pos;
+    uint32_t flags;
+    uint8_t slot;
+
+    /* a queued command failed, the port doesn't take new ones before it is restarted */
+    if(info->error)
+        AHCI_portRecover(drive);
+
+    if(!(all & ~info->queued))
+        return EXIT_CODE_GLOBAL_GENERAL_FAIL;
+
+    for(slot = 0; info->queued & (1U << slot); ++slot);
+
+    sg_start(&pos, cmd->sg);
+
+    if(!(fis = AHCI_prepareSlot(drive, slot, &pos, cmd->sctr * SECTOR_SIZE, 0)))
+        return EXIT_CODE_AHCI_ERROR_READING_DRIVE;
+
+    AHCI_setLBA(fis, cmd->LBA, true);
+    fis->command = ATA_COMMAND_FPDMA_READ;
+    fis->feature = (uint8_t) cmd->sctr;
+    fis->feature_hi = (uint8_t) (cmd->sctr >> 8);
+    fis->count = (uint8_t) (slot << 3);
+
+    cmd->status = DISK_CMD_PENDING;
+
+    /* the IRQ handler takes a slot that's queued but not issued yet for a finished one */
+    flags = CPU_irq_save();
+
+    if(!info->queued)
+        info->progress = timer_getCurrentTick();
+
+    info->cmds[slot] = cmd;
+    info->queued |= 1U << slot;
+    port->sact = 1U << slot;
+    port->ci = 1U << slot;
+
+    CPU_irq_restore(flags);
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* finishes the submitted commands without an IRQ, and takes the port back when one of them failed
+   or the drive didn't finish any of them for AHCI_TIMEOUT */
+static void AHCI_poll(uint8_t drive)
+{
+    AHCI_DRIVE *info = &ahci_drive_t[drive];
+
+    if(!info->queued)
+        return;
+
+    if(ahci_irq == AHCI_NO_IRQ)
+        AHCI_update(drive);
+
+    if(info->queued && (info->error || timer_getCurrentTick() - info->progress >= AHCI_TIMEOUT))
+        AHCI_portRecover(drive);
+}
+
+static void AHCI_reportDrives(uint8_t *drive_list)
+{
+    uint32_t i = 0;
+
+    for(; i < AHCI_DRIVER_MAX_DRIVES; ++i)
+        drive_list[i] = ahci_drive_t[i].type;
+}
+
+static void AHCI_getDriveInfo(uint32_t *drv)
+{
+    AHCI_DRIVE *info = &ahci_drive_t[drv[1]];
+    uint32_t *out = (uint32_t *) drv[2];
+
+    out[AHCI_INFO_SECTORS] = (uint32_t) info->sectors;
+    out[AHCI_INFO_SECTORS_HI] = (uint32_t) (info->sectors >> 32);
+    out[AHCI_INFO_PORT] = info->port;
+    out[AHCI_INFO_SLOTS] = info->slots;
+    out[AHCI_INFO_QUEUE_DEPTH] = info->queue_depth;
+}
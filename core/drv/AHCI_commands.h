@@ -0,0 +1,122 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __AHCI_COMMANDS_H__
+#define __AHCI_COMMANDS_H__
+
+
+/*#define AHCI_COMMAND_INIT    0x00
+---- (not defined since COMMANDS.H already defines INIT)
+    Paramaters for the INIT command to the AHCI driver are the following:
+        parameter1: internal PCI device ID (bus, device, function, class)
+        parameter2, parameter3, parameter4
+*/
+
+/* the commands diskio uses have the same numbers as the IDE driver's, so it can
+   send the same packets to either controller */
+
+#define AHCI_COMMAND_READ    0x10
+/*
+	parameter1: drive
+	parameter2: starting sector
+	parameter3: # sectors to read (1 - AHCI_COMMAND_GET_MAX_SECTORS)
+	parameter4: buffer to read to (or a scatter-gather list, see below)
+
+	the transfer is split up over as many command slots as it needs, which the
+	drive gets all at once (as native command queuing commands when it can do those)
+*/
+
+#define AHCI_COMMAND_WRITE   0x11
+/*
+	parameter1: drive
+	parameter2: starting sector
+	parameter3: # sectors to write (1 - AHCI_COMMAND_GET_MAX_SECTORS)
+	parameter4: buffer with the data to be written (or a scatter-gather list, see below)
+
+	READ and WRITE take a scatter-gather list (SG_ENTRY array, see dsk/sglist.h) as parameter4
+	when parameter1 is the drive OR'd with DRIVE_SG
+*/
+
+#define AHCI_COMMAND_REPORTDRIVES   0x12
+/*
+	reports the drive 'map' detected by the driver in an array as large as AHCI_DRIVER_MAX_DRIVES,
+	drives are numbered in the order of the ports they're connected to
+
+	parameter1: pointer to array to store the map in
+
+	the array uses DRIVE_TYPE_SATA, DRIVE_TYPE_SATAPI and DRIVE_TYPE_UNKNOWN
+*/
+
+#define AHCI_COMMAND_GET_MAX_SECTORS   0x16
+/*
+	reports how many sectors AHCI_COMMAND_READ/AHCI_COMMAND_WRITE take at most
+
+	parameter1: drive
+
+	returns:
+	parameter2: the number of sectors
+*/
+
+#define AHCI_COMMAND_GET_DRIVE_INFO    0x17
+/*
+	parameter1: drive
+	parameter2: pointer to an array of AHCI_INFO_LEN uint32_t's to store it in
+*/
+
+#define AHCI_INFO_SECTORS       0x00 /* capacity in sectors, low 32 bits (0 for ATAPI) */
+#define AHCI_INFO_SECTORS_HI    0x01 /* high 32 bits */
+#define AHCI_INFO_PORT          0x02
+#define AHCI_INFO_SLOTS         0x03 /* commands the driver gives the drive at once */
+#define AHCI_INFO_QUEUE_DEPTH   0x04 /* native command queuing depth, 0 without NCQ */
+#define AHCI_INFO_LEN           0x05
+
+#define AHCI_COMMAND_SUBMIT     0x18
+/*
+	hands a read to the drive as a queued (NCQ) command and returns without waiting for it,
+	the IRQ handler sets the command's status when the drive is done
+
+	parameter1: drive
+	parameter4: pointer to a DISK_CMD (see dsk/diskcmd.h), 1 - AHCI_COMMAND_GET_QUEUE's parameter3 sectors
+
+	returns EXIT_CODE_GLOBAL_UNSUPPORTED if the drive can't queue commands and EXIT_CODE_GLOBAL_GENERAL_FAIL
+	if all its slots are taken. READ and WRITE wait for the queued commands to finish first
+*/
+
+#define AHCI_COMMAND_POLL       0x19
+/*
+	for whoever waits on submitted commands: finishes them when the controller has no IRQ, and takes
+	the port back when a queued command failed or the drive stopped answering (the others then fail too)
+
+	parameter1: drive
+*/
+
+#define AHCI_COMMAND_GET_QUEUE  0x1A
+/*
+	parameter1: drive
+
+	returns:
+	parameter2: commands AHCI_COMMAND_SUBMIT takes at the same time (0 if it can't be used for the drive)
+	parameter3: sectors per submitted command
+*/
+
+#endif
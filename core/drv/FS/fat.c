@@ -30,6 +30,7 @@ SOFTWARE.
 #include "../../include/file.h"
 
 #include "../../dsk/diskio.h"
+#include "../../dsk/dcache.h"
 
 #include "../../memory/memory.h"
 #include "../../memory/paging.h"
@@ -164,7 +165,7 @@ static uint32_t *FAT32_readFat(uint32_t cluster, uint32_t *nclusters);
 static uint32_t FAT32_read_table(uint32_t cluster);
 
 static uint16_t *FAT32_readDir(uint32_t cluster);
-static FAT32_DIR *FAT_find_in_dir(FAT32_DIR *dir, char *filename);
+static FAT32_DIR *FAT_lookup(uint32_t cluster, char *filename);
 static uint32_t FAT_file_exists(FAT32_DIR *dir, char *filename);
 
 static uint8_t FAT_setDrivePartitionActive(const char *id);
@@ -244,13 +245,13 @@ void fat_handler(uint32_t *drv)
             }
 
             // TODO: test file not found error
+            drv[3] = dir_entry->fSize;
             ptr = FAT32_read_file(dir_entry);
 
             if(ptr == NULL)
                 gErrorCode = EXIT_CODE_GLOBAL_GENERAL_FAIL;
 
             drv[2] = (uint32_t) ptr;
-            drv[3] = dir_entry->fSize;
         
         break;
 
@@ -261,6 +262,8 @@ void fat_handler(uint32_t *drv)
                 break;
 
             FAT_save_file((char *) drv[1], (uint16_t *) drv[2], (size_t) drv[3], (uint8_t) drv[4]);      
+            dcache_invalidate(DCACHE_MOUNT(currentWorkingDrive, currentWorkingPartition));
+            diskio_flush(currentWorkingDrive);
         break;
 
         case FS_COMMAND_RENAME:
@@ -270,6 +273,8 @@ void fat_handler(uint32_t *drv)
                 break;
 
             FAT_rename((char *) drv[1], (char *) drv[2]);      
+            dcache_invalidate(DCACHE_MOUNT(currentWorkingDrive, currentWorkingPartition));
+            diskio_flush(currentWorkingDrive);
         break;
 
         default:
@@ -528,19 +533,21 @@ static uint32_t *FAT32_read_file(FAT32_DIR *entry)
 
     kfree(req);
 
-    /* read the clusters */
-    for(uint32_t i = 0; i < nclusters; ++i)
+    /* read the clusters, a run of consecutive ones (an extent) with a single request */
+    uint8_t *dest = (uint8_t *) buffer;
+    uint32_t n;
+
+    for(uint32_t i = 0; i < nclusters && nlba_read; i += n)
     {
-        const uint32_t nsects = (nlba_read < sectclust) ? nlba_read : sectclust;
-        uint32_t starting_lba = FAT_cluster_LBA(clusters[i]);
+        for(n = 1; i + n < nclusters && clusters[i + n] == clusters[i + n - 1] + 1; ++n);
 
-        read(currentWorkingDrive, starting_lba, (uint32_t) nsects, (uint8_t *) buffer);
+        /* no underflows in my kingdom >:) */
+        const uint32_t nsects = (nlba_read < n * sectclust) ? nlba_read : n * sectclust;
 
-        buffer += sectclust << 9;
+        read(currentWorkingDrive, FAT_cluster_LBA(clusters[i]), nsects, dest);
 
-        /* no underflows in my kingdom >:) */
-        if(nlba_read >= sectclust)
-            nlba_read -= sectclust;
+        dest += nsects << 9;
+        nlba_read -= nsects;
     }
     kfree(clusters);
     kfree(entry);
@@ -925,23 +932,70 @@ static uint32_t * seek_empty_clusters(uint32_t n)
     return clusters;
 }
 
-/* returns entry of the directory, or input pointer if fail */
-static FAT32_DIR *FAT_find_in_dir(FAT32_DIR *dir, char *filename)
+/* returns a copy of the entry in the directory that starts at cluster (free it with kfree()),
+   or null if it isn't there. the directory is only read if the dentry cache doesn't know the file */
+static FAT32_DIR *FAT_lookup(uint32_t cluster, char *filename)
 {
-    char *file[12];
-    FAT32_DIR *d = (FAT32_DIR *) NULL;
+    const uint16_t mount = DCACHE_MOUNT(currentWorkingDrive, currentWorkingPartition);
+    FAT32_DIR *entry = kmalloc(sizeof(FAT32_DIR));
+    DENTRY dentry;
+    char file[12];
 
-    FAT_convertFilenameToFATCompat(&filename[0], (char *) &file[0]);
-        
-    uint32_t entry = FAT_file_exists(dir, (char *) &file[0]);
-        
-    if(entry != MAX)
-        d = &dir[entry];    
-    
+    if(entry == NULL)
+        return NULL;
 
-    //dbg_assert(!(i >= EXIT_CODE32_FAT_FAIL));
-    return d;
-    
+    FAT_convertFilenameToFATCompat(&filename[0], &file[0]);
+    file[FILENAME_LEN] = '\0';
+
+    const uint32_t len = strlen(&file[0]);
+
+    switch(dcache_lookup(mount, cluster, &file[0], len, &dentry))
+    {
+        case DCACHE_HIT:
+            memset((char *) entry, sizeof(FAT32_DIR), 0);
+            memcpy(&(entry->name[0]), &file[0], 8);
+            memcpy(&(entry->ext[0]), &file[8], 3);
+            entry->attrib = dentry.attrib;
+            entry->clHi = (uint16_t) ((dentry.start >> 16U) & 0xFFFFU);
+            entry->clLo = (uint16_t) (dentry.start & 0xFFFFU);
+            entry->fSize = dentry.size;
+            return entry;
+
+        case DCACHE_NEGATIVE:
+            kfree(entry);
+            return NULL;
+
+        default:
+        break;
+    }
+
+    FAT32_DIR *dir = (FAT32_DIR *) FAT32_readDir(cluster);
+
+    if(dir == NULL)
+    {
+        kfree(entry);
+        return NULL;
+    }
+
+    uint32_t i = FAT_file_exists(dir, &file[0]);
+
+    if(i == MAX)
+    {
+        dcache_add(mount, cluster, &file[0], len, NULL);
+        kfree(dir);
+        kfree(entry);
+        return NULL;
+    }
+
+    memcpy((char *) entry, (char *) &dir[i], sizeof(FAT32_DIR));
+    kfree(dir);
+
+    dentry.start = (uint32_t) ((entry->clHi << 16U) | (entry->clLo));
+    dentry.size = entry->fSize;
+    dentry.attrib = entry->attrib;
+    dcache_add(mount, cluster, &file[0], len, &dentry);
+
+    return entry;
 }
 
 static uint32_t FAT_file_exists(FAT32_DIR *dir, char *filename)
@@ -1018,23 +1072,20 @@ static FAT32_DIR *FAT_convertPath(char *path, uint32_t *dir_cluster)
         if(!strchr(path, '.') && strcmp(current, (char *) ".."))
             FAT_convertFilenameToFATCompat(current, &file[0]);
         
-        uint16_t *buffer = FAT32_readDir(cluster);
-
-        dir = FAT_find_in_dir((FAT32_DIR *) buffer, &file[0]);
-
-        cluster = (uint32_t) ((dir->clHi << 16U) | (dir->clLo));
+        dir = FAT_lookup(cluster, &file[0]);
 
         // TODO: MAKE SURE EVERY FUNCTION CHECKS FOR A NULL RETURNED
         // AND IF RETURNED READS THE DIR_CLUSTER THEMSELVES
         if(dir == NULL)
         {
             // we didn't find the current thing in the directory
-            kfree(buffer);
             kfree((void *) backup);
             *(dir_cluster) = prev_cluster;
             return NULL;
         }
 
+        cluster = (uint32_t) ((dir->clHi << 16U) | (dir->clLo));
+
         // save this cluster for outside-of-this-function use 
         *(dir_cluster) = cluster;
 
@@ -1042,7 +1093,7 @@ static FAT32_DIR *FAT_convertPath(char *path, uint32_t *dir_cluster)
         if(current == NULL)
             break;
 
-        kfree(buffer);
+        kfree(dir);
         prev_cluster = cluster;
     }
 
@@ -46,6 +46,7 @@ SOFTWARE.
 
 #include "../../dsk/diskio.h"
 #include "../../dsk/diskdefines.h"
+#include "../../dsk/dcache.h"
 
 #include "../../util/util.h"
 
@@ -56,9 +57,11 @@ SOFTWARE.
 #define VOL_IDENT_SIZE          32
 
 #define FIRST_DESCRIPTOR_LBA	0x10
+#define DESCRIPTOR_BATCH		8		// descriptors read per command
 
 // Descriptor types
 #define VD_TYPE_PRIMARY         0x01
+#define VD_TYPE_SUPPLEMENTARY   0x02
 #define VD_TYPE_TERMINATOR      0xFF // I'll be back
 
 // offsets within the Primary Volume Descriptor
@@ -68,6 +71,25 @@ SOFTWARE.
 #define PVD_PATHTABLE_SIZE      132
 #define PVD_PATHTABLE_LBA       140
 #define PVD_ROOTDIR_ENTRY       156
+#define SVD_ESCAPES             88  // Joliet puts its UCS-2 escape sequence here ('%/@', '%/C' or '%/E')
+
+// where the names of files and directories come from
+#define NAMES_ISO               0   // ISO9660 identifiers ('FILE.ELF;1')
+#define NAMES_JOLIET            1   // UCS-2 names of the Joliet volume descriptor
+#define NAMES_ROCKRIDGE         2   // POSIX names in the NM entries of the directory records
+#define ISO_NAME_MAX            255
+
+// System Use Sharing Protocol (Rock Ridge lives in there)
+#define SUSP_HEADER             4   // signature (2), length and version
+#define SUSP_SP_LEN             7
+#define SUSP_NM_FLAGS           4
+#define SUSP_NM_NAME            5
+#define SUSP_PX_MODE            4
+#define SUSP_PX_LEN             36
+#define NM_CURRENT              (1 << 1)
+#define NM_PARENT               (1 << 2)
+#define PX_S_IFMT               0170000
+#define PX_S_IFDIR              0040000
 
 // supported file flags
 #define FF_HIDDEN               1 << 0
@@ -80,6 +102,16 @@ SOFTWARE.
 
 // path table stuff
 #define MINIMUM_NEXT_LBA_PTABLE(a)		((sizeof(pathtable_t) * a) / SECTOR_SIZE)		// used to compute the minimum lba that an entry may be at
+#define ROOT_DIR_INDEX			1		// the path table numbers its directories from 1, the root comes first
+#define DIR_HASH_MIN			64		// buckets in the directory hash table, always a power of two
+#define DIR_INDEX_MAX			0xFFFF	// parent numbers in the path table are 16 bits
+
+// directories with a name index (see iso_dir_index())
+#define ISO_DIR_INDEXES			8
+
+// open files
+#define ISO_MAX_OPEN			16		// files open at the same time
+#define ISO_HANDLE(i)			((i) + 1u)	// 0 is never a valid handle
 
 typedef struct 
 {
@@ -117,8 +149,53 @@ typedef struct
 
 	char volident[VOL_IDENT_SIZE+1]; // volume name
 	uint32_t vol_size;	// in blocks of 2048 bytes
+	uint32_t path_table_bytes;
+	uint8_t names;		// NAMES_ISO, NAMES_JOLIET or NAMES_ROCKRIDGE
+	uint8_t susp_skip;	// bytes to skip in the system use area of a directory record (from the SP entry)
 } __attribute__((packed)) cd_info_t;
 
+// one directory of the in-memory copy of the path table
+typedef struct
+{
+	uint32_t lba;		// first sector of the directory
+	uint16_t parent;	// index of the parent directory
+	uint16_t next;		// next directory in the same hash bucket, 0 ends the chain
+	uint32_t name;		// offset of the name in iso_dir_names
+	uint8_t name_len;
+} isodir_t;
+
+// a file opened with iso_open(), files on a CD are one extent so this is all we need
+typedef struct
+{
+	uint8_t drive;
+	uint8_t used;
+	uint32_t lba;		// first sector of the file
+	uint32_t size;		// in bytes
+} isofile_t;
+
+// one file or directory in the name index of a directory
+typedef struct
+{
+	uint32_t lba;
+	uint32_t size;
+	uint32_t next;		// next name in the same hash bucket plus one, 0 ends the chain
+	uint32_t name;		// offset of the name in the pool
+	uint8_t name_len;
+	uint8_t flags;		// file flags, FF_DIRECTORY comes from Rock Ridge when the disc has it
+} isoname_t;
+
+// the names of a directory, hashed. the names, the hash table and the pool are a single allocation
+typedef struct
+{
+	uint8_t drive;
+	uint32_t lba;		// first sector of the directory
+	uint32_t used;		// iso_dir_tick at the last lookup
+	uint32_t mask;
+	isoname_t *names;	// NULL when the slot is free
+	uint32_t *hash;
+	char *pool;
+} isodirindex_t;
+
 
 /* the indentifier for drivers + information about our driver */
 struct DRIVER ISO_driver_id = {(uint32_t) 0xB14D05, "VIREODRV", (FS_TYPE_ISO | DRIVER_TYPE_FS), (uint32_t) (iso_handler)};
@@ -128,6 +205,21 @@ uint8_t n_atapi_devs    = 0;
 
 uint32_t *cd_info_ptr 	= NULL;
 
+// the path table, indexed by iso_index_path_table(). iso_dirs[0] is unused so path table
+// numbers can be used as they are
+isodir_t *iso_dirs		= NULL;
+char *iso_dir_names		= NULL;
+uint16_t *iso_dir_hash	= NULL;
+uint16_t iso_dir_mask	= 0;
+uint16_t iso_dir_n		= 0;
+uint8_t iso_dir_drive	= 0xFF;
+uint8_t iso_dir_index_on = 1;
+
+isofile_t iso_files[ISO_MAX_OPEN];
+
+isodirindex_t iso_dir_indexes[ISO_DIR_INDEXES];
+uint32_t iso_dir_tick = 0;
+
 uint8_t gerror;
 
 void iso_handler(uint32_t * drv)
@@ -144,6 +236,18 @@ void iso_handler(uint32_t * drv)
 			iso_read((char *) drv[1], drv);
 		break;
 
+		case FS_COMMAND_OPEN:
+			drv[2] = iso_open((char *) drv[1], &drv[3]);
+		break;
+
+		case FS_COMMAND_READ_AT:
+			gerror = iso_read_at(drv[1], drv[2], (uint8_t *) drv[4], &drv[3]);
+		break;
+
+		case FS_COMMAND_CLOSE:
+			gerror = iso_close(drv[1]);
+		break;
+
 		default:
             gerror = EXIT_CODE_GLOBAL_UNSUPPORTED;
         break;
@@ -170,11 +274,26 @@ void iso_init(uint8_t drive)
 		return; 
 
 	// search and read the primary vol. desc.
-	iso_search_descriptor(drive, buffer, VD_TYPE_PRIMARY);
-	dbg_assert(buffer[0] == VD_TYPE_PRIMARY);
+	gerror = iso_search_descriptor(drive, buffer, VD_TYPE_PRIMARY);
+
+	if(gerror || buffer[0] != VD_TYPE_PRIMARY)
+	{
+		// no volume descriptor to work with, so don't claim the drive
+		if(!gerror)
+			gerror = EXIT_CODE_FS_UNSUPPORTED_DRIVE;
+
+		iso_free_bfr(buffer);
+		return;
+	}
 
 	// save all interesting data
 	iso_save_pvd_data(buffer);
+	iso_detect_names(drive, buffer);
+
+	// keep the path table in memory so paths resolve without reading it again. when it doesn't
+	// fit, iso_traverse() searches the path table on disk like it always did
+	if(iso_index_path_table(drive))
+		gerror = 0;
 
 	if(n_atapi_devs < IDE_DRIVER_MAX_DRIVES)
 		atapi_devices |= (1u << drive);
@@ -189,30 +308,73 @@ void iso_init(uint8_t drive)
 		print_value("[ISO9660 DRIVER] Path table size (in sectors): %i\n", (uint32_t) (info->path_table_size));
 		print_value("[ISO9660 DRIVER] Path tanle lba: %i\n", (uint32_t) (info->path_table_lba));
 		print_value("[ISO9660 DRIVER] Rootdir lba: %i\n", (uint32_t) (info->rootdir_lba));
+		print_value("[ISO9660 DRIVER] Directories indexed: %i\n", (uint32_t) iso_dir_count());
+		print_value("[ISO9660 DRIVER] Names: %s\n", (uint32_t) ((info->names == NAMES_ROCKRIDGE) ? "Rock Ridge" : 
+																(info->names == NAMES_JOLIET) ? "Joliet" : "ISO9660"));
         print("\n");
 	#endif
 	
 }
 
-void iso_search_descriptor(uint8_t drive, uint8_t * buffer, uint8_t type)
+uint8_t iso_search_descriptor(uint8_t drive, uint8_t * buffer, uint8_t type)
 {
 	uint32_t lba = FIRST_DESCRIPTOR_LBA;
+	uint32_t i;
+
+	// most CDs have only a handful of descriptors, so one read usually gets all of them
+	uint8_t *batch = iso_allocate_bfr(SECTOR_SIZE * DESCRIPTOR_BATCH);
+
+	if(!batch)
+		return EXIT_CODE_OUT_OF_MEMORY;
 
 	while(1)
 	{
 		// read disk
-		uint8_t error = read(drive, lba, 0x01, buffer);
+		uint8_t error = read(drive, lba, DESCRIPTOR_BATCH, batch);
 
-		dbg_assert(!error); // asserts when drive is out of range
+		if(error)
+		{
+			iso_free_bfr(batch);
+			return error;
+		}
+
+		for(i = 0; i < DESCRIPTOR_BATCH; ++i)
+			if((batch[i * SECTOR_SIZE] == type) || (batch[i * SECTOR_SIZE] == VD_TYPE_TERMINATOR))
+				break;
 
-		if((buffer[0] == type) || (buffer[0] == VD_TYPE_TERMINATOR))
+		if(i < DESCRIPTOR_BATCH)
 			break;
 
-		++lba;
+		lba += DESCRIPTOR_BATCH;
 
-		dbg_assert(lba != 0xFF);	// we don't want to read the whole CD until we 'find' what we
-									// are looking for
+		// we don't want to read the whole CD until we 'find' what we are looking for
+		if(lba >= 0xFF)
+		{
+			iso_free_bfr(batch);
+			return EXIT_CODE_FS_UNSUPPORTED_DRIVE;
+		}
 	}
+
+	memcpy((char *) buffer, (char *) &batch[i * SECTOR_SIZE], SECTOR_SIZE);
+	iso_free_bfr(batch);
+
+	return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+// stores the path table and root directory of a volume descriptor, the primary one or the Joliet one
+static void iso_save_tree(const uint8_t *vd)
+{
+	cd_info_t * info = (cd_info_t *) cd_info_ptr;
+	const uint32_t bytes = *((const uint32_t *) &vd[PVD_PATHTABLE_SIZE]);
+
+	// store path table size (in sectors) and lba
+	info->path_table_size = (bytes / SECTOR_SIZE) + (bytes % SECTOR_SIZE != 0);
+	info->path_table_bytes = bytes;
+	info->path_table_lba = *((const uint32_t *) &vd[PVD_PATHTABLE_LBA]);
+
+	// store root dir lba
+	const direntry_t *root = (const direntry_t *) &vd[PVD_ROOTDIR_ENTRY];
+	info->rootdir_lba = (root->lba_extend);
 }
 
 void iso_save_pvd_data(uint8_t * pvd)
@@ -239,32 +401,81 @@ void iso_save_pvd_data(uint8_t * pvd)
 	word = (uint16_t *) &pvd[PVD_BLOCK_SIZE];
 	dbg_assert(*(word) == SECTOR_SIZE);
 
-	// store path table size (in sectors) and lba
-	dword = (uint32_t *) &pvd[PVD_PATHTABLE_SIZE];
-	info->path_table_size = (*(dword) / SECTOR_SIZE) + (*(dword) % SECTOR_SIZE != 0);
+	iso_save_tree(pvd);
+}
 
-	dword = (uint32_t *) &pvd[PVD_PATHTABLE_LBA];
-	info->path_table_lba = *(dword);
+// returns: offset of the system use area in the directory record
+static uint32_t iso_susp_start(const direntry_t *entry, uint32_t skip)
+{
+	uint32_t off = sizeof(direntry_t) + (entry->ident_len);
 
-	// store root dir lba
-	direntry_t *root = (direntry_t *) &pvd[PVD_ROOTDIR_ENTRY];
-	info->rootdir_lba = (root->lba_extend);
+	// the system use area starts at an even offset
+	return off + (off % 2) + skip;
 }
 
-void * iso_allocate_bfr(size_t size)
+// the first record of the root directory ('.') starts with an SP entry when the disc uses SUSP,
+// the Rock Ridge entries after it tell us the names are in there
+static uint8_t iso_has_rockridge(uint8_t drive)
 {
-	uint32_t * ptr = kmalloc(size);
+	cd_info_t *info = (cd_info_t *) cd_info_ptr;
+	uint8_t *b = (uint8_t *) iso_read_drive(drive, (info->rootdir_lba), 1);
+	uint8_t found = 0;
+
+	if(!b)
+		return 0;
+
+	const direntry_t *dot = (const direntry_t *) b;
+	uint32_t off = iso_susp_start(dot, 0);
+	const uint32_t end = (dot->DR_len);
+
+	if(off + SUSP_SP_LEN <= end && b[off] == 'S' && b[off + 1] == 'P' && b[off + 4] == 0xBE && b[off + 5] == 0xEF)
+	{
+		info->susp_skip = b[off + 6];
+
+		for(off += b[off + 2]; off + SUSP_HEADER <= end && b[off + 2] >= SUSP_HEADER; off += b[off + 2])
+			if((b[off] == 'R' && b[off + 1] == 'R') || (b[off] == 'P' && b[off + 1] == 'X') ||
+			   (b[off] == 'E' && b[off + 1] == 'R') || (b[off] == 'N' && b[off + 1] == 'M'))
+				found = 1;
+	}
+
+	iso_free_bfr(b);
+	return found;
+}
+
+// decides where the names come from: Rock Ridge, Joliet or the ISO9660 identifiers (in that order).
+// buffer is a sector the function may use
+void iso_detect_names(uint8_t drive, uint8_t *buffer)
+{
+	cd_info_t *info = (cd_info_t *) cd_info_ptr;
+
+	info->names = NAMES_ISO;
+	info->susp_skip = 0;
+
+	if(iso_has_rockridge(drive))
+	{
+		info->names = NAMES_ROCKRIDGE;
+		return;
+	}
+
+	// a supplementary volume descriptor with a UCS-2 escape sequence is a Joliet one
+	if(iso_search_descriptor(drive, buffer, VD_TYPE_SUPPLEMENTARY))
+		return;
 
-	if(ptr)
-		return ptr;
+	if(buffer[0] != VD_TYPE_SUPPLEMENTARY || buffer[SVD_ESCAPES] != '%' || buffer[SVD_ESCAPES + 1] != '/')
+		return;
+
+	if(buffer[SVD_ESCAPES + 2] != '@' && buffer[SVD_ESCAPES + 2] != 'C' && buffer[SVD_ESCAPES + 2] != 'E')
+		return;
 
-	// no kernel memory left, so let's use a page
-	PAGE_REQ req;
-	req.attr = PAGE_REQ_ATTR_READ_WRITE | PAGE_REQ_ATTR_SUPERVISOR;
-	req.pid  = PID_KERNEL;
-	req.size = size;
+	// Joliet has a path table and directories of its own
+	iso_save_tree(buffer);
+	info->names = NAMES_JOLIET;
+}
 
-	ptr = valloc(&req);
+void * iso_allocate_bfr(size_t size)
+{
+	// kmalloc() takes care of big buffers itself (it gets pages for them)
+	uint32_t * ptr = kmalloc(size);
 
 	if(!ptr)
 		gerror = EXIT_CODE_OUT_OF_MEMORY;
@@ -274,10 +485,420 @@ void * iso_allocate_bfr(size_t size)
 
 void iso_free_bfr(void *ptr)
 {
-	if((uint32_t *) ptr > (uint32_t *) memory_get_malloc_end())
-		vfree(ptr);
-	else
-		kfree(ptr);
+	kfree(ptr);
+}
+
+// copies a name to out the way the driver compares names: upper case and without the version
+// number ('conway.elf;1' becomes 'CONWAY.ELF'). names is the kind of name, a name from a path
+// is taken as it is, like a Rock Ridge name. returns: the length of the name in out
+static uint32_t iso_fold_name(const uint8_t *ident, uint32_t len, uint8_t names, char *out, uint32_t max)
+{
+	const uint32_t step = (names == NAMES_JOLIET) ? 2 : 1;
+	uint32_t i, n = 0;
+
+	for(i = 0; i + step <= len && n < max; i += step)
+	{
+		uint16_t c = (step == 2) ? (uint16_t) ((ident[i] << 8) | ident[i + 1]) : ident[i];
+
+		if(c == ';' && names != NAMES_ROCKRIDGE)
+			break;
+
+		// we only do 8 bit characters
+		if(c > 0xFF)
+			c = '_';
+
+		if(c >= 'a' && c <= 'z')
+			c = (uint16_t) (c - ('a' - 'A'));
+
+		out[n++] = (char) c;
+	}
+
+	// 'README.;1' is a file without an extension
+	if(names != NAMES_ROCKRIDGE && n && out[n - 1] == '.')
+		n--;
+
+	out[n] = '\0';
+	return n;
+}
+
+// returns: the kind of names in the path table, Rock Ridge doesn't change those
+static uint8_t iso_path_table_names(void)
+{
+	const cd_info_t *info = (cd_info_t *) cd_info_ptr;
+	return ((info->names) == NAMES_JOLIET) ? NAMES_JOLIET : NAMES_ISO;
+}
+
+// returns: EXIT_CODE_GLOBAL_SUCCESS if a path table identifier and a name from a path are the same name
+static uint8_t iso_name_cmp(const uint8_t *ident, uint32_t len, const char *name)
+{
+	char a[ISO_NAME_MAX + 1], b[ISO_NAME_MAX + 1];
+	uint32_t n = iso_fold_name(ident, len, iso_path_table_names(), a, ISO_NAME_MAX);
+
+	if(n != iso_fold_name((const uint8_t *) name, strlen((char *) name), NAMES_ROCKRIDGE, b, ISO_NAME_MAX) || memcmp(a, b, n))
+		return EXIT_CODE_GLOBAL_GENERAL_FAIL;
+
+	return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+// copies the folded name of the directory record to out, a Rock Ridge name (NM) wins over the
+// ISO9660 or Joliet identifier. returns: the length of the name
+static uint32_t iso_entry_name(const direntry_t *entry, char *out, uint8_t *flags)
+{
+	const cd_info_t *info = (cd_info_t *) cd_info_ptr;
+	const uint8_t *r = (const uint8_t *) entry;
+	const uint32_t end = (entry->DR_len);
+	uint32_t off, n = 0;
+	uint8_t nm = 0;
+
+	*(flags) = (entry->file_flags);
+
+	if((info->names) == NAMES_ROCKRIDGE)
+		for(off = iso_susp_start(entry, (info->susp_skip)); off + SUSP_HEADER <= end && r[off + 2] >= SUSP_HEADER; off += r[off + 2])
+		{
+			const uint32_t len = r[off + 2];
+
+			if(off + len > end || (r[off] == 'S' && r[off + 1] == 'T'))
+				break;
+
+			// a long name is split over more than one NM entry
+			if(r[off] == 'N' && r[off + 1] == 'M' && len > SUSP_NM_NAME && !(r[off + SUSP_NM_FLAGS] & (NM_CURRENT | NM_PARENT)))
+			{
+				n += iso_fold_name(&r[off + SUSP_NM_NAME], len - SUSP_NM_NAME, NAMES_ROCKRIDGE, &out[n], ISO_NAME_MAX - n);
+				nm = 1;
+			}
+
+			// the POSIX file mode says if it's a directory
+			if(r[off] == 'P' && r[off + 1] == 'X' && len >= SUSP_PX_LEN)
+			{
+				const uint32_t mode = *((const uint32_t *) &r[off + SUSP_PX_MODE]);
+
+				if((mode & PX_S_IFMT) == PX_S_IFDIR)
+					*(flags) = (uint8_t) (*(flags) | FF_DIRECTORY);
+				else
+					*(flags) = (uint8_t) (*(flags) & ~(FF_DIRECTORY));
+			}
+		}
+
+	// continuation areas (CE) aren't followed, without an NM entry the identifier will have to do
+	if(!nm)
+		n = iso_fold_name(r + sizeof(direntry_t), (entry->ident_len), (info->names), out, ISO_NAME_MAX);
+
+	return n;
+}
+
+static uint16_t iso_dir_hash_name(uint16_t parent, const char *name, uint32_t len)
+{
+	// seeded with the parent so equal names in different directories spread
+	return (uint16_t) (name_hash(parent, name, len) & iso_dir_mask);
+}
+
+static void iso_dir_free_index(void)
+{
+	uint32_t i;
+
+	// the name indexes of the directories belong to the same disc
+	for(i = 0; i < ISO_DIR_INDEXES; ++i)
+	{
+		iso_free_bfr(iso_dir_indexes[i].names);
+		iso_dir_indexes[i].names = NULL;
+		iso_dir_indexes[i].used = 0;
+	}
+
+	iso_free_bfr(iso_dirs);
+	iso_free_bfr(iso_dir_names);
+	iso_free_bfr(iso_dir_hash);
+
+	iso_dirs = NULL;
+	iso_dir_names = NULL;
+	iso_dir_hash = NULL;
+	iso_dir_drive = 0xFF;
+	iso_dir_n = 0;
+}
+
+uint8_t iso_index_path_table(uint8_t drive)
+{
+	const cd_info_t *info = (cd_info_t *) cd_info_ptr;
+	uint32_t i, n = 0, names = 0, buckets = DIR_HASH_MIN;
+
+	// there is only one cd_info, so only the last drive that was initialized gets an index
+	iso_dir_free_index();
+	dcache_invalidate(DCACHE_MOUNT(drive, 0));
+
+	// the whole path table in one read, it's rarely more than a couple of sectors
+	uint8_t *table = (uint8_t *) iso_read_drive(drive, (info->path_table_lba), (info->path_table_size));
+
+	if(!table)
+		return gerror;
+
+	// count the directories and the space their names need
+	for(i = 0; (i + sizeof(pathtable_t)) <= (info->path_table_bytes) && n < (DIR_INDEX_MAX - 1); ++n)
+	{
+		pathtable_t *t = (pathtable_t *) &table[i];
+
+		if(!(t->ident_len))
+			break;
+
+		names += (t->ident_len) + 1u;
+		i += sizeof(pathtable_t) + (t->ident_len) + ((t->ident_len) % 2 == 1);
+	}
+
+	while(buckets < n)
+		buckets <<= 1;
+
+	iso_dirs = iso_allocate_bfr((n + 1) * sizeof(isodir_t));
+	iso_dir_names = iso_allocate_bfr(names);
+	iso_dir_hash = iso_allocate_bfr(buckets * sizeof(uint16_t));
+
+	if(!n || !iso_dirs || !iso_dir_names || !iso_dir_hash)
+	{
+		iso_dir_free_index();
+		iso_free_bfr(table);
+		return EXIT_CODE_OUT_OF_MEMORY;
+	}
+
+	memset((char *) iso_dir_hash, buckets * sizeof(uint16_t), 0);
+	memset((char *) &iso_dirs[0], sizeof(isodir_t), 0);
+	iso_dir_mask = (uint16_t) (buckets - 1);
+
+	uint32_t index, name = 0;
+	i = 0;
+
+	for(index = ROOT_DIR_INDEX; index <= n; ++index)
+	{
+		pathtable_t *t = (pathtable_t *) &table[i];
+		isodir_t *d = &iso_dirs[index];
+
+		d->lba = (t->lba);
+		d->parent = (t->parent);
+		d->name = name;
+		d->name_len = (uint8_t) iso_fold_name(&table[i + sizeof(pathtable_t)], (t->ident_len), iso_path_table_names(), 
+											  &iso_dir_names[name], (t->ident_len));
+		name += (t->ident_len) + 1u;
+
+		// the root is its own parent and nobody looks it up by name
+		if(index != ROOT_DIR_INDEX)
+		{
+			uint16_t h = iso_dir_hash_name(d->parent, &iso_dir_names[d->name], d->name_len);
+			d->next = iso_dir_hash[h];
+			iso_dir_hash[h] = (uint16_t) index;
+		}
+		else
+			d->next = 0;
+
+		i += sizeof(pathtable_t) + (t->ident_len) + ((t->ident_len) % 2 == 1);
+	}
+
+	iso_dir_n = (uint16_t) n;
+	iso_dir_drive = drive;
+
+	iso_free_bfr(table);
+	return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+uint16_t iso_dir_count(void)
+{
+	return iso_dir_n;
+}
+
+// 0 makes iso_traverse() search the path table on disk, even when it's indexed
+void iso_set_path_index(uint8_t enable)
+{
+	iso_dir_index_on = enable;
+}
+
+// returns: the path table number of the directory, 0 when there is no such directory
+static uint16_t iso_dir_lookup(uint16_t parent, const char *name, uint32_t len)
+{
+	uint16_t i = iso_dir_hash[iso_dir_hash_name(parent, name, len)];
+
+	while(i)
+	{
+		const isodir_t *d = &iso_dirs[i];
+
+		if(d->parent == parent && d->name_len == len && !memcmp(&iso_dir_names[d->name], name, len))
+			return i;
+
+		i = d->next;
+	}
+
+	return 0;
+}
+
+// returns: the next record in the directory that isn't '.' or '..', NULL at the end
+static const direntry_t *iso_next_entry(const uint8_t *dir, uint32_t bytes, uint32_t *off)
+{
+	while(*(off) + sizeof(direntry_t) <= bytes)
+	{
+		const direntry_t *entry = (const direntry_t *) &dir[*(off)];
+
+		// records don't cross sectors, the rest of a sector is zeroes
+		if(!(entry->DR_len))
+		{
+			*(off) = (*(off) / SECTOR_SIZE + 1) * SECTOR_SIZE;
+			continue;
+		}
+
+		*(off) += (entry->DR_len);
+
+		if(*(off) > bytes)
+			break;
+
+		if((entry->ident_len) == 1 && dir[*(off) - (entry->DR_len) + sizeof(direntry_t)] <= 1)
+			continue;
+
+		return entry;
+	}
+
+	return NULL;
+}
+
+static const isoname_t *iso_dir_find_name(const isodirindex_t *x, const char *name, uint32_t len)
+{
+	uint32_t i = x->hash[name_hash(0, name, len) & (x->mask)];
+
+	while(i)
+	{
+		const isoname_t *n = &(x->names[i - 1]);
+
+		if(n->name_len == len && !memcmp(&(x->pool[n->name]), name, len))
+			return n;
+
+		i = n->next;
+	}
+
+	return NULL;
+}
+
+// returns: the name index of the directory, the directory is read and indexed the first time it's
+// asked for. NULL when it can't be read or there is no memory for it (gerror tells)
+static const isodirindex_t *iso_dir_index(uint8_t drive, uint32_t dir_lba)
+{
+	isodirindex_t *x = &iso_dir_indexes[0];
+	char name[ISO_NAME_MAX + 1];
+	const direntry_t *entry;
+	uint32_t i, off, n = 0, pool = 0, buckets = 1;
+	uint8_t flags;
+
+	iso_dir_tick++;
+
+	for(i = 0; i < ISO_DIR_INDEXES; ++i)
+		if(iso_dir_indexes[i].names && iso_dir_indexes[i].lba == dir_lba && iso_dir_indexes[i].drive == drive)
+		{
+			iso_dir_indexes[i].used = iso_dir_tick;
+			return &iso_dir_indexes[i];
+		}
+
+	// reuse the index that wasn't used for the longest time
+	for(i = 1; i < ISO_DIR_INDEXES; ++i)
+		if(iso_dir_indexes[i].used < x->used)
+			x = &iso_dir_indexes[i];
+
+	size_t size = iso_get_dir_size(drive, dir_lba);
+	uint32_t nlba = size / SECTOR_SIZE + ((size % SECTOR_SIZE) != 0);
+	uint8_t *dir = nlba ? (uint8_t *) iso_read_drive(drive, dir_lba, nlba) : NULL;
+
+	// a directory that can't be read doesn't get an index, the next lookup tries again
+	if(!dir)
+		return NULL;
+
+	iso_free_bfr(x->names);
+	x->names = NULL;
+	x->used = 0;
+
+	// count the names and the space they need first
+	for(off = 0; (entry = iso_next_entry(dir, size, &off)) != NULL; ++n)
+		pool += iso_entry_name(entry, name, &flags) + 1u;
+
+	// about a name per bucket
+	while(buckets < n)
+		buckets <<= 1;
+
+	uint8_t *mem = iso_allocate_bfr(n * sizeof(isoname_t) + buckets * sizeof(uint32_t) + pool);
+
+	if(!mem)
+	{
+		iso_free_bfr(dir);
+		return NULL;
+	}
+
+	x->names = (isoname_t *) mem;
+	x->hash = (uint32_t *) &mem[n * sizeof(isoname_t)];
+	x->pool = (char *) &mem[n * sizeof(isoname_t) + buckets * sizeof(uint32_t)];
+	x->mask = buckets - 1;
+	x->drive = drive;
+	x->lba = dir_lba;
+	x->used = iso_dir_tick;
+
+	memset((char *) x->hash, buckets * sizeof(uint32_t), 0);
+
+	for(i = 0, off = 0, pool = 0; i < n && (entry = iso_next_entry(dir, size, &off)) != NULL; ++i)
+	{
+		isoname_t *e = &(x->names[i]);
+
+		e->name = pool;
+		e->name_len = (uint8_t) iso_entry_name(entry, &(x->pool[pool]), &(e->flags));
+		e->lba = (entry->lba_extend);
+		e->size = (entry->size);
+		e->next = 0;
+		pool += e->name_len + 1u;
+
+		// a file of more than one extent has a record for each, the first is where it starts
+		if(iso_dir_find_name(x, &(x->pool[e->name]), e->name_len))
+			continue;
+
+		uint32_t h = name_hash(0, &(x->pool[e->name]), e->name_len) & (x->mask);
+		e->next = x->hash[h];
+		x->hash[h] = i + 1;
+	}
+
+	iso_free_bfr(dir);
+	return x;
+}
+
+// returns: the (folded) name in the directory, NULL if it isn't there
+static const isoname_t *iso_dir_find(uint8_t drive, uint32_t dir_lba, const char *name, uint32_t len)
+{
+	const isodirindex_t *x = iso_dir_index(drive, dir_lba);
+	return x ? iso_dir_find_name(x, name, len) : NULL;
+}
+
+// returns: lba of the directory the file in the path is in, MAX if one of the directories doesn't exist
+static uint32_t iso_index_to_dir_lba(uint8_t drive, char *path)
+{
+	char name[ISO_NAME_MAX + 1];
+	uint32_t len = find_in_str(path, "/"), n;
+	uint32_t lba = 0; // set once we're past what the path table knows
+	uint16_t dir = ROOT_DIR_INDEX, next;
+
+	// walk from the root to the file, one hash lookup per directory and nothing read from the disc
+	while(len != MAX)
+	{
+		path += len + 1;
+
+		if((len = find_in_str(path, "/")) == MAX)
+			break;
+
+		if(!len)
+			continue;
+
+		n = iso_fold_name((const uint8_t *) path, len, NAMES_ROCKRIDGE, name, ISO_NAME_MAX);
+
+		if(!lba && (next = iso_dir_lookup(dir, name, n)) != 0)
+		{
+			dir = next;
+			continue;
+		}
+
+		// the path table only has the ISO9660 names, a (long) Rock Ridge name is only in the directory itself
+		const isoname_t *e = iso_dir_find(drive, lba ? lba : iso_dirs[dir].lba, name, n);
+
+		if(!e || !((e->flags) & FF_DIRECTORY))
+			return MAX;
+
+		lba = e->lba;
+	}
+
+	return lba ? lba : iso_dirs[dir].lba;
 }
 
 // use this function to convert a path into the lba of the file
@@ -299,18 +920,30 @@ uint32_t iso_traverse(char *path, size_t *fsize)
 	memcpy(filename, a, flen);
 	filename[flen] = '\0';
 
-	// reverse path and remove everything we don't need anymore
-	iso_clean_path_reverse(p);
-
 	cd_info_t *info = (cd_info_t *) cd_info_ptr;
 	uint32_t dir_lba = (info->rootdir_lba);
 
-	// if there is only a file in the path, we do not have to search for directories
-	if(find_in_str(p, ".") == MAX)
-		dir_lba = iso_path_to_dir_lba(drive, p);
-	
-	uint32_t flba = iso_search_dir(drive, dir_lba, (const char *) filename, fsize);
+	if(iso_dirs && iso_dir_index_on && drive == iso_dir_drive)
+		dir_lba = iso_index_to_dir_lba(drive, path);
+	else
+	{
+		// reverse path and remove everything we don't need anymore
+		iso_clean_path_reverse(p);
+
+		// if there is only a file in the path, we do not have to search for directories
+		if(find_in_str(p, ".") == MAX)
+			dir_lba = iso_path_to_dir_lba(drive, p);
+	}
+
+	uint32_t flba = 0;
+	*(fsize) = 0;
+
+	if(dir_lba != MAX)
+		flba = iso_search_dir(drive, dir_lba, (const char *) filename, fsize);
+	else if(!gerror)
+		gerror = EXIT_CODE_FS_FILE_NOT_FOUND;
 	
+	iso_free_bfr(a);
 	iso_free_bfr(p);
 	iso_free_bfr(filename);
 
@@ -319,92 +952,58 @@ uint32_t iso_traverse(char *path, size_t *fsize)
 
 uint32_t iso_search_dir(uint8_t drive, uint32_t dir_lba, const char *filename, size_t *fsize)
 {
-	uint32_t flba; // file lba
-	uint32_t *bfr;
+	char name[ISO_NAME_MAX + 1];
+	DENTRY dentry;
 
-	size_t size = iso_get_dir_size(drive, dir_lba);
-	size_t bfr_size = iso_alloc_dir_buffer(size, &bfr);
+	const uint16_t mount = DCACHE_MOUNT(drive, 0);
+	const uint32_t len = iso_fold_name((const uint8_t *) filename, strlen((char *) filename), NAMES_ROCKRIDGE, name, ISO_NAME_MAX);
 
-	if(!bfr || !bfr_size)
-	{gerror = EXIT_CODE_OUT_OF_MEMORY; return 0;}
-	
-	uint32_t nlba = size / SECTOR_SIZE + ((size % SECTOR_SIZE) != 0);
-	const uint32_t to_read = (bfr_size / SECTOR_SIZE);
-
-	// when the buffer is bigger than the sector size,
-	// it means we have enough space to read the entire directory in one go
-	// instead of multiple small ones
-	if(bfr_size > SECTOR_SIZE)
-		nlba = 1;
+	*(fsize) = 0;
 
-	while(nlba)
+	// did we look in this directory for this file before?
+	switch(dcache_lookup(mount, dir_lba, name, len, &dentry))
 	{
-		read(drive, dir_lba, to_read, (uint8_t *) bfr);
-		flba = iso_search_dir_bfr(bfr, bfr_size, filename, fsize);
-		
-		if(flba || !(nlba--))
-			break;
+		case DCACHE_HIT:
+			*(fsize) = dentry.size;
+			return dentry.start;
 
-		iso_free_bfr(bfr);
-		dir_lba++;
-	}
+		case DCACHE_NEGATIVE:
+			return 0;
 
-	iso_free_bfr(bfr);
+		default:
+		break;
+	}
 
-	return flba;
-}
+	const isodirindex_t *x = iso_dir_index(drive, dir_lba);
 
-uint32_t iso_search_dir_bfr(uint32_t *bfr, size_t bfr_size, const char *filename, size_t *fsize)
-{
-	uint8_t *b = (uint8_t *) bfr;
-	uint32_t len = strlen((char *) filename);
-	uint32_t i = 0;
+	// if the directory couldn't be read or indexed we don't know if the file is there, so
+	// there is nothing to remember either
+	if(!x)
+		return 0;
 
-	*(fsize) = 0;
+	const isoname_t *e = iso_dir_find_name(x, name, len);
 
-	while(bfr_size)
+	if(e)
 	{
-		direntry_t *entry = (direntry_t *) &b[i];
-		size_t size = (entry->DR_len);
-		char *file = ((char *)&(entry->ident_len) + sizeof(uint8_t));
-
-		dbg_assert(size);
-		
-		if(strlen(file) >= len)
-			if(!strcmp_until(filename, (char *) ((char *)&(entry->ident_len) + sizeof(uint8_t)), len))
-			{
-				*(fsize) = (entry->size);
-				return (entry->lba_extend);
-			}
-
-		bfr_size -= size;
-		i += size;
+		*(fsize) = (e->size);
+		dentry.start = (e->lba);
+		dentry.size = (e->size);
+		dentry.attrib = (e->flags);
 	}
 
-	return 0;
-}
-
-size_t iso_alloc_dir_buffer(size_t dir_size, uint32_t **ret_addr)
-{
-	// first try and allocate the entire size of the dir, since that would make our job easier
-	// otherwise just try and allocate the size of one lba.
-	dir_size += SECTOR_SIZE - (dir_size % SECTOR_SIZE);
+	dcache_add(mount, dir_lba, name, len, e ? &dentry : NULL);
 
-	*(ret_addr) = iso_allocate_bfr(dir_size);
-	
-	// succesfully allocated?
-	if(*(ret_addr))
-		return dir_size;
-
-	*(ret_addr) = iso_allocate_bfr(SECTOR_SIZE);
-
-	return *(ret_addr) ? SECTOR_SIZE : 0;
+	return e ? (e->lba) : 0;
 }
 
 size_t iso_get_dir_size(uint8_t drive, uint32_t dir_lba)
 {
 	direntry_t *dir = (direntry_t *) iso_read_drive(drive, dir_lba, 1);
-		
+
+	// 0 when the directory couldn't be read (gerror tells why)
+	if(!dir)
+		return 0;
+
 	size_t size = (dir->size);
 	iso_free_bfr((uint32_t *) dir);
 
@@ -413,7 +1012,7 @@ size_t iso_get_dir_size(uint8_t drive, uint32_t dir_lba)
 
 static uint8_t check_parent(char *filename, pathtable_t *p)
 {
-	if(strcmp_until(filename, ((char *) p) + sizeof(pathtable_t), strlen(filename)))
+	if(iso_name_cmp(((uint8_t *) p) + sizeof(pathtable_t), (p->ident_len), filename))
 		return EXIT_CODE_GLOBAL_GENERAL_FAIL;
 
 	return EXIT_CODE_GLOBAL_SUCCESS;
@@ -433,9 +1032,15 @@ static uint8_t check_parents(const pathtable_t *child, uint8_t drive, char *path
 	{
 		pathtable_t *t = (pathtable_t *) iso_find_index(drive, (uint16_t) (index - 1));
 
+		if(!t)
+			return 0; // couldn't read the parent, so it doesn't match either
+
 		replace_in_str(parent, ' ', '\0');
 		if(check_parent(parent, t))
+		{
+			iso_free_bfr(t);
 			return 0; // parents do not match
+		}
 		
 		index = t->parent;
 		iso_free_bfr(t);
@@ -443,7 +1048,6 @@ static uint8_t check_parents(const pathtable_t *child, uint8_t drive, char *path
 		parent = strtok(NULL, "/");
 	}
 	
-	iso_free_bfr(p);
 	return 1; // success
 }
 
@@ -511,7 +1115,7 @@ static uint16_t iso_read_path_table_buffer(uint8_t *buffer, char *filename, uint
 		const char *str = (const char *) &buffer[read + sizeof(pathtable_t)];
 
 		// compare string
-		if(!strcmp_until(str, filename, ident_len))
+		if(!iso_name_cmp((const uint8_t *) str, ident_len, filename))
 			return (uint16_t) read;
 		
 		// add amount of bytes read: base entry size, length of the identifier and padding byte 
@@ -534,6 +1138,10 @@ uint32_t *iso_search_in_path_table(uint8_t drive, char *filename, uint8_t reset)
 	while(lba < (info->path_table_size)) // was: (lba * SECTOR_SIZE) < (info->path_table_size)
 	{
 		uint8_t * b = (uint8_t *) iso_read_drive(drive, (info->path_table_lba) + lba, 1);
+
+		if(!b)
+			return NULL;
+
 		loc = iso_read_path_table_buffer(b, filename, loc);
 		
 		if(loc == (uint16_t) MAX)
@@ -596,6 +1204,10 @@ uint32_t *iso_find_index(uint8_t drive, uint16_t index)
 	while(lba < (info->path_table_size)) // was: (lba * SECTOR_SIZE) < (info->path_table_size)
 	{
 		uint8_t * b = (uint8_t *) iso_read_drive(drive, (info->path_table_lba) + lba, 1);
+
+		if(!b)
+			return NULL;
+
 		uint16_t read = iso_count_index(&i, index, b);
 
 		// if we are at the end of the current buffer, update the total
@@ -684,8 +1296,15 @@ uint16_t *iso_read_drive(uint8_t drive, uint32_t lba, uint32_t sctr_read)
 		return NULL;
 	}
 
-	// read the drive
-	read(drive, lba, sctr_read, (uint8_t *) buf);
+	// read the drive, a buffer with half a sector in it is of no use to anyone
+	uint8_t error = read(drive, lba, sctr_read, (uint8_t *) buf);
+
+	if(error)
+	{
+		iso_free_bfr(buf);
+		gerror = error;
+		return NULL;
+	}
 
 	return buf;
 }
@@ -695,6 +1314,14 @@ void iso_read(char * path, uint32_t *drv)
 	size_t fsize = 0;
     uint32_t flba = iso_traverse(path, &fsize);
 
+	if(!flba)
+	{
+		// a read error tells more than 'not found'
+		if(!gerror)
+			gerror = EXIT_CODE_FS_FILE_NOT_FOUND;
+		return;
+	}
+
 	uint32_t nlba = fsize / SECTOR_SIZE + ((fsize % SECTOR_SIZE) != 0);
 	uint8_t drive = (uint8_t) (convert_drive_id((const char *) path) >> DISKIO_DISK_NUMBER);
 
@@ -704,3 +1331,118 @@ void iso_read(char * path, uint32_t *drv)
 	drv[2] = (uint32_t) bfr;
 	drv[3] = fsize;
 }
+
+// returns: a handle for iso_read_at() and iso_close(), 0 if the file couldn't be opened (gerror tells why)
+uint32_t iso_open(char *path, size_t *fsize)
+{
+	uint8_t drive = (uint8_t) (convert_drive_id((const char *) path) >> DISKIO_DISK_NUMBER);
+	uint32_t i;
+
+	*(fsize) = 0;
+
+	if(drive == 0xFF)
+	{
+		gerror = EXIT_CODE_FS_UNSUPPORTED_DRIVE;
+		return 0;
+	}
+
+	for(i = 0; i < ISO_MAX_OPEN; ++i)
+		if(!iso_files[i].used)
+			break;
+
+	if(i == ISO_MAX_OPEN)
+	{
+		gerror = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+		return 0;
+	}
+
+	uint32_t flba = iso_traverse(path, fsize);
+
+	if(!flba)
+	{
+		if(!gerror)
+			gerror = EXIT_CODE_FS_FILE_NOT_FOUND;
+		return 0;
+	}
+
+	iso_files[i].drive = drive;
+	iso_files[i].lba = flba;
+	iso_files[i].size = *(fsize);
+	iso_files[i].used = 1;
+
+	return ISO_HANDLE(i);
+}
+
+// reads *len bytes at offset into buf, *len is set to what was actually read
+uint8_t iso_read_at(uint32_t handle, uint32_t offset, uint8_t *buf, size_t *len)
+{
+	if(!handle || handle > ISO_MAX_OPEN || !iso_files[handle - 1].used)
+		return EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+
+	const isofile_t *f = &iso_files[handle - 1];
+	uint32_t lba = f->lba + offset / SECTOR_SIZE;
+	uint32_t skip = offset % SECTOR_SIZE;
+	size_t left, n;
+	uint8_t error = EXIT_CODE_GLOBAL_SUCCESS;
+	uint8_t *sector = NULL;
+
+	if(offset >= f->size)
+	{
+		*(len) = 0;
+		return EXIT_CODE_GLOBAL_SUCCESS;
+	}
+
+	if(*(len) > f->size - offset)
+		*(len) = f->size - offset;
+
+	left = *(len);
+
+	while(left)
+	{
+		// whole sectors go straight into the caller's buffer, the partial ones at the start
+		// and the end go through a sector of our own
+		if(!skip && left >= SECTOR_SIZE)
+		{
+			n = left / SECTOR_SIZE;
+			error = read(f->drive, lba, n, buf);
+
+			n *= SECTOR_SIZE;
+		}
+		else
+		{
+			if(!sector && !(sector = iso_allocate_bfr(SECTOR_SIZE)))
+				return EXIT_CODE_OUT_OF_MEMORY;
+
+			n = SECTOR_SIZE - skip;
+			n = (n > left) ? left : n;
+
+			if(!(error = read(f->drive, lba, 1, sector)))
+				memcpy((char *) buf, (char *) &sector[skip], n);
+
+			skip = 0;
+		}
+
+		if(error)
+			break;
+
+		lba += (n + SECTOR_SIZE - 1) / SECTOR_SIZE;
+		buf += n;
+		left -= n;
+	}
+
+	iso_free_bfr(sector);
+
+	if(error)
+		*(len) -= left;
+
+	return error;
+}
+
+uint8_t iso_close(uint32_t handle)
+{
+	if(!handle || handle > ISO_MAX_OPEN || !iso_files[handle - 1].used)
+		return EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+
+	iso_files[handle - 1].used = 0;
+	return EXIT_CODE_GLOBAL_SUCCESS;
+}
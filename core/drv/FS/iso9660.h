@@ -27,16 +27,19 @@ SOFTWARE.
 void iso_handler(unsigned int *drv);
 
 void iso_init(unsigned char drive);
-void iso_search_descriptor(unsigned char drive, unsigned char * buffer, unsigned char type);
+unsigned char iso_search_descriptor(unsigned char drive, unsigned char * buffer, unsigned char type);
 void iso_save_pvd_data(unsigned char * pvd);
+void iso_detect_names(unsigned char drive, unsigned char *buffer);
+
+unsigned char iso_index_path_table(unsigned char drive);
+unsigned short iso_dir_count(void);
+void iso_set_path_index(unsigned char enable);
 
 void * iso_allocate_bfr(unsigned int size);
 void iso_free_bfr(void *ptr);
 
 unsigned int iso_traverse(char *path, unsigned int *fsize);
 unsigned int iso_search_dir(unsigned char drive, unsigned int dir_lba, const char *filename, unsigned int *fsize);
-unsigned int iso_search_dir_bfr(unsigned int *bfr, unsigned int bfr_size, const char *filename, unsigned int *fsize);
-unsigned int iso_alloc_dir_buffer(unsigned int dir_size, unsigned int **ret_addr);
 unsigned int iso_get_dir_size(unsigned char drive, unsigned int dir_lba);
 
 unsigned int *iso_search_in_path_table(unsigned char drive, char *filename, unsigned char reset);
@@ -51,4 +54,8 @@ void reverse_path(char *path);
 unsigned short *iso_read_drive(unsigned char drive, unsigned int lba, unsigned int sctr_read);
 void iso_read(char * path, unsigned int *drv);
 
+unsigned int iso_open(char *path, unsigned int *fsize);
+unsigned char iso_read_at(unsigned int handle, unsigned int offset, unsigned char *buf, unsigned int *len);
+unsigned char iso_close(unsigned int handle);
+
 #endif
\ No newline at end of file
@@ -64,4 +64,30 @@ drv[2] (parameter2) --> new filename
 drv[4] (parameter4) --> (returns) error code
 */
 
+#define FS_COMMAND_OPEN 0x13
+/*
+drv[1] (parameter1) --> path
+drv[2] (parameter2) --> (returns) handle, used by the commands below
+drv[3] (parameter3) --> (returns) file size
+drv[4] (parameter4) --> (returns) error code
+*/
+
+#define FS_COMMAND_READ_AT 0x14
+/*
+drv[1] (parameter1) --> handle
+drv[2] (parameter2) --> offset in the file (bytes)
+drv[3] (parameter3) --> number of bytes to read, (returns) number of bytes read (less at the end of the file)
+drv[4] (parameter4) --> buffer, at least drv[3] bytes
+drv[4] (parameter4) --> (returns) error code
+
+only the part of the file that is asked for is read, so a file can be read in pieces that are
+much smaller than the file itself.
+*/
+
+#define FS_COMMAND_CLOSE 0x15
+/*
+drv[1] (parameter1) --> handle
+drv[4] (parameter4) --> (returns) error code
+*/
+
 #endif
@@ -29,9 +29,9 @@ SOFTWARE.
 #include "../../include/exit_code.h"
 #include "../../include/types.h"
 #include "../../dsk/diskdefines.h"
+#include "../../dsk/sglist.h"
 
-#include "../../cpu/interrupts/IDT.h"
-#include "../../hardware/pic.h"
+#include "../../cpu/interrupts/isr.h"
 
 #ifndef NO_DEBUG_INFO
 #include "../../screen/screen_basic.h"
@@ -47,15 +47,27 @@ SOFTWARE.
 
 #include "../../io/io.h"
 
+#include "../../cpu/cpu.h"
+
+#include "../../memory/paging.h"
+#include "../../hardware/timer.h"
+
 #include "../../dbg/dbg.h"
 
 #include "../../util/util.h"
 
 #define IDEController_PCI_CLASS_SUBCLASS    0x101
 
-#define IDE_DRIVER_VERSION_STRING "[IDE_DRIVER] Vireo Internal PIO IDE/ATA Driver Mk. I\n"
+#define IDE_DRIVER_VERSION_STRING "[IDE_DRIVER] Vireo Internal PIO/DMA IDE/ATA Driver Mk. I\n"
 
 #define SECTOR_SIZE         512 // bytes
+#define PAGE_SIZE           4096 // bytes
+#define IDE_MAX_SECTORS     256   /* per LBA28 command, a sector count of 0 means 256 */
+#define IDE_MAX_SECTORS48   65536 /* per LBA48 command, same */
+#define IDE_ATAPI_MAX_SECTORS 1024  /* READ(12) takes 32 bits, but it has to finish within IDE_TIMEOUT */
+#define ATAPI_SECTOR_SIZE   2048  // bytes
+#define ATAPI_BYTE_LIMIT    0xF800 /* largest multiple of ATAPI_SECTOR_SIZE per DRQ block */
+#define IDE_LBA28_MAX       0x0FFFFFFFU
 
 /* defines for ata_info_t */
 #define ATA_INFO_PRIMARY    0x00
@@ -74,62 +86,195 @@ SOFTWARE.
 #define ATA_STAT_DF     0x20
 #define ATA_STAT_BUSY   0x80
 
+#define ATA_CTRL_SRST   0x04    /* device control port, resets both drives of the channel */
+
 #define ATAPI_COMMAND_READ 0xA8
 
 #define ATA_COMMAND_READ    0x20
 #define ATA_COMMAND_WRITE   0x30
+#define ATA_COMMAND_READ_EXT    0x24
+#define ATA_COMMAND_WRITE_EXT   0x34
+
+#define ATA_COMMAND_READ_MULTIPLE       0xC4
+#define ATA_COMMAND_WRITE_MULTIPLE      0xC5
+#define ATA_COMMAND_READ_MULTIPLE_EXT   0x29
+#define ATA_COMMAND_WRITE_MULTIPLE_EXT  0x39
+#define ATA_COMMAND_SET_MULTIPLE        0xC6
+#define ATA_COMMAND_SET_FEATURES        0xEF
+
+/* SET FEATURES subcommands */
+#define ATA_FEATURE_WCACHE_ON       0x02
+#define ATA_FEATURE_TRANSFER_MODE   0x03 /* sector count: IDE_MODE_* | mode */
+#define ATA_FEATURE_LOOKAHEAD_ON    0xAA
 
 #define ATAPI_COMMAND_PACKET 0xA0
 #define ATAPI_COMMAND_READ  0xA8
 
 #define ATA_COMMAND_DMAREAD 0xC8
 #define ATA_COMMAND_DMAWRITE 0xCA
+#define ATA_COMMAND_DMAREAD_EXT  0x25
+#define ATA_COMMAND_DMAWRITE_EXT 0x35
+#define ATA_COMMAND_FLUSH   0xE7
 
 #define ATAPI_IDENTIFY   0xA1
 #define ATA_IDENTIFY     0xEC
 
+/* IDENTIFY (PACKET DEVICE) words */
+#define ATA_IDENT_MULTIPLE  47  /* low byte: max sectors per DRQ block of READ/WRITE MULTIPLE */
+#define ATA_IDENT_CAPS      49  /* bit 8: drive can do DMA */
+#define ATA_IDENT_PIO_OLD   51  /* high byte: PIO mode 0 - 2 */
+#define ATA_IDENT_VALID     53  /* bit 1: words 64 - 70 are valid, bit 2: word 88 is */
+#define ATA_IDENT_SECTORS   60  /* and 61, LBA28 capacity */
+#define ATA_IDENT_MWDMA     63  /* bits 0 - 2: multiword DMA modes supported */
+#define ATA_IDENT_PIO       64  /* bit 0: PIO 3, bit 1: PIO 4 */
+#define ATA_IDENT_CMDSET1   82  /* bit 5: write cache, bit 6: read look-ahead */
+#define ATA_IDENT_CMDSET2   83  /* bit 10: LBA48 */
+#define ATA_IDENT_ENABLED1  85  /* same as ATA_IDENT_CMDSET1 but enabled */
+#define ATA_IDENT_UDMA      88  /* bits 0 - 6: ultra DMA modes supported */
+#define ATA_IDENT_RESET     93  /* bit 13: 80 wire cable */
+#define ATA_IDENT_SECTORS48 100 /* up to 103, LBA48 capacity */
+
+#define ATA_UDMA_40_WIRE    0x07 /* ultra DMA modes above 2 need an 80 wire cable */
+
+/* bus master registers (BAR4), the secondary channel's are at +8 */
+#define BM_PORT_COMMAND     0x00
+#define BM_PORT_STATUS      0x02
+#define BM_PORT_PRDT        0x04
+
+#define BM_CMD_START        0x01
+#define BM_CMD_READ         0x08 /* device to memory */
+
+#define BM_STAT_ACTIVE      0x01
+#define BM_STAT_ERR         0x02
+#define BM_STAT_IRQ         0x04
+
+#define IDE_PRD_EOT         0x8000 /* last entry of the table */
+#define IDE_PRD_MAX         512    /* entries per channel */
+
+/* per DMA command, so that even a buffer of single pages that doesn't start at one fits in the PRD table */
+#define IDE_DMA_MAX_SECTORS ((IDE_PRD_MAX - 1) * (PAGE_SIZE / SECTOR_SIZE))
+
+#define IDE_TIMEOUT         5000   /* ms, for any command */
+
+/* what the request in flight is waiting for (IDE_REQUEST.type) */
+#define IDE_REQ_READ        0x00   /* PIO, an IRQ per sector */
+#define IDE_REQ_WRITE       0x01   /* PIO, an IRQ per sector */
+#define IDE_REQ_FLUSH       0x02   /* all written, the drive is flushing its cache */
+#define IDE_REQ_DMA         0x03   /* one IRQ when all of it has been moved */
+#define IDE_REQ_ATAPI       0x04   /* an IRQ per DRQ block and one at the end */
+
 /* Flags stuff */
 #define IDE_FLAG_INIT_RAN   1 /* used by init to say it did ran and did it's thing */
-#define IDE_FLAG_IRQ        1 << 2
 
 
 typedef struct
 {
     uint8_t type;
-    /* there'll be more here, probably */
+    uint8_t pio;            /* IDE_PIO_16, IDE_PIO_32 only when asked for (or IDE_PIO_LOOP for benchmarks) */
+    uint64_t pio_cycles;    /* timestamp counter cycles spent moving data */
+    uint32_t pio_bytes;     /* bytes moved, since the last IDE_COMMAND_SET_PIO */
+    uint8_t dma_capable;    /* both the drive and the controller can do bus master DMA */
+    uint8_t dma;            /* use DMA (see IDE_COMMAND_SET_DMA) */
+    uint8_t lba48;
+    uint8_t multiple;       /* sectors per DRQ block (READ/WRITE MULTIPLE), 0 if not supported */
+    uint32_t max_sectors;   /* per command */
+    uint64_t sectors;       /* capacity (0 for ATAPI) */
+    uint16_t caps;          /* IDE_CAP_* (the cache ones) */
+    uint8_t max_multiple;
+    uint8_t pio_mode;       /* highest supported */
+    uint8_t mwdma;          /* supported modes, bit n is mode n */
+    uint8_t udma;
+    uint8_t mode;           /* the one in use, IDE_MODE_* | mode */
+    uint32_t requests;      /* the time from sending a command until the drive finished it */
+    uint64_t wait_total;    /* (in microseconds) */
+    uint32_t wait_max;
+    uint32_t wait_last;
 } DRIVE_INFO;
 
+/* a command in flight, IDE_IRQ() moves its data and completes it */
+typedef struct
+{
+    uint8_t drive;
+    uint8_t type;           /* IDE_REQ_* */
+    SG_POS pos;             /* where the next block goes to (or comes from) */
+    uint32_t left;          /* bytes */
+    uint32_t block;         /* bytes per DRQ block (PIO) */
+    volatile uint8_t done;  /* the completion, set by IDE_IRQ() */
+    uint8_t error;
+    uint64_t issued;        /* see IDE_now() */
+    uint64_t finished;
+} IDE_REQUEST;
+
+/* physical region descriptor, the controller walks a table of these during DMA */
+typedef struct
+{
+    uint32_t addr;          /* physical */
+    uint16_t size;          /* bytes, 0 means 64 KiB */
+    uint16_t flags;
+} __attribute__((packed)) IDE_PRD;
+
 /* functions defined here, because it *should* be private to the driver */
 
 void IDEController_handler(uint32_t *drv);
 
-extern void ASM_IDE_IRQ(void);
-
-void IDE_IRQ(void);
+static uint8_t IDE_IRQ(uint8_t channel);
+static uint8_t IDE_IRQ_primary(void);
+static uint8_t IDE_IRQ_secondary(void);
 
 static void IDE_software_reset(uint16_t port);
 static void IDE_wait(void);
 static uint8_t IDE_polling(uint16_t port, bool errTest);
 static uint16_t IDE_getPort(uint8_t drive);
 static uint8_t IDE_getSlavebit(uint8_t drive);
-static void IDEClearFlagBit(uint16_t flag_bit);
 
 static void IDEDriverInit(unsigned int device);
 #ifndef NO_DEBUG_INFO
 static void IDEPrintWelcome(void);
 #endif
 static void IDE_enumerate(void);
-static uint8_t IDE_getDriveType(uint16_t port, uint8_t slavebit);
-
-static uint8_t IDE_readPIO28(uint8_t drive, uint32_t start, uint8_t sctrwrite, uint16_t *buf);
-static uint8_t IDE_writePIO28(uint8_t drive, uint32_t start, uint8_t sctrwrite, uint16_t *buf);
-static uint8_t IDE_readPIO28_atapi(uint8_t drive, uint32_t start, uint8_t sctrwrite, uint16_t *buf);
+static uint8_t IDE_getDriveType(uint16_t port, uint8_t slavebit, uint16_t *ident);
+
+static void IDE_pio_in(uint8_t drive, uint16_t port, uint32_t words, uint16_t *buf);
+static void IDE_pio_out(uint8_t drive, uint16_t port, uint32_t words, uint16_t *buf);
+static void IDE_pio_move(uint8_t drive, uint16_t port, SG_POS *pos, uint32_t bytes, bool write);
+static void IDE_setPIO(uint32_t *drv);
+
+static void IDE_parseIdentify(uint8_t drive, uint16_t *ident);
+static uint8_t IDE_commandPolled(uint8_t drive, uint8_t command, uint8_t feature, uint8_t count);
+static void IDE_setTransferMode(uint8_t drive);
+static void IDE_setCaches(uint8_t drive);
+static void IDE_setMultiple(uint8_t drive);
+static uint8_t IDE_highestMode(uint8_t modes);
+static void IDE_getDriveInfo(uint32_t *drv);
+static bool IDE_selectLBA(uint8_t drive, uint32_t start, uint32_t sctrwrite);
+static uint8_t IDE_transferATA(uint8_t drive, uint32_t start, uint32_t sctrwrite, SG_POS pos, bool write);
+static uint8_t IDE_transferPIO(uint8_t drive, uint32_t start, uint32_t sctrwrite, SG_POS pos, bool write);
+static uint8_t IDE_readATAPI(uint8_t drive, uint32_t start, uint32_t sctrwrite, SG_POS pos);
+
+static uint16_t IDE_getBusMaster(uint8_t drive);
+static uint8_t IDE_preparePRDT(uint8_t drive, SG_POS pos, uint32_t size);
+static uint8_t IDE_transferDMA(uint8_t drive, uint32_t start, uint32_t sctrwrite, SG_POS pos, bool write);
+
+static uint64_t IDE_now(void);
+static void IDE_startRequest(IDE_REQUEST *req, uint8_t drive, uint8_t type, const SG_POS *pos, uint32_t size, uint32_t block);
+static void IDE_finishRequest(uint8_t channel, bool error);
+static uint8_t IDE_requestDone(void *req);
+static uint8_t IDE_waitRequest(IDE_REQUEST *req);
+static void IDE_resetChannel(uint8_t drive);
+static void IDE_getLatency(uint32_t *drv);
 
 static void IDE_reportDrives(uint8_t *drive_list);
 
 DRIVE_INFO drive_info_t[IDE_DRIVER_MAX_DRIVES];
 uint32_t PCI_controller;
 
+/* one table per channel, a page aligned on a page so it never crosses a 64 KiB boundary */
+IDE_PRD ide_prdt[2][IDE_PRD_MAX] __attribute__((aligned(IDE_PRD_MAX * sizeof(IDE_PRD))));
+uint16_t bm_base_port;
+
+/* the request each channel is busy with */
+IDE_REQUEST * volatile ide_request_t[2] = {NULL, NULL};
+
 uint16_t p_base_port;
 uint16_t p_ctrl_port;
 uint16_t s_base_port;
@@ -137,19 +282,27 @@ uint16_t s_ctrl_port;
 
 /* some flag values:
         - bit 0: if set, init executed succesfully
-        - bit 1: IRQ fired
         */
 uint16_t ide_flags = 0;
 
+/* [lba48][write] */
+static const uint8_t ide_command_pio[2][2] = {{ATA_COMMAND_READ, ATA_COMMAND_WRITE}, 
+                                              {ATA_COMMAND_READ_EXT, ATA_COMMAND_WRITE_EXT}};
+static const uint8_t ide_command_multiple[2][2] = {{ATA_COMMAND_READ_MULTIPLE, ATA_COMMAND_WRITE_MULTIPLE}, 
+                                                   {ATA_COMMAND_READ_MULTIPLE_EXT, ATA_COMMAND_WRITE_MULTIPLE_EXT}};
+static const uint8_t ide_command_dma[2][2] = {{ATA_COMMAND_DMAREAD, ATA_COMMAND_DMAWRITE}, 
+                                              {ATA_COMMAND_DMAREAD_EXT, ATA_COMMAND_DMAWRITE_EXT}};
+
 /* the indentifier for drivers + information about our driver */
 struct DRIVER IDE_driver_id = {(uint32_t) 0xB14D05, "VIREODRV", (IDEController_PCI_CLASS_SUBCLASS | DRIVER_TYPE_PCI), (uint32_t) (IDEController_handler)};
 
 // FIXME remove static declarations/prototypes and put all functions in .h
-// FIXME check in read/write functions if sctrwrite is not too big of a value (creates fault)
 
 void IDEController_handler(uint32_t *drv)
 {
     uint8_t error = 0;
+    SG_ENTRY whole;
+    SG_POS pos;
 
     /* To make sure that we don't do anything stupid, we check if INIT is either being called NOW
 or has executed succesfully in the past */
@@ -163,26 +316,92 @@ or has executed succesfully in the past */
         break;
 
         case IDE_COMMAND_READ:
+            sg_from_command(&pos, &whole, drv);
+
+            if(drv[1] >= IDE_DRIVER_MAX_DRIVES || !drv[3] || drv[3] > drive_info_t[drv[1]].max_sectors)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
             if(drive_info_t[drv[1]].type == DRIVE_TYPE_IDE_PATA)
-                error = IDE_readPIO28((uint8_t) drv[1], drv[2], (uint8_t) drv[3], (uint16_t *) drv[4]);
+                error = IDE_transferATA((uint8_t) drv[1], drv[2], drv[3], pos, false);
             if(drive_info_t[drv[1]].type == DRIVE_TYPE_IDE_PATAPI)
-                error = IDE_readPIO28_atapi((uint8_t) drv[1], drv[2], (uint8_t) drv[3], (uint16_t *) drv[4]);
+                error = IDE_readATAPI((uint8_t) drv[1], drv[2], drv[3], pos);
         break;
 
         case IDE_COMMAND_WRITE:
+            sg_from_command(&pos, &whole, drv);
+
+            if(drv[1] >= IDE_DRIVER_MAX_DRIVES || !drv[3] || drv[3] > drive_info_t[drv[1]].max_sectors)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
             if(drive_info_t[drv[1]].type != DRIVE_TYPE_IDE_PATA)
             {
                 error = EXIT_CODE_GLOBAL_GENERAL_FAIL;
                 break;
             }
 
-            IDE_writePIO28((uint8_t) drv[1], drv[2], (uint8_t) drv[3], (uint16_t *) drv[4]);
+            error = IDE_transferATA((uint8_t) drv[1], drv[2], drv[3], pos, true);
         break;
 
         case IDE_COMMAND_REPORTDRIVES:
             IDE_reportDrives((uint8_t *) *(&drv[1]));
         break;
 
+        case IDE_COMMAND_SET_PIO:
+            if(drv[1] >= IDE_DRIVER_MAX_DRIVES || drv[2] > IDE_PIO_32)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            IDE_setPIO(drv);
+        break;
+
+        case IDE_COMMAND_SET_DMA:
+            if(drv[1] >= IDE_DRIVER_MAX_DRIVES || (drv[2] && !drive_info_t[drv[1]].dma_capable))
+            {
+                error = EXIT_CODE_GLOBAL_UNSUPPORTED;
+                break;
+            }
+
+            drive_info_t[drv[1]].dma = (uint8_t) (drv[2] != 0);
+        break;
+
+        case IDE_COMMAND_GET_MAX_SECTORS:
+            if(drv[1] >= IDE_DRIVER_MAX_DRIVES)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            drv[2] = drive_info_t[drv[1]].max_sectors;
+        break;
+
+        case IDE_COMMAND_GET_DRIVE_INFO:
+            if(drv[1] >= IDE_DRIVER_MAX_DRIVES)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            IDE_getDriveInfo(drv);
+        break;
+
+        case IDE_COMMAND_GET_LATENCY:
+            if(drv[1] >= IDE_DRIVER_MAX_DRIVES)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            IDE_getLatency(drv);
+        break;
+
         default:
             error = EXIT_CODE_GLOBAL_UNSUPPORTED;
         break;
@@ -197,12 +416,135 @@ or has executed succesfully in the past */
     
 }
 
-// ISR
-void IDE_IRQ(void)
+// ISR, channel: 0 (primary) or 1 (secondary). returns: 1 if the interrupt was for the request on the channel
+static uint8_t IDE_IRQ(uint8_t channel)
+{
+    IDE_REQUEST *req = ide_request_t[channel];
+    uint16_t port = channel ? s_base_port : p_base_port;
+    uint16_t bm = channel ? (uint16_t) (bm_base_port + 8) : bm_base_port;
+    uint8_t status, bm_status;
+    uint32_t size, words;
+    bool write;
+
+    /* reading the status also acknowledges the interrupt at the drive */
+    status = (uint8_t) inb(port | ATA_PORT_COMSTAT);
+
+    if(!req)
+        return 0;
+
+    switch(req->type)
+    {
+        case IDE_REQ_DMA:
+            bm_status = (uint8_t) inb(bm | BM_PORT_STATUS);
+
+            /* not from the transfer */
+            if(!(bm_status & BM_STAT_IRQ))
+                return 0;
+
+            write = !(inb(bm | BM_PORT_COMMAND) & BM_CMD_READ);
+
+            outb(bm | BM_PORT_COMMAND, 0);
+            outb(bm | BM_PORT_STATUS, (uint8_t) (bm_status | BM_STAT_ERR | BM_STAT_IRQ));
+
+            if((bm_status & BM_STAT_ERR) || (status & (ATA_STAT_ERR | ATA_STAT_DF)))
+                IDE_finishRequest(channel, true);
+            else if(write)
+            {
+                /* same as PIO, flush the drive's cache before calling it done */
+                req->type = IDE_REQ_FLUSH;
+                outb(port | ATA_PORT_COMSTAT, ATA_COMMAND_FLUSH);
+            }
+            else
+                IDE_finishRequest(channel, false);
+        break;
+
+        case IDE_REQ_FLUSH:
+            /* older drives don't know about flushing, they're done anyway */
+            IDE_finishRequest(channel, (status & ATA_STAT_DF) != 0);
+        break;
+
+        case IDE_REQ_READ:
+            if(status & (ATA_STAT_ERR | ATA_STAT_DF))
+            {
+                IDE_finishRequest(channel, true);
+                break;
+            }
+
+            if(status & ATA_STAT_DRQ)
+            {
+                words = ((req->block > req->left) ? req->left : req->block) / sizeof(uint16_t);
+
+                IDE_pio_move(req->drive, port, &req->pos, words * sizeof(uint16_t), false);
+                req->left -= words * sizeof(uint16_t);
+            }
+
+            /* there's no IRQ after the last block */
+            if(!req->left)
+                IDE_finishRequest(channel, false);
+        break;
+
+        case IDE_REQ_WRITE:
+            if(status & (ATA_STAT_ERR | ATA_STAT_DF))
+            {
+                IDE_finishRequest(channel, true);
+                break;
+            }
+
+            if(req->left && (status & ATA_STAT_DRQ))
+            {
+                words = ((req->block > req->left) ? req->left : req->block) / sizeof(uint16_t);
+
+                IDE_pio_move(req->drive, port, &req->pos, words * sizeof(uint16_t), true);
+                req->left -= words * sizeof(uint16_t);
+            }
+            else if(!req->left)
+            {
+                /* everything is in the drive's cache, make sure it ends up on the disk */
+                req->type = IDE_REQ_FLUSH;
+                outb(port | ATA_PORT_COMSTAT, ATA_COMMAND_FLUSH);
+            }
+        break;
+
+        case IDE_REQ_ATAPI:
+            if(status & (ATA_STAT_ERR | ATA_STAT_DF))
+            {
+                IDE_finishRequest(channel, true);
+                break;
+            }
+
+            /* DRQ clear means the command is done */
+            if(!(status & ATA_STAT_DRQ))
+            {
+                IDE_finishRequest(channel, req->left != 0);
+                break;
+            }
+
+            size = (uint32_t) (inb(port | ATA_PORT_LBAHI)<<8U) | inb(port | ATA_PORT_LBAMID);
+            words = ((size > req->left) ? req->left : size) / sizeof(uint16_t);
+
+            IDE_pio_move(req->drive, port, &req->pos, words * sizeof(uint16_t), false);
+            req->left -= words * sizeof(uint16_t);
+
+            /* the drive won't continue until we took all of it */
+            for(size = size - words * sizeof(uint16_t); size > 1; size -= sizeof(uint16_t))
+                inw(port);
+        break;
+
+        default:
+        break;
+    }
+
+    return 1;
+}
+
+static uint8_t IDE_IRQ_primary(void)
 {
-    ide_flags = ide_flags | IDE_FLAG_IRQ;
+    return IDE_IRQ(0);
+}
 
-    PIC_EOI(0x0F);
+static uint8_t IDE_IRQ_secondary(void)
+{
+    return IDE_IRQ(1);
 }
 
 static void IDE_software_reset(uint16_t port){
@@ -258,15 +600,11 @@ static uint8_t IDE_getSlavebit(uint8_t drive)
     return (drive % 2) ? (uint8_t) 1 : 0;
 }
 
-static void IDEClearFlagBit(uint16_t flag_bit)
-{
-    ide_flags = ide_flags & (uint16_t)~(flag_bit);
-}
-
 static void IDEDriverInit(uint32_t device)
 {
     uint8_t drive, slavebit;
     uint16_t port;
+    uint16_t *ident = kmalloc(256 * sizeof(uint16_t));
 
     PCI_controller = device & (uint32_t)~(DRIVER_TYPE_PCI);
 
@@ -277,14 +615,20 @@ static void IDEDriverInit(uint32_t device)
 
     /* get the ports for both primary and secondary */
     IDE_enumerate();
+
+    if(bm_base_port)
+        pciEnableBusMaster(PCI_controller);
     
 
     IDE_software_reset(p_ctrl_port);
     IDE_software_reset(s_ctrl_port);
 
-    /* register our IRQ handler */
-    IDT_add_handler(0x2E, (uint32_t) ASM_IDE_IRQ);
-    IDT_add_handler(0x2F, (uint32_t) ASM_IDE_IRQ);
+    /* register our IRQ handlers, a PCI device may end up on the same lines */
+    ISR_add_irq_handler(14, IDE_IRQ_primary);
+    ISR_add_irq_handler(15, IDE_IRQ_secondary);
+
+    /* measure it now, IDE_now() is also used by the IRQ handler */
+    CPU_tsc_per_us();
 
     /* disable IRQs */
     outb((uint32_t) p_ctrl_port, 2);
@@ -296,9 +640,21 @@ static void IDEDriverInit(uint32_t device)
         port = IDE_getPort(drive);
         slavebit = IDE_getSlavebit(drive);
 
-        drive_info_t[drive].type = IDE_getDriveType(port, slavebit);
+        memset((char *) ident, 256 * sizeof(uint16_t), 0);
+        drive_info_t[drive].type = IDE_getDriveType(port, slavebit, ident);
+
+        if(drive_info_t[drive].type == DRIVE_TYPE_UNKNOWN)
+            continue;
+
+        IDE_parseIdentify(drive, ident);
+
+        IDE_setTransferMode(drive);
+        IDE_setCaches(drive);
+        IDE_setMultiple(drive);
     }
 
+    kfree(ident);
+
     outb((uint32_t) p_ctrl_port, 0);
     outb((uint32_t) s_ctrl_port, 0);
 
@@ -313,6 +669,9 @@ static void IDEDriverInit(uint32_t device)
 #ifndef NO_DEBUG_INFO
 static void IDEPrintWelcome(void)
 {
+    DRIVE_INFO *info;
+    uint8_t drive;
+
     print( IDE_DRIVER_VERSION_STRING);
     print_value( "[IDE_DRIVER] Kernel reported PCI controller %x\n", PCI_controller);
 
@@ -320,6 +679,27 @@ static void IDEPrintWelcome(void)
     print_value( "[IDE_DRIVER] Secondary base port: %x\n", s_base_port);
     print_value( "[IDE_DRIVER] Primary control port: %x\n", p_ctrl_port);
     print_value( "[IDE_DRIVER] Secondary control port: %x\n", s_ctrl_port);
+    print_value( "[IDE_DRIVER] Bus master port: %x\n", bm_base_port);
+
+    for(drive = 0; drive < IDE_DRIVER_MAX_DRIVES; ++drive)
+    {
+        info = &drive_info_t[drive];
+
+        if(info->type == DRIVE_TYPE_UNKNOWN)
+            continue;
+
+        print_value( "[IDE_DRIVER] Drive %i: ", drive);
+        print( (info->type == DRIVE_TYPE_IDE_PATA) ? "PATA, " : "PATAPI, ");
+
+        if(info->type == DRIVE_TYPE_IDE_PATA)
+            print_value( "%i MiB, ", (uint32_t) (info->sectors / 2048));
+
+        print( (info->mode & IDE_MODE_UDMA) ? "UDMA" : (info->mode & IDE_MODE_MWDMA) ? "MWDMA" : "PIO");
+        print_value( " %i", info->mode & 0x07);
+        print( (info->caps & IDE_CAP_WRITE_CACHE_ON) ? ", write cache" : "");
+        print( (info->caps & IDE_CAP_LOOKAHEAD_ON) ? ", look-ahead" : "");
+        print( "\n");
+    }
 
     print( "\n");
 
@@ -344,12 +724,16 @@ static void IDE_enumerate(void)
     bar = pciGetBar(PCI_controller, PCI_BAR3) & 0xFFFFFFFC;
     s_ctrl_port = (uint16_t) (bar + 0x376U*(!bar)) & 0xFFFFU;
 
+    /* bus mastering, only if the controller has it (and it's in I/O space) */
+    bar = pciGetBar(PCI_controller, PCI_BAR4);
+    bm_base_port = (bar & 1U) ? (uint16_t) (bar & 0xFFFC) : 0;
+
 }
 
-static uint8_t IDE_getDriveType(uint16_t port, uint8_t slavebit)
+/* ident: 256 words, filled with the IDENTIFY (PACKET DEVICE) data */
+static uint8_t IDE_getDriveType(uint16_t port, uint8_t slavebit, uint16_t *ident)
 {
     uint16_t status = 0;
-    uint16_t *buffer;
     uint16_t lo, hi;
     uint8_t type = DRIVE_TYPE_IDE_PATA;
 
@@ -373,10 +757,9 @@ static uint8_t IDE_getDriveType(uint16_t port, uint8_t slavebit)
         return DRIVE_TYPE_UNKNOWN;
 
 
-    /* send the IDENTIFY command in case of PATA (not connected is also hi == lo == 0) */
-    if(type == DRIVE_TYPE_IDE_PATA) outb((uint32_t) port_comstat, ATA_IDENTIFY);
-    else if(type == DRIVE_TYPE_IDE_PATAPI)
-        return type;
+    /* send the IDENTIFY command in case of PATA (not connected is also hi == lo == 0), 
+       ATAPI drives have their own */
+    outb((uint32_t) port_comstat, (type == DRIVE_TYPE_IDE_PATA) ? ATA_IDENTIFY : ATAPI_IDENTIFY);
 
     /* if status = 0 then there's no such device */
     if(!inb(port_comstat))
@@ -393,121 +776,279 @@ static uint8_t IDE_getDriveType(uint16_t port, uint8_t slavebit)
         if(status & 0x08) break;
     }
 
-    /* right now we discard the info returned by the device, though it may be useful to not discard this in the future */
-    buffer = kmalloc(256 * sizeof(uint16_t));
+    if(!(status & 0x01))
+        insw(port, 256, ident);
+
+    return type;
+}
+
+/* keeps what the driver (and IDE_COMMAND_GET_DRIVE_INFO) needs of the IDENTIFY data */
+static void IDE_parseIdentify(uint8_t drive, uint16_t *ident)
+{
+    DRIVE_INFO *info = &drive_info_t[drive];
+    bool pata = (info->type == DRIVE_TYPE_IDE_PATA);
+    bool dma = (ident[ATA_IDENT_CAPS] & (1U << 8)) != 0;
+
+    info->lba48 = (uint8_t) (pata && (ident[ATA_IDENT_CMDSET2] & (1U << 10)));
+    /* word 48 bit 0 used to say 32-bit PIO works, it's obsolete (trusted computing in ATA8) and 32-bit I/O
+       is up to the controller anyway. rep insd is only used when someone asks for it (IDE_COMMAND_SET_PIO) */
+    info->pio = IDE_PIO_16;
+    info->max_multiple = (uint8_t) (pata ? ident[ATA_IDENT_MULTIPLE] & 0xFF : 0);
+
+    if(info->lba48)
+        info->sectors = ((uint64_t) ident[ATA_IDENT_SECTORS48 + 3] << 48) | ((uint64_t) ident[ATA_IDENT_SECTORS48 + 2] << 32) 
+                        | ((uint64_t) ident[ATA_IDENT_SECTORS48 + 1] << 16) | ident[ATA_IDENT_SECTORS48];
+    else
+        info->sectors = pata ? ((uint32_t) ident[ATA_IDENT_SECTORS + 1] << 16) | ident[ATA_IDENT_SECTORS] : 0;
+
+    info->max_sectors = info->lba48 ? IDE_MAX_SECTORS48 : IDE_MAX_SECTORS;
+    if(!pata)
+        info->max_sectors = IDE_ATAPI_MAX_SECTORS;
+
+    /* PIO 3 and 4 are in word 64, older drives only have word 51 */
+    if(ident[ATA_IDENT_VALID] & 2U)
+        info->pio_mode = (ident[ATA_IDENT_PIO] & 2U) ? 4 : (ident[ATA_IDENT_PIO] & 1U) ? 3 : 2;
+    else
+        info->pio_mode = (uint8_t) (((ident[ATA_IDENT_PIO_OLD] >> 8) > 2) ? 2 : (ident[ATA_IDENT_PIO_OLD] >> 8));
+
+    info->mwdma = (uint8_t) (dma ? ident[ATA_IDENT_MWDMA] & 0x07 : 0);
+    info->udma = (uint8_t) ((dma && (ident[ATA_IDENT_VALID] & 4U)) ? ident[ATA_IDENT_UDMA] & 0x7F : 0);
+
+    if(!(ident[ATA_IDENT_RESET] & (1U << 13)))
+        info->udma = info->udma & ATA_UDMA_40_WIRE;
+
+    /* the command set words are 0 or 0xFFFF when they're not there */
+    info->caps = 0;
+    if(ident[ATA_IDENT_CMDSET1] && ident[ATA_IDENT_CMDSET1] != 0xFFFF)
+    {
+        info->caps |= (ident[ATA_IDENT_CMDSET1] & (1U << 5)) ? IDE_CAP_WRITE_CACHE : 0;
+        info->caps |= (ident[ATA_IDENT_CMDSET1] & (1U << 6)) ? IDE_CAP_LOOKAHEAD : 0;
+        info->caps |= (ident[ATA_IDENT_ENABLED1] & (1U << 5)) ? IDE_CAP_WRITE_CACHE_ON : 0;
+        info->caps |= (ident[ATA_IDENT_ENABLED1] & (1U << 6)) ? IDE_CAP_LOOKAHEAD_ON : 0;
+    }
+
+    /* ATAPI transfers are PIO only (for now) */
+    info->dma_capable = (uint8_t) (bm_base_port && pata && dma);
+}
+
+/* for commands without data while IRQs are still off (init)
+   returns: EXIT_CODE_GLOBAL_GENERAL_FAIL if the drive didn't accept the command */
+static uint8_t IDE_commandPolled(uint8_t drive, uint8_t command, uint8_t feature, uint8_t count)
+{
+    uint16_t port = IDE_getPort(drive);
 
-    insw(port, 255, buffer);
+    outb(port | ATA_PORT_SELECT, ((uint8_t)0xA0U) | ((uint8_t)(IDE_getSlavebit(drive) << 4U)));
+    IDE_wait();
 
-    kfree(buffer);
+    outb(port | ATA_PORT_FEATURES, feature);
+    outb(port | ATA_PORT_SCTRCNT, count);
+    outb(port | ATA_PORT_COMSTAT, command);
 
-    return type;
+    IDE_polling(port, false);
+
+    if(inb(port | ATA_PORT_COMSTAT) & (ATA_STAT_ERR | ATA_STAT_DF))
+        return EXIT_CODE_GLOBAL_GENERAL_FAIL;
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* the fastest mode both the drive and the driver can do: ultra DMA, multiword DMA and PIO (in that order) */
+static void IDE_setTransferMode(uint8_t drive)
+{
+    DRIVE_INFO *info = &drive_info_t[drive];
+    uint8_t pio = (uint8_t) (IDE_MODE_PIO | info->pio_mode);
+    uint8_t mode = pio;
+
+    if(info->dma_capable && info->udma)
+        mode = (uint8_t) (IDE_MODE_UDMA | IDE_highestMode(info->udma));
+    else if(info->dma_capable && info->mwdma)
+        mode = (uint8_t) (IDE_MODE_MWDMA | IDE_highestMode(info->mwdma));
+
+    if(IDE_commandPolled(drive, ATA_COMMAND_SET_FEATURES, ATA_FEATURE_TRANSFER_MODE, mode) && mode != pio)
+    {
+        mode = pio;
+        IDE_commandPolled(drive, ATA_COMMAND_SET_FEATURES, ATA_FEATURE_TRANSFER_MODE, mode);
+    }
+
+    info->mode = mode;
+    info->dma_capable = (uint8_t) ((mode & (IDE_MODE_UDMA | IDE_MODE_MWDMA)) != 0);
+    info->dma = info->dma_capable;
+}
+
+/* writes are followed by a cache flush, so the write cache is safe to turn on */
+static void IDE_setCaches(uint8_t drive)
+{
+    DRIVE_INFO *info = &drive_info_t[drive];
+
+    if((info->caps & IDE_CAP_WRITE_CACHE) && !(info->caps & IDE_CAP_WRITE_CACHE_ON)
+        && !IDE_commandPolled(drive, ATA_COMMAND_SET_FEATURES, ATA_FEATURE_WCACHE_ON, 0))
+        info->caps |= IDE_CAP_WRITE_CACHE_ON;
+
+    if((info->caps & IDE_CAP_LOOKAHEAD) && !(info->caps & IDE_CAP_LOOKAHEAD_ON)
+        && !IDE_commandPolled(drive, ATA_COMMAND_SET_FEATURES, ATA_FEATURE_LOOKAHEAD_ON, 0))
+        info->caps |= IDE_CAP_LOOKAHEAD_ON;
+}
+
+/* READ/WRITE MULTIPLE cut the number of IRQs per command, use the biggest block the drive can do */
+static void IDE_setMultiple(uint8_t drive)
+{
+    DRIVE_INFO *info = &drive_info_t[drive];
+
+    info->multiple = 0;
+
+    if(info->type != DRIVE_TYPE_IDE_PATA || info->max_multiple < 2)
+        return;
+
+    if(!IDE_commandPolled(drive, ATA_COMMAND_SET_MULTIPLE, 0, info->max_multiple))
+        info->multiple = info->max_multiple;
+}
+
+/* returns: the number of the highest bit set in modes */
+static uint8_t IDE_highestMode(uint8_t modes)
+{
+    uint8_t mode = 0;
+
+    while(modes >>= 1)
+        mode++;
+
+    return mode;
 }
 
-static uint8_t IDE_readPIO28(uint8_t drive, uint32_t start, uint8_t sctrwrite, uint16_t *buf)
+/* returns: true if the command has to be an LBA48 one
+   sctrwrite: 1 - max_sectors of the drive */
+static bool IDE_selectLBA(uint8_t drive, uint32_t start, uint32_t sctrwrite)
 {
-    uint8_t i = 0;
     uint16_t port = IDE_getPort(drive);
     uint8_t slavebit = IDE_getSlavebit(drive);
-    uint16_t *buf_ptr = buf;
-    
-    if(drive > 3)
-        return EXIT_CODE_IDE_ERROR_READING_DRIVE;
-    if(drive_info_t[drive].type != DRIVE_TYPE_IDE_PATA)
-        return EXIT_CODE_IDE_ERROR_READING_DRIVE;
 
-    outb(port | ATA_PORT_SELECT,  ((uint8_t)0xE0U) | ((uint8_t)(slavebit << 4U)) | ((((uint8_t)start >> 24U)) & 0x0F));
+    /* LBA28 needs fewer port writes, only use LBA48 when we have to */
+    if(!drive_info_t[drive].lba48 || (sctrwrite <= IDE_MAX_SECTORS && start + sctrwrite - 1 <= IDE_LBA28_MAX))
+    {
+        outb(port | ATA_PORT_SELECT,  ((uint8_t)0xE0U) | ((uint8_t)(slavebit << 4U)) | ((uint8_t) (start >> 24U) & 0x0F));
+
+        outb(port | ATA_PORT_FEATURES, 0U);
+        outb(port | ATA_PORT_SCTRCNT, (uint8_t) sctrwrite);
+
+        start = start & IDE_LBA28_MAX;
 
-    outb(port | ATA_PORT_FEATURES, 0U); /* no DMA */
-    outb(port | ATA_PORT_SCTRCNT, sctrwrite);
+        outb(port | ATA_PORT_LBALOW, (uint8_t) start);
+        outb(port | ATA_PORT_LBAMID, (uint8_t) (start >> 8U));
+        outb(port | ATA_PORT_LBAHI, (uint8_t) (start >> 16U));
 
-    start = start & 0x0FFFFFFFU;
+        return false;
+    }
 
+    outb(port | ATA_PORT_SELECT, ((uint8_t)0x40U) | ((uint8_t)(slavebit << 4U)));
+
+    /* the high bytes go first, LBA bits 32-47 are always zero for us */
+    outb(port | ATA_PORT_FEATURES, 0U);
+    outb(port | ATA_PORT_SCTRCNT, (uint8_t) (sctrwrite >> 8U));
+    outb(port | ATA_PORT_LBALOW, (uint8_t) (start >> 24U));
+    outb(port | ATA_PORT_LBAMID, 0U);
+    outb(port | ATA_PORT_LBAHI, 0U);
+
+    outb(port | ATA_PORT_FEATURES, 0U);
+    outb(port | ATA_PORT_SCTRCNT, (uint8_t) sctrwrite);
     outb(port | ATA_PORT_LBALOW, (uint8_t) start);
     outb(port | ATA_PORT_LBAMID, (uint8_t) (start >> 8U));
     outb(port | ATA_PORT_LBAHI, (uint8_t) (start >> 16U));
 
-    outb(port | ATA_PORT_COMSTAT, ATA_COMMAND_READ);
+    return true;
+}
 
-    if(IDE_polling(port, false))
-        return EXIT_CODE_IDE_ERROR_READING_DRIVE;
+/* sctrwrite: 1 - max_sectors of the drive, DMA transfers are split up to fit the PRD table */
+static uint8_t IDE_transferATA(uint8_t drive, uint32_t start, uint32_t sctrwrite, SG_POS pos, bool write)
+{
+    uint32_t n;
+    uint8_t error;
 
-    for(i = 0; i < sctrwrite; ++i)
+    if(!drive_info_t[drive].dma)
+        return IDE_transferPIO(drive, start, sctrwrite, pos, write);
+
+    while(sctrwrite)
     {
-        insw(port, 256, buf_ptr);
-        while(!(inb(port |ATA_PORT_COMSTAT) & 0x40));
+        n = (sctrwrite > IDE_DMA_MAX_SECTORS) ? IDE_DMA_MAX_SECTORS : sctrwrite;
+
+        if((error = IDE_transferDMA(drive, start, n, pos, write)))
+            return error;
 
-        buf_ptr += SECTOR_SIZE;
+        start = start + n;
+        sctrwrite = sctrwrite - n;
+        sg_advance(&pos, n * SECTOR_SIZE);
     }
 
     return EXIT_CODE_GLOBAL_SUCCESS;
 }
 
-static uint8_t IDE_writePIO28(uint8_t drive, uint32_t start, uint8_t sctrwrite, uint16_t *buf)
+static uint8_t IDE_transferPIO(uint8_t drive, uint32_t start, uint32_t sctrwrite, SG_POS pos, bool write)
 {
-    uint8_t i = 0;
+    IDE_REQUEST req;
+    SG_POS rest;
     uint16_t port = IDE_getPort(drive);
-    uint8_t slavebit = IDE_getSlavebit(drive);
-    uint16_t *buf_ptr = buf;
-
+    uint8_t multiple = drive_info_t[drive].multiple;
+    uint32_t block = (multiple ? multiple : 1U) * SECTOR_SIZE;
+    uint32_t size = sctrwrite * SECTOR_SIZE;
+    bool lba48;
+    
     if(drive > 3)
         return EXIT_CODE_IDE_ERROR_READING_DRIVE;
     if(drive_info_t[drive].type != DRIVE_TYPE_IDE_PATA)
         return EXIT_CODE_IDE_ERROR_READING_DRIVE;
 
-    outb(port | ATA_PORT_SELECT,  ((uint8_t)0xE0U) | ((uint8_t)(slavebit << 4U)) | ((((uint8_t)start >> 24U)) & 0x0F));
+    lba48 = IDE_selectLBA(drive, start, sctrwrite);
 
-    outb(port | ATA_PORT_FEATURES, 0U); /* no DMA */
-    outb(port | ATA_PORT_SCTRCNT, sctrwrite);
+    if(!write)
+    {
+        IDE_startRequest(&req, drive, IDE_REQ_READ, &pos, size, block);
+        outb(port | ATA_PORT_COMSTAT, multiple ? ide_command_multiple[lba48][write] : ide_command_pio[lba48][write]);
 
-    start = start & 0x0FFFFFFFU;
+        return IDE_waitRequest(&req);
+    }
 
-    outb(port | ATA_PORT_LBALOW, (uint8_t) start);
-    outb(port | ATA_PORT_LBAMID, (uint8_t) (start >> 8U));
-    outb(port | ATA_PORT_LBAHI, (uint8_t) (start >> 16U));
+    outb(port | ATA_PORT_COMSTAT, multiple ? ide_command_multiple[lba48][write] : ide_command_pio[lba48][write]);
 
-    outb(port | ATA_PORT_COMSTAT, ATA_COMMAND_WRITE);
-    IDE_wait();
+    /* the drive doesn't raise an IRQ for the first block, it just waits for it */
+    if(IDE_polling(port, true))
+        return EXIT_CODE_IDE_ERROR_READING_DRIVE;
 
-    while(!(inb(port |ATA_PORT_COMSTAT) & 0x40));
+    block = (block > size) ? size : block;
 
-    for(i = 0; i < sctrwrite; ++i)
-    {
-        outsw(port, 256, buf_ptr);
-        while(!(inb(port |ATA_PORT_COMSTAT) & 0x40));
+    /* the IRQ handler takes over after the first block */
+    rest = pos;
+    sg_advance(&rest, block);
 
-        buf_ptr += SECTOR_SIZE;
-    }
+    IDE_startRequest(&req, drive, IDE_REQ_WRITE, &rest, size - block, block);
+    IDE_pio_move(drive, port, &pos, block, true);
 
-    outb(port | ATA_PORT_COMSTAT, ATA_COMMAND_WRITE);
-
-    return EXIT_CODE_GLOBAL_SUCCESS;
+    return IDE_waitRequest(&req);
 }
 
-static uint8_t IDE_readPIO28_atapi(uint8_t drive, uint32_t start, uint8_t sctrwrite, uint16_t *buf)
+/* READ(12) of sctrwrite 2048 byte sectors, the drive decides how much it hands over per DRQ block
+   (up to ATAPI_BYTE_LIMIT) and IDE_IRQ() keeps taking blocks until it's done */
+static uint8_t IDE_readATAPI(uint8_t drive, uint32_t start, uint32_t sctrwrite, SG_POS pos)
 {
+    IDE_REQUEST req;
     uint8_t read_command[12] = {ATAPI_COMMAND_READ,0,0,0,0,0,0,0,0,0,0};
-    uint16_t byteCount = (uint16_t) 2048U;
     uint16_t port = IDE_getPort(drive);
     uint8_t slavebit = IDE_getSlavebit(drive);
     uint8_t status;
-    uint32_t size, i;
 
     if(drive > 3)
         return EXIT_CODE_IDE_ERROR_READING_DRIVE;
     if(drive_info_t[drive].type != DRIVE_TYPE_IDE_PATAPI)
         return EXIT_CODE_IDE_ERROR_READING_DRIVE;
 
-    IDEClearFlagBit(IDE_FLAG_IRQ);
-
-    outb(port | ATA_PORT_SELECT,  ((uint8_t)0xE0U) | ((uint8_t)(slavebit << 4U)) | ((((uint8_t)start >> 24U)) & 0x0F));
+    /* the lba goes in the packet, not in the task file */
+    outb(port | ATA_PORT_SELECT,  ((uint8_t)0xA0U) | ((uint8_t)(slavebit << 4U)));
     IDE_wait();
 
     outb(port | ATA_PORT_FEATURES, 0U);
-    outb(port | ATA_PORT_LBAMID, (uint8_t) (2048 & 0xFF));
-    outb(port | ATA_PORT_LBAHI, (uint8_t) (2048 >> 8U));
+    outb(port | ATA_PORT_LBAMID, (uint8_t) (ATAPI_BYTE_LIMIT & 0xFF));
+    outb(port | ATA_PORT_LBAHI, (uint8_t) (ATAPI_BYTE_LIMIT >> 8U));
 
     outb(port | ATA_PORT_COMSTAT, ATAPI_COMMAND_PACKET);
   
+    /* waiting for the drive to ask for the packet is short */
     while(inb(port | ATA_PORT_COMSTAT) & 0x80) __asm__ __volatile__("pause");
     while(!(status = inb(port | ATA_PORT_COMSTAT) & 0x08) && !(status & 0x1)) 
         __asm__ __volatile__("pause");
@@ -520,25 +1061,16 @@ static uint8_t IDE_readPIO28_atapi(uint8_t drive, uint32_t start, uint8_t sctrwr
     read_command[3] = (uint8_t) (start >> 0x10) & 0xFF;
     read_command[4] = (uint8_t) (start >> 0x08) & 0xFF;
     read_command[5] = (uint8_t) (start >> 0x00) & 0xFF;
-    read_command[9] = (uint8_t) sctrwrite;
+    read_command[6] = (uint8_t) (sctrwrite >> 0x18) & 0xFF;
+    read_command[7] = (uint8_t) (sctrwrite >> 0x10) & 0xFF;
+    read_command[8] = (uint8_t) (sctrwrite >> 0x08) & 0xFF;
+    read_command[9] = (uint8_t) (sctrwrite >> 0x00) & 0xFF;
 
+    /* the data phase is up to the IRQ handler */
+    IDE_startRequest(&req, drive, IDE_REQ_ATAPI, &pos, sctrwrite * ATAPI_SECTOR_SIZE, ATAPI_BYTE_LIMIT);
     outsw(port, 6, (uint16_t *) &read_command);
-    
-    while(!(ide_flags & IDE_FLAG_IRQ))
-        __asm__ __volatile__("pause");
-    IDEClearFlagBit(IDE_FLAG_IRQ);
-
-    size = (uint32_t) (inb(port | ATA_PORT_LBAHI)<<8U) | inb(port | ATA_PORT_LBAMID);
-    dbg_assert(size == byteCount);
-
-    insw(port, (sctrwrite * byteCount) / sizeof(uint16_t), buf);
-
-    /* wait for second IRQ or timeout */
-    while(inb(port | ATA_PORT_COMSTAT) & (ATA_STAT_BUSY | ATA_STAT_DRQ))
-        __asm__ __volatile__("pause");
-    IDEClearFlagBit(IDE_FLAG_IRQ);
 
-    return EXIT_CODE_GLOBAL_SUCCESS;
+    return IDE_waitRequest(&req);
 }
 
 static void IDE_reportDrives(uint8_t *drive_list)
@@ -548,3 +1080,295 @@ static void IDE_reportDrives(uint8_t *drive_list)
     for(; i < IDE_DRIVER_MAX_DRIVES; ++i)
         drive_list[i] = drive_info_t[i].type;
 }
+
+/* moves words from the data port into buf in the way the drive was told to (see IDE_COMMAND_SET_PIO) */
+static void IDE_pio_in(uint8_t drive, uint16_t port, uint32_t words, uint16_t *buf)
+{
+    uint8_t tsc = CPU_has_feature(CPU_FEATURE_TSC);
+    uint64_t start = tsc ? ASM_CPU_RDTSC() : 0;
+    uint32_t i;
+
+    if(drive_info_t[drive].pio == IDE_PIO_32 && !(words & 1U))
+        insl(port, words / 2, (uint32_t *) buf);
+    else if(drive_info_t[drive].pio == IDE_PIO_LOOP)
+        for(i = 0; i < words; ++i)
+            buf[i] = (uint16_t) inw(port);
+    else
+        insw(port, words, buf);
+
+    if(tsc)
+        drive_info_t[drive].pio_cycles += ASM_CPU_RDTSC() - start;
+    drive_info_t[drive].pio_bytes += words * sizeof(uint16_t);
+}
+
+static void IDE_pio_out(uint8_t drive, uint16_t port, uint32_t words, uint16_t *buf)
+{
+    uint8_t tsc = CPU_has_feature(CPU_FEATURE_TSC);
+    uint64_t start = tsc ? ASM_CPU_RDTSC() : 0;
+    uint32_t i;
+
+    if(drive_info_t[drive].pio == IDE_PIO_32 && !(words & 1U))
+        outsl(port, words / 2, (uint32_t *) buf);
+    else if(drive_info_t[drive].pio == IDE_PIO_LOOP)
+        for(i = 0; i < words; ++i)
+            outw(port, buf[i]);
+    else
+        outsw(port, words, buf);
+
+    if(tsc)
+        drive_info_t[drive].pio_cycles += ASM_CPU_RDTSC() - start;
+    drive_info_t[drive].pio_bytes += words * sizeof(uint16_t);
+}
+
+/* moves bytes between the data port and the scatter-gather list at pos, pos is moved along */
+static void IDE_pio_move(uint8_t drive, uint16_t port, SG_POS *pos, uint32_t bytes, bool write)
+{
+    uint16_t *buf;
+    uint32_t len;
+
+    while(bytes)
+    {
+        buf = (uint16_t *) sg_ptr(pos, &len);
+        len = (len > bytes) ? bytes : len;
+
+        if(write)
+            IDE_pio_out(drive, port, len / sizeof(uint16_t), buf);
+        else
+            IDE_pio_in(drive, port, len / sizeof(uint16_t), buf);
+
+        sg_advance(pos, len);
+        bytes -= len;
+    }
+}
+
+static void IDE_setPIO(uint32_t *drv)
+{
+    DRIVE_INFO *info = &drive_info_t[drv[1]];
+    uint32_t blocks = info->pio_bytes / 2048U;
+
+    drv[3] = blocks ? (uint32_t) (info->pio_cycles / blocks) : 0;
+    drv[4] = info->pio_bytes;
+
+    info->pio_cycles = 0;
+    info->pio_bytes = 0;
+
+    /* nothing tells us if the controller can do 32-bit PIO, so IDE_PIO_32 has to be asked for explicitly */
+    info->pio = (uint8_t) ((drv[2] == IDE_PIO_AUTO) ? IDE_PIO_16 : drv[2]);
+}
+
+static uint16_t IDE_getBusMaster(uint8_t drive)
+{
+    return (uint16_t) ((drive > 1) ? bm_base_port + 8 : bm_base_port);
+}
+
+/* fills the PRD table of the drive's channel with the physical pages behind the scatter-gather list at pos,
+   contiguous pages are merged as long as they stay within the same 64 KiB */
+static uint8_t IDE_preparePRDT(uint8_t drive, SG_POS pos, uint32_t size)
+{
+    IDE_PRD *prd = ide_prdt[drive > 1];
+    uint8_t *vptr;
+    uint32_t n = 0, pptr, len, left, last = 0;
+
+    while(size)
+    {
+        vptr = sg_ptr(&pos, &left);
+        pptr = (uint32_t) paging_vptr_to_pptr(vptr);
+        len = PAGE_SIZE - (pptr & (PAGE_SIZE - 1));
+        len = (len > left) ? left : len;
+        len = (len > size) ? size : len;
+
+        /* the controller can only do word aligned transfers */
+        if((pptr & 1U) || (len & 1U))
+            return EXIT_CODE_GLOBAL_GENERAL_FAIL;
+
+        if(!n || prd[n - 1].addr + last != pptr || !(pptr & 0xFFFF))
+        {
+            if(n == IDE_PRD_MAX)
+                return EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+
+            prd[n].addr = pptr;
+            prd[n].flags = 0;
+            last = 0;
+            n++;
+        }
+
+        /* 64 KiB becomes 0, which is what the controller wants */
+        last = last + len;
+        prd[n - 1].size = (uint16_t) last;
+
+        sg_advance(&pos, len);
+        size = size - len;
+    }
+
+    prd[n - 1].flags = IDE_PRD_EOT;
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* falls back to PIO when the buffer can't be described by the PRD table
+   sctrwrite: 1 - IDE_DMA_MAX_SECTORS */
+static uint8_t IDE_transferDMA(uint8_t drive, uint32_t start, uint32_t sctrwrite, SG_POS pos, bool write)
+{
+    uint16_t port = IDE_getPort(drive);
+    uint16_t bm = IDE_getBusMaster(drive);
+    uint8_t command = write ? 0 : BM_CMD_READ;
+    IDE_REQUEST req;
+    bool lba48;
+
+    if(IDE_preparePRDT(drive, pos, sctrwrite * SECTOR_SIZE))
+        return IDE_transferPIO(drive, start, sctrwrite, pos, write);
+
+    /* stop whatever is going on and set up the controller, the direction must be set before starting */
+    outb(bm | BM_PORT_COMMAND, 0);
+    outl(bm | BM_PORT_PRDT, (uint32_t) paging_vptr_to_pptr(ide_prdt[drive > 1]));
+    outb(bm | BM_PORT_COMMAND, command);
+    outb(bm | BM_PORT_STATUS, (uint8_t) (inb(bm | BM_PORT_STATUS) | BM_STAT_ERR | BM_STAT_IRQ));
+
+    lba48 = IDE_selectLBA(drive, start, sctrwrite);
+
+    IDE_startRequest(&req, drive, IDE_REQ_DMA, &pos, sctrwrite * SECTOR_SIZE, 0);
+    outb(port | ATA_PORT_COMSTAT, ide_command_dma[lba48][write]);
+
+    /* the IRQ handler stops the controller when the drive is done */
+    outb(bm | BM_PORT_COMMAND, command | BM_CMD_START);
+
+    return IDE_waitRequest(&req);
+}
+
+/* returns: the timestamp counter, or the PIT tick without one */
+static uint64_t IDE_now(void)
+{
+    return CPU_tsc_per_us() ? ASM_CPU_RDTSC() : (uint64_t) timer_getCurrentTick();
+}
+
+/* makes req the channel's request in flight, call before sending the command to the drive */
+static void IDE_startRequest(IDE_REQUEST *req, uint8_t drive, uint8_t type, const SG_POS *pos, uint32_t size, uint32_t block)
+{
+    req->drive = drive;
+    req->type = type;
+    req->pos = *pos;
+    req->left = size;
+    req->block = block;
+    req->done = 0;
+    req->error = EXIT_CODE_GLOBAL_SUCCESS;
+    req->issued = IDE_now();
+
+    ide_request_t[drive > 1] = req;
+}
+
+/* IRQ handler only */
+static void IDE_finishRequest(uint8_t channel, bool error)
+{
+    IDE_REQUEST *req = ide_request_t[channel];
+
+    ide_request_t[channel] = NULL;
+
+    req->finished = IDE_now();
+    req->error = error ? EXIT_CODE_IDE_ERROR_READING_DRIVE : EXIT_CODE_GLOBAL_SUCCESS;
+    req->done = 1;
+}
+
+static uint8_t IDE_requestDone(void *req)
+{
+    return ((IDE_REQUEST *) req)->done;
+}
+
+/* halts until IDE_IRQ() completed req (or IDE_TIMEOUT ran out) */
+static uint8_t IDE_waitRequest(IDE_REQUEST *req)
+{
+    DRIVE_INFO *info = &drive_info_t[req->drive];
+    uint32_t end = timer_getCurrentTick() + IDE_TIMEOUT;
+    uint32_t per_us = CPU_tsc_per_us();
+    uint32_t wait, flags;
+    bool timeout = false;
+
+    CPU_irq_wait(IDE_requestDone, req, end, 0);
+
+    /* the IRQ can still come in until the request is taken away from IDE_IRQ() */
+    flags = CPU_irq_save();
+
+    if(!req->done)
+    {
+        if(req->type == IDE_REQ_DMA)
+            outb(IDE_getBusMaster(req->drive) | BM_PORT_COMMAND, 0);
+
+        ide_request_t[req->drive > 1] = NULL;
+        req->finished = IDE_now();
+        req->error = EXIT_CODE_IDE_ERROR_READING_DRIVE;
+        timeout = true;
+    }
+
+    CPU_irq_restore(flags);
+
+    /* the drive is still busy with the command, the next one would fail too */
+    if(timeout)
+        IDE_resetChannel(req->drive);
+
+    wait = per_us ? (uint32_t) ((req->finished - req->issued) / per_us) : (uint32_t) (req->finished - req->issued) * 1000;
+
+    info->requests++;
+    info->wait_total += wait;
+    info->wait_last = wait;
+    info->wait_max = (wait > info->wait_max) ? wait : info->wait_max;
+
+    return req->error;
+}
+
+/* pulses SRST and waits until the drives of the channel are done resetting */
+static void IDE_resetChannel(uint8_t drive)
+{
+    uint16_t ctrl = (drive > 1) ? s_ctrl_port : p_ctrl_port;
+    uint16_t port = IDE_getPort(drive);
+    uint32_t end;
+
+    outb(ctrl, ATA_CTRL_SRST);
+    sleep(1);
+    outb(ctrl, 0);
+
+    /* BSY isn't guaranteed to be set within the first 2 ms */
+    sleep(2);
+    end = timer_getCurrentTick() + IDE_TIMEOUT;
+
+    while((inb(port | ATA_PORT_COMSTAT) & ATA_STAT_BUSY) && timer_getCurrentTick() < end);
+
+#ifndef NO_DEBUG_INFO
+    print_value("[IDE_DRIVER] Reset the channel of drive %i after a timeout\n", drive);
+#endif
+}
+
+static void IDE_getLatency(uint32_t *drv)
+{
+    DRIVE_INFO *info = &drive_info_t[drv[1]];
+    uint32_t *latency = (uint32_t *) drv[2];
+
+    latency[IDE_LATENCY_REQUESTS] = info->requests;
+    latency[IDE_LATENCY_AVERAGE] = info->requests ? (uint32_t) (info->wait_total / info->requests) : 0;
+    latency[IDE_LATENCY_MAX] = info->wait_max;
+    latency[IDE_LATENCY_LAST] = info->wait_last;
+
+    if(!drv[3])
+        return;
+
+    info->requests = 0;
+    info->wait_total = 0;
+    info->wait_max = 0;
+    info->wait_last = 0;
+}
+
+static void IDE_getDriveInfo(uint32_t *drv)
+{
+    DRIVE_INFO *info = &drive_info_t[drv[1]];
+    uint32_t *out = (uint32_t *) drv[2];
+
+    out[IDE_INFO_SECTORS] = (uint32_t) info->sectors;
+    out[IDE_INFO_SECTORS_HI] = (uint32_t) (info->sectors >> 32);
+    out[IDE_INFO_FLAGS] = info->caps;
+    out[IDE_INFO_FLAGS] |= info->lba48 ? IDE_CAP_LBA48 : 0;
+    out[IDE_INFO_FLAGS] |= info->dma_capable ? IDE_CAP_DMA : 0;
+    out[IDE_INFO_FLAGS] |= (info->pio == IDE_PIO_32) ? IDE_CAP_PIO32 : 0;
+    out[IDE_INFO_MULTIPLE] = info->max_multiple;
+    out[IDE_INFO_MWDMA] = info->mwdma;
+    out[IDE_INFO_UDMA] = info->udma;
+    out[IDE_INFO_PIO] = info->pio_mode;
+    out[IDE_INFO_MODE] = info->mode;
+}
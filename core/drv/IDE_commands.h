@@ -39,16 +39,19 @@ SOFTWARE.
 /*
 	parameter1: drive
 	parameter2: starting sector
-	parameter3: # sectors to read
-	parameter4: buffer to read to
+	parameter3: # sectors to read (1 - IDE_COMMAND_GET_MAX_SECTORS)
+	parameter4: buffer to read to (or a scatter-gather list, see below)
 */
 
 #define IDE_COMMAND_WRITE   0x11
 /*
 	parameter1: drive
 	parameter2: starting sector
-	parameter3: # sectors to write
-	parameter4: buffer with the data to be written
+	parameter3: # sectors to write (1 - IDE_COMMAND_GET_MAX_SECTORS)
+	parameter4: buffer with the data to be written (or a scatter-gather list, see below)
+
+	READ and WRITE take a scatter-gather list (SG_ENTRY array, see dsk/sglist.h) as parameter4
+	when parameter1 is the drive OR'd with DRIVE_SG
 */
 
 #define IDE_COMMAND_REPORTDRIVES   0x12
@@ -70,6 +73,98 @@ SOFTWARE.
 	DRIVE_TYPE_UNKNOWN
 */
 
+#define IDE_COMMAND_SET_PIO   0x13
+/*
+	sets how the data of PIO transfers is moved (meant for benchmarks, the driver uses rep insw/outsw 
+	by itself) and reports how long that took so far. IDE_PIO_32 is never picked by the driver: there
+	is no reliable way to tell if the controller can do it, check the data when turning it on
+
+	parameter1: drive
+	parameter2: one of the IDE_PIO_* defines below
+
+	returns:
+	parameter3: average timestamp counter cycles per 2048 bytes moved since the last 
+	            IDE_COMMAND_SET_PIO (0 without a timestamp counter)
+	parameter4: number of bytes moved since the last IDE_COMMAND_SET_PIO
+*/
+
+#define IDE_PIO_AUTO    0x00 /* the default, IDE_PIO_16 */
+#define IDE_PIO_LOOP    0x01 /* one inw per word */
+#define IDE_PIO_16      0x02 /* rep insw/outsw */
+#define IDE_PIO_32      0x03 /* rep insd/outsd */
+
+#define IDE_COMMAND_SET_DMA   0x14
+/*
+	turns bus master DMA on or off for a drive (on by default for PATA drives that
+	support it, when the controller does too)
+
+	parameter1: drive
+	parameter2: 1 to use DMA, 0 for PIO
+
+	returns EXIT_CODE_GLOBAL_UNSUPPORTED if the drive or controller can't do DMA
+*/
+
+#define IDE_COMMAND_GET_LATENCY   0x15
+/*
+	reports how long the drive took to finish commands, from sending the command until the 
+	drive's last IRQ (in microseconds)
+
+	parameter1: drive
+	parameter2: pointer to an array of IDE_LATENCY_LEN uint32_t's to store them in
+	parameter3: non-zero resets the numbers afterwards
+*/
+
+#define IDE_LATENCY_REQUESTS    0x00 /* number of commands */
+#define IDE_LATENCY_AVERAGE     0x01
+#define IDE_LATENCY_MAX         0x02
+#define IDE_LATENCY_LAST        0x03
+#define IDE_LATENCY_LEN         0x04
+
+#define IDE_COMMAND_GET_MAX_SECTORS   0x16
+/*
+	reports how many sectors IDE_COMMAND_READ/IDE_COMMAND_WRITE take at most
+	for a drive (65536 for LBA48 drives, 256 for older ones)
+
+	parameter1: drive
+
+	returns:
+	parameter2: the number of sectors
+*/
+
+#define IDE_COMMAND_GET_DRIVE_INFO    0x17
+/*
+	reports what the drive can do (from IDENTIFY or IDENTIFY PACKET DEVICE) and the 
+	transfer mode the driver picked for it
+
+	parameter1: drive
+	parameter2: pointer to an array of IDE_INFO_LEN uint32_t's to store it in
+*/
+
+#define IDE_INFO_SECTORS        0x00 /* capacity in sectors, low 32 bits (0 for ATAPI) */
+#define IDE_INFO_SECTORS_HI     0x01 /* high 32 bits */
+#define IDE_INFO_FLAGS          0x02 /* IDE_CAP_* */
+#define IDE_INFO_MULTIPLE       0x03 /* max. sectors per DRQ block of READ/WRITE MULTIPLE */
+#define IDE_INFO_MWDMA          0x04 /* supported multiword DMA modes, bit n is mode n */
+#define IDE_INFO_UDMA           0x05 /* supported ultra DMA modes, same */
+#define IDE_INFO_PIO            0x06 /* highest PIO mode */
+#define IDE_INFO_MODE           0x07 /* the mode in use, IDE_MODE_* | mode */
+#define IDE_INFO_LEN            0x08
+
+#define IDE_CAP_LBA48           (1U << 0)
+#define IDE_CAP_DMA             (1U << 1) /* the driver uses bus master DMA for the drive */
+#define IDE_CAP_PIO32           (1U << 2) /* the driver uses 32-bit PIO for the drive (IDE_COMMAND_SET_PIO) */
+#define IDE_CAP_WRITE_CACHE     (1U << 3) /* supported */
+#define IDE_CAP_LOOKAHEAD       (1U << 4)
+#define IDE_CAP_WRITE_CACHE_ON  (1U << 5) /* turned on */
+#define IDE_CAP_LOOKAHEAD_ON    (1U << 6)
+
+#define IDE_MODE_PIO            0x08
+#define IDE_MODE_MWDMA          0x20
+#define IDE_MODE_UDMA           0x40
+
+/* 0x18 - 0x1A are the SUBMIT, POLL and GET_QUEUE commands of the AHCI and virtio-blk drivers
+   (see AHCI_commands.h), the IDE driver does one command at a time and doesn't have them */
+
 #ifndef IDE_DRIVER_MAX_DRIVES
 #define IDE_DRIVER_MAX_DRIVES   4
 #endif
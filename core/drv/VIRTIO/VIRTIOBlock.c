@@ -0,0 +1,856 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "VIRTIOBlock.h"
+
+#include "../VIRTIO_commands.h"
+#include "../COMMANDS.H"
+
+#include "../../include/exit_code.h"
+#include "../../include/types.h"
+#include "../../dsk/diskdefines.h"
+#include "../../dsk/sglist.h"
+#include "../../dsk/diskcmd.h"
+
+#include "../../cpu/cpu.h"
+#include "../../cpu/interrupts/isr.h"
+
+#ifndef NO_DEBUG_INFO
+#include "../../screen/screen_basic.h"
+#endif
+
+#include "../../hardware/pci.h"
+#include "../../hardware/driver.h"
+#include "../../hardware/timer.h"
+
+#include "../../memory/memory.h"
+#include "../../memory/paging.h"
+
+#include "../../exec/task.h"
+
+#include "../../io/io.h"
+
+#include "../../util/util.h"
+
+/* legacy (transitional) virtio devices say they're SCSI controllers, the ID tells them apart */
+#define VIRTIOBlock_PCI_CLASS_SUBCLASS  0x100
+#define VIRTIO_BLK_REG0                 0x10011AF4 /* device 0x1001, vendor 0x1AF4 */
+
+#define VIRTIO_DRIVER_VERSION_STRING "[VIRTIO_DRIVER] Vireo Internal virtio-blk Driver Mk. I\n"
+
+#define SECTOR_SIZE         512  // bytes, always (whatever the device's block size)
+#define PAGE_SIZE           4096 // bytes
+
+#define VIRTIO_REQ_SECTORS  128  /* per request */
+#define VIRTIO_REQ_SEGMENTS ((VIRTIO_REQ_SECTORS * SECTOR_SIZE) / PAGE_SIZE + 1) /* data descriptors a request takes at most */
+#define VIRTIO_REQ_DESC     (VIRTIO_REQ_SEGMENTS + 2) /* + header and status */
+#define VIRTIO_MAX_BATCH    32   /* requests per notify */
+#define VIRTIO_MAX_SECTORS  (VIRTIO_MAX_BATCH * VIRTIO_REQ_SECTORS) /* per driver command */
+#define VIRTIO_TIMEOUT      5000 /* ms, per batch */
+#define VIRTIO_NO_IRQ       0xFF
+
+/* legacy PCI registers (I/O space, BAR0) */
+#define VIRTIO_REG_DEVICE_FEATURES  0x00
+#define VIRTIO_REG_GUEST_FEATURES   0x04
+#define VIRTIO_REG_QUEUE_ADDRESS    0x08 /* page frame number */
+#define VIRTIO_REG_QUEUE_SIZE       0x0C
+#define VIRTIO_REG_QUEUE_SELECT     0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY     0x10
+#define VIRTIO_REG_STATUS           0x12
+#define VIRTIO_REG_ISR              0x13 /* reading it acknowledges the interrupt */
+#define VIRTIO_ISR_QUEUE            0x01 /* a used ring was updated */
+#define VIRTIO_ISR_CONFIG           0x02 /* the configuration changed */
+#define VIRTIO_REG_CONFIG           0x14 /* without MSI-X */
+
+/* virtio-blk config space */
+#define VIRTIO_BLK_CFG_CAPACITY     0x00 /* 64 bits, in 512 byte sectors */
+#define VIRTIO_BLK_CFG_SIZE_MAX     0x08
+#define VIRTIO_BLK_CFG_SEG_MAX      0x0C
+
+#define VIRTIO_STATUS_ACKNOWLEDGE   0x01
+#define VIRTIO_STATUS_DRIVER        0x02
+#define VIRTIO_STATUS_DRIVER_OK     0x04
+#define VIRTIO_STATUS_FAILED        0x80
+
+#define VIRTIO_BLK_F_SIZE_MAX       (1U << 1)
+#define VIRTIO_BLK_F_SEG_MAX        (1U << 2)
+#define VIRTIO_BLK_F_RO             (1U << 5)
+#define VIRTIO_BLK_F_FLUSH          (1U << 9)
+#define VIRTIO_RING_F_EVENT_IDX     (1U << 29)
+
+/* everything we know what to do with */
+#define VIRTIO_FEATURES (VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH | VIRTIO_RING_F_EVENT_IDX)
+
+#define VIRTIO_BLK_T_IN             0x00
+#define VIRTIO_BLK_T_OUT            0x01
+#define VIRTIO_BLK_T_FLUSH          0x04
+#define VIRTIO_BLK_S_OK             0x00
+
+#define VIRTQ_DESC_F_NEXT           0x01
+#define VIRTQ_DESC_F_WRITE          0x02 /* the device writes to it */
+
+#define VIRTQ_ALIGN(x)              (((x) + PAGE_SIZE - 1U) & ~(PAGE_SIZE - 1U))
+
+typedef struct
+{
+    uint32_t addr;          /* physical */
+    uint32_t addr_hi;
+    uint32_t len;
+    uint16_t flags;         /* VIRTQ_DESC_F_* */
+    uint16_t next;
+} __attribute__((packed)) VIRTQ_DESC;
+
+/* the descriptor chains we give to the device, followed by used_event */
+typedef struct
+{
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} VIRTQ_AVAIL;
+
+typedef struct
+{
+    uint32_t id;            /* head of the chain */
+    uint32_t len;           /* bytes written by the device */
+} __attribute__((packed)) VIRTQ_USED_ELEM;
+
+/* the chains the device is done with */
+typedef struct
+{
+    uint16_t flags;
+    volatile uint16_t idx;
+    VIRTQ_USED_ELEM ring[];
+} VIRTQ_USED;
+
+typedef struct
+{
+    uint32_t type;          /* VIRTIO_BLK_T_* */
+    uint32_t rsv;
+    uint64_t sector;
+} __attribute__((packed)) VIRTIO_BLK_REQ;
+
+/* functions defined here, because it *should* be private to the driver */
+
+void VIRTIOBlock_handler(uint32_t *drv);
+
+static uint8_t VIRTIO_IRQ(void);
+
+static void VIRTIODriverInit(uint32_t device);
+#ifndef NO_DEBUG_INFO
+static void VIRTIOPrintWelcome(void);
+#endif
+static uint8_t VIRTIO_setupQueue(void);
+static uint8_t VIRTIO_start(void);
+static void VIRTIO_reset(void);
+
+static uint16_t VIRTIO_addDescriptor(void *ptr, uint32_t len, uint16_t flags);
+static uint32_t VIRTIO_addData(SG_POS pos, uint32_t size, bool write);
+static uint32_t VIRTIO_addRequest(uint8_t n, uint32_t type, uint32_t sector, const SG_POS *pos, uint32_t size);
+static uint8_t VIRTIO_submit(void);
+static uint8_t VIRTIO_submitDone(void *target);
+static uint8_t VIRTIO_transfer(uint32_t start, uint32_t sctrwrite, SG_POS pos, bool write);
+
+static uint8_t VIRTIO_queue(DISK_CMD *cmd);
+static void VIRTIO_complete(void);
+static void VIRTIO_cancel(void);
+static void VIRTIO_poll(void);
+static uint8_t VIRTIO_drain(void);
+static uint8_t VIRTIO_drainDone(void *unused);
+
+static void VIRTIO_reportDrives(uint8_t *drive_list);
+static void VIRTIO_getDriveInfo(uint32_t *drv);
+
+uint32_t VIRTIO_PCI_controller;
+uint16_t virtio_port;
+uint8_t virtio_irq = VIRTIO_NO_IRQ;
+uint8_t virtio_type = DRIVE_TYPE_UNKNOWN;
+uint32_t virtio_features;
+uint64_t virtio_sectors;
+uint32_t virtio_seg_bytes;  /* largest data descriptor the device takes */
+uint32_t virtio_seg_max;    /* data descriptors per request */
+
+/* the queue (there's only one for virtio-blk) */
+uint16_t virtq_size;
+uint32_t virtq_bytes;       /* of the pages the queue is in */
+VIRTQ_DESC *virtq_desc;
+VIRTQ_AVAIL *virtq_avail;
+VIRTQ_USED *virtq_used;
+uint16_t virtq_last_used;   /* used->idx after the last batch completed */
+
+/* the batch being put together, requests are only in flight between VIRTIO_submit() and its return */
+uint16_t virtq_next_desc;
+uint16_t virtq_batch;
+VIRTIO_BLK_REQ virtio_req_t[VIRTIO_MAX_BATCH];
+volatile uint8_t virtio_status[VIRTIO_MAX_BATCH];
+
+/* reads of VIRTIO_COMMAND_SUBMIT, there's never a batch at the same time. The one in slot n uses request n
+   and the descriptors from n * VIRTIO_REQ_DESC on, so the device can give them back in any order */
+uint8_t virtio_slots;
+volatile uint32_t virtio_queued;        /* a bit per slot the device has */
+DISK_CMD *virtio_cmds[VIRTIO_MAX_BATCH];
+uint32_t virtio_progress;               /* tick of the last read that was submitted or finished */
+
+uint32_t virtio_requests = 0;
+uint32_t virtio_notifies = 0;
+volatile uint32_t virtio_interrupts = 0;
+
+/* the indentifier for drivers + information about our driver */
+struct DRIVER VIRTIO_driver_id = {(uint32_t) 0xB14D05, "VIREODRV", (VIRTIOBlock_PCI_CLASS_SUBCLASS | DRIVER_TYPE_PCI), (uint32_t) (VIRTIOBlock_handler)};
+
+void VIRTIOBlock_handler(uint32_t *drv)
+{
+    uint8_t error = EXIT_CODE_GLOBAL_SUCCESS;
+    SG_ENTRY whole;
+    SG_POS pos;
+    DISK_CMD *cmd;
+
+    /* also covers the SCSI controllers that aren't virtio-blk devices */
+    if(drv[0] != DRV_COMMAND_INIT && virtio_type == DRIVE_TYPE_UNKNOWN)
+        return;
+
+    switch(drv[0])
+    {
+        case DRV_COMMAND_INIT:
+            VIRTIODriverInit(drv[1]);
+        break;
+
+        case VIRTIO_COMMAND_READ:
+        case VIRTIO_COMMAND_WRITE:
+            sg_from_command(&pos, &whole, drv);
+
+            if(drv[1] >= VIRTIO_DRIVER_MAX_DRIVES || !drv[3] || drv[3] > VIRTIO_MAX_SECTORS)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            if(drv[0] == VIRTIO_COMMAND_WRITE && (virtio_features & VIRTIO_BLK_F_RO))
+            {
+                error = EXIT_CODE_GLOBAL_GENERAL_FAIL;
+                break;
+            }
+
+            error = VIRTIO_transfer(drv[2], drv[3], pos, drv[0] == VIRTIO_COMMAND_WRITE);
+        break;
+
+        case VIRTIO_COMMAND_REPORTDRIVES:
+            VIRTIO_reportDrives((uint8_t *) drv[1]);
+        break;
+
+        case VIRTIO_COMMAND_GET_MAX_SECTORS:
+            if(drv[1] >= VIRTIO_DRIVER_MAX_DRIVES)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            drv[2] = VIRTIO_MAX_SECTORS;
+        break;
+
+        case VIRTIO_COMMAND_GET_DRIVE_INFO:
+            if(drv[1] >= VIRTIO_DRIVER_MAX_DRIVES)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            VIRTIO_getDriveInfo(drv);
+        break;
+
+        case VIRTIO_COMMAND_SUBMIT:
+            cmd = (DISK_CMD *) drv[4];
+
+            if(drv[1] >= VIRTIO_DRIVER_MAX_DRIVES || !cmd->sctr || cmd->sctr > VIRTIO_REQ_SECTORS)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            error = VIRTIO_queue(cmd);
+        break;
+
+        case VIRTIO_COMMAND_POLL:
+            if(drv[1] >= VIRTIO_DRIVER_MAX_DRIVES)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            VIRTIO_poll();
+        break;
+
+        case VIRTIO_COMMAND_GET_QUEUE:
+            if(drv[1] >= VIRTIO_DRIVER_MAX_DRIVES)
+            {
+                error = EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+                break;
+            }
+
+            /* a buffer takes a descriptor per page it touches at most */
+            drv[2] = virtio_slots;
+            drv[3] = ((virtio_seg_max - 1) * PAGE_SIZE) / SECTOR_SIZE;
+            drv[3] = (drv[3] > VIRTIO_REQ_SECTORS) ? VIRTIO_REQ_SECTORS : drv[3];
+        break;
+
+        default:
+            error = EXIT_CODE_GLOBAL_UNSUPPORTED;
+        break;
+    }
+
+    if(!error)
+        return;
+
+    /* else */
+    drv[4] = NULL;
+    drv[1] = error;
+}
+
+// ISR, finishes submitted reads (batches are waited for by VIRTIO_submit()). returns: 1 if the interrupt
+// was from the device, the line may be shared with other devices
+static uint8_t VIRTIO_IRQ(void)
+{
+    /* reading it tells the device we got it, it's 0 when the interrupt was somebody else's */
+    uint8_t isr = (uint8_t) inb((uint16_t) (virtio_port + VIRTIO_REG_ISR));
+
+    if(isr & VIRTIO_ISR_QUEUE)
+    {
+        virtio_interrupts++;
+        VIRTIO_complete();
+    }
+
+    return (isr & (VIRTIO_ISR_QUEUE | VIRTIO_ISR_CONFIG)) ? 1 : 0;
+}
+
+static void VIRTIODriverInit(uint32_t device)
+{
+    uint8_t bus, dev, func;
+    uint32_t bar;
+
+    VIRTIO_PCI_controller = device & (uint32_t)~(DRIVER_TYPE_PCI);
+
+    bus  = (uint8_t) ((VIRTIO_PCI_controller >> 24) & 0xFF);
+    dev  = (uint8_t) ((VIRTIO_PCI_controller >> 16) & 0xFF);
+    func = (uint8_t) ((VIRTIO_PCI_controller >> 8)  & 0xFF);
+
+    /* some other SCSI controller, or a modern-only virtio device */
+    if(pciGetReg0(VIRTIO_PCI_controller) != VIRTIO_BLK_REG0)
+        return;
+
+    /* the legacy registers are in I/O space */
+    bar = pciGetBar(VIRTIO_PCI_controller, PCI_BAR0);
+
+    if(!(bar & 0x01))
+        return;
+
+    virtio_port = (uint16_t) (bar & 0xFFFC);
+
+    pciEnableBusMaster(VIRTIO_PCI_controller);
+
+    if(VIRTIO_start())
+        return;
+
+    virtio_sectors = (uint64_t) (uint32_t) inl((uint16_t) (virtio_port + VIRTIO_REG_CONFIG + VIRTIO_BLK_CFG_CAPACITY))
+                   | ((uint64_t) (uint32_t) inl((uint16_t) (virtio_port + VIRTIO_REG_CONFIG + VIRTIO_BLK_CFG_CAPACITY + 4)) << 32);
+
+    /* we never make a data descriptor bigger than a request, or use more of them than a request needs */
+    virtio_seg_bytes = VIRTIO_REQ_SECTORS * SECTOR_SIZE;
+    virtio_seg_max = VIRTIO_REQ_SEGMENTS;
+
+    if(virtio_features & VIRTIO_BLK_F_SIZE_MAX)
+    {
+        bar = (uint32_t) inl((uint16_t) (virtio_port + VIRTIO_REG_CONFIG + VIRTIO_BLK_CFG_SIZE_MAX));
+        virtio_seg_bytes = (bar && bar < virtio_seg_bytes) ? bar : virtio_seg_bytes;
+    }
+
+    if(virtio_features & VIRTIO_BLK_F_SEG_MAX)
+    {
+        bar = (uint32_t) inl((uint16_t) (virtio_port + VIRTIO_REG_CONFIG + VIRTIO_BLK_CFG_SEG_MAX));
+        virtio_seg_max = (bar && bar < virtio_seg_max) ? bar : virtio_seg_max;
+    }
+
+    virtio_slots = (uint8_t) ((virtq_size / VIRTIO_REQ_DESC > VIRTIO_MAX_BATCH) ? VIRTIO_MAX_BATCH : virtq_size / VIRTIO_REQ_DESC);
+
+    /* register our IRQ handler (if there's anything to register it for) */
+    virtio_irq = pciGetInterruptLine(bus, dev, func);
+
+    if(virtio_irq >= 16 || ISR_add_irq_handler(virtio_irq, VIRTIO_IRQ))
+        virtio_irq = VIRTIO_NO_IRQ;
+
+    virtio_type = DRIVE_TYPE_VIRTIO;
+
+#ifndef NO_DEBUG_INFO
+    VIRTIOPrintWelcome();
+#endif
+}
+
+#ifndef NO_DEBUG_INFO
+static void VIRTIOPrintWelcome(void)
+{
+    print( VIRTIO_DRIVER_VERSION_STRING);
+    print_value( "[VIRTIO_DRIVER] Kernel reported PCI controller %x\n", VIRTIO_PCI_controller);
+    print_value( "[VIRTIO_DRIVER] I/O port: %x\n", virtio_port);
+    print_value( "[VIRTIO_DRIVER] IRQ: %i\n", virtio_irq);
+    print_value( "[VIRTIO_DRIVER] Queue size: %i\n", virtq_size);
+    print_value( "[VIRTIO_DRIVER] Drive 0: %i MiB", (uint32_t) (virtio_sectors / 2048));
+    print( (virtio_features & VIRTIO_BLK_F_RO) ? ", read-only" : "");
+    print( (virtio_features & VIRTIO_BLK_F_FLUSH) ? ", flush" : "");
+    print( "\n\n");
+}
+#endif
+
+/* allocates queue 0 in the layout legacy devices expect: the descriptors and the available ring,
+   then the used ring on the next page */
+static uint8_t VIRTIO_setupQueue(void)
+{
+    PAGE_REQ req = {PID_KERNEL, PAGE_REQ_ATTR_SUPERVISOR | PAGE_REQ_ATTR_READ_WRITE | PAGE_REQ_ATTR_ZERO, 0};
+    uint32_t avail_end;
+    uint8_t *mem;
+
+    outw((uint16_t) (virtio_port + VIRTIO_REG_QUEUE_SELECT), 0);
+    virtq_size = inw((uint16_t) (virtio_port + VIRTIO_REG_QUEUE_SIZE));
+
+    /* the device needs at least one request's worth */
+    if(virtq_size < VIRTIO_REQ_DESC)
+        return EXIT_CODE_GLOBAL_UNSUPPORTED;
+
+    /* avail: flags, idx, ring, used_event. used: flags, idx, ring, avail_event */
+    avail_end = virtq_size * sizeof(VIRTQ_DESC) + (3U + virtq_size) * sizeof(uint16_t);
+    req.size = VIRTQ_ALIGN(avail_end) + VIRTQ_ALIGN(2U * sizeof(uint16_t) + virtq_size * sizeof(VIRTQ_USED_ELEM) + sizeof(uint16_t));
+
+    /* after a reset the queue goes where it was, the device forgot all about it */
+    if(virtq_desc)
+    {
+        if(req.size > virtq_bytes)
+            return EXIT_CODE_GLOBAL_UNSUPPORTED;
+
+        mem = (uint8_t *) virtq_desc;
+        memset((char *) mem, virtq_bytes, 0);
+    }
+    else if(!(mem = valloc(&req)))
+        return EXIT_CODE_OUT_OF_MEMORY;
+    else
+        virtq_bytes = req.size;
+
+    virtq_desc = (VIRTQ_DESC *) mem;
+    virtq_avail = (VIRTQ_AVAIL *) (mem + virtq_size * sizeof(VIRTQ_DESC));
+    virtq_used = (VIRTQ_USED *) (mem + VIRTQ_ALIGN(avail_end));
+    virtq_last_used = 0;
+
+    outl((uint16_t) (virtio_port + VIRTIO_REG_QUEUE_ADDRESS), (uint32_t) paging_vptr_to_pptr(mem) / PAGE_SIZE);
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* reset, then tell the device we found it, know how to drive it and where its queue is.
+   returns: nonzero if the device can't be used (it's marked as failed then) */
+static uint8_t VIRTIO_start(void)
+{
+    uint8_t error;
+
+    outb((uint16_t) (virtio_port + VIRTIO_REG_STATUS), 0);
+    outb((uint16_t) (virtio_port + VIRTIO_REG_STATUS), VIRTIO_STATUS_ACKNOWLEDGE);
+    outb((uint16_t) (virtio_port + VIRTIO_REG_STATUS), VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    virtio_features = (uint32_t) inl((uint16_t) (virtio_port + VIRTIO_REG_DEVICE_FEATURES)) & VIRTIO_FEATURES;
+    outl((uint16_t) (virtio_port + VIRTIO_REG_GUEST_FEATURES), virtio_features);
+
+    if((error = VIRTIO_setupQueue()))
+    {
+        outb((uint16_t) (virtio_port + VIRTIO_REG_STATUS), VIRTIO_STATUS_FAILED);
+        return error;
+    }
+
+    virtq_next_desc = 0;
+    virtq_batch = 0;
+
+    outb((uint16_t) (virtio_port + VIRTIO_REG_STATUS), VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* the device didn't finish a batch in time and may still write to its buffers, or read descriptors we'd
+   reuse. A reset is the only way to take them back; if the device doesn't come back no more I/O goes to it */
+static void VIRTIO_reset(void)
+{
+    if(!VIRTIO_start())
+        return;
+
+    virtio_type = DRIVE_TYPE_UNKNOWN;
+
+    #ifndef NO_DEBUG_INFO
+    print("[VIRTIO_DRIVER] Device didn't come back after a reset, giving up on it\n");
+    #endif
+}
+
+/* returns: the descriptor, already linked to the one after it */
+static uint16_t VIRTIO_addDescriptor(void *ptr, uint32_t len, uint16_t flags)
+{
+    uint16_t desc = virtq_next_desc++;
+
+    virtq_desc[desc].addr = (uint32_t) paging_vptr_to_pptr(ptr);
+    virtq_desc[desc].addr_hi = 0;
+    virtq_desc[desc].len = len;
+    virtq_desc[desc].flags = (uint16_t) (flags | VIRTQ_DESC_F_NEXT);
+    virtq_desc[desc].next = virtq_next_desc;
+
+    return desc;
+}
+
+/* describes the scatter-gather list at pos in as few descriptors as possible (physically contiguous pages are merged)
+   returns: the bytes that fit in virtio_seg_max descriptors, a multiple of SECTOR_SIZE */
+static uint32_t VIRTIO_addData(SG_POS pos, uint32_t size, bool write)
+{
+    VIRTQ_DESC *prev = NULL;
+    uint16_t flags = write ? 0 : VIRTQ_DESC_F_WRITE;
+    uint32_t done = 0, addr, len, left, segs = 0, over;
+    uint8_t *buf;
+
+    while(done < size)
+    {
+        buf = sg_ptr(&pos, &left);
+        addr = (uint32_t) paging_vptr_to_pptr(buf);
+        len = PAGE_SIZE - (addr & (PAGE_SIZE - 1U));
+        len = (len > left) ? left : len;
+        len = (len > size - done) ? size - done : len;
+
+        if(prev && prev->addr + prev->len == addr && prev->len + len <= virtio_seg_bytes)
+            prev->len += len;
+        else if(segs < virtio_seg_max)
+        {
+            prev = &virtq_desc[VIRTIO_addDescriptor(buf, len, flags)];
+            segs++;
+        }
+        else
+            break;
+
+        sg_advance(&pos, len);
+        done += len;
+    }
+
+    /* didn't fit, the request ends at the last whole sector */
+    over = done % SECTOR_SIZE;
+
+    while(over)
+    {
+        len = (prev->len > over) ? over : prev->len;
+        prev->len -= len;
+        over -= len;
+        done -= len;
+
+        if(!prev->len)
+        {
+            virtq_next_desc--;
+            prev--;
+        }
+    }
+
+    return done;
+}
+
+/* queues request n (its header and status) in the batch, it gets smaller when the data takes too many descriptors
+   returns: the bytes from pos (NULL without data) the request covers */
+static uint32_t VIRTIO_addRequest(uint8_t n, uint32_t type, uint32_t sector, const SG_POS *pos, uint32_t size)
+{
+    VIRTIO_BLK_REQ *req = &virtio_req_t[n];
+    uint16_t head;
+
+    req->type = type;
+    req->rsv = 0;
+    req->sector = sector;
+    virtio_status[n] = 0xFF;
+
+    head = VIRTIO_addDescriptor(req, sizeof(VIRTIO_BLK_REQ), 0);
+
+    /* not even a sector fits, forget about it */
+    if(size && !(size = VIRTIO_addData(*pos, size, type == VIRTIO_BLK_T_OUT)))
+    {
+        virtq_next_desc = head;
+        return 0;
+    }
+
+    /* the status byte ends the chain */
+    virtq_desc[VIRTIO_addDescriptor((void *) &virtio_status[n], 1, VIRTQ_DESC_F_WRITE)].flags = VIRTQ_DESC_F_WRITE;
+
+    virtq_avail->ring[(virtq_avail->idx + virtq_batch) % virtq_size] = head;
+    virtq_batch++;
+
+    return size;
+}
+
+/* makes the whole batch available, notifies the device once and waits until it used all of it */
+static uint8_t VIRTIO_submit(void)
+{
+    uint16_t *used_event = &virtq_avail->ring[virtq_size];
+    uint16_t target = (uint16_t) (virtq_last_used + virtq_batch);
+    uint32_t end = timer_getCurrentTick() + VIRTIO_TIMEOUT;
+    uint8_t error = EXIT_CODE_GLOBAL_SUCCESS;
+    uint16_t i;
+
+    /* one interrupt, when the last request of the batch is done */
+    if(virtio_features & VIRTIO_RING_F_EVENT_IDX)
+        *used_event = (uint16_t) (target - 1);
+
+    /* the ring entries and descriptors have to be there before the device sees the new index */
+    __asm__ __volatile__("" ::: "memory");
+    virtq_avail->idx = (uint16_t) (virtq_avail->idx + virtq_batch);
+    __asm__ __volatile__("" ::: "memory");
+
+    outw((uint16_t) (virtio_port + VIRTIO_REG_QUEUE_NOTIFY), 0);
+
+    virtio_requests += virtq_batch;
+    virtio_notifies++;
+
+    /* timed out, the device still owns (part of) the batch */
+    if(!CPU_irq_wait(VIRTIO_submitDone, &target, end, virtio_irq == VIRTIO_NO_IRQ))
+    {
+        VIRTIO_reset();
+        return EXIT_CODE_VIRTIO_ERROR_READING_DRIVE;
+    }
+
+    for(i = 0; i < virtq_batch && !error; ++i)
+        if(virtio_status[i] != VIRTIO_BLK_S_OK)
+            error = EXIT_CODE_VIRTIO_ERROR_READING_DRIVE;
+
+    /* all of it came back, the descriptors are ours again */
+    virtq_last_used = target;
+    virtq_next_desc = 0;
+    virtq_batch = 0;
+
+    return error;
+}
+
+static uint8_t VIRTIO_transfer(uint32_t start, uint32_t sctrwrite, SG_POS pos, bool write)
+{
+    uint32_t type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    uint32_t size;
+    uint8_t error = EXIT_CODE_GLOBAL_SUCCESS;
+
+    if((error = VIRTIO_drain()))
+        return error;
+
+    while(sctrwrite && !error)
+    {
+        /* as many requests as fit in the queue, the device gets them in one go */
+        while(sctrwrite && virtq_batch < VIRTIO_MAX_BATCH && virtq_size - virtq_next_desc >= VIRTIO_REQ_DESC)
+        {
+            size = ((sctrwrite > VIRTIO_REQ_SECTORS) ? VIRTIO_REQ_SECTORS : sctrwrite) * SECTOR_SIZE;
+
+            if(!(size = VIRTIO_addRequest((uint8_t) virtq_batch, type, start, &pos, size)))
+                break;
+
+            start += size / SECTOR_SIZE;
+            sctrwrite -= size / SECTOR_SIZE;
+            sg_advance(&pos, size);
+        }
+
+        /* the buffer can't be described at all */
+        if(!virtq_batch)
+            return EXIT_CODE_VIRTIO_ERROR_READING_DRIVE;
+
+        error = VIRTIO_submit();
+    }
+
+    /* same as the other disk drivers, writes aren't done until they're out of the device's cache */
+    if(!error && write && (virtio_features & VIRTIO_BLK_F_FLUSH))
+    {
+        VIRTIO_addRequest(0, VIRTIO_BLK_T_FLUSH, 0, NULL, 0);
+        error = VIRTIO_submit();
+    }
+
+    return error;
+}
+
+static uint8_t VIRTIO_submitDone(void *target)
+{
+    return virtq_used->idx == *(uint16_t *) target;
+}
+
+/* puts a read in the queue as request slot, notifies the device and returns, VIRTIO_complete() finishes it */
+static uint8_t VIRTIO_queue(DISK_CMD *cmd)
+{
+    uint16_t *used_event = &virtq_avail->ring[virtq_size];
+    uint32_t size = cmd->sctr * SECTOR_SIZE;
+    uint32_t flags;
+    SG_POS pos;
+    uint8_t slot;
+
+    for(slot = 0; slot < virtio_slots && (virtio_queued & (1U << slot)); ++slot);
+
+    if(slot == virtio_slots)
+        return EXIT_CODE_GLOBAL_GENERAL_FAIL;
+
+    sg_start(&pos, cmd->sg);
+    virtq_next_desc = (uint16_t) (slot * VIRTIO_REQ_DESC);
+    virtq_batch = 0;
+
+    /* it can't be split up like READ does, whoever submitted it waits for all of it */
+    if(VIRTIO_addRequest(slot, VIRTIO_BLK_T_IN, cmd->LBA, &pos, size) != size)
+    {
+        virtq_next_desc = 0;
+        virtq_batch = 0;
+        return EXIT_CODE_VIRTIO_ERROR_READING_DRIVE;
+    }
+
+    cmd->status = DISK_CMD_PENDING;
+
+    /* VIRTIO_complete() mustn't see the slot before it's in the ring, or used_event change under it */
+    flags = CPU_irq_save();
+
+    if(!virtio_queued)
+        virtio_progress = timer_getCurrentTick();
+
+    virtio_cmds[slot] = cmd;
+    virtio_queued |= 1U << slot;
+
+    /* an interrupt for every read that's done */
+    if(virtio_features & VIRTIO_RING_F_EVENT_IDX)
+        *used_event = virtq_last_used;
+
+    __asm__ __volatile__("" ::: "memory");
+    virtq_avail->idx = (uint16_t) (virtq_avail->idx + 1);
+    __asm__ __volatile__("" ::: "memory");
+
+    outw((uint16_t) (virtio_port + VIRTIO_REG_QUEUE_NOTIFY), 0);
+
+    CPU_irq_restore(flags);
+
+    virtio_requests++;
+    virtio_notifies++;
+    virtq_next_desc = 0;
+    virtq_batch = 0;
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* takes the submitted reads the device is done with off the used ring (IRQ handler, or VIRTIO_poll()
+   and VIRTIO_drain() without an IRQ). Batches are left to VIRTIO_submit() */
+static void VIRTIO_complete(void)
+{
+    uint16_t *used_event = &virtq_avail->ring[virtq_size];
+    uint32_t slot;
+
+    if(!virtio_queued)
+        return;
+
+    while(virtq_last_used != virtq_used->idx)
+    {
+        /* the entry is there before the device moves idx */
+        __asm__ __volatile__("" ::: "memory");
+
+        slot = virtq_used->ring[virtq_last_used % virtq_size].id / VIRTIO_REQ_DESC;
+        virtq_last_used++;
+
+        if(slot >= virtio_slots || !virtio_cmds[slot])
+            continue;
+
+        virtio_cmds[slot]->status = (virtio_status[slot] == VIRTIO_BLK_S_OK) ? EXIT_CODE_GLOBAL_SUCCESS : EXIT_CODE_VIRTIO_ERROR_READING_DRIVE;
+        virtio_cmds[slot] = NULL;
+        virtio_queued &= ~(1U << slot);
+        virtio_progress = timer_getCurrentTick();
+    }
+
+    if(virtio_features & VIRTIO_RING_F_EVENT_IDX)
+        *used_event = virtq_last_used;
+}
+
+/* the device didn't finish the submitted reads in time, after the reset it can't touch their buffers anymore and they fail */
+static void VIRTIO_cancel(void)
+{
+    uint32_t flags = CPU_irq_save();
+    uint8_t slot;
+
+    VIRTIO_reset();
+
+    for(slot = 0; slot < virtio_slots; ++slot)
+    {
+        if(!virtio_cmds[slot])
+            continue;
+
+        virtio_cmds[slot]->status = EXIT_CODE_VIRTIO_ERROR_READING_DRIVE;
+        virtio_cmds[slot] = NULL;
+    }
+
+    virtio_queued = 0;
+
+    CPU_irq_restore(flags);
+}
+
+/* finishes the submitted reads without an IRQ, and cancels them when the device didn't finish any for VIRTIO_TIMEOUT */
+static void VIRTIO_poll(void)
+{
+    uint32_t flags;
+
+    if(!virtio_queued)
+        return;
+
+    if(virtio_irq == VIRTIO_NO_IRQ)
+    {
+        flags = CPU_irq_save();
+        VIRTIO_complete();
+        CPU_irq_restore(flags);
+    }
+
+    if(virtio_queued && timer_getCurrentTick() - virtio_progress >= VIRTIO_TIMEOUT)
+        VIRTIO_cancel();
+}
+
+/* a batch uses the descriptors from 0 on, the device finishes the submitted reads first
+   returns: nonzero if the device is gone after it didn't */
+static uint8_t VIRTIO_drain(void)
+{
+    /* the timeout counts from the last read that finished, VIRTIO_drainDone() checks it */
+    CPU_irq_wait(VIRTIO_drainDone, NULL, 0xFFFFFFFFU, virtio_irq == VIRTIO_NO_IRQ);
+
+    if(virtio_queued)
+        VIRTIO_cancel();
+
+    return (virtio_type == DRIVE_TYPE_UNKNOWN) ? EXIT_CODE_VIRTIO_ERROR_READING_DRIVE : EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+static uint8_t VIRTIO_drainDone(void *unused)
+{
+    (void) unused;
+
+    if(virtio_irq == VIRTIO_NO_IRQ)
+        VIRTIO_complete();
+
+    return !virtio_queued || timer_getCurrentTick() - virtio_progress >= VIRTIO_TIMEOUT;
+}
+
+static void VIRTIO_reportDrives(uint8_t *drive_list)
+{
+    drive_list[0] = virtio_type;
+}
+
+static void VIRTIO_getDriveInfo(uint32_t *drv)
+{
+    uint32_t *out = (uint32_t *) drv[2];
+
+    out[VIRTIO_INFO_SECTORS] = (uint32_t) virtio_sectors;
+    out[VIRTIO_INFO_SECTORS_HI] = (uint32_t) (virtio_sectors >> 32);
+    out[VIRTIO_INFO_QUEUE_SIZE] = virtq_size;
+    out[VIRTIO_INFO_FEATURES] = virtio_features;
+    out[VIRTIO_INFO_REQUESTS] = virtio_requests;
+    out[VIRTIO_INFO_NOTIFIES] = virtio_notifies;
+    out[VIRTIO_INFO_INTERRUPTS] = virtio_interrupts;
+}
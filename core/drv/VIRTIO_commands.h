@@ -0,0 +1,122 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __VIRTIO_COMMANDS_H__
+#define __VIRTIO_COMMANDS_H__
+
+
+/*#define VIRTIO_COMMAND_INIT    0x00
+---- (not defined since COMMANDS.H already defines INIT)
+    Paramaters for the INIT command to the virtio-blk driver are the following:
+        parameter1: internal PCI device ID (bus, device, function, class)
+        parameter2, parameter3, parameter4
+*/
+
+/* the commands diskio uses have the same numbers as the IDE driver's, so it can
+   send the same packets to any controller */
+
+#define VIRTIO_COMMAND_READ    0x10
+/*
+	parameter1: drive
+	parameter2: starting sector (512 bytes)
+	parameter3: # sectors to read (1 - VIRTIO_COMMAND_GET_MAX_SECTORS)
+	parameter4: buffer to read to (or a scatter-gather list, see below)
+
+	the transfer is split up in requests that go into the queue together, the device
+	is only notified once for all of them
+*/
+
+#define VIRTIO_COMMAND_WRITE   0x11
+/*
+	parameter1: drive
+	parameter2: starting sector (512 bytes)
+	parameter3: # sectors to write (1 - VIRTIO_COMMAND_GET_MAX_SECTORS)
+	parameter4: buffer with the data to be written (or a scatter-gather list, see below)
+
+	READ and WRITE take a scatter-gather list (SG_ENTRY array, see dsk/sglist.h) as parameter4
+	when parameter1 is the drive OR'd with DRIVE_SG
+*/
+
+#define VIRTIO_COMMAND_REPORTDRIVES   0x12
+/*
+	reports the drive 'map' in an array as large as VIRTIO_DRIVER_MAX_DRIVES (there's a 
+	device, and so a driver, per drive)
+
+	parameter1: pointer to array to store the map in
+
+	the array uses DRIVE_TYPE_VIRTIO and DRIVE_TYPE_UNKNOWN
+*/
+
+#define VIRTIO_COMMAND_GET_MAX_SECTORS   0x16
+/*
+	parameter1: drive
+
+	returns:
+	parameter2: the number of sectors READ and WRITE take at most
+*/
+
+#define VIRTIO_COMMAND_GET_DRIVE_INFO    0x17
+/*
+	parameter1: drive
+	parameter2: pointer to an array of VIRTIO_INFO_LEN uint32_t's to store it in
+*/
+
+#define VIRTIO_INFO_SECTORS       0x00 /* capacity in sectors, low 32 bits */
+#define VIRTIO_INFO_SECTORS_HI    0x01 /* high 32 bits */
+#define VIRTIO_INFO_QUEUE_SIZE    0x02 /* descriptors in the queue */
+#define VIRTIO_INFO_FEATURES      0x03 /* the feature bits the driver and device agreed on */
+#define VIRTIO_INFO_REQUESTS      0x04 /* requests sent to the device so far */
+#define VIRTIO_INFO_NOTIFIES      0x05 /* times the device was told about new requests */
+#define VIRTIO_INFO_INTERRUPTS    0x06
+#define VIRTIO_INFO_LEN           0x07
+
+#define VIRTIO_COMMAND_SUBMIT     0x18
+/*
+	puts a read in the queue and returns without waiting for it, the IRQ handler sets the
+	command's status when the device is done. The device may finish them in any order
+
+	parameter1: drive
+	parameter4: pointer to a DISK_CMD (see dsk/diskcmd.h), 1 - VIRTIO_COMMAND_GET_QUEUE's parameter3 sectors
+
+	returns EXIT_CODE_GLOBAL_GENERAL_FAIL if the queue is full. READ and WRITE wait for the
+	submitted reads to finish first
+*/
+
+#define VIRTIO_COMMAND_POLL       0x19
+/*
+	for whoever waits on submitted reads: finishes them when the device has no IRQ, and resets
+	the device when it didn't finish one in time (they all fail then)
+
+	parameter1: drive
+*/
+
+#define VIRTIO_COMMAND_GET_QUEUE  0x1A
+/*
+	parameter1: drive
+
+	returns:
+	parameter2: reads VIRTIO_COMMAND_SUBMIT takes at the same time
+	parameter3: sectors per submitted read
+*/
+
+#endif
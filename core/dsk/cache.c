@@ -0,0 +1,538 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* hashed LRU cache of disk sectors that sits between read()/write() and the drivers.
+   Every block holds one sector of a drive. Small writes stay in the cache (write-back) until the
+   block is evicted or someone calls cache_flush(). Big transfers bypass it, otherwise a single
+   large read would throw out everything that's in there. */
+
+#include "cache.h"
+#include "diskio.h"
+
+#include "../include/types.h"
+#include "../include/exit_code.h"
+
+#include "../memory/memory.h"
+#include "../memory/paging.h"
+
+#include "../exec/task.h"
+
+#include "../util/util.h"
+
+#ifndef NO_DEBUG_INFO
+#include "../screen/screen_basic.h"
+#endif
+
+#define CACHE_BLOCK_SIZE        2048    // bytes, big enough for a CD sector
+#define CACHE_MIN_BLOCKS        64
+#define CACHE_MAX_BLOCKS        4096
+#define CACHE_MEMORY_SHARE      32      // the cache gets 1/32 of the memory
+#define CACHE_BYPASS_SECTORS    64      // transfers bigger than this go straight to the drive
+#define CACHE_FLUSH_RUN         32      // max. sectors written back with a single command
+#define CACHE_PREFETCH_MAX      64      // max. sectors read into the cache with a single command
+
+#define CACHE_NO_DRIVE          0xFF    // block is free
+
+typedef struct CACHE_BLOCK
+{
+    uint32_t LBA;
+    uint8_t drive;
+    uint8_t dirty;
+    uint8_t readahead;              /* prefetched and not used yet */
+    uint16_t size;                  /* sector size in bytes */
+    struct CACHE_BLOCK *hash_next;
+    struct CACHE_BLOCK *prev;       /* LRU list, head is most recently used */
+    struct CACHE_BLOCK *next;
+    uint8_t *data;
+} CACHE_BLOCK;
+
+static CACHE_BLOCK *cache_blocks = NULL;
+static CACHE_BLOCK **cache_hash;
+static CACHE_BLOCK *cache_head, *cache_tail;
+static uint32_t cache_nblocks = 0;
+static uint32_t cache_hash_mask;
+
+static uint32_t cache_stats[CACHE_STAT_LEN];
+
+static uint32_t cache_bucket(uint8_t drive, uint32_t LBA);
+static CACHE_BLOCK *cache_lookup(uint8_t drive, uint32_t LBA);
+static void cache_unhash(CACHE_BLOCK *b);
+static void cache_unlink(CACHE_BLOCK *b);
+static void cache_touch(CACHE_BLOCK *b);
+static void cache_drop(CACHE_BLOCK *b);
+static CACHE_BLOCK *cache_get_block(uint8_t drive, uint32_t LBA, uint16_t size);
+static uint8_t cache_writeback(CACHE_BLOCK *b);
+
+void cache_init(void)
+{
+    PAGE_REQ req = {PID_KERNEL, PAGE_REQ_ATTR_SUPERVISOR | PAGE_REQ_ATTR_READ_WRITE | PAGE_REQ_ATTR_ZERO, 0};
+    uint32_t i, n, nbuckets;
+    uint8_t *data;
+
+    n = memory_getAvailable() / CACHE_MEMORY_SHARE / (CACHE_BLOCK_SIZE / 1024U);
+    n = (n < CACHE_MIN_BLOCKS) ? CACHE_MIN_BLOCKS : (n > CACHE_MAX_BLOCKS) ? CACHE_MAX_BLOCKS : n;
+
+    // a power of two, so the hash can be masked; about two blocks per bucket
+    for(nbuckets = 1; nbuckets < n / 2U; nbuckets <<= 1);
+
+    req.size = n * CACHE_BLOCK_SIZE;
+    data = valloc(&req);
+
+    cache_blocks = kmalloc(n * sizeof(CACHE_BLOCK));
+    cache_hash = kmalloc(nbuckets * sizeof(CACHE_BLOCK *));
+
+    // without a cache read() and write() go straight to the drives
+    if(!data || !cache_blocks || !cache_hash)
+    {
+        vfree(data);
+        kfree(cache_blocks);
+        kfree(cache_hash);
+        cache_blocks = NULL;
+        return;
+    }
+
+    memset((char *) cache_hash, nbuckets * sizeof(CACHE_BLOCK *), 0);
+
+    for(i = 0; i < n; ++i)
+    {
+        cache_blocks[i].drive = CACHE_NO_DRIVE;
+        cache_blocks[i].dirty = 0;
+        cache_blocks[i].readahead = 0;
+        cache_blocks[i].hash_next = NULL;
+        cache_blocks[i].prev = (i == 0) ? NULL : &cache_blocks[i - 1];
+        cache_blocks[i].next = (i == n - 1) ? NULL : &cache_blocks[i + 1];
+        cache_blocks[i].data = data + i * CACHE_BLOCK_SIZE;
+    }
+
+    cache_head = &cache_blocks[0];
+    cache_tail = &cache_blocks[n - 1];
+    cache_nblocks = n;
+    cache_hash_mask = nbuckets - 1;
+
+    memset((char *) cache_stats, sizeof(cache_stats), 0);
+    cache_stats[CACHE_STAT_BLOCKS] = n;
+
+    #ifndef NO_DEBUG_INFO
+    print_value("[CACHE] %i blocks", n);
+    print_value(" of %i bytes\n", CACHE_BLOCK_SIZE);
+    #endif
+}
+
+uint8_t cache_read(uint8_t drive, uint32_t LBA, uint32_t sctrRead, uint8_t *buf, uint32_t sector_size)
+{
+    uint32_t i, j, k;
+    uint8_t error;
+    CACHE_BLOCK *b;
+
+    if(!cache_blocks || sector_size > CACHE_BLOCK_SIZE)
+        return diskio_read_device(drive, LBA, sctrRead, buf);
+
+    if(sctrRead > CACHE_BYPASS_SECTORS)
+    {
+        error = diskio_read_device(drive, LBA, sctrRead, buf);
+
+        if(error || !cache_stats[CACHE_STAT_DIRTY])
+            return error;
+
+        // the drive doesn't know about the sectors that haven't been written back yet
+        for(i = 0; i < sctrRead; ++i)
+            if((b = cache_lookup(drive, LBA + i)) != NULL && b->dirty)
+                memcpy((char *) (buf + i * sector_size), (char *) b->data, sector_size);
+        
+        return EXIT_CODE_GLOBAL_SUCCESS;
+    }
+
+    i = 0;
+    while(i < sctrRead)
+    {
+        if((b = cache_lookup(drive, LBA + i)) != NULL)
+        {
+            memcpy((char *) (buf + i * sector_size), (char *) b->data, sector_size);
+            cache_touch(b);
+            cache_stats[CACHE_STAT_HITS]++;
+
+            if(b->readahead)
+                cache_stats[CACHE_STAT_RA_HITS]++;
+            b->readahead = 0;
+            i++;
+            continue;
+        }
+
+        // read the whole run of missing sectors with one request
+        for(j = i + 1; j < sctrRead && !cache_lookup(drive, LBA + j); ++j);
+
+        error = diskio_read_device(drive, LBA + i, j - i, buf + i * sector_size);
+        
+        if(error)
+            return error;
+        
+        cache_stats[CACHE_STAT_MISSES] += j - i;
+
+        for(k = i; k < j; ++k)
+        {
+            if((b = cache_get_block(drive, LBA + k, (uint16_t) sector_size)) == NULL)
+                break;
+
+            memcpy((char *) b->data, (char *) (buf + k * sector_size), sector_size);
+        }
+
+        i = j;
+    }
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+uint8_t cache_write(uint8_t drive, uint32_t LBA, uint32_t sctrWrite, uint8_t *buf, uint32_t sector_size)
+{
+    uint32_t i;
+    uint8_t error;
+    CACHE_BLOCK *b;
+
+    if(!cache_blocks || sector_size > CACHE_BLOCK_SIZE)
+        return diskio_write_device(drive, LBA, sctrWrite, buf);
+
+    if(sctrWrite > CACHE_BYPASS_SECTORS)
+    {
+        // whatever is cached of these sectors is about to be overwritten
+        for(i = 0; i < sctrWrite; ++i)
+            if((b = cache_lookup(drive, LBA + i)) != NULL)
+                cache_drop(b);
+
+        return diskio_write_device(drive, LBA, sctrWrite, buf);
+    }
+
+    for(i = 0; i < sctrWrite; ++i)
+    {
+        b = cache_lookup(drive, LBA + i);
+
+        if(b == NULL)
+            b = cache_get_block(drive, LBA + i, (uint16_t) sector_size);
+        
+        // no block to spare, write this one through
+        if(b == NULL)
+        {
+            if((error = diskio_write_device(drive, LBA + i, 1, buf + i * sector_size)))
+                return error;
+            continue;
+        }
+
+        memcpy((char *) b->data, (char *) (buf + i * sector_size), sector_size);
+        cache_touch(b);
+
+        if(!b->dirty)
+            cache_stats[CACHE_STAT_DIRTY]++;
+        b->dirty = 1;
+    }
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* reads the sectors that aren't cached yet into the cache, for readahead (non-zero readahead)
+   or for requests that were merged into one command. Is limited to a quarter of the cache,
+   so one reader can't take all of it. */
+void cache_prefetch(uint8_t drive, uint32_t LBA, uint32_t sctrRead, uint32_t sector_size, uint8_t readahead)
+{
+    uint32_t i, j, k;
+    CACHE_BLOCK *run[CACHE_PREFETCH_MAX];
+    SG_ENTRY sg[CACHE_PREFETCH_MAX];
+
+    if(!cache_blocks || sector_size > CACHE_BLOCK_SIZE)
+        return;
+
+    sctrRead = (sctrRead > cache_nblocks / 4U) ? cache_nblocks / 4U : sctrRead;
+    sctrRead = (sctrRead > CACHE_PREFETCH_MAX) ? CACHE_PREFETCH_MAX : sctrRead;
+
+    for(i = 0; i < sctrRead; i = j)
+    {
+        for(j = i; j < sctrRead && !cache_lookup(drive, LBA + j); ++j);
+
+        if(j == i)
+        {
+            j++;
+            continue;
+        }
+
+        // the drive puts every sector straight in its own block
+        for(k = i; k < j; ++k)
+        {
+            if((run[k - i] = cache_get_block(drive, LBA + k, (uint16_t) sector_size)) == NULL)
+                break;
+
+            sg[k - i].buf = run[k - i]->data;
+            sg[k - i].size = sector_size;
+        }
+
+        // errors are for whoever reads these sectors for real
+        if(k == i || diskio_read_sg(drive, LBA + i, k - i, sg))
+        {
+            while(k-- > i)
+                cache_drop(run[k - i]);
+            return;
+        }
+
+        for(j = i; j < k; ++j)
+        {
+            run[j - i]->readahead = readahead;
+            cache_stats[CACHE_STAT_RA_SECTORS] += readahead;
+        }
+    }
+}
+
+/* returns: non-zero if the cache has any of the sectors */
+uint8_t cache_contains(uint8_t drive, uint32_t LBA, uint32_t sctr)
+{
+    uint32_t i;
+
+    if(!cache_blocks)
+        return 0;
+
+    for(i = 0; i < sctr; ++i)
+        if(cache_lookup(drive, LBA + i))
+            return 1;
+
+    return 0;
+}
+
+/* puts sectors that were read from the drive without the cache (a read that was queued at the drive)
+   in it, the way cache_read() does with its misses. Sectors it has already are left alone, they may
+   have been written since. */
+void cache_fill(uint8_t drive, uint32_t LBA, uint32_t sctrRead, uint8_t *buf, uint32_t sector_size)
+{
+    uint32_t i;
+    CACHE_BLOCK *b;
+
+    if(!cache_blocks || sector_size > CACHE_BLOCK_SIZE || sctrRead > CACHE_BYPASS_SECTORS)
+        return;
+
+    cache_stats[CACHE_STAT_MISSES] += sctrRead;
+
+    for(i = 0; i < sctrRead; ++i)
+    {
+        if(cache_lookup(drive, LBA + i))
+            continue;
+
+        if((b = cache_get_block(drive, LBA + i, (uint16_t) sector_size)) == NULL)
+            break;
+
+        memcpy((char *) b->data, (char *) (buf + i * sector_size), sector_size);
+    }
+}
+
+/* writes the dirty blocks of drive (or of all drives with CACHE_ALL_DRIVES) back,
+   runs of consecutive sectors are written with one request */
+uint8_t cache_flush(uint8_t drive)
+{
+    uint32_t i, n, LBA;
+    uint8_t error = EXIT_CODE_GLOBAL_SUCCESS, e;
+    CACHE_BLOCK *b, *run[CACHE_FLUSH_RUN];
+    SG_ENTRY sg[CACHE_FLUSH_RUN];
+
+    if(!cache_blocks)
+        return EXIT_CODE_GLOBAL_SUCCESS;
+
+    for(i = 0; i < cache_nblocks && cache_stats[CACHE_STAT_DIRTY]; ++i)
+    {
+        b = &cache_blocks[i];
+
+        if(!b->dirty || (drive != CACHE_ALL_DRIVES && b->drive != drive))
+            continue;
+
+        // start at the first dirty sector of the run
+        LBA = b->LBA;
+        while(LBA && (b = cache_lookup(b->drive, LBA - 1)) != NULL && b->dirty)
+            LBA--;
+        b = cache_lookup(cache_blocks[i].drive, LBA);
+
+        for(n = 0; n < CACHE_FLUSH_RUN && b != NULL && b->dirty; ++n)
+        {
+            sg[n].buf = b->data;
+            sg[n].size = b->size;
+            run[n] = b;
+            b = cache_lookup(b->drive, b->LBA + 1);
+        }
+
+        e = diskio_write_sg(run[0]->drive, run[0]->LBA, n, sg);
+
+        if(e)
+        {
+            error = e;
+            continue;
+        }
+
+        while(n--)
+        {
+            run[n]->dirty = 0;
+            cache_stats[CACHE_STAT_DIRTY]--;
+            cache_stats[CACHE_STAT_WRITEBACKS]++;
+        }
+
+        // the block at i may have been in the middle of the run
+        if(cache_blocks[i].dirty)
+            i--;
+    }
+
+    return error;
+}
+
+/* writes back and then forgets everything cached of drive (or of all drives with CACHE_ALL_DRIVES) */
+uint8_t cache_invalidate(uint8_t drive)
+{
+    uint32_t i;
+    uint8_t error = cache_flush(drive);
+
+    if(error || !cache_blocks)
+        return error;
+
+    for(i = 0; i < cache_nblocks; ++i)
+        if(cache_blocks[i].drive != CACHE_NO_DRIVE && (drive == CACHE_ALL_DRIVES || cache_blocks[i].drive == drive))
+            cache_drop(&cache_blocks[i]);
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* stats should be an array of CACHE_STAT_LEN entries */
+void cache_get_stats(uint32_t *stats)
+{
+    memcpy((char *) stats, (char *) cache_stats, sizeof(cache_stats));
+}
+
+static uint32_t cache_bucket(uint8_t drive, uint32_t LBA)
+{
+    return ((LBA * 2654435761U) ^ drive) & cache_hash_mask;
+}
+
+static CACHE_BLOCK *cache_lookup(uint8_t drive, uint32_t LBA)
+{
+    CACHE_BLOCK *b = cache_hash[cache_bucket(drive, LBA)];
+
+    while(b != NULL && (b->LBA != LBA || b->drive != drive))
+        b = b->hash_next;
+
+    return b;
+}
+
+static void cache_unhash(CACHE_BLOCK *b)
+{
+    CACHE_BLOCK **p = &cache_hash[cache_bucket(b->drive, b->LBA)];
+
+    while(*p != b)
+        p = &(*p)->hash_next;
+
+    *p = b->hash_next;
+    b->hash_next = NULL;
+}
+
+static void cache_unlink(CACHE_BLOCK *b)
+{
+    if(b->prev)
+        b->prev->next = b->next;
+    else
+        cache_head = b->next;
+
+    if(b->next)
+        b->next->prev = b->prev;
+    else
+        cache_tail = b->prev;
+}
+
+/* makes b the most recently used block */
+static void cache_touch(CACHE_BLOCK *b)
+{
+    if(b == cache_head)
+        return;
+
+    cache_unlink(b);
+
+    b->prev = NULL;
+    b->next = cache_head;
+    cache_head->prev = b;
+    cache_head = b;
+}
+
+/* forgets b without writing it back, free blocks go to the tail to be reused first */
+static void cache_drop(CACHE_BLOCK *b)
+{
+    if(b->dirty)
+        cache_stats[CACHE_STAT_DIRTY]--;
+
+    cache_unhash(b);
+    b->drive = CACHE_NO_DRIVE;
+    b->dirty = 0;
+    b->readahead = 0;
+
+    if(b == cache_tail)
+        return;
+
+    cache_unlink(b);
+
+    b->next = NULL;
+    b->prev = cache_tail;
+    cache_tail->next = b;
+    cache_tail = b;
+}
+
+/* takes the least recently used block for a new sector (it is not filled in yet),
+   returns NULL if that block was dirty and could not be written back */
+static CACHE_BLOCK *cache_get_block(uint8_t drive, uint32_t LBA, uint16_t size)
+{
+    CACHE_BLOCK *b = cache_tail;
+
+    if(b->drive != CACHE_NO_DRIVE)
+    {
+        if(b->dirty && cache_writeback(b))
+            return NULL;
+
+        cache_unhash(b);
+        cache_stats[CACHE_STAT_EVICTIONS]++;
+
+        if(b->readahead)
+            cache_stats[CACHE_STAT_RA_WASTED]++;
+    }
+
+    b->drive = drive;
+    b->LBA = LBA;
+    b->size = size;
+    b->dirty = 0;
+    b->readahead = 0;
+
+    b->hash_next = cache_hash[cache_bucket(drive, LBA)];
+    cache_hash[cache_bucket(drive, LBA)] = b;
+
+    cache_touch(b);
+
+    return b;
+}
+
+static uint8_t cache_writeback(CACHE_BLOCK *b)
+{
+    uint8_t error = diskio_write_device(b->drive, b->LBA, 1, b->data);
+
+    if(error)
+        return error;
+
+    b->dirty = 0;
+    cache_stats[CACHE_STAT_DIRTY]--;
+    cache_stats[CACHE_STAT_WRITEBACKS]++;
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
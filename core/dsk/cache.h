@@ -0,0 +1,51 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#define CACHE_ALL_DRIVES        0xFF
+
+// indices in the array filled by cache_get_stats()
+#define CACHE_STAT_HITS         0   // sectors served from the cache
+#define CACHE_STAT_MISSES       1   // sectors that had to be read from the drive
+#define CACHE_STAT_EVICTIONS    2   // blocks that were reused for another sector
+#define CACHE_STAT_WRITEBACKS   3   // dirty sectors written to the drive
+#define CACHE_STAT_BLOCKS       4   // number of blocks in the cache
+#define CACHE_STAT_DIRTY        5   // number of blocks waiting to be written back
+#define CACHE_STAT_RA_SECTORS   6   // sectors read ahead
+#define CACHE_STAT_RA_HITS      7   // sectors read ahead that were asked for later on
+#define CACHE_STAT_RA_WASTED    8   // sectors read ahead that were evicted before anyone asked for them
+#define CACHE_STAT_LEN          9
+
+void cache_init(void);
+unsigned char cache_read(unsigned char drive, unsigned int LBA, unsigned int sctrRead, unsigned char *buf, unsigned int sector_size);
+unsigned char cache_write(unsigned char drive, unsigned int LBA, unsigned int sctrWrite, unsigned char *buf, unsigned int sector_size);
+void cache_prefetch(unsigned char drive, unsigned int LBA, unsigned int sctrRead, unsigned int sector_size, unsigned char readahead);
+unsigned char cache_contains(unsigned char drive, unsigned int LBA, unsigned int sctr);
+void cache_fill(unsigned char drive, unsigned int LBA, unsigned int sctrRead, unsigned char *buf, unsigned int sector_size);
+unsigned char cache_flush(unsigned char drive);
+unsigned char cache_invalidate(unsigned char drive);
+void cache_get_stats(unsigned int *stats);
+
+#endif
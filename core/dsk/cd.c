@@ -49,9 +49,9 @@ void cd_init(void)
     driver_addInternalDriver((FS_TYPE_ISO | DRIVER_TYPE_FS));
     uint32_t *drv = kmalloc(DRIVER_COMMAND_PACKET_LEN * sizeof(uint32_t));
 
-    for(uint8_t i = 0; i < IDE_DRIVER_MAX_DRIVES; ++i)
+    for(uint8_t i = 0; i < MAX_DRIVES; ++i)
     {
-        if(drives[i] != DRIVE_TYPE_IDE_PATAPI)
+        if(!DRIVE_TYPE_IS_CD(drives[i]))
             continue;
         
         drv[0] = DRV_COMMAND_INIT;
@@ -70,8 +70,8 @@ void cd_init(void)
 
 uint8_t cd_check_exists(uint8_t *drives)
 {
-    for(uint8_t i = 0; i < IDE_DRIVER_MAX_DRIVES; ++i)
-        if(drives[i] == DRIVE_TYPE_IDE_PATAPI)
+    for(uint8_t i = 0; i < MAX_DRIVES; ++i)
+        if(DRIVE_TYPE_IS_CD(drives[i]))
             return 1; // true
     
     return 0;   // false
@@ -0,0 +1,266 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+/* hashed LRU cache of directory entries, shared by the filesystem drivers.
+   It maps a name in a directory of a mount to where the file (or directory) starts, so opening the
+   same path again doesn't have to read any directories. The 'parent' is whatever the filesystem
+   uses to point at a directory (its first sector or cluster). Names that weren't found are
+   remembered too (negative entries), a path that doesn't exist is usually asked for more than once. */
+
+#include "dcache.h"
+
+#include "../include/types.h"
+
+#include "../memory/memory.h"
+
+#include "../util/util.h"
+
+#ifndef NO_DEBUG_INFO
+#include "../screen/screen_basic.h"
+#endif
+
+#define DCACHE_ENTRIES          256
+#define DCACHE_BUCKETS          128     // a power of two, so the hash can be masked
+
+#define DCACHE_NO_MOUNT         0xFFFF  // entry is free
+
+typedef struct DCACHE_ENTRY
+{
+    uint16_t mount;
+    uint8_t name_len;
+    uint8_t negative;                   /* the name does not exist in the parent */
+    uint32_t parent;
+    DENTRY dentry;
+    struct DCACHE_ENTRY *hash_next;
+    struct DCACHE_ENTRY *prev;          /* LRU list, head is most recently used */
+    struct DCACHE_ENTRY *next;
+    char name[DCACHE_NAME_LEN];
+} DCACHE_ENTRY;
+
+static DCACHE_ENTRY *dcache_entries = NULL;
+static DCACHE_ENTRY **dcache_hash;
+static DCACHE_ENTRY *dcache_head, *dcache_tail;
+
+static uint32_t dcache_stats[DCACHE_STAT_LEN];
+
+static uint32_t dcache_bucket(uint16_t mount, uint32_t parent, const char *name, uint32_t len);
+static DCACHE_ENTRY *dcache_find(uint16_t mount, uint32_t parent, const char *name, uint32_t len);
+static void dcache_unhash(DCACHE_ENTRY *e);
+static void dcache_unlink(DCACHE_ENTRY *e);
+static void dcache_touch(DCACHE_ENTRY *e);
+static void dcache_drop(DCACHE_ENTRY *e);
+
+void dcache_init(void)
+{
+    uint32_t i;
+
+    dcache_entries = kmalloc(DCACHE_ENTRIES * sizeof(DCACHE_ENTRY));
+    dcache_hash = kmalloc(DCACHE_BUCKETS * sizeof(DCACHE_ENTRY *));
+
+    // without a dentry cache every lookup goes to the disk
+    if(!dcache_entries || !dcache_hash)
+    {
+        kfree(dcache_entries);
+        kfree(dcache_hash);
+        dcache_entries = NULL;
+        return;
+    }
+
+    memset((char *) dcache_hash, DCACHE_BUCKETS * sizeof(DCACHE_ENTRY *), 0);
+
+    for(i = 0; i < DCACHE_ENTRIES; ++i)
+    {
+        dcache_entries[i].mount = DCACHE_NO_MOUNT;
+        dcache_entries[i].hash_next = NULL;
+        dcache_entries[i].prev = (i == 0) ? NULL : &dcache_entries[i - 1];
+        dcache_entries[i].next = (i == DCACHE_ENTRIES - 1) ? NULL : &dcache_entries[i + 1];
+    }
+
+    dcache_head = &dcache_entries[0];
+    dcache_tail = &dcache_entries[DCACHE_ENTRIES - 1];
+
+    memset((char *) dcache_stats, sizeof(dcache_stats), 0);
+
+    #ifndef NO_DEBUG_INFO
+    print_value("[DCACHE] %i entries\n", DCACHE_ENTRIES);
+    #endif
+}
+
+unsigned char dcache_lookup(uint16_t mount, uint32_t parent, const char *name, uint32_t len, DENTRY *dentry)
+{
+    DCACHE_ENTRY *e;
+
+    if(!dcache_entries || len > DCACHE_NAME_LEN)
+        return DCACHE_MISS;
+
+    if((e = dcache_find(mount, parent, name, len)) == NULL)
+    {
+        dcache_stats[DCACHE_STAT_MISSES]++;
+        return DCACHE_MISS;
+    }
+
+    dcache_touch(e);
+
+    if(e->negative)
+    {
+        dcache_stats[DCACHE_STAT_NEGATIVE]++;
+        return DCACHE_NEGATIVE;
+    }
+
+    *(dentry) = e->dentry;
+    dcache_stats[DCACHE_STAT_HITS]++;
+
+    return DCACHE_HIT;
+}
+
+// a NULL dentry remembers that the name does not exist in the parent
+void dcache_add(uint16_t mount, uint32_t parent, const char *name, uint32_t len, const DENTRY *dentry)
+{
+    DCACHE_ENTRY *e;
+
+    if(!dcache_entries || !len || len > DCACHE_NAME_LEN || mount == DCACHE_NO_MOUNT)
+        return;
+
+    if((e = dcache_find(mount, parent, name, len)) == NULL)
+    {
+        // reuse the least recently used entry
+        e = dcache_tail;
+
+        if(e->mount != DCACHE_NO_MOUNT)
+        {
+            dcache_unhash(e);
+            dcache_stats[DCACHE_STAT_EVICTIONS]++;
+        }
+        else
+            dcache_stats[DCACHE_STAT_ENTRIES]++;
+
+        uint32_t bucket = dcache_bucket(mount, parent, name, len);
+
+        e->mount = mount;
+        e->parent = parent;
+        e->name_len = (uint8_t) len;
+        memcpy(e->name, (char *) name, len);
+
+        e->hash_next = dcache_hash[bucket];
+        dcache_hash[bucket] = e;
+    }
+
+    e->negative = (dentry == NULL);
+
+    if(dentry)
+        e->dentry = *(dentry);
+
+    dcache_touch(e);
+}
+
+// call after changing a directory on the mount, DCACHE_ALL_MOUNTS forgets everything
+void dcache_invalidate(uint16_t mount)
+{
+    uint32_t i;
+
+    if(!dcache_entries)
+        return;
+
+    for(i = 0; i < DCACHE_ENTRIES; ++i)
+        if(dcache_entries[i].mount != DCACHE_NO_MOUNT && (mount == DCACHE_ALL_MOUNTS || dcache_entries[i].mount == mount))
+            dcache_drop(&dcache_entries[i]);
+}
+
+void dcache_get_stats(uint32_t *stats)
+{
+    memcpy((char *) stats, (char *) dcache_stats, sizeof(dcache_stats));
+}
+
+static uint32_t dcache_bucket(uint16_t mount, uint32_t parent, const char *name, uint32_t len)
+{
+    // seeded with where it lives
+    return name_hash(parent ^ ((uint32_t) mount << 16U), name, len) & (DCACHE_BUCKETS - 1);
+}
+
+static DCACHE_ENTRY *dcache_find(uint16_t mount, uint32_t parent, const char *name, uint32_t len)
+{
+    DCACHE_ENTRY *e = dcache_hash[dcache_bucket(mount, parent, name, len)];
+
+    for(; e != NULL; e = e->hash_next)
+        if(e->mount == mount && e->parent == parent && e->name_len == len && !memcmp(e->name, name, len))
+            return e;
+
+    return NULL;
+}
+
+static void dcache_unhash(DCACHE_ENTRY *e)
+{
+    DCACHE_ENTRY **p = &dcache_hash[dcache_bucket(e->mount, e->parent, e->name, e->name_len)];
+
+    while(*p != NULL && *p != e)
+        p = &((*p)->hash_next);
+
+    if(*p)
+        *p = e->hash_next;
+
+    e->hash_next = NULL;
+}
+
+static void dcache_unlink(DCACHE_ENTRY *e)
+{
+    if(e->prev)
+        e->prev->next = e->next;
+    else
+        dcache_head = e->next;
+
+    if(e->next)
+        e->next->prev = e->prev;
+    else
+        dcache_tail = e->prev;
+}
+
+// makes the entry the most recently used one
+static void dcache_touch(DCACHE_ENTRY *e)
+{
+    if(e == dcache_head)
+        return;
+
+    dcache_unlink(e);
+
+    e->prev = NULL;
+    e->next = dcache_head;
+    dcache_head->prev = e;
+    dcache_head = e;
+}
+
+// frees the entry and puts it at the end of the list, so it's the first to be reused
+static void dcache_drop(DCACHE_ENTRY *e)
+{
+    dcache_unhash(e);
+    e->mount = DCACHE_NO_MOUNT;
+    dcache_stats[DCACHE_STAT_ENTRIES]--;
+
+    if(e == dcache_tail)
+        return;
+
+    dcache_unlink(e);
+
+    e->next = NULL;
+    e->prev = dcache_tail;
+    dcache_tail->next = e;
+    dcache_tail = e;
+}
@@ -0,0 +1,58 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef __DCACHE_H__
+#define __DCACHE_H__
+
+#define DCACHE_NAME_LEN         32      // longer names are not cached
+#define DCACHE_ALL_MOUNTS       0xFFFF
+
+// a mount is a drive and a partition, the same way convert_drive_id() puts them together
+#define DCACHE_MOUNT(drive, partition)  ((unsigned short) ((((drive) & 0xFFU) << 8U) | ((partition) & 0xFFU)))
+
+// returned by dcache_lookup()
+#define DCACHE_MISS             0       // the cache doesn't know, ask the disk
+#define DCACHE_HIT              1       // the entry was copied to the dentry
+#define DCACHE_NEGATIVE         2       // the name is known not to exist
+
+// indices in the array filled by dcache_get_stats()
+#define DCACHE_STAT_HITS        0       // lookups answered with an entry
+#define DCACHE_STAT_NEGATIVE    1       // lookups answered with 'does not exist'
+#define DCACHE_STAT_MISSES      2       // lookups the filesystem had to do itself
+#define DCACHE_STAT_EVICTIONS   3       // entries thrown out to make room for another one
+#define DCACHE_STAT_ENTRIES     4       // entries in use
+#define DCACHE_STAT_LEN         5
+
+typedef struct
+{
+    unsigned int start;                 // first sector (ISO9660) or cluster (FAT) of the file or directory
+    unsigned int size;                  // in bytes
+    unsigned char attrib;               // whatever the filesystem keeps as attributes
+} DENTRY;
+
+void dcache_init(void);
+unsigned char dcache_lookup(unsigned short mount, unsigned int parent, const char *name, unsigned int len, DENTRY *dentry);
+void dcache_add(unsigned short mount, unsigned int parent, const char *name, unsigned int len, const DENTRY *dentry);
+void dcache_invalidate(unsigned short mount);
+void dcache_get_stats(unsigned int *stats);
+
+#endif
@@ -0,0 +1,43 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __DISKCMD_H__
+#define __DISKCMD_H__
+
+#include "sglist.h"
+
+#define DISK_CMD_PENDING    0xFF    /* DISK_CMD.status while the drive is working on it */
+
+/* a read that is handed to the drive with the SUBMIT command of the AHCI and virtio-blk drivers
+   (see AHCI_commands.h). The driver returns right away, its IRQ handler sets status when the drive
+   is done. The command and the buffers it points to have to stay around until then. */
+typedef struct DISK_CMD
+{
+    unsigned int LBA;
+    unsigned int sctr;
+    const SG_ENTRY *sg;
+    volatile unsigned char status;  /* DISK_CMD_PENDING, then the exit code */
+    void *data;                     /* for whoever submitted it, the driver doesn't touch it */
+} DISK_CMD;
+
+#endif
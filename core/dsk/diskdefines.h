@@ -26,9 +26,18 @@ SOFTWARE.
 
 #define DRIVE_TYPE_IDE_PATA    0x00
 #define DRIVE_TYPE_IDE_PATAPI  0x01
+#define DRIVE_TYPE_SATA        0x02
+#define DRIVE_TYPE_SATAPI      0x03
+#define DRIVE_TYPE_VIRTIO      0x04
 #define DRIVE_TYPE_UNKNOWN     0xFF
 
+/* hard disks and CD drives, whatever they're connected to */
+#define DRIVE_TYPE_IS_HD(type)  ((type) == DRIVE_TYPE_IDE_PATA || (type) == DRIVE_TYPE_SATA || (type) == DRIVE_TYPE_VIRTIO)
+#define DRIVE_TYPE_IS_CD(type)  ((type) == DRIVE_TYPE_IDE_PATAPI || (type) == DRIVE_TYPE_SATAPI)
+
 #define IDE_DRIVER_MAX_DRIVES   4
-#define MAX_DRIVES    IDE_DRIVER_MAX_DRIVES /*TODO: + floppy's + ... */
+#define AHCI_DRIVER_MAX_DRIVES  8
+#define VIRTIO_DRIVER_MAX_DRIVES 1
+#define MAX_DRIVES    (IDE_DRIVER_MAX_DRIVES + AHCI_DRIVER_MAX_DRIVES + VIRTIO_DRIVER_MAX_DRIVES) /*TODO: + floppy's + ... */
 
 #endif
@@ -22,6 +22,9 @@ SOFTWARE.
 */
 
 #include "diskio.h"
+#include "diskcmd.h"
+#include "cache.h"
+#include "dcache.h"
 
 #include "../include/types.h"
 #include "../dsk/diskdefines.h"
@@ -29,50 +32,185 @@ SOFTWARE.
 
 #include "../hardware/driver.h"
 #include "../hardware/pci.h"
+#include "../hardware/timer.h"
+
+#include "../cpu/cpu.h"
 
 #include "../memory/memory.h"
 
 #include "../util/util.h"
 
 #include "../drv/IDE_commands.h"
+#include "../drv/AHCI_commands.h"
+
+#define DISKIO_MAX_DRIVES MAX_DRIVES /* 4 IDE drives, then the AHCI ones and virtio-blk (, (TODO:) max. 2 floppies) */
+
+#define DISKIO_SECTOR_SIZE      512  // bytes
+#define DISKIO_SECTOR_SIZE_CD   2048 // bytes
+
+#define DISKIO_READAHEAD_MIN    8    // sectors, the first window when a drive is read sequentially
+#define DISKIO_READAHEAD_MAX    64   // sectors, the window doubles up to this
+
+#define DISKIO_MERGE_MAX        64   // sectors, reads are merged into one command up to this size
+#define DISKIO_MERGE_REQS       16   // max. requests merged into one command
 
-#define DISKIO_MAX_DRIVES 4 /* max. 4 IDE drives (, (TODO:) max. 2 floppies) */
+#define DISKIO_MAX_INFLIGHT     32   // max. reads queued at a drive at once (NCQ's limit)
+
+#define DISKIO_REQUEST_IS_READ(r)   ((r)->command == DISKIO_REQUEST_READ || (r)->command == DISKIO_REQUEST_PREFETCH)
 
 typedef struct{
     uint8_t diskID;
     uint8_t disktype;
     uint16_t controller_info;
+    uint32_t max_sectors; /* per driver command */
 }__attribute__((packed)) DISKINFO;
 
 DISKINFO disk_info_t[DISKIO_MAX_DRIVES];
 
+typedef struct{
+    uint32_t next;      /* where the next read starts if the drive is read sequentially */
+    uint32_t end;       /* end of what was read ahead */
+    uint32_t window;    /* sectors, 0 when access isn't sequential */
+    DISKIO_REQUEST req; /* the prefetch, only one at a time */
+} READAHEAD;
+
+static READAHEAD readahead_t[DISKIO_MAX_DRIVES];
+static uint8_t readahead_enabled = 1;
+
+/* a read that was handed to the drive with the driver's SUBMIT command, cmd.data is the request (NULL if the slot is free) */
+typedef struct{
+    DISK_CMD cmd;
+    SG_ENTRY sg;
+} DISKIO_INFLIGHT;
+
+/* requests that were submitted but aren't done yet, per drive, oldest first */
+typedef struct DISKIO_QUEUE{
+    DISKIO_REQUEST *head;
+    DISKIO_REQUEST *tail;
+    uint32_t position;  /* where the last command ended, for the elevator */
+    uint8_t scheduler;  /* DISKIO_SCHED_* */
+    uint32_t stats[DISKIO_SCHED_STAT_LEN];
+    uint8_t depth;      /* reads the drive can have at once, 0 if the driver does one command at a time */
+    uint32_t depth_sectors; /* per read at the drive */
+    uint8_t inflight;   /* reads at the drive right now */
+    DISKIO_INFLIGHT slots[DISKIO_MAX_INFLIGHT];
+} DISKIO_QUEUE;
+
+static DISKIO_QUEUE queue_t[DISKIO_MAX_DRIVES];
+
+/* a scheduler picks which of the queued requests goes to the drive next */
+typedef DISKIO_REQUEST *(*DISKIO_SCHEDULER)(DISKIO_QUEUE *q);
+
+static DISKIO_REQUEST *diskio_sched_noop(DISKIO_QUEUE *q);
+static DISKIO_REQUEST *diskio_sched_clook(DISKIO_QUEUE *q);
+
+// indexed by DISKIO_SCHED_*
+static const DISKIO_SCHEDULER diskio_schedulers[DISKIO_SCHED_COUNT] = {diskio_sched_noop, diskio_sched_clook};
+
+static void diskio_add_controller(uint8_t subclass, uint8_t first, uint8_t ndrives);
+static uint8_t diskio_check(uint32_t command, uint8_t drive);
+static uint32_t diskio_sector_size(uint8_t drive);
+static void diskio_readahead(uint8_t drive, uint32_t LBA, uint32_t sctr);
+static void diskio_enqueue(DISKIO_REQUEST *req);
+static uint8_t diskio_run_one(uint8_t drive);
+static void diskio_complete(DISKIO_REQUEST *req);
+static uint8_t diskio_queue_read(uint8_t drive, DISKIO_REQUEST *req);
+static uint8_t diskio_reap(uint8_t drive);
+static void diskio_idle(uint8_t drive);
+static uint8_t diskio_slotDone(void *queue);
+static void diskio_unlink(DISKIO_QUEUE *q, DISKIO_REQUEST *req);
+static DISKIO_REQUEST *diskio_conflict(DISKIO_QUEUE *q, DISKIO_REQUEST *req);
+static DISKIO_REQUEST *diskio_find_merge(DISKIO_QUEUE *q, uint32_t start, uint32_t end);
+static uint8_t diskio_transfer_sg(uint32_t command, uint8_t drive, uint32_t LBA, uint32_t sctr, const SG_ENTRY *sg);
+static uint8_t diskio_transfer(uint32_t command, uint8_t drive, uint32_t LBA, uint32_t sctr, SG_ENTRY *list);
+
 void diskio_init(void)
 {
     uint8_t i;
-    uint32_t *devicelist, IDE_ctrl;
+
+    for(i = 0; i < DISKIO_MAX_DRIVES; ++i)
+    {
+        disk_info_t[i].disktype = DRIVE_TYPE_UNKNOWN;
+        readahead_t[i].next = readahead_t[i].end = readahead_t[i].window = 0;
+        readahead_t[i].req.status = EXIT_CODE_GLOBAL_SUCCESS;
+        queue_t[i].head = queue_t[i].tail = NULL;
+        queue_t[i].position = 0;
+        queue_t[i].scheduler = DISKIO_SCHED_CLOOK;
+        queue_t[i].depth = queue_t[i].inflight = 0;
+        memset((char *) queue_t[i].stats, sizeof(queue_t[i].stats), 0);
+    }
+
+    // the IDE drives come first, so their numbers don't change when there's an AHCI controller too
+    diskio_add_controller(0x01, 0, IDE_DRIVER_MAX_DRIVES);
+    diskio_add_controller(0x06, IDE_DRIVER_MAX_DRIVES, AHCI_DRIVER_MAX_DRIVES);
+    diskio_add_controller(0x00, IDE_DRIVER_MAX_DRIVES + AHCI_DRIVER_MAX_DRIVES, VIRTIO_DRIVER_MAX_DRIVES);
+
+    cache_init();
+    dcache_init();
+}
+
+/* asks the driver of the mass storage controller (PCI class 0x01) with this subclass which drives it has,
+   they become drives first to first + ndrives - 1 */
+static void diskio_add_controller(uint8_t subclass, uint8_t first, uint8_t ndrives)
+{
+    uint8_t i;
+    uint32_t *devicelist, ctrl;
     uint32_t *drv = kmalloc(sizeof(uint32_t) * DRIVER_COMMAND_PACKET_LEN);
-    
-    // drive list
-    uint8_t *drives = (uint8_t *)((uint32_t)drv) + sizeof(uint32_t)*DRIVER_COMMAND_PACKET_LEN;
+    uint8_t *drives = kmalloc(ndrives);
 
-    devicelist = pciGetDevices(0x01, 0x01);
-    IDE_ctrl = devicelist[1];
+    devicelist = pciGetDevices(0x01, subclass);
+    ctrl = (devicelist[0] > 1) ? devicelist[1] : 0;
     kfree(devicelist);
 
-    // prepare and exec IDE report command
+    // no such controller, so no driver to ask either
+    if(!ctrl || !drv || !drives)
+    {
+        kfree(drives);
+        kfree(drv);
+        return;
+    }
+
+    // prepare and exec report command (same number for IDE, AHCI and virtio-blk)
+    memset((char *) drives, ndrives, (char) DRIVE_TYPE_UNKNOWN);
     drv[0] = IDE_COMMAND_REPORTDRIVES;
     drv[1] = (uint32_t) (drives);
-    driver_exec(pciGetInfo(IDE_ctrl) | DRIVER_TYPE_PCI, drv); 
+    driver_exec(pciGetInfo(ctrl) | DRIVER_TYPE_PCI, drv); 
 
-    for(i = 0; i < DISKIO_MAX_DRIVES; ++i)
+    for(i = 0; i < ndrives; ++i)
     {
         // disks are returned in order with their type being stored at the 
-        // index of the drive number (see IDE_commands.h for more info)
-        disk_info_t[i].disktype = (uint8_t) drives[i];
-        disk_info_t[i].diskID = i; 
-        disk_info_t[i].controller_info = (uint16_t) pciGetInfo(IDE_ctrl);
+        // index of the drive number (see IDE_commands.h, AHCI_commands.h and VIRTIO_commands.h)
+        disk_info_t[first + i].disktype = (uint8_t) drives[i];
+        disk_info_t[first + i].diskID = i; 
+        disk_info_t[first + i].controller_info = (uint16_t) pciGetInfo(ctrl);
+        disk_info_t[first + i].max_sectors = 0;
+
+        if(disk_info_t[first + i].disktype == DRIVE_TYPE_UNKNOWN)
+            continue;
+
+        // there's no head to move around on a virtual drive, just keep the order
+        if(disk_info_t[first + i].disktype == DRIVE_TYPE_VIRTIO)
+            queue_t[first + i].scheduler = DISKIO_SCHED_NOOP;
+
+        /* read() and write() split everything up in commands this big */
+        drv[0] = IDE_COMMAND_GET_MAX_SECTORS;
+        drv[1] = (uint32_t) i;
+        drv[2] = 0;
+        driver_exec(pciGetInfo(ctrl) | DRIVER_TYPE_PCI, drv);
+
+        disk_info_t[first + i].max_sectors = drv[2];
+
+        /* AHCI drives with NCQ and virtio-blk take reads while they're busy with others (IDE doesn't have the command) */
+        drv[0] = AHCI_COMMAND_GET_QUEUE;
+        drv[1] = (uint32_t) i;
+        drv[2] = drv[3] = 0;
+        driver_exec(pciGetInfo(ctrl) | DRIVER_TYPE_PCI, drv);
+
+        queue_t[first + i].depth = (uint8_t) ((drv[2] > DISKIO_MAX_INFLIGHT) ? DISKIO_MAX_INFLIGHT : drv[2]);
+        queue_t[first + i].depth_sectors = drv[3];
     }
 
+    kfree(drives);
     kfree(drv);
 }
 
@@ -81,60 +219,192 @@ uint8_t *diskio_reportDrives(void)
     uint32_t i = 0;
     uint8_t *drive_list = (uint8_t *) kmalloc(DISKIO_MAX_DRIVES*sizeof(uint32_t));
 
-    for(; i < IDE_DRIVER_MAX_DRIVES; ++i)
+    for(; i < DISKIO_MAX_DRIVES; ++i)
         drive_list[i] = disk_info_t[i].disktype;
 
     return drive_list;
 }
 
-uint8_t read(unsigned char drive, unsigned int LBA, unsigned int sctrRead, unsigned char *buf)
+/* queues req on its drive, returns non-zero (and doesn't queue it) if the request can't be done.
+   req has to stay around until it is done: the callback is called, or status isn't DISKIO_STATUS_PENDING
+   anymore. diskio_wait() and diskio_poll() hand the requests to the drive, as many reads at once as it
+   takes (AHCI with NCQ and virtio-blk, see diskio_queue_read()), the others one by one. The drivers' IRQ
+   handlers finish those reads, their callbacks are called by diskio_wait() and diskio_poll() too.
+   Don't submit from an IRQ handler, the drivers wait on their own IRQs. */
+uint8_t diskio_submit(DISKIO_REQUEST *req)
 {
-    uint32_t *drv = kmalloc(sizeof(uint32_t) * DRIVER_COMMAND_PACKET_LEN);
-    uint8_t disk_type = disk_info_t[drive].disktype;
-    uint32_t command = (disk_type == DRIVE_TYPE_IDE_PATA || disk_type == DRIVE_TYPE_IDE_PATAPI ) ?
-            IDE_COMMAND_READ : NULL; /* TODO: make NULL floppy command */
+    uint8_t error;
 
-    if(drive > DISKIO_MAX_DRIVES)
-        return EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+    if(req->command == DISKIO_REQUEST_PREFETCH)
+        return EXIT_CODE_GLOBAL_UNSUPPORTED;
 
-    drv[0] = command;
-    drv[1] = (uint32_t) (drive);
-    drv[2] = LBA;
-    drv[3] = sctrRead;
-    drv[4] = (uint32_t) (buf);
+    error = diskio_check((req->command == DISKIO_REQUEST_WRITE) ? IDE_COMMAND_WRITE : IDE_COMMAND_READ, req->drive);
 
-    driver_exec((uint32_t) (disk_info_t[drive].controller_info | DRIVER_TYPE_PCI), drv);
+    if(error)
+        return error;
 
-    if(drv[4] == NULL)
-        return (uint8_t) drv[1];
-
-    kfree(drv);
+    diskio_enqueue(req);
 
     return EXIT_CODE_GLOBAL_SUCCESS;
 }
 
+/* does the requests of req's drive until req is done, returns: its exit code */
+uint8_t diskio_wait(DISKIO_REQUEST *req)
+{
+    while(req->status == DISKIO_STATUS_PENDING)
+    {
+        if(diskio_reap(req->drive) || diskio_run_one(req->drive))
+            continue;
+
+        if(!queue_t[req->drive].inflight)
+            break;
+
+        diskio_idle(req->drive);
+    }
+
+    return req->status;
+}
+
+/* does everything that was submitted, for when the kernel has nothing better to do */
+void diskio_poll(void)
+{
+    uint8_t i;
+
+    for(i = 0; i < DISKIO_MAX_DRIVES; ++i)
+    {
+        while(1)
+        {
+            if(diskio_reap(i) || diskio_run_one(i))
+                continue;
+
+            if(!queue_t[i].inflight)
+                break;
+
+            diskio_idle(i);
+        }
+    }
+}
+
+uint8_t read(unsigned char drive, unsigned int LBA, unsigned int sctrRead, unsigned char *buf)
+{
+    DISKIO_REQUEST req = {drive, DISKIO_REQUEST_READ, 0, LBA, sctrRead, buf, NULL, NULL, NULL};
+    uint8_t error = diskio_submit(&req);
+
+    if(error)
+        return error;
+
+    return diskio_wait(&req);
+}
+
 uint8_t write(unsigned char drive, unsigned int LBA, unsigned int sctrWrite, unsigned char *buf)
 {
-    uint32_t *drv = kmalloc(sizeof(uint32_t) * DRIVER_COMMAND_PACKET_LEN);
-    uint32_t command = (disk_info_t[drive].disktype == DRIVE_TYPE_IDE_PATA) ?
-            IDE_COMMAND_WRITE : NULL; /* TODO: make NULL floppy command */
+    DISKIO_REQUEST req = {drive, DISKIO_REQUEST_WRITE, 0, LBA, sctrWrite, buf, NULL, NULL, NULL};
+    uint8_t error = diskio_submit(&req);
 
-    drv[0] = command;
-    drv[1] = (uint32_t) (drive);
-    drv[2] = LBA;
-    drv[3] = sctrWrite;
-    drv[4] = (uint32_t) (buf);
+    if(error)
+        return error;
 
-    driver_exec((uint32_t) (disk_info_t[drive].controller_info | DRIVER_TYPE_PCI), drv);
+    return diskio_wait(&req);
+}
 
-    if(drv[4] == NULL)
-        return (uint8_t) drv[1];
+/* reads from the drive itself, without going through the cache */
+uint8_t diskio_read_device(unsigned char drive, unsigned int LBA, unsigned int sctrRead, unsigned char *buf)
+{
+    SG_ENTRY whole = {buf, MAX};
+    uint8_t error = diskio_check(IDE_COMMAND_READ, drive);
 
-    kfree(drv);
+    if(error)
+        return error;
+
+    return diskio_transfer(IDE_COMMAND_READ, drive, LBA, sctrRead, &whole);
+}
+
+/* writes to the drive itself, without going through the cache */
+uint8_t diskio_write_device(unsigned char drive, unsigned int LBA, unsigned int sctrWrite, unsigned char *buf)
+{
+    SG_ENTRY whole = {buf, MAX};
+    uint8_t error = diskio_check(IDE_COMMAND_WRITE, drive);
+
+    if(error)
+        return error;
+
+    return diskio_transfer(IDE_COMMAND_WRITE, drive, LBA, sctrWrite, &whole);
+}
+
+/* reads from the drive itself into the pieces of a scatter-gather list (see sglist.h), 
+   sctrRead can be more than the driver takes with one command */
+uint8_t diskio_read_sg(unsigned char drive, unsigned int LBA, unsigned int sctrRead, const SG_ENTRY *sg)
+{
+    uint8_t error = diskio_check(IDE_COMMAND_READ, drive);
+
+    if(error)
+        return error;
+
+    return diskio_transfer_sg(IDE_COMMAND_READ, drive, LBA, sctrRead, sg);
+}
+
+/* writes the pieces of a scatter-gather list to the drive itself */
+uint8_t diskio_write_sg(unsigned char drive, unsigned int LBA, unsigned int sctrWrite, const SG_ENTRY *sg)
+{
+    uint8_t error = diskio_check(IDE_COMMAND_WRITE, drive);
+
+    if(error)
+        return error;
+
+    return diskio_transfer_sg(IDE_COMMAND_WRITE, drive, LBA, sctrWrite, sg);
+}
+
+/* turns readahead on (non-zero) or off for all drives */
+void diskio_set_readahead(unsigned char enable)
+{
+    uint8_t i;
+
+    readahead_enabled = enable;
+
+    for(i = 0; i < DISKIO_MAX_DRIVES; ++i)
+        readahead_t[i].next = readahead_t[i].end = readahead_t[i].window = 0;
+}
+
+/* returns: the current readahead window of drive in sectors, 0 when it isn't being read sequentially */
+unsigned int diskio_readahead_window(unsigned char drive)
+{
+    if(drive >= DISKIO_MAX_DRIVES)
+        return 0;
+
+    return readahead_t[drive].window;
+}
+
+/* picks the scheduler of drive (DISKIO_SCHED_*) */
+uint8_t diskio_set_scheduler(unsigned char drive, unsigned char scheduler)
+{
+    if(drive >= DISKIO_MAX_DRIVES || scheduler >= DISKIO_SCHED_COUNT)
+        return EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+
+    queue_t[drive].scheduler = scheduler;
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* stats should be an array of DISKIO_SCHED_STAT_LEN entries */
+uint8_t diskio_get_sched_stats(unsigned char drive, unsigned int *stats)
+{
+    if(drive >= DISKIO_MAX_DRIVES)
+        return EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+
+    memcpy((char *) stats, (char *) queue_t[drive].stats, sizeof(queue_t[drive].stats));
 
     return EXIT_CODE_GLOBAL_SUCCESS;
 }
 
+/* writes back whatever the cache still holds for drive (DISKIO_ALL_DRIVES for every drive) */
+uint8_t diskio_flush(unsigned char drive)
+{
+    if(drive != DISKIO_ALL_DRIVES && drive >= DISKIO_MAX_DRIVES)
+        return EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+
+    return cache_flush(drive);
+}
+
 // @returns:
 //   - most significant byte: actual drive number
 //   - least significant byte: actual partition number (when applicable)
@@ -207,7 +477,8 @@ uint8_t to_actual_drive(uint8_t drive, uint8_t type)
     
     for(uint8_t i = 0; i < DISKIO_MAX_DRIVES; ++i)
     {
-        if(drivelist[i] == type)
+        // SATA drives are HDs and CDs all the same
+        if((type == DRIVE_TYPE_IDE_PATA) ? DRIVE_TYPE_IS_HD(drivelist[i]) : DRIVE_TYPE_IS_CD(drivelist[i]))
         {
             nfound++;
 
@@ -218,4 +489,442 @@ uint8_t to_actual_drive(uint8_t drive, uint8_t type)
 
     kfree(drivelist);
     return (uint8_t) MAX;
-}
\ No newline at end of file
+}
+
+static uint8_t diskio_check(uint32_t command, uint8_t drive)
+{
+    uint8_t disk_type;
+
+    if(drive >= DISKIO_MAX_DRIVES)
+        return EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+
+    /* TODO: floppy command */
+    disk_type = disk_info_t[drive].disktype;
+    if(!DRIVE_TYPE_IS_HD(disk_type) && (command == IDE_COMMAND_WRITE || !DRIVE_TYPE_IS_CD(disk_type)))
+        return EXIT_CODE_GLOBAL_UNSUPPORTED;
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+static uint32_t diskio_sector_size(uint8_t drive)
+{
+    return DRIVE_TYPE_IS_CD(disk_info_t[drive].disktype) ? DISKIO_SECTOR_SIZE_CD : DISKIO_SECTOR_SIZE;
+}
+
+static void diskio_enqueue(DISKIO_REQUEST *req)
+{
+    DISKIO_QUEUE *q = &queue_t[req->drive];
+
+    req->status = DISKIO_STATUS_PENDING;
+    req->next = NULL;
+
+    if(q->tail)
+        q->tail->next = req;
+    else
+        q->head = req;
+
+    q->tail = req;
+
+    q->stats[DISKIO_SCHED_STAT_DEPTH]++;
+    if(q->stats[DISKIO_SCHED_STAT_DEPTH] > q->stats[DISKIO_SCHED_STAT_MAX_DEPTH])
+        q->stats[DISKIO_SCHED_STAT_MAX_DEPTH] = q->stats[DISKIO_SCHED_STAT_DEPTH];
+}
+
+/* lets the scheduler pick a request of drive and does it, together with the queued reads right
+   next to it (as one command to the drive). A read the drive can queue is only handed to it.
+   returns: zero if nothing was queued, or the drive has to finish a read first */
+static uint8_t diskio_run_one(uint8_t drive)
+{
+    DISKIO_QUEUE *q = &queue_t[drive];
+    DISKIO_REQUEST *batch[DISKIO_MERGE_REQS];
+    DISKIO_REQUEST *req, *older;
+    uint32_t start, end, n = 1, i;
+    uint8_t queueable;
+
+    if(!q->head)
+        return 0;
+
+    req = diskio_schedulers[q->scheduler](q);
+
+    // a request may not pass an older one it overlaps with, if either writes
+    while((older = diskio_conflict(q, req)) != NULL)
+        req = older;
+
+    // the drive takes it next to the reads it's busy with already, diskio_reap() finishes it.
+    // Whatever the cache has of it is left to cache_read(), it may be newer than what's on the drive
+    queueable = q->depth && req->command == DISKIO_REQUEST_READ && req->sctr <= q->depth_sectors && !cache_contains(drive, req->LBA, req->sctr);
+
+    if(queueable && q->inflight == q->depth)
+        return 0;
+
+    // off the queue first, callbacks may submit (or wait for) other requests
+    diskio_unlink(q, req);
+
+    // if the driver can't take it after all, it's done like the others below
+    if(queueable && !diskio_queue_read(drive, req))
+    {
+        q->stats[DISKIO_SCHED_STAT_DISPATCHED]++;
+        q->stats[DISKIO_SCHED_STAT_SEEK] += (req->LBA > q->position) ? req->LBA - q->position : q->position - req->LBA;
+        q->position = req->LBA + req->sctr;
+
+        if(q->inflight > q->stats[DISKIO_SCHED_STAT_MAX_INFLIGHT])
+            q->stats[DISKIO_SCHED_STAT_MAX_INFLIGHT] = q->inflight;
+
+        return 1;
+    }
+
+    batch[0] = req;
+    start = req->LBA;
+    end = req->LBA + req->sctr;
+
+    // writes stay in the cache anyway, flushing it merges those
+    while(DISKIO_REQUEST_IS_READ(req) && n < DISKIO_MERGE_REQS && (batch[n] = diskio_find_merge(q, start, end)) != NULL)
+    {
+        diskio_unlink(q, batch[n]);
+
+        start = (batch[n]->LBA < start) ? batch[n]->LBA : start;
+        end = (batch[n]->LBA + batch[n]->sctr > end) ? batch[n]->LBA + batch[n]->sctr : end;
+        n++;
+    }
+
+    q->stats[DISKIO_SCHED_STAT_DISPATCHED]++;
+    q->stats[DISKIO_SCHED_STAT_MERGED] += n - 1;
+    q->stats[DISKIO_SCHED_STAT_SEEK] += (start > q->position) ? start - q->position : q->position - start;
+    q->position = end;
+
+    // one command for all of them, then they all find their sectors in the cache
+    if(n > 1)
+        cache_prefetch(drive, start, end - start, diskio_sector_size(drive), 0);
+
+    for(i = 0; i < n; ++i)
+        diskio_complete(batch[i]);
+
+    return 1;
+}
+
+static void diskio_complete(DISKIO_REQUEST *req)
+{
+    uint32_t sector_size = diskio_sector_size(req->drive);
+
+    switch(req->command)
+    {
+        case DISKIO_REQUEST_READ:
+            req->status = cache_read(req->drive, req->LBA, req->sctr, req->buf, sector_size);
+
+            if(!req->status && readahead_enabled)
+                diskio_readahead(req->drive, req->LBA, req->sctr);
+        break;
+
+        case DISKIO_REQUEST_WRITE:
+            req->status = cache_write(req->drive, req->LBA, req->sctr, req->buf, sector_size);
+        break;
+
+        case DISKIO_REQUEST_PREFETCH:
+            cache_prefetch(req->drive, req->LBA, req->sctr, sector_size, 1);
+            req->status = EXIT_CODE_GLOBAL_SUCCESS;
+        break;
+
+        default:
+            req->status = EXIT_CODE_GLOBAL_UNSUPPORTED;
+        break;
+    }
+
+    if(req->callback)
+        req->callback(req);
+}
+
+/* hands req to the drive in a free slot with the driver's SUBMIT command, returns: non-zero if the driver didn't take it */
+static uint8_t diskio_queue_read(uint8_t drive, DISKIO_REQUEST *req)
+{
+    DISKIO_QUEUE *q = &queue_t[drive];
+    DISKIO_INFLIGHT *f = q->slots;
+    uint32_t drv[DRIVER_COMMAND_PACKET_LEN];
+
+    while(f->cmd.data)
+        f++;
+
+    f->sg.buf = req->buf;
+    f->sg.size = req->sctr * diskio_sector_size(drive);
+    f->cmd.LBA = req->LBA;
+    f->cmd.sctr = req->sctr;
+    f->cmd.sg = &f->sg;
+    f->cmd.status = EXIT_CODE_GLOBAL_GENERAL_FAIL; /* the driver makes it DISK_CMD_PENDING when it took it */
+
+    drv[0] = AHCI_COMMAND_SUBMIT;
+    drv[1] = (uint32_t) (disk_info_t[drive].diskID);
+    drv[2] = drv[3] = 0;
+    drv[4] = (uint32_t) (&f->cmd);
+
+    driver_exec((uint32_t) (disk_info_t[drive].controller_info | DRIVER_TYPE_PCI), drv);
+
+    if(drv[4] == NULL)
+        return (uint8_t) drv[1];
+
+    f->cmd.data = req;
+    q->inflight++;
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* finishes the reads of drive the driver's IRQ handler said are done, like diskio_complete() does with the others.
+   returns: non-zero if there were any */
+static uint8_t diskio_reap(uint8_t drive)
+{
+    DISKIO_QUEUE *q = &queue_t[drive];
+    DISKIO_INFLIGHT *f;
+    DISKIO_REQUEST *req;
+    uint8_t i, n = 0;
+
+    for(i = 0; i < q->depth && q->inflight; ++i)
+    {
+        f = &q->slots[i];
+
+        if(!f->cmd.data || f->cmd.status == DISK_CMD_PENDING)
+            continue;
+
+        // the slot is free first, callbacks may submit (or wait for) other requests
+        req = f->cmd.data;
+        f->cmd.data = NULL;
+        q->inflight--;
+        n++;
+
+        req->status = f->cmd.status;
+
+        if(!req->status)
+        {
+            cache_fill(drive, req->LBA, req->sctr, req->buf, diskio_sector_size(drive));
+
+            if(readahead_enabled)
+                diskio_readahead(drive, req->LBA, req->sctr);
+        }
+
+        if(req->callback)
+            req->callback(req);
+    }
+
+    return (n) ? 1 : 0;
+}
+
+/* nothing to do until the drive finished a read, lets the driver check on them (it gives up on a
+   drive that doesn't answer) and halts until the next IRQ (the timer's, if it's not the drive's) */
+static void diskio_idle(uint8_t drive)
+{
+    DISKIO_QUEUE *q = &queue_t[drive];
+    uint32_t drv[DRIVER_COMMAND_PACKET_LEN];
+
+    drv[0] = AHCI_COMMAND_POLL;
+    drv[1] = (uint32_t) (disk_info_t[drive].diskID);
+    driver_exec((uint32_t) (disk_info_t[drive].controller_info | DRIVER_TYPE_PCI), drv);
+
+    /* a tick at most, then the caller checks on the drive again */
+    CPU_irq_wait(diskio_slotDone, q, timer_getCurrentTick() + 1, 0);
+}
+
+static uint8_t diskio_slotDone(void *queue)
+{
+    DISKIO_QUEUE *q = (DISKIO_QUEUE *) queue;
+    uint8_t i;
+
+    for(i = 0; i < q->depth; ++i)
+        if(q->slots[i].cmd.data && q->slots[i].cmd.status != DISK_CMD_PENDING)
+            return 1;
+
+    return 0;
+}
+
+static void diskio_unlink(DISKIO_QUEUE *q, DISKIO_REQUEST *req)
+{
+    DISKIO_REQUEST *prev = NULL, *r = q->head;
+
+    while(r != req)
+    {
+        prev = r;
+        r = r->next;
+    }
+
+    if(prev)
+        prev->next = req->next;
+    else
+        q->head = req->next;
+
+    if(q->tail == req)
+        q->tail = prev;
+
+    req->next = NULL;
+    q->stats[DISKIO_SCHED_STAT_DEPTH]--;
+}
+
+/* returns: the oldest request queued before req that has to be done before it, or NULL */
+static DISKIO_REQUEST *diskio_conflict(DISKIO_QUEUE *q, DISKIO_REQUEST *req)
+{
+    DISKIO_REQUEST *r;
+
+    for(r = q->head; r != req; r = r->next)
+        if(r->LBA < req->LBA + req->sctr && req->LBA < r->LBA + r->sctr && !(DISKIO_REQUEST_IS_READ(r) && DISKIO_REQUEST_IS_READ(req)))
+            return r;
+
+    return NULL;
+}
+
+/* returns: a queued read right before or after sectors start to end that can go with them, or NULL */
+static DISKIO_REQUEST *diskio_find_merge(DISKIO_QUEUE *q, uint32_t start, uint32_t end)
+{
+    DISKIO_REQUEST *r;
+
+    for(r = q->head; r != NULL; r = r->next)
+    {
+        if(!DISKIO_REQUEST_IS_READ(r) || (r->LBA != end && r->LBA + r->sctr != start))
+            continue;
+
+        if(end - start + r->sctr > DISKIO_MERGE_MAX || diskio_conflict(q, r))
+            continue;
+
+        return r;
+    }
+
+    return NULL;
+}
+
+/* first come, first served */
+static DISKIO_REQUEST *diskio_sched_noop(DISKIO_QUEUE *q)
+{
+    return q->head;
+}
+
+/* C-LOOK: the request closest after where the last one ended, back to the lowest LBA when there's none */
+static DISKIO_REQUEST *diskio_sched_clook(DISKIO_QUEUE *q)
+{
+    DISKIO_REQUEST *r, *next = NULL, *lowest = q->head;
+
+    for(r = q->head; r != NULL; r = r->next)
+    {
+        if(r->LBA >= q->position && (next == NULL || r->LBA < next->LBA))
+            next = r;
+
+        if(r->LBA < lowest->LBA)
+            lowest = r;
+    }
+
+    return (next) ? next : lowest;
+}
+
+/* reads ahead into the cache when the drive is being read sequentially, the window doubles
+   every time the reader gets into the second half of what was read ahead before.
+   The prefetch is queued behind whatever was submitted already, so it is done while the kernel
+   is idle or before the next request of the drive. */
+static void diskio_readahead(uint8_t drive, uint32_t LBA, uint32_t sctr)
+{
+    READAHEAD *ra = &readahead_t[drive];
+    uint32_t start;
+
+    // random access (or a big read, which doesn't need any help), forget about the window
+    if(LBA != ra->next || sctr > DISKIO_READAHEAD_MAX)
+    {
+        ra->next = LBA + sctr;
+        ra->end = ra->window = 0;
+        return;
+    }
+
+    ra->next = LBA + sctr;
+
+    if(ra->end > ra->next + ra->window / 2U)
+        return;
+
+    ra->window = (ra->window) ? ra->window * 2U : DISKIO_READAHEAD_MIN;
+    ra->window = (ra->window > DISKIO_READAHEAD_MAX) ? DISKIO_READAHEAD_MAX : ra->window;
+
+    // the last one is still queued
+    if(ra->req.status == DISKIO_STATUS_PENDING)
+        return;
+
+    start = (ra->end > ra->next) ? ra->end : ra->next;
+
+    ra->req.drive = drive;
+    ra->req.command = DISKIO_REQUEST_PREFETCH;
+    ra->req.LBA = start;
+    ra->req.sctr = ra->next + ra->window - start;
+    ra->req.buf = NULL;
+    ra->req.callback = NULL;
+    diskio_enqueue(&ra->req);
+
+    ra->end = ra->next + ra->window;
+}
+
+/* splits the transfer up in the biggest commands the driver takes */
+static uint8_t diskio_transfer_sg(uint32_t command, uint8_t drive, uint32_t LBA, uint32_t sctr, const SG_ENTRY *sg)
+{
+    uint32_t total = sctr * diskio_sector_size(drive);
+    uint32_t bytes, count;
+    SG_ENTRY *list;
+    uint8_t error;
+
+    // fits in one command, the driver gets the list as it is
+    if(sctr <= disk_info_t[drive].max_sectors)
+        return diskio_transfer(command, drive, LBA, sctr, (SG_ENTRY *) sg);
+
+    for(count = 0, bytes = 0; bytes < total; ++count)
+        bytes += sg[count].size;
+
+    if(!(list = kmalloc(count * sizeof(SG_ENTRY))))
+        return EXIT_CODE_OUT_OF_MEMORY;
+
+    memcpy((char *) list, (char *) sg, count * sizeof(SG_ENTRY));
+
+    error = diskio_transfer(command, drive, LBA, sctr, list);
+
+    kfree(list);
+
+    return error;
+}
+
+/* splits the transfer up in the biggest commands the driver takes, every command gets the
+   scatter-gather list from where the last one ended (so list is changed when there's more than one) */
+static uint8_t diskio_transfer(uint32_t command, uint8_t drive, uint32_t LBA, uint32_t sctr, SG_ENTRY *list)
+{
+    uint32_t drv[DRIVER_COMMAND_PACKET_LEN];
+    uint32_t sector_size = diskio_sector_size(drive);
+    uint32_t max = disk_info_t[drive].max_sectors;
+    uint32_t n, left;
+    uint8_t error = EXIT_CODE_GLOBAL_SUCCESS;
+    SG_ENTRY *entry;
+    SG_POS pos;
+    uint8_t *ptr;
+
+    if(!max)
+        error = EXIT_CODE_GLOBAL_UNSUPPORTED;
+
+    sg_start(&pos, list);
+
+    while(sctr && !error)
+    {
+        n = (sctr > max) ? max : sctr;
+
+        // the command may start in the middle of an entry, that entry then starts there
+        ptr = sg_ptr(&pos, &left);
+        entry = &list[pos.entry - list];
+
+        if(pos.offset)
+        {
+            entry->buf = ptr;
+            entry->size = left;
+            pos.offset = 0;
+        }
+
+        drv[0] = command;
+        drv[1] = (uint32_t) (disk_info_t[drive].diskID) | DRIVE_SG;
+        drv[2] = LBA;
+        drv[3] = n;
+        drv[4] = (uint32_t) (entry);
+
+        driver_exec((uint32_t) (disk_info_t[drive].controller_info | DRIVER_TYPE_PCI), drv);
+
+        if(drv[4] == NULL)
+            error = (uint8_t) drv[1];
+
+        LBA = LBA + n;
+        sctr = sctr - n;
+        sg_advance(&pos, n * sector_size);
+    }
+
+    return error;
+}
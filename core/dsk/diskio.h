@@ -24,6 +24,8 @@ SOFTWARE.
 #ifndef __DISKIO_H__
 #define __DISKIO_H__
 
+#include "sglist.h"
+
 #define DISKIO_DISKID_HD    "HD"    // HDD
 #define DISKIO_DISKID_CD    "CD"    // CD/DVD drive
 #define DISKIO_DISKID_P     'P'    // partition
@@ -32,10 +34,58 @@ SOFTWARE.
 #define DISKIO_DISK_NUMBER  8U
 #define DISKIO_PART_NUMBER  16U
 
+#define DISKIO_ALL_DRIVES   0xFF    // for diskio_flush()
+
+// DISKIO_REQUEST.command
+#define DISKIO_REQUEST_READ         0x00
+#define DISKIO_REQUEST_WRITE        0x01
+#define DISKIO_REQUEST_PREFETCH     0x02    // into the cache only, buf isn't used
+
+#define DISKIO_STATUS_PENDING       0xFF    // DISKIO_REQUEST.status until the request is done
+
+// schedulers for diskio_set_scheduler()
+#define DISKIO_SCHED_NOOP           0x00    // in the order they were submitted (SSDs, virtual drives)
+#define DISKIO_SCHED_CLOOK          0x01    // elevator, one direction (rotating disks, default)
+#define DISKIO_SCHED_COUNT          2
+
+// indices in the array filled by diskio_get_sched_stats()
+#define DISKIO_SCHED_STAT_DEPTH         0   // requests queued right now
+#define DISKIO_SCHED_STAT_MAX_DEPTH     1   // most requests ever queued at the same time
+#define DISKIO_SCHED_STAT_DISPATCHED    2   // commands sent to the drive (or the cache)
+#define DISKIO_SCHED_STAT_MERGED        3   // requests that went along with another one's command
+#define DISKIO_SCHED_STAT_SEEK          4   // sum of the distance (in sectors) between commands
+#define DISKIO_SCHED_STAT_MAX_INFLIGHT  5   // most reads queued at the drive itself at the same time
+#define DISKIO_SCHED_STAT_LEN           6
+
+typedef struct DISKIO_REQUEST
+{
+    unsigned char drive;
+    unsigned char command;
+    unsigned char status;           /* DISKIO_STATUS_PENDING, then the exit code */
+    unsigned int LBA;
+    unsigned int sctr;
+    unsigned char *buf;
+    void (*callback)(struct DISKIO_REQUEST *req); /* called when done (may be NULL) */
+    void *data;                     /* for the callback, diskio doesn't touch it */
+    struct DISKIO_REQUEST *next;    /* used by the queue */
+} DISKIO_REQUEST;
+
 void diskio_init(void);
 unsigned char *diskio_reportDrives(void);
+unsigned char diskio_submit(DISKIO_REQUEST *req);
+unsigned char diskio_wait(DISKIO_REQUEST *req);
+void diskio_poll(void);
 unsigned char read(unsigned char drive, unsigned int LBA, unsigned int sctrRead, unsigned char *buf);
 unsigned char write(unsigned char drive, unsigned int LBA, unsigned int sctrWrite, unsigned char *buf);
+unsigned char diskio_read_device(unsigned char drive, unsigned int LBA, unsigned int sctrRead, unsigned char *buf);
+unsigned char diskio_write_device(unsigned char drive, unsigned int LBA, unsigned int sctrWrite, unsigned char *buf);
+unsigned char diskio_read_sg(unsigned char drive, unsigned int LBA, unsigned int sctrRead, const SG_ENTRY *sg);
+unsigned char diskio_write_sg(unsigned char drive, unsigned int LBA, unsigned int sctrWrite, const SG_ENTRY *sg);
+unsigned char diskio_flush(unsigned char drive);
+void diskio_set_readahead(unsigned char enable);
+unsigned int diskio_readahead_window(unsigned char drive);
+unsigned char diskio_set_scheduler(unsigned char drive, unsigned char scheduler);
+unsigned char diskio_get_sched_stats(unsigned char drive, unsigned int *stats);
 
 unsigned short convert_drive_id(const char *id);
 unsigned char drive_type(const char *id);
@@ -143,8 +143,8 @@ static void MBR_printAll(void)
 static uint8_t MBR_getIDEDrives(uint8_t *drives)
 {
     uint8_t i = 0, disks = 0;
-    for(; i < IDE_DRIVER_MAX_DRIVES; ++i)
-        if(drives[i] == DRIVE_TYPE_IDE_PATA) DISKS[disks++].disk = i;
+    for(; i < MAX_DRIVES; ++i)
+        if(DRIVE_TYPE_IS_HD(drives[i])) DISKS[disks++].disk = i;
 
     return disks;
 }
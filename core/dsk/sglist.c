@@ -0,0 +1,69 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "sglist.h"
+
+#include "../include/types.h"
+
+void sg_start(SG_POS *pos, const SG_ENTRY *list)
+{
+    pos->entry = list;
+    pos->offset = 0;
+}
+
+/* for the disk drivers: sets pos to the start of the buffer of a READ or WRITE command packet and takes
+   DRIVE_SG out of the drive. A plain buffer becomes the list in whole (it has to stay around as long as pos). */
+void sg_from_command(SG_POS *pos, SG_ENTRY *whole, uint32_t *drv)
+{
+    if(drv[1] & DRIVE_SG)
+    {
+        drv[1] &= ~DRIVE_SG;
+        sg_start(pos, (const SG_ENTRY *) drv[4]);
+        return;
+    }
+
+    whole->buf = (void *) drv[4];
+    whole->size = MAX;
+    sg_start(pos, whole);
+}
+
+/* returns: the address pos is at, len is set to the bytes left in its entry */
+uint8_t *sg_ptr(SG_POS *pos, uint32_t *len)
+{
+    // empty entries and the ones that were used up are skipped only now, so
+    // sg_advance() never looks past the end of the list
+    while(pos->offset >= pos->entry->size)
+    {
+        pos->offset -= pos->entry->size;
+        pos->entry++;
+    }
+
+    *len = pos->entry->size - pos->offset;
+
+    return (uint8_t *) pos->entry->buf + pos->offset;
+}
+
+void sg_advance(SG_POS *pos, uint32_t bytes)
+{
+    pos->offset += bytes;
+}
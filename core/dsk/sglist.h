@@ -0,0 +1,49 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __SGLIST_H__
+#define __SGLIST_H__
+
+/* OR'd into the drive (parameter1) of the READ and WRITE commands of the disk drivers,
+   parameter4 then points to a scatter-gather list instead of a buffer */
+#define DRIVE_SG    0x80000000U
+
+/* one piece of a scatter-gather list. Every entry is a whole number of sectors
+   and together they hold at least all sectors of the command. */
+typedef struct{
+    void *buf;
+    unsigned int size;  /* bytes */
+} SG_ENTRY;
+
+/* a position in a scatter-gather list */
+typedef struct{
+    const SG_ENTRY *entry;
+    unsigned int offset;
+} SG_POS;
+
+void sg_start(SG_POS *pos, const SG_ENTRY *list);
+void sg_from_command(SG_POS *pos, SG_ENTRY *whole, unsigned int *drv);
+unsigned char *sg_ptr(SG_POS *pos, unsigned int *len);
+void sg_advance(SG_POS *pos, unsigned int bytes);
+
+#endif
@@ -31,6 +31,17 @@ SOFTWARE.
 #include "../screen/screen_basic.h"
 
 #include "../memory/paging.h"
+#include "../memory/memory.h"
+
+#include "../hardware/driver.h"
+
+#include "../drv/FS_commands.h"
+#include "../drv/FS_TYPES.H"
+
+#include "../dsk/diskio.h"
+#include "../dsk/diskdefines.h"
+
+#include "../cpu/cpu.h"
 
 #include "../util/util.h"
 
@@ -55,6 +66,9 @@ SOFTWARE.
 
 #define ELF_PTYPE_LOAD      1
 
+#define ELF_HEADER_READ     2048 // bytes read for the ELF and program headers when loading from a file
+#define ELF_STACK_SIZE      4096
+
 typedef struct
 {
     uint8_t elf_ident[ELF_IDENT_SIZE];
@@ -117,52 +131,225 @@ static uint8_t elf_check_errors(elf_header_t *hdr)
     return EXIT_CODE_GLOBAL_SUCCESS;
 }
 
-static void *elf_load_binary(void *file)
+/* a segment can't have more bytes in the file than it has in memory, they'd be copied past its end */
+static uint8_t elf_check_segments(const elf_header_t *hdr, const elf_program_t *prog)
 {
-    const elf_header_t *hdr = (elf_header_t *) file;
-    const elf_program_t *prog = (elf_program_t *) (file + (hdr->phoff));
+    for(uint32_t i = 0; i < (hdr->phnum); ++i)
+        if((prog[i].type) == ELF_PTYPE_LOAD && (prog[i].file_size) > (prog[i].memsize))
+            return EXIT_CODE_GLOBAL_GENERAL_FAIL;
 
-    uint8_t pid = task_new_pid();
-    void *ptr = 0;
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* the loadable segments are put in one block of pages, at the same distance from each other as in the file.
+   returns: the pages (vfree() them), or NULL when there is no memory */
+static uint8_t *elf_alloc_image(const elf_header_t *hdr, const elf_program_t *prog, uint8_t pid, uint32_t *base)
+{
+    uint32_t start = MAX, end = 0;
 
     for(uint32_t i = 0; i < (hdr->phnum); ++i)
     {
         if((prog[i].type) != ELF_PTYPE_LOAD)
             continue;
-        
-        // allocate page for program thing
-        PAGE_REQ req = {
-            .pid = pid,
-            .attr = PAGE_REQ_ATTR_READ_WRITE,
-            .size = prog[i].memsize
-        };
-        char *loc = valloc(&req);
-        ptr = (!ptr) ? loc : ptr;
-
-        memcpy(loc, (file + prog[i].offset), prog[i].file_size);
+
+        start = (prog[i].vaddr < start) ? prog[i].vaddr : start;
+        end = (prog[i].vaddr + prog[i].memsize > end) ? prog[i].vaddr + prog[i].memsize : end;
     }
 
-    return ptr;
+    if(start >= end)
+        return NULL;
+
+    PAGE_REQ req = {
+        .pid = pid,
+        .attr = PAGE_REQ_ATTR_READ_WRITE | PAGE_REQ_ATTR_ZERO,
+        .size = end - start
+    };
+
+    *(base) = start;
+    return valloc(&req);
 }
 
-uint8_t elf_parse_binary(void **ptr, unsigned int size)
+static uint8_t elf_load_binary(void *file, uint8_t pid, void **image, uint32_t *base)
+{
+    const elf_header_t *hdr = (elf_header_t *) file;
+    const elf_program_t *prog = (elf_program_t *) ((uint8_t *) file + (hdr->phoff));
+
+    if(elf_check_segments(hdr, prog))
+        return EXIT_CODE_GLOBAL_GENERAL_FAIL;
+
+    uint8_t *loc = elf_alloc_image(hdr, prog, pid, base);
+
+    if(!loc)
+        return EXIT_CODE_OUT_OF_MEMORY;
+
+    for(uint32_t i = 0; i < (hdr->phnum); ++i)
+        if((prog[i].type) == ELF_PTYPE_LOAD)
+            memcpy((char *) (loc + prog[i].vaddr - *(base)), (char *) file + prog[i].offset, prog[i].file_size);
+
+    *(image) = loc;
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* returns: the filesystem driver that knows the drive in the path */
+static uint32_t elf_fs_driver(const char *path)
+{
+    return ((drive_type(path) == DRIVE_TYPE_IDE_PATAPI) ? FS_TYPE_ISO : FS_TYPE_FAT32) | DRIVER_TYPE_FS;
+}
+
+/* reads a piece of an open file, the filesystem driver puts it straight into buf */
+static uint8_t elf_read(uint32_t fs, uint32_t handle, uint32_t offset, uint32_t size, void *buf)
+{
+    uint32_t drv[DRIVER_COMMAND_PACKET_LEN] = {FS_COMMAND_READ_AT, handle, offset, size, (uint32_t) buf};
+
+    driver_exec(fs, drv);
+
+    if(drv[4])
+        return (uint8_t) drv[4];
+
+    return (drv[3] == size) ? EXIT_CODE_GLOBAL_SUCCESS : EXIT_CODE_GLOBAL_OUT_OF_RANGE;
+}
+
+static uint8_t elf_load_segments(uint32_t fs, uint32_t handle, const elf_header_t *hdr, uint8_t pid, void **image,
+                                 uint32_t *base)
+{
+    const elf_program_t *prog = (const elf_program_t *) ((const uint8_t *) hdr + (hdr->phoff));
+    uint8_t err = EXIT_CODE_GLOBAL_SUCCESS;
+
+    if(elf_check_segments(hdr, prog))
+        return EXIT_CODE_GLOBAL_GENERAL_FAIL;
+
+    uint8_t *loc = elf_alloc_image(hdr, prog, pid, base);
+
+    if(!loc)
+        return EXIT_CODE_OUT_OF_MEMORY;
+
+    // no copy of the file in between, the segments are read into the pages they'll run from
+    for(uint32_t i = 0; i < (hdr->phnum) && !err; ++i)
+        if((prog[i].type) == ELF_PTYPE_LOAD && prog[i].file_size)
+            err = elf_read(fs, handle, prog[i].offset, prog[i].file_size, loc + prog[i].vaddr - *(base));
+
+    if(err)
+    {
+        vfree(loc);
+        return err;
+    }
+
+    *(image) = loc;
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* the image starts at the lowest vaddr (base), so the entry is at the same distance from it */
+static uint8_t elf_exec(void *image, uint32_t base, uint32_t entry, uint8_t pid)
 {
-    elf_header_t *hdr = (elf_header_t *) *ptr;
+    PAGE_REQ req = {
+        .pid = pid,
+        .attr = PAGE_REQ_ATTR_READ_WRITE | PAGE_REQ_ATTR_ZERO,
+        .size = ELF_STACK_SIZE
+    };
+
+    uint8_t *stack = valloc(&req);
+
+    if(!stack)
+        return EXIT_CODE_OUT_OF_MEMORY;
+
+    // the stack grows down, so it starts at the end of its pages
+    CPU_fpu_switch(pid);
+    asm_exec_call((uint8_t *) image + entry - base, stack + ELF_STACK_SIZE);
+    CPU_fpu_switch(PID_KERNEL);
+    CPU_fpu_release(pid);
+
+    vfree(stack);
+    return EXIT_CODE_GLOBAL_SUCCESS;
+}
+
+/* checks the binary in memory and copies its segments to an image of their own (vfree() it) */
+uint8_t elf_load_buffer(void *file, uint8_t pid, void **image, uint32_t *entry, uint32_t *base)
+{
+    elf_header_t *hdr = (elf_header_t *) file;
     
     uint8_t err;
     if((err = elf_check_errors(hdr)))
         return err;
+
+    *(entry) = (hdr->entry);
+    return elf_load_binary(file, pid, image, base);
+}
+
+/* loads the binary from the file in the path without reading the whole file into memory first,
+   only the headers are. the filesystem driver has to support FS_COMMAND_OPEN */
+uint8_t elf_load_file(const char *path, uint8_t pid, void **image, uint32_t *entry, uint32_t *base)
+{
+    const uint32_t fs = elf_fs_driver(path);
+    uint32_t drv[DRIVER_COMMAND_PACKET_LEN] = {FS_COMMAND_OPEN, (uint32_t) path, 0, 0, 0};
+    uint8_t err;
+
+    driver_exec(fs, drv);
+
+    if(drv[4])
+        return (uint8_t) drv[4];
+
+    const uint32_t handle = drv[2];
+    const uint32_t hsize = (drv[3] < ELF_HEADER_READ) ? drv[3] : ELF_HEADER_READ;
+    elf_header_t *hdr = kmalloc(ELF_HEADER_READ);
+
+    if(!hdr)
+        err = EXIT_CODE_OUT_OF_MEMORY;
+    else if(hsize < sizeof(elf_header_t))
+        err = EXIT_CODE_GLOBAL_GENERAL_FAIL;
+    else
+        err = elf_read(fs, handle, 0, hsize, hdr);
+
+    if(!err)
+        err = elf_check_errors(hdr);
+
+    // the program headers have to be in what we read, they're right after the ELF header in any binary we make
+    if(!err && (hdr->phoff) + (hdr->phnum) * sizeof(elf_program_t) > hsize)
+        err = EXIT_CODE_GLOBAL_NOT_IMPLEMENTED;
+
+    if(!err)
+    {
+        *(entry) = (hdr->entry);
+        err = elf_load_segments(fs, handle, hdr, pid, image, base);
+    }
+
+    kfree(hdr);
+
+    drv[0] = FS_COMMAND_CLOSE;
+    drv[1] = handle;
+    driver_exec(fs, drv);
+
+    return err;
+}
+
+uint8_t elf_parse_binary(void **ptr, unsigned int size)
+{
+    uint8_t pid = task_new_pid();
+    uint32_t entry, base;
+    void *nptr;
+
+    uint8_t err;
+    if((err = elf_load_buffer(*ptr, pid, &nptr, &entry, &base)))
+        return err;
     
     print("well! seems to be compatible...\n");
 
-    void *nptr = elf_load_binary(*ptr);
-
     // FIXME: freeing file pointer generates page fault
     //vfree(*ptr);
     
     *ptr = nptr;
-    uint32_t * stck  = valloc(4096);
-    asm_exec_call((void *) ((hdr->entry) | (uint32_t)nptr), stck);
-    
-    return EXIT_CODE_GLOBAL_SUCCESS;
+    return elf_exec(nptr, base, entry, pid);
+}
+
+uint8_t elf_parse_file(const char *path, void **ptr)
+{
+    uint8_t pid = task_new_pid();
+    uint32_t entry, base;
+
+    uint8_t err;
+    if((err = elf_load_file(path, pid, ptr, &entry, &base)))
+        return err;
+
+    print("well! seems to be compatible...\n");
+
+    return elf_exec(*ptr, base, entry, pid);
 }
\ No newline at end of file
@@ -25,5 +25,9 @@ SOFTWARE.
 #define __ELF_H__
 
 unsigned char elf_parse_binary(void **ptr, unsigned int size);
+unsigned char elf_parse_file(const char *path, void **ptr);
+
+unsigned char elf_load_buffer(void *file, unsigned char pid, void **image, unsigned int *entry, unsigned int *base);
+unsigned char elf_load_file(const char *path, unsigned char pid, void **image, unsigned int *entry, unsigned int *base);
 
 #endif
\ No newline at end of file
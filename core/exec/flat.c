@@ -29,16 +29,22 @@ SOFTWARE.
 
 #include "../memory/paging.h"
 
+#include "../cpu/cpu.h"
+
 void flat_call_binary(void *ptr, size_t stack_size)
 {
     PAGE_REQ req = {
         .pid = task_new_pid(),
-        .attr = PAGE_REQ_ATTR_READ_WRITE,
+        .attr = PAGE_REQ_ATTR_READ_WRITE | PAGE_REQ_ATTR_ZERO,
         .size = stack_size
     };
 
     // TODO: maybe there's a better way to do this
     uint32_t *stack = valloc(&req);
+
+    CPU_fpu_switch(req.pid);
     asm_exec_call(ptr, stack + stack_size);
+    CPU_fpu_switch(PID_KERNEL);
+    CPU_fpu_release(req.pid);
 
 }
\ No newline at end of file
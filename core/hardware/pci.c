@@ -48,6 +48,7 @@ typedef struct
 static PCI_DEV PCI_DEV_LIST[PCI_DEVLIST_LENGTH];
 
 static uint32_t pciConfigRead (uint8_t bus, uint8_t device, uint8_t func, uint8_t reg);
+static void pciConfigWrite(uint8_t bus, uint8_t device, uint8_t func, uint8_t reg, uint32_t value);
 
 void pci_init(void)
 {	
@@ -197,6 +198,19 @@ uint32_t pciGetBar(uint32_t device, uint8_t bar)
     return pciConfigRead(bus, dev, func, bar);
 }
 
+/* lets the device do DMA on its own (needed for e.g. IDE bus mastering) */
+void pciEnableBusMaster(uint32_t device)
+{
+    uint8_t bus     = (uint8_t) ((device >> 24) & 0xFF);
+    uint8_t dev     = (uint8_t) ((device >> 16) & 0xFF);
+    uint8_t func    = (uint8_t) ((device >> 8)  & 0xFF);
+
+    /* register 1 is command (low) and status (high), writing zeroes to the status leaves it alone */
+    uint32_t command = pciConfigRead(bus, dev, func, 0x01) & 0xFFFF;
+
+    pciConfigWrite(bus, dev, func, 0x01, command | PCI_COMMAND_BUS_MASTER);
+}
+
 static uint32_t pciConfigRead (uint8_t bus, uint8_t device, uint8_t func, uint8_t reg){
 	
 	/*just so it looks nice*/
@@ -214,3 +228,11 @@ static uint32_t pciConfigRead (uint8_t bus, uint8_t device, uint8_t func, uint8_
 	
 	return tmmp;
 }
+
+static void pciConfigWrite(uint8_t bus, uint8_t device, uint8_t func, uint8_t reg, uint32_t value)
+{
+	uint32_t address = (uint32_t) (((uint32_t) bus << 16) | ((uint32_t) device << 11) | ((uint32_t) func << 8) | ((uint32_t) reg << 2) | (uint32_t) 0x80000000);
+
+	outl(0x0cf8, address);
+	outl(0x0cfc, value);
+}
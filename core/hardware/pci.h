@@ -31,6 +31,8 @@ SOFTWARE.
 #define PCI_BAR4    0x08
 #define PCI_BAR5    0x09
 
+#define PCI_COMMAND_BUS_MASTER  (1U << 2)
+
 void pci_init(void);
 unsigned char pciGetInterruptLine(unsigned char bus, unsigned char device, unsigned char func);
 unsigned int *pciGetDevices(unsigned char class, unsigned char subclass);
@@ -41,5 +43,6 @@ unsigned int pciGetReg0(unsigned int device);
 unsigned int pciGetDeviceByReg0(unsigned int Reg0);
 
 unsigned int pciGetBar(unsigned int device, unsigned char bar);
+void pciEnableBusMaster(unsigned int device);
 
 #endif
\ No newline at end of file
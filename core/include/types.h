@@ -32,6 +32,9 @@ SOFTWARE.
 /* if you don't want assertions (dbg.h): */
 /*#define NDEBUG*/
 
+/* if you want the benchmarks (bench/bench.h) to run at start-up: */
+/*#define BENCHMARK*/
+
 #define UCHAR_MAX 255
 
 #define MAX       0xFFFFFFFF
@@ -42,6 +45,7 @@ typedef signed short int16_t;
 typedef unsigned short uint16_t;
 typedef signed int int32_t;
 typedef unsigned int uint32_t;
+typedef unsigned long long uint64_t;
 
 typedef uint8_t size8_t;
 typedef uint32_t size_t; 
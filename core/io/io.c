@@ -65,25 +65,26 @@ long inl(uint16_t _port)
 	return rv;
 }
 
+/* size: in words */
 void outsw(uint16_t port, uint32_t size, uint16_t *data)
 {
-	uint32_t i;
-	
-	for(i = 0; i < size; ++i)
-	{
-		__asm__ __volatile__ ("outw %1, %0" :: "dN" (port), "a" (data[i]));
-	}
-	
+	__asm__ __volatile__ ("cld; rep outsw" : "+S" (data), "+c" (size) : "d" (port) : "memory");
 }
 
+/* size: in words */
 void insw(uint16_t port, uint32_t size, uint16_t *buffer)
 {
-	uint32_t i;
-	uint16_t value;
-
-	for(i = 0; i < size; ++i)
-	{
-		__asm__ __volatile__ ("inw %1, %0" : "=a" (value) :  "dN" (port));
-		buffer[i] = value;
-	}
+	__asm__ __volatile__ ("cld; rep insw" : "+D" (buffer), "+c" (size) : "d" (port) : "memory");
+}
+
+/* size: in dwords */
+void outsl(uint16_t port, uint32_t size, uint32_t *data)
+{
+	__asm__ __volatile__ ("cld; rep outsl" : "+S" (data), "+c" (size) : "d" (port) : "memory");
+}
+
+/* size: in dwords */
+void insl(uint16_t port, uint32_t size, uint32_t *buffer)
+{
+	__asm__ __volatile__ ("cld; rep insl" : "+D" (buffer), "+c" (size) : "d" (port) : "memory");
 }
\ No newline at end of file
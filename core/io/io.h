@@ -34,5 +34,7 @@ void outl (unsigned short _port, unsigned int _data);
 long inl (unsigned short _port);
 void outsw(unsigned short port, unsigned int size, unsigned short *data);
 void insw(unsigned short port, unsigned int size, unsigned short *buffer);
+void outsl(unsigned short port, unsigned int size, unsigned int *data);
+void insl(unsigned short port, unsigned int size, unsigned int *buffer);
 
 #endif
\ No newline at end of file
@@ -40,6 +40,7 @@ SOFTWARE.
 
 #include "memory/memory.h"
 #include "memory/paging.h"
+#include "memory/buddy.h"
 
 #include "hardware/pci.h"
 #include "hardware/pic.h"
@@ -53,10 +54,13 @@ SOFTWARE.
 
 #include "exec/exec.h"
 #include "exec/flat.h"
+#include "exec/elf.h"
 
 #include "kernel/panic.h"
 #include "kernel/info.h"
 
+#include "bench/bench.h"
+
 /* TODO: remove */
 #include "drv/COMMANDS.H"
 #include "drv/IDE_commands.h"
@@ -66,7 +70,11 @@ SOFTWARE.
 #include "drv/FS/fat.h"
 #include "drv/FS/fs_exitcode.h"
 
+/* pages zeroed per round of the idle loop, keeps the loop short */
+#define KERNEL_IDLE_ZERO_PAGES  16
+
 void init_env(void);
+void init_disk_controller(uint8_t subclass);
 void main(void);
 
 typedef struct
@@ -83,7 +91,6 @@ void init_env(void)
     GDT_ACCESS access;
     GDT_FLAGS flags;
     uint8_t exit_code;
-    uint32_t *drvcmd, *devicelist, device; /* for the driver inits and such */
 
     exit_code = loader_detect();
     if(exit_code == EXIT_CODE_GLOBAL_NOT_IMPLEMENTED)
@@ -101,6 +108,7 @@ void init_env(void)
 
     IDT_setup();
     CPU_init();
+    util_mem_init();
 
     exit_code = memory_init();
     
@@ -112,17 +120,9 @@ void init_env(void)
 
     /* the kernel should actually detect anything that has a driver and init them,
     but until that's implemented this'll live here */
-    devicelist = pciGetDevices(0x01, 0x01);
-    device = devicelist[1];
-    kfree(devicelist);
-
-    // initialize IDE driver
-    drvcmd = kmalloc(DRIVER_COMMAND_PACKET_LEN * sizeof(uint32_t *));
-    drvcmd[0] = DRV_COMMAND_INIT;
-    drvcmd[1] = (uint32_t) device;
-
-    driver_exec(pciGetInfo(device) | DRIVER_TYPE_PCI, drvcmd);
-    kfree(drvcmd);
+    init_disk_controller(0x01); /* IDE */
+    init_disk_controller(0x06); /* AHCI */
+    init_disk_controller(0x00); /* virtio-blk (legacy devices say they're SCSI) */
 
     /* after all disk drivers have been initialized this one should be called */
     diskio_init();
@@ -140,6 +140,26 @@ void init_env(void)
     // driver_exec((0x0B | DRIVER_TYPE_FS), drv);
 }
 
+/* initializes the driver of the first mass storage controller (PCI class 0x01) with this subclass, if there is one */
+void init_disk_controller(uint8_t subclass)
+{
+    uint32_t *drvcmd, *devicelist, device;
+
+    devicelist = pciGetDevices(0x01, subclass);
+    device = (devicelist[0] > 1) ? devicelist[1] : 0;
+    kfree(devicelist);
+
+    if(!device)
+        return;
+
+    drvcmd = kmalloc(DRIVER_COMMAND_PACKET_LEN * sizeof(uint32_t *));
+    drvcmd[0] = DRV_COMMAND_INIT;
+    drvcmd[1] = (uint32_t) device;
+
+    driver_exec(pciGetInfo(device) | DRIVER_TYPE_PCI, drvcmd);
+    kfree(drvcmd);
+}
+
 void main(void)
 {
     unsigned int exit_code = 0;
@@ -152,30 +172,36 @@ void main(void)
 
     init_env();
 
-    drv[0] = FS_COMMAND_READ;
-    drv[1] = (uint32_t) "CD0/TEST/CONWAY.ELF\0";
-    driver_exec((FS_TYPE_ISO | DRIVER_TYPE_FS), drv);
-    print_value("READ FILE WITH ERROR CODE: %x\n", drv[4]);
-    print_value("buffer location: 0x%x\t", drv[2]);
-    print_value("size: %i\n", drv[3]);
-    print_value("file that should have been read: %s\n", drv[1]);
+#ifdef BENCHMARK
+    bench_run();
+#endif
 
-    if(drv[4] == EXIT_CODE_FS_UNSUPPORTED_DRIVE)
-        print("Error: drive specification unsupported\n");
-    
 #ifndef NO_DEBUG_INFO /* you can define NO_DEBUG_INFO in types.h and it'll make all modules quiet */
     info_print_full_version();    
     print((char*)"\n");
 #endif
 
-    uint8_t err = elf_parse_binary((void **) &drv[2], drv[3]);
+    /* the segments are read straight from the CD into the pages they run from */
+    uint8_t err = elf_parse_file("CD0/TEST/CONWAY.ELF", (void **) &drv[2]);
+    print_value("LOADED FILE WITH ERROR CODE: %x\n", err);
     print_value("new pointer: 0x%x\n", drv[2]);
 
+    if(err == EXIT_CODE_FS_UNSUPPORTED_DRIVE)
+        print("Error: drive specification unsupported\n");
+
     if(err == EXIT_CODE_GLOBAL_UNSUPPORTED)
         debug_print_error("ELF binary incompatible");
 
     print_value("::%x\n", kmalloc(512));
     /*conways_game_of_life();*/
 
-    while(1);
+    /* nothing to do, so finish queued disk requests (readahead) and clean up freed pages.
+       if they're all clean, wait for the next interrupt */
+    while(1)
+    {
+        diskio_poll();
+
+        if(!buddy_zero_free(KERNEL_IDLE_ZERO_PAGES))
+            __asm__ __volatile__("hlt");
+    }
 }
@@ -0,0 +1,468 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* The buddy allocator hands out physical pages in blocks of 2^order pages (4 KiB thru 4 MiB).
+   Every order has a list of free blocks, the links of that list live in the free pages themselves
+   (all of the memory is identity mapped). A freed block gets merged with its buddy (the block of
+   the same size right next to it) for as long as that one is free too.
+
+   Allocations that aren't a power of two are split up into a few blocks, every block after the
+   first one is marked as a 'tail' so buddy_free() knows where an allocation ends.
+
+   Freed pages aren't zeroed right away. A bitmap remembers which free pages are known to be zero,
+   buddy_alloc() only zeroes the dirty ones (when asked to) and buddy_zero_free() cleans up the
+   rest when there's nothing better to do. */
+
+#include "buddy.h"
+
+#include "../include/types.h"
+#include "../include/macro.h"
+
+#include "../exec/task.h"
+
+#include "../util/util.h"
+
+#define BUDDY_PAGE_SHIFT    12U
+#define BUDDY_MAX_BLOCK     (1U << BUDDY_MAX_ORDER) /* pages */
+
+/* the order byte of every page: the order of the block starting at that page + these flags */
+#define BUDDY_FLAG_FREE     0x80U /* first page of a free block */
+#define BUDDY_FLAG_TAIL     0x40U /* first page of a block that continues the allocation in front of it */
+#define BUDDY_FLAG_RESV     0x20U /* never given to the allocator (kernel, tables, holes) */
+#define BUDDY_ORDER_MASK    0x0FU
+
+#define BUDDY_BITS          32U /* pages per word in the zeroed bitmap */
+
+#define BUDDY_PAGE_TO_PTR(page)    ((void *) ((page) << BUDDY_PAGE_SHIFT))
+#define BUDDY_PTR_TO_PAGE(ptr)     (((uint32_t) (ptr)) >> BUDDY_PAGE_SHIFT)
+
+/* replaces the shadow map (which used three bytes per page) */
+typedef struct
+{
+    uint8_t pid;    /* owner of the allocation (only valid for the first page of a block) */
+    uint8_t order;
+} __attribute__((packed)) BUDDY_PAGE;
+
+typedef struct BUDDY_BLOCK
+{
+    struct BUDDY_BLOCK *prev;
+    struct BUDDY_BLOCK *next;
+} BUDDY_BLOCK;
+
+BUDDY_PAGE *buddy_page_t = NULL;
+uint32_t buddy_npages = 0;
+
+BUDDY_BLOCK *buddy_free_t[BUDDY_MAX_ORDER + 1];
+uint32_t buddy_nfree = 0;
+
+/* pages owned per process id */
+uint32_t buddy_owned_t[PID_RESV + 1];
+
+/* one bit per page, set if the (free) page is filled with zeroes. The first few bytes 
+   of a page may still hold the links of a free list (buddy_take_pages() takes care of those) */
+uint32_t *buddy_zeroed_t = NULL;
+BUDDY_ZERO_STATS buddy_zero_stats_t;
+
+static void buddy_push(uint32_t page, uint32_t order);
+static void buddy_remove(uint32_t page, uint32_t order);
+static void buddy_release(uint32_t page, uint32_t order);
+static uint32_t buddy_fit(uint32_t offset, uint32_t left);
+static void buddy_claim(uint32_t page, uint32_t span, uint32_t npages, uint8_t pid, uint8_t zero);
+static void *buddy_alloc_huge(uint32_t npages, uint8_t pid, uint8_t zero);
+static void buddy_zero_page(uint32_t page, uint32_t skip);
+static void buddy_take_pages(uint32_t page, uint32_t npages, uint8_t zero);
+
+/* meta: where the page information can live, returns the amount of bytes used there */
+uint32_t buddy_init(void *meta, uint32_t npages)
+{
+    uint32_t i, size;
+    const uint32_t nwords = HOW_MANY(npages, BUDDY_BITS);
+
+    buddy_page_t = (BUDDY_PAGE *) meta;
+    buddy_npages = npages;
+
+    /* the bitmap goes right after the page information (dword aligned) */
+    size = (npages * sizeof(BUDDY_PAGE) + 3U) & ~3U;
+    buddy_zeroed_t = (uint32_t *) (((uint32_t) meta) + size);
+
+    /* nothing is free until buddy_add_range() says so */
+    for(i = 0; i < npages; ++i)
+    {
+        buddy_page_t[i].pid = PID_KERNEL;
+        buddy_page_t[i].order = BUDDY_FLAG_RESV;
+    }
+
+    /* we don't know what's in there */
+    for(i = 0; i < nwords; ++i)
+        buddy_zeroed_t[i] = 0;
+
+    for(i = 0; i <= BUDDY_MAX_ORDER; ++i)
+        buddy_free_t[i] = NULL;
+
+    return size + nwords * sizeof(uint32_t);
+}
+
+/* gives the pages between start and end (physical addresses) to the allocator */
+void buddy_add_range(uint32_t start, uint32_t end)
+{
+    uint32_t order;
+    uint32_t page = HOW_MANY(start, (1U << BUDDY_PAGE_SHIFT));
+    uint32_t last = end >> BUDDY_PAGE_SHIFT;
+
+    /* page 0 would be a NULL pointer */
+    page = (page) ? page : 1;
+    last = (last > buddy_npages) ? buddy_npages : last;
+
+    if(page < last)
+        buddy_zero_stats_t.dirty += last - page;
+
+    while(page < last)
+    {
+        order = buddy_fit(page, last - page);
+        
+        buddy_page_t[page].order = 0;
+        buddy_release(page, order);
+
+        page += 1U << order;
+    }
+}
+
+/* zero: if set, the pages handed out are filled with zeroes */
+void *buddy_alloc(uint32_t npages, uint8_t pid, uint8_t zero)
+{
+    uint32_t order = 0, page, o;
+
+    if(!npages)
+        return NULL;
+
+    if(npages > BUDDY_MAX_BLOCK)
+        return buddy_alloc_huge(npages, pid, zero);
+
+    /* smallest order that fits */
+    while((1U << order) < npages)
+        order++;
+
+    for(o = order; o <= BUDDY_MAX_ORDER; ++o)
+        if(buddy_free_t[o])
+            break;
+
+    if(o > BUDDY_MAX_ORDER)
+        return NULL;
+
+    page = BUDDY_PTR_TO_PAGE(buddy_free_t[o]);
+    buddy_remove(page, o);
+
+    /* use what we need, and give back the rest */
+    buddy_claim(page, 1U << o, npages, pid, zero);
+
+    return BUDDY_PAGE_TO_PTR(page);
+}
+
+/* returns the number of pages freed */
+uint32_t buddy_free(void *ptr)
+{
+    uint32_t page = BUDDY_PTR_TO_PAGE(ptr);
+    uint32_t order, next, n = 0;
+    uint8_t pid;
+
+    if(page >= buddy_npages || (buddy_page_t[page].order & (BUDDY_FLAG_FREE | BUDDY_FLAG_TAIL | BUDDY_FLAG_RESV)))
+        return 0;
+
+    pid = buddy_page_t[page].pid;
+
+    do
+    {
+        order = buddy_page_t[page].order & BUDDY_ORDER_MASK;
+        next = page + (1U << order);
+
+        buddy_release(page, order);
+        n += 1U << order;
+
+        page = next;
+    } while(page < buddy_npages && (buddy_page_t[page].order & (BUDDY_FLAG_FREE | BUDDY_FLAG_TAIL)) == BUDDY_FLAG_TAIL);
+
+    buddy_owned_t[pid] -= n;
+
+    /* their zeroed bits were cleared when they were handed out, buddy_zero_free() will get to them */
+    buddy_zero_stats_t.dirty += n;
+
+    return n;
+}
+
+/* returns the size (in pages) of the allocation starting at ptr */
+uint32_t buddy_get_npages(void *ptr)
+{
+    uint32_t page = BUDDY_PTR_TO_PAGE(ptr);
+    uint32_t n = 0;
+
+    if(page >= buddy_npages || (buddy_page_t[page].order & (BUDDY_FLAG_FREE | BUDDY_FLAG_TAIL | BUDDY_FLAG_RESV)))
+        return 0;
+
+    do
+    {
+        n += 1U << (buddy_page_t[page].order & BUDDY_ORDER_MASK);
+        page = BUDDY_PTR_TO_PAGE(ptr) + n;
+    } while(page < buddy_npages && (buddy_page_t[page].order & (BUDDY_FLAG_FREE | BUDDY_FLAG_TAIL)) == BUDDY_FLAG_TAIL);
+
+    return n;
+}
+
+/* free pages */
+uint32_t buddy_get_free(void)
+{
+    return buddy_nfree;
+}
+
+uint32_t buddy_get_owned(uint8_t pid)
+{
+    return buddy_owned_t[pid];
+}
+
+BUDDY_ZERO_STATS buddy_get_zero_stats(void)
+{
+    return buddy_zero_stats_t;
+}
+
+/* zeroes at most max free pages that are dirty, meant for when the kernel has nothing else to do.
+   returns: the number of pages zeroed (0 means everything's clean) */
+uint32_t buddy_zero_free(uint32_t max)
+{
+    BUDDY_BLOCK *block;
+    uint32_t order, page, first, i, n = 0;
+    
+    if(!buddy_zero_stats_t.dirty)
+        return 0;
+
+    /* big blocks first, those are the ones that'll be used for big (zeroed) buffers */
+    for(order = BUDDY_MAX_ORDER + 1; order-- > 0 && n < max;)
+    {
+        for(block = buddy_free_t[order]; block && n < max; block = block->next)
+        {
+            first = BUDDY_PTR_TO_PAGE(block);
+
+            for(i = 0; i < (1U << order) && n < max; ++i)
+            {
+                page = first + i;
+
+                /* skip clean words in one go */
+                if(!(page % BUDDY_BITS) && (i + BUDDY_BITS) <= (1U << order) && buddy_zeroed_t[page / BUDDY_BITS] == MAX)
+                {
+                    i += BUDDY_BITS - 1;
+                    continue;
+                }
+
+                if(buddy_zeroed_t[page / BUDDY_BITS] & (1U << (page % BUDDY_BITS)))
+                    continue;
+
+                /* the first page holds the links of the free list */
+                buddy_zero_page(page, (page == first) ? sizeof(BUDDY_BLOCK) : 0);
+                buddy_zeroed_t[page / BUDDY_BITS] |= 1U << (page % BUDDY_BITS);
+
+                buddy_zero_stats_t.dirty--;
+                buddy_zero_stats_t.idle++;
+                n++;
+            }
+        }
+    }
+
+    return n;
+}
+
+static void buddy_push(uint32_t page, uint32_t order)
+{
+    BUDDY_BLOCK *block = (BUDDY_BLOCK *) BUDDY_PAGE_TO_PTR(page);
+
+    block->prev = NULL;
+    block->next = buddy_free_t[order];
+
+    if(block->next)
+        block->next->prev = block;
+
+    buddy_free_t[order] = block;
+
+    buddy_page_t[page].pid = PID_RESV;
+    buddy_page_t[page].order = (uint8_t) (order | BUDDY_FLAG_FREE);
+}
+
+static void buddy_remove(uint32_t page, uint32_t order)
+{
+    BUDDY_BLOCK *block = (BUDDY_BLOCK *) BUDDY_PAGE_TO_PTR(page);
+
+    if(block->prev)
+        block->prev->next = block->next;
+    else
+        buddy_free_t[order] = block->next;
+
+    if(block->next)
+        block->next->prev = block->prev;
+
+    buddy_page_t[page].order = (uint8_t) order;
+    buddy_nfree -= 1U << order;
+}
+
+/* frees a block and merges it with its buddies */
+static void buddy_release(uint32_t page, uint32_t order)
+{
+    uint32_t buddy;
+
+    buddy_page_t[page].order = 0;
+    buddy_nfree += 1U << order;
+
+    while(order < BUDDY_MAX_ORDER)
+    {
+        buddy = page ^ (1U << order);
+
+        if((buddy + (1U << order)) > buddy_npages)
+            break;
+
+        /* only merge with a free block of the same size */
+        if(buddy_page_t[buddy].order != (BUDDY_FLAG_FREE | order))
+            break;
+
+        buddy_remove(buddy, order);
+        buddy_nfree += 1U << order;
+        buddy_page_t[buddy].order = 0;
+
+        page = page & ~(1U << order);
+        order++;
+    }
+
+    buddy_push(page, order);
+}
+
+/* the biggest block that can start at offset (alignment) and isn't bigger than left */
+static uint32_t buddy_fit(uint32_t offset, uint32_t left)
+{
+    uint32_t order = BUDDY_MAX_ORDER;
+
+    while((offset & ((1U << order) - 1)) || (1U << order) > left)
+        order--;
+
+    return order;
+}
+
+/* marks the first npages of a span (that has just been taken off the free lists) as allocated
+   and gives the rest of it back */
+static void buddy_claim(uint32_t page, uint32_t span, uint32_t npages, uint8_t pid, uint8_t zero)
+{
+    uint32_t offset = 0, order;
+    uint8_t flag = 0;
+
+    buddy_take_pages(page, npages, zero);
+
+    while(offset < npages)
+    {
+        order = buddy_fit(offset, npages - offset);
+
+        buddy_page_t[page + offset].pid = pid;
+        buddy_page_t[page + offset].order = (uint8_t) (order | flag);
+
+        flag = BUDDY_FLAG_TAIL;
+        offset += 1U << order;
+    }
+
+    while(offset < span)
+    {
+        order = buddy_fit(offset, span - offset);
+        buddy_release(page + offset, order);
+
+        offset += 1U << order;
+    }
+
+    buddy_owned_t[pid] += npages;
+}
+
+/* for things bigger than the largest block: look for a few largest blocks in a row */
+static void *buddy_alloc_huge(uint32_t npages, uint8_t pid, uint8_t zero)
+{
+    const uint32_t nblocks = HOW_MANY(npages, BUDDY_MAX_BLOCK);
+    BUDDY_BLOCK *block;
+    uint32_t page, next, i;
+
+    for(block = buddy_free_t[BUDDY_MAX_ORDER]; block; block = block->next)
+    {
+        page = BUDDY_PTR_TO_PAGE(block);
+
+        for(i = 1; i < nblocks; ++i)
+        {
+            next = page + i * BUDDY_MAX_BLOCK;
+
+            if((next + BUDDY_MAX_BLOCK) > buddy_npages)
+                break;
+            if(buddy_page_t[next].order != (BUDDY_FLAG_FREE | BUDDY_MAX_ORDER))
+                break;
+        }
+
+        if(i != nblocks)
+            continue;
+
+        for(i = 0; i < nblocks; ++i)
+            buddy_remove(page + i * BUDDY_MAX_BLOCK, BUDDY_MAX_ORDER);
+
+        buddy_claim(page, nblocks * BUDDY_MAX_BLOCK, npages, pid, zero);
+
+        return BUDDY_PAGE_TO_PTR(page);
+    }
+
+    return NULL;
+}
+
+/* fills a page with zeroes, except for the first skip bytes */
+static void buddy_zero_page(uint32_t page, uint32_t skip)
+{
+    memset(((char *) BUDDY_PAGE_TO_PTR(page)) + skip, (1U << BUDDY_PAGE_SHIFT) - skip, 0x00);
+}
+
+/* the pages are leaving the allocator: zero the ones that need it and forget about them */
+static void buddy_take_pages(uint32_t page, uint32_t npages, uint8_t zero)
+{
+    uint32_t i, *word, bit;
+
+    for(i = page; i < (page + npages); ++i)
+    {
+        word = &buddy_zeroed_t[i / BUDDY_BITS];
+        bit = 1U << (i % BUDDY_BITS);
+
+        if(*word & bit)
+        {
+            *word &= ~bit;
+
+            if(!zero)
+                continue;
+
+            /* there might be a stale free list link in there */
+            ((BUDDY_BLOCK *) BUDDY_PAGE_TO_PTR(i))->prev = NULL;
+            ((BUDDY_BLOCK *) BUDDY_PAGE_TO_PTR(i))->next = NULL;
+            buddy_zero_stats_t.prezeroed++;
+            continue;
+        }
+
+        buddy_zero_stats_t.dirty--;
+
+        if(!zero)
+            continue;
+
+        buddy_zero_page(i, 0);
+        buddy_zero_stats_t.on_demand++;
+    }
+}
@@ -0,0 +1,51 @@
+/*
+MIT license
+Copyright (c) 2019-2021 Maarten Vermeulen
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef __BUDDY_H__
+#define __BUDDY_H__
+
+/* largest block the buddy allocator keeps track of: 2^10 pages (4 MiB) */
+#define BUDDY_MAX_ORDER     10U
+
+typedef struct
+{
+    unsigned int on_demand;     /* dirty pages zeroed by buddy_alloc() */
+    unsigned int prezeroed;     /* pages that were already zero when buddy_alloc() was asked for zeroed pages */
+    unsigned int idle;          /* pages zeroed by buddy_zero_free() */
+    unsigned int dirty;         /* free pages that haven't been zeroed yet */
+} BUDDY_ZERO_STATS;
+
+unsigned int buddy_init(void *meta, unsigned int npages);
+void buddy_add_range(unsigned int start, unsigned int end);
+
+void *buddy_alloc(unsigned int npages, unsigned char pid, unsigned char zero);
+unsigned int buddy_free(void *ptr);
+unsigned int buddy_get_npages(void *ptr);
+
+unsigned int buddy_get_free(void);
+unsigned int buddy_get_owned(unsigned char pid);
+
+BUDDY_ZERO_STATS buddy_get_zero_stats(void);
+unsigned int buddy_zero_free(unsigned int max);
+
+#endif
@@ -23,8 +23,7 @@ SOFTWARE.
 
 #include "memory.h"
 
-/* TODO: can be removed if (no, not when) a tasking header is implemented 
- we only need this header because of the PIDs */
+/* slabs and large allocations come from valloc() */
 #include "paging.h" 
 
 #include "../include/types.h"
@@ -43,17 +42,37 @@ SOFTWARE.
 #include "../util/util.h"
 #include "../dbg/dbg.h"
 
-#define MEMORY_MMAP_TYPE_VIREO 1
-#define MEMORY_MMAP_TYPE_RESV  2
+#include "../exec/task.h"
+
+#define MEMORY_MMAP_TYPE_USABLE 0
+#define MEMORY_MMAP_TYPE_VIREO  1
+#define MEMORY_MMAP_TYPE_RESV   2
+
+/* regions in the physical memory map (usable and reserved) */
+#define MEMORY_MAP_LENGTH       32U
+
+/* everything above this is out of reach for a 32-bit kernel without PAE */
+#define MEMORY_MAP_TOP          0xFFFFF000U
 
 // 1  MiB - 1 byte reserved for kernel (0x100000 thru 0x1fffff)
 #define MEMORY_KERNELSTRT         0x100000
 #define MEMORY_MALLOC_MEMSTRT     0x200000
 
-#define MEMORY_TABLE_LENGTH    128U  // entries
-#define MEMORY_BLOCK_SIZE      512U // bytes
+/* the boot heap: kmalloc() takes its slabs from here until paging is up */
+#define MEMORY_MALLOC_SPACE       0x10000U // bytes
+
+#define MEMORY_PAGE_SIZE          4096U
+#define MEMORY_PAGE_MASK          0xFFFFF000U
+
+/* slab allocator, kmalloc() sizes are rounded up to one of the size classes
+   (16, 32, 64, ..., 2048 bytes), every class has its own list of slabs */
+#define MEMORY_SLAB_MAGIC         0x51AB0B1D
+#define MEMORY_SLAB_CLASSES       8U
+#define MEMORY_SLAB_MIN_SHIFT     4U   /* smallest class: 1 << 4 = 16 bytes */
+#define MEMORY_SLAB_MAX_SIZE      2048U
+#define MEMORY_SLAB_LARGE         0xFFFFU /* 'class' of allocations that got pages of their own */
 
-#define MEMORY_MALLOC_SPACE     (MEMORY_BLOCK_SIZE * MEMORY_TABLE_LENGTH)
+#define MEMORY_SLAB_FLAG_BOOT     1U /* lives in the boot heap, can't be given back to vfree() */
 
 #define MEMORY_VMALLOC_STAT_ALLOCT      1<<7
 #define MEMORY_VMALLOC_STAT_READONLY    1<<6
@@ -73,35 +92,78 @@ typedef struct
     uint32_t vmemory_table_size; /* in pages (aka in array length) */
 } MEMORY_INFO;
 
+/* every slab is one page and starts with this header (32 bytes, so objects stay 16 byte aligned).
+   kfree() finds it back by rounding the pointer down to the page. */
+typedef struct MEMORY_SLAB
+{
+    uint32_t magic;
+    uint16_t cache;             /* index in memory_cache_t or MEMORY_SLAB_LARGE */
+    uint16_t inuse;             /* objects handed out */
+    uint32_t *free;             /* freed objects, the first dword of each links to the next */
+    uint32_t bump;              /* next object that has never been handed out */
+    struct MEMORY_SLAB *prev;   /* partial list */
+    struct MEMORY_SLAB *next;
+    uint32_t flags;
+    uint32_t npages;            /* size of large allocations (in pages) */
+} MEMORY_SLAB;
+
 typedef struct
 {
-    uint32_t loc;
-    uint32_t size;
-} MEMORY_TABLE;
+    uint16_t size;              /* object size in bytes */
+    uint16_t capacity;          /* objects per slab */
+    uint32_t nempty;            /* completely free slabs on the partial list */
+    MEMORY_SLAB *partial;       /* slabs with at least one free object */
+} MEMORY_CACHE;
+
+#define MEMORY_SLAB_CAPACITY(size)  ((MEMORY_PAGE_SIZE - sizeof(MEMORY_SLAB)) / (size))
+#define MEMORY_SLAB_OBJ(slab)       ((uint32_t) (slab) + sizeof(MEMORY_SLAB))
 
 /* I'm sorry for this ugly define line here */
-#define MEMORY_VIRTUAL_TABLES  MEMORY_MALLOC_MEMSTRT + (MEMORY_BLOCK_SIZE * MEMORY_TABLE_LENGTH)
+#define MEMORY_VIRTUAL_TABLES  MEMORY_MALLOC_MEMSTRT + MEMORY_MALLOC_SPACE
 /* ---- */
 
 extern void start(void);
 extern void STACK_TOP(void);
 
 MEMORY_INFO  memory_info_t;
-MEMORY_MAP   temp_memory_map[2];
 
-/* 1 KiB of information, though I can imagine this being too little.
-This can store 64 KiB of memory this way */
-MEMORY_TABLE memory_t[MEMORY_TABLE_LENGTH]; 
+/* physical memory map, reserved ranges are cut out of the usable ones by memory_map_carve() */
+MEMORY_MAP   memory_map_t[MEMORY_MAP_LENGTH];
+uint32_t     memory_map_length = 0;
+
+/* no init needed, kmalloc() is used before memory_init() is called */
+MEMORY_CACHE memory_cache_t[MEMORY_SLAB_CLASSES] = {
+    {16,   MEMORY_SLAB_CAPACITY(16),   0, NULL},
+    {32,   MEMORY_SLAB_CAPACITY(32),   0, NULL},
+    {64,   MEMORY_SLAB_CAPACITY(64),   0, NULL},
+    {128,  MEMORY_SLAB_CAPACITY(128),  0, NULL},
+    {256,  MEMORY_SLAB_CAPACITY(256),  0, NULL},
+    {512,  MEMORY_SLAB_CAPACITY(512),  0, NULL},
+    {1024, MEMORY_SLAB_CAPACITY(1024), 0, NULL},
+    {2048, MEMORY_SLAB_CAPACITY(2048), 0, NULL}
+};
+
+uint32_t memory_boot_heap = MEMORY_MALLOC_MEMSTRT; /* next free page in the boot heap */
 
 uint32_t virtual_memory_table_size;
 uint8_t loader_type = 0;
 
-static void memory_update_table(uint8_t index, uint32_t loc, uint8_t blocks);
-static void memory_create_temp_mmap(void);
+static void memory_map_add(uint8_t type, uint32_t start, uint32_t end);
+static void memory_map_read(LOADER_INFO *info);
+static void memory_map_reserve_boot(void);
+static void memory_map_carve(void);
+
+static void *memory_get_pages(uint32_t npages, uint32_t *flags);
+static uint32_t memory_slab_class(size_t size);
+static MEMORY_SLAB *memory_slab_create(uint16_t cache);
+static void memory_slab_link(MEMORY_CACHE *cache, MEMORY_SLAB *slab);
+static void memory_slab_unlink(MEMORY_CACHE *cache, MEMORY_SLAB *slab);
+static void *memory_large_alloc(size_t size);
 
 uint8_t memory_init(void)
 {
     LOADER_INFO infoStruct;
+    uint32_t i;
     
     loader_type = loader_get_type();
     
@@ -116,107 +178,200 @@ uint8_t memory_init(void)
 
     infoStruct = loader_get_infoStruct();
     
-    /* GRUB returns KB's but I like KiB's more, sorry */
-    memory_info_t.available_memory = (uint32_t) (infoStruct.total_memory * 1.024);
-    
     #ifndef NO_DEBUG_INFO
-    print_value("[MEMORY] Total memory: %i KiB\n", memory_info_t.available_memory);
     print_value("[MEMORY] Memory map location: %x\n", (unsigned int) infoStruct.mmap);
-    print_value("[MEMORY] Memory map length: %i bytes\n\n", infoStruct.mmap_length);
+    print_value("[MEMORY] Memory map length: %i bytes\n", infoStruct.mmap_length);
     #endif
 
-    /* TODO: if exists, read memory map */
-    /* TODO: if not exists, try int 15h (v86) */
-    memory_create_temp_mmap();
+    /* TODO: if the memory map doesn't exist, try int 15h (v86) */
+    if(infoStruct.mmap && infoStruct.mmap_length)
+        memory_map_read(&infoStruct);
+    else
+    {
+        /* no memory map, so we have to believe upper memory is one contiguous range.
+           GRUB returns KB's (lower + upper memory), pretend it all starts at 1 MiB to be safe */
+        memory_map_add(MEMORY_MMAP_TYPE_USABLE, MEMORY_KERNELSTRT, infoStruct.total_memory * 1024U);
+    }
+
+    /* the RAM we have, before the kernel takes its share */
+    memory_info_t.available_memory = 0;
+    for(i = 0; i < memory_map_length; ++i)
+        if(memory_map_t[i].type == MEMORY_MMAP_TYPE_USABLE)
+            memory_info_t.available_memory += (memory_map_t[i].loc_end - memory_map_t[i].loc_start) / 1024U;
+
+    memory_map_reserve_boot();
+    memory_map_carve();
     
-    memset((char *) &memory_t, sizeof(MEMORY_TABLE)*128, 0);
+    #ifndef NO_DEBUG_INFO
+    for(i = 0; i < memory_map_length; ++i)
+    {
+        if(memory_map_t[i].loc_start == memory_map_t[i].loc_end)
+            continue;
+
+        print_value("[MEMORY] %x", memory_map_t[i].loc_start);
+        print_value(" - %x", memory_map_t[i].loc_end);
+        print_value(" type %i\n", memory_map_t[i].type);
+    }
+
+    print_value("[MEMORY] Total memory: %i KiB\n\n", memory_info_t.available_memory);
+    #endif
 
     return EXIT_CODE_GLOBAL_SUCCESS;
 }
 
 uint32_t *memory_paging_tables_loc(void)
 {
-    uint32_t *tables = (uint32_t *) (MEMORY_VIRTUAL_TABLES);
+    return (uint32_t *) (MEMORY_VIRTUAL_TABLES);
+}
+
+/* returns: end of the highest usable region, everything up to here should be mapped */
+uint32_t memory_get_top(void)
+{
+    uint32_t i, top = 0;
 
-    /* this puts the total available memory at the location of the tables allocation, which 
-    save space in memory and this file (I'm too lazy to make a struct for this) */
-    tables[0] = memory_info_t.available_memory;
+    for(i = 0; i < memory_map_length; ++i)
+        if((memory_map_t[i].type == MEMORY_MMAP_TYPE_USABLE) && (memory_map_t[i].loc_end > top))
+            top = memory_map_t[i].loc_end;
 
-    return tables;
+    return top;
 }
 
-void *kmalloc(size_t size)
+/* gets the usable region number 'index', returns 0 if there is no such region */
+uint8_t memory_get_usable(uint32_t index, uint32_t *start, uint32_t *end)
 {
-    uint32_t location;
-    uint8_t loc, available = 0;
-    uint8_t index;
-    int8_t mallocd_index;
-
-    uint8_t blocks = (uint8_t) (HOW_MANY(size, MEMORY_BLOCK_SIZE));
+    uint32_t i;
 
-    /* see if we can find enough 512 blocks to fit our needs; look down below for a *very detailed* explanation
-     on why this only allocates 512 byte blocks */
-    for(loc = 0; loc < MEMORY_TABLE_LENGTH; loc++)
+    for(i = 0; i < memory_map_length; ++i)
     {
-        if(!memory_t[loc].loc)
-            available++;
-        else
-            available = 0;
+        if((memory_map_t[i].type != MEMORY_MMAP_TYPE_USABLE) || (memory_map_t[i].loc_start == memory_map_t[i].loc_end))
+            continue;
 
-        if(available == blocks)
-            break;
+        if(index--)
+            continue;
+
+        *(start) = memory_map_t[i].loc_start;
+        *(end)   = memory_map_t[i].loc_end;
+        return 1;
     }
 
-    /* not enough free memory */
-    if(loc >= MEMORY_TABLE_LENGTH && available < blocks)
-        return (void *) NULL;
+    return 0;
+}
 
-    /* calc the index for the memory table */
-    loc = (uint8_t) (loc - blocks + 1);
-    index = loc;
+/* returns 1 if start thru end lies completely within one usable region */
+uint8_t memory_is_usable(uint32_t start, uint32_t end)
+{
+    uint32_t i;
 
-    mallocd_index = (int8_t) ((index - 1 < 0)? -1 : (index - 1));
+    for(i = 0; i < memory_map_length; ++i)
+        if((memory_map_t[i].type == MEMORY_MMAP_TYPE_USABLE) && (memory_map_t[i].loc_start <= start) && (memory_map_t[i].loc_end >= end))
+            return 1;
 
-    /* store the information in the memory table */
-    if(mallocd_index <= -1)
-        memory_update_table(0, MEMORY_MALLOC_MEMSTRT, blocks);
-    else
+    return 0;
+}
+
+void *kmalloc(size_t size)
+{
+    MEMORY_CACHE *cache;
+    MEMORY_SLAB *slab;
+    uint32_t *obj;
+    uint32_t index;
+
+    if(!size)
+        return NULL;
+
+    if(size > MEMORY_SLAB_MAX_SIZE)
+        return memory_large_alloc(size);
+
+    index = memory_slab_class(size);
+    cache = &memory_cache_t[index];
+
+    /* every slab on the partial list has room, so we only ever look at the first one */
+    if(!(slab = cache->partial))
     {
-        location = (uint32_t) (memory_t[mallocd_index].loc + (memory_t[mallocd_index].size * MEMORY_BLOCK_SIZE));
-        memory_update_table(index, location, blocks);
+        if(!(slab = memory_slab_create((uint16_t) index)))
+            return NULL;
+
+        memory_slab_link(cache, slab);
+        cache->nempty++;
     }
 
-    /* all done! :) */
-    return (void *) memory_t[index].loc;
+    if(!slab->inuse)
+        cache->nempty--;
+
+    /* prefer recently freed objects (they're probably still cached) */
+    if(slab->free)
+    {
+        obj = slab->free;
+        slab->free = (uint32_t *) *obj;
+    }
+    else
+    {
+        obj = (uint32_t *) slab->bump;
+        slab->bump += cache->size;
+    }
 
-    /* alright! seems to work :)
-        So, you may be asking: 'why only use 512 byte blocks?!'
-        Well, I hope that the memory allocation this way is easier and more reliable than with Vireo-I */
+    if(++slab->inuse == cache->capacity)
+        memory_slab_unlink(cache, slab);
 
+    return (void *) obj;
 }
 
 void kfree(void *ptr)
 {
-    uint8_t i;
-    uint8_t len;
+    MEMORY_SLAB *slab;
+    MEMORY_CACHE *cache;
+    uint32_t offset;
 
     if(ptr == NULL)
         return;
     
-    /* find the memory table entries that correspond to 
-        the pointer */
-    for(i = 0; i < MEMORY_TABLE_LENGTH; i++)
-        if(memory_t[i].loc == (uint32_t) ptr)
-            break;
+    /* the slab header is always at the start of the page */
+    slab = (MEMORY_SLAB *) (((uint32_t) ptr) & MEMORY_PAGE_MASK);
+
+    /* not one of ours (or a pointer into the middle of a large allocation) */
+    if(slab->magic != MEMORY_SLAB_MAGIC)
+        return;
+
+    if(slab->cache == MEMORY_SLAB_LARGE)
+    {
+        if((uint32_t) ptr != MEMORY_SLAB_OBJ(slab) || (slab->flags & MEMORY_SLAB_FLAG_BOOT))
+            return;
+
+        slab->magic = 0;
+        vfree((void *) slab);
+        return;
+    }
+
+    if(slab->cache >= MEMORY_SLAB_CLASSES)
+        return;
+
+    cache = &memory_cache_t[slab->cache];
+    offset = (uint32_t) ptr - MEMORY_SLAB_OBJ(slab);
+
+    /* only pointers to the start of an object that has been handed out */
+    if((offset % cache->size) || ((uint32_t) ptr >= slab->bump) || !slab->inuse)
+        return;
+
+    /* was full, so it's not on the partial list */
+    if(slab->inuse == cache->capacity)
+        memory_slab_link(cache, slab);
+
+    *((uint32_t *) ptr) = (uint32_t) slab->free;
+    slab->free = (uint32_t *) ptr;
+
+    if(--slab->inuse)
+        return;
 
-    len = (uint8_t) (i + memory_t[i].size);
-    for(i = i; i < len; i++)
+    /* keep one empty slab around, so a kmalloc()/kfree() loop doesn't keep asking for pages */
+    if(!cache->nempty || (slab->flags & MEMORY_SLAB_FLAG_BOOT))
     {
-        memory_t[i].loc  = 0;
-        memory_t[i].size = 0;
+        cache->nempty++;
+        return;
     }
 
-    // memset(ptr, len * MEMORY_BLOCK_SIZE, 0);
+    memory_slab_unlink(cache, slab);
+    slab->magic = 0;
+    vfree((void *) slab);
 }
 
 uint32_t memory_getAvailable(void)
@@ -264,32 +419,209 @@ uint32_t *memsrch(void *match, size_t matchsize, uint32_t start, uint32_t end)
     return (uint32_t *) (buffer + i - matchsize);
 }
 
-static void memory_update_table(uint8_t index, uint32_t loc, uint8_t blocks)
+/* usable regions shrink to whole pages, reserved regions grow to whole pages */
+static void memory_map_add(uint8_t type, uint32_t start, uint32_t end)
 {
-    uint8_t i;
-    uint8_t end = (uint8_t) (index + blocks);
+    if(end > MEMORY_MAP_TOP)
+        end = MEMORY_MAP_TOP;
 
-    for(i = index; i < end; i++)
+    if(type == MEMORY_MMAP_TYPE_USABLE)
+    {
+        start = (start + MEMORY_PAGE_SIZE - 1) & MEMORY_PAGE_MASK;
+        end   = end & MEMORY_PAGE_MASK;
+    }
+    else
     {
-        memory_t[i].loc = (uint32_t) loc;
-        memory_t[i].size = blocks;
+        start = start & MEMORY_PAGE_MASK;
+        end   = (end + MEMORY_PAGE_SIZE - 1) & MEMORY_PAGE_MASK;
     }
+
+    if((start >= end) || (memory_map_length >= MEMORY_MAP_LENGTH))
+        return;
+
+    memory_map_t[memory_map_length].type = type;
+    memory_map_t[memory_map_length].loc_start = start;
+    memory_map_t[memory_map_length].loc_end = end;
+    memory_map_length++;
 }
 
-static void memory_create_temp_mmap(void)
+static void memory_map_read(LOADER_INFO *info)
 {
+    multiboot_memory_map_t *entry = (multiboot_memory_map_t *) info->mmap;
+    uint32_t mmap_end = ((uint32_t) info->mmap) + info->mmap_length;
+    multiboot_uint64_t end;
 
-    /* where Vireo lives, sort of */
-    temp_memory_map[0].type = MEMORY_MMAP_TYPE_VIREO;
-    temp_memory_map[0].loc_start = (uint32_t) (((uint32_t)start) - 0x0C);
-    temp_memory_map[0].loc_end   = (uint32_t) STACK_TOP;
+    while((uint32_t) entry < mmap_end)
+    {
+        end = entry->addr + entry->len;
+
+        /* above 4 GiB, we can't use that anyway */
+        if(entry->len && entry->addr < MEMORY_MAP_TOP)
+        {
+            end = (end > MEMORY_MAP_TOP) ? MEMORY_MAP_TOP : end;
+
+            /* ACPI reclaimable memory still holds the tables, so it's reserved as far as we're concerned */
+            memory_map_add((entry->type == MULTIBOOT_MEMORY_AVAILABLE) ? MEMORY_MMAP_TYPE_USABLE : MEMORY_MMAP_TYPE_RESV,
+                            (uint32_t) entry->addr, (uint32_t) end);
+        }
+
+        /* the size field doesn't count itself */
+        entry = (multiboot_memory_map_t *) (((uint32_t) entry) + entry->size + sizeof(entry->size));
+    }
+}
+
+static void memory_map_reserve_boot(void)
+{
+    uint32_t mbinfo = (uint32_t) loader_get_multiboot_info_location();
+    LOADER_INFO info = loader_get_infoStruct();
 
     /* kernel flows through malloc memory */
     dbg_assert((((uint32_t) STACK_TOP) <= MEMORY_MALLOC_MEMSTRT));
-    
+
+    /* where Vireo lives, sort of */
+    memory_map_add(MEMORY_MMAP_TYPE_VIREO, ((uint32_t) start) - 0x0C, (uint32_t) STACK_TOP);
 
     /* and here is the grub memory info */
-    temp_memory_map[1].type = MEMORY_MMAP_TYPE_RESV;
-    temp_memory_map[1].loc_start = (uint32_t) loader_get_multiboot_info_location();
-    temp_memory_map[1].loc_end   = (uint32_t) sizeof(multiboot_info_t);
+    memory_map_add(MEMORY_MMAP_TYPE_RESV, mbinfo, mbinfo + sizeof(multiboot_info_t));
+    memory_map_add(MEMORY_MMAP_TYPE_RESV, (uint32_t) info.mmap, ((uint32_t) info.mmap) + info.mmap_length);
+}
+
+/* cuts every reserved region out of the usable regions it overlaps with */
+static void memory_map_carve(void)
+{
+    uint32_t r, u, rstart, rend;
+    MEMORY_MAP *use;
+
+    for(r = 0; r < memory_map_length; ++r)
+    {
+        if(memory_map_t[r].type == MEMORY_MMAP_TYPE_USABLE)
+            continue;
+
+        rstart = memory_map_t[r].loc_start;
+        rend   = memory_map_t[r].loc_end;
+
+        for(u = 0; u < memory_map_length; ++u)
+        {
+            use = &memory_map_t[u];
+
+            if((use->type != MEMORY_MMAP_TYPE_USABLE) || (rstart >= use->loc_end) || (rend <= use->loc_start))
+                continue;
+
+            /* reserved in the middle, split in two (the second half goes at the end of the map) */
+            if((rstart > use->loc_start) && (rend < use->loc_end))
+            {
+                memory_map_add(MEMORY_MMAP_TYPE_USABLE, rend, use->loc_end);
+                use->loc_end = rstart;
+            }
+            else if(rstart > use->loc_start)
+                use->loc_end = rstart;
+            else if(rend < use->loc_end)
+                use->loc_start = rend;
+            else /* nothing left */
+                use->loc_end = use->loc_start;
+        }
+    }
+}
+
+static void *memory_get_pages(uint32_t npages, uint32_t *flags)
+{
+    PAGE_REQ req = {PID_KERNEL, PAGE_REQ_ATTR_SUPERVISOR | PAGE_REQ_ATTR_READ_WRITE, 0};
+    uint32_t ptr;
+
+    if(paging_is_enabled())
+    {
+        *(flags) = 0;
+        req.size = npages * MEMORY_PAGE_SIZE;
+        return valloc(&req);
+    }
+
+    /* no paging (yet), so use the boot heap */
+    if((memory_boot_heap + npages * MEMORY_PAGE_SIZE) > memory_get_malloc_end())
+        return NULL;
+
+    ptr = memory_boot_heap;
+    memory_boot_heap += npages * MEMORY_PAGE_SIZE;
+    *(flags) = MEMORY_SLAB_FLAG_BOOT;
+
+    return (void *) ptr;
+}
+
+static uint32_t memory_slab_class(size_t size)
+{
+    if(size <= (1U << MEMORY_SLAB_MIN_SHIFT))
+        return 0;
+
+    /* log2 rounded up, minus the smallest class */
+    return (uint32_t) (32 - __builtin_clz(size - 1)) - MEMORY_SLAB_MIN_SHIFT;
+}
+
+static MEMORY_SLAB *memory_slab_create(uint16_t cache)
+{
+    uint32_t flags;
+    MEMORY_SLAB *slab = (MEMORY_SLAB *) memory_get_pages(1, &flags);
+
+    if(!slab)
+        return NULL;
+
+    slab->magic  = MEMORY_SLAB_MAGIC;
+    slab->cache  = cache;
+    slab->inuse  = 0;
+    slab->free   = NULL;
+    slab->bump   = MEMORY_SLAB_OBJ(slab);
+    slab->prev   = slab->next = NULL;
+    slab->flags  = flags;
+    slab->npages = 1;
+
+    return slab;
+}
+
+static void memory_slab_link(MEMORY_CACHE *cache, MEMORY_SLAB *slab)
+{
+    slab->prev = NULL;
+    slab->next = cache->partial;
+
+    if(cache->partial)
+        cache->partial->prev = slab;
+
+    cache->partial = slab;
+}
+
+static void memory_slab_unlink(MEMORY_CACHE *cache, MEMORY_SLAB *slab)
+{
+    if(slab->prev)
+        slab->prev->next = slab->next;
+    else
+        cache->partial = slab->next;
+
+    if(slab->next)
+        slab->next->prev = slab->prev;
+
+    slab->prev = slab->next = NULL;
+}
+
+/* anything bigger than the largest class gets pages of its own (with a slab header in front) */
+static void *memory_large_alloc(size_t size)
+{
+    uint32_t flags;
+    uint32_t bytes = size + sizeof(MEMORY_SLAB);
+    uint32_t npages = HOW_MANY(bytes, MEMORY_PAGE_SIZE);
+    MEMORY_SLAB *slab;
+
+    /* overflow */
+    if(bytes < size)
+        return NULL;
+
+    if(!(slab = (MEMORY_SLAB *) memory_get_pages(npages, &flags)))
+        return NULL;
+
+    slab->magic  = MEMORY_SLAB_MAGIC;
+    slab->cache  = MEMORY_SLAB_LARGE;
+    slab->inuse  = 1;
+    slab->free   = NULL;
+    slab->bump   = 0;
+    slab->prev   = slab->next = NULL;
+    slab->flags  = flags;
+    slab->npages = npages;
+
+    return (void *) MEMORY_SLAB_OBJ(slab);
 }
@@ -26,6 +26,9 @@ SOFTWARE.
 
 unsigned char memory_init(void);
 unsigned int *memory_paging_tables_loc(void);
+unsigned int memory_get_top(void);
+unsigned char memory_get_usable(unsigned int index, unsigned int *start, unsigned int *end);
+unsigned char memory_is_usable(unsigned int start, unsigned int end);
 void *kmalloc(unsigned int size);
 void kfree(void *ptr);
 unsigned int memory_getAvailable(void);
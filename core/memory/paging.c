@@ -23,9 +23,11 @@ SOFTWARE.
 
 #include "paging.h"
 #include "memory.h"
+#include "buddy.h"
 
 #include "../include/types.h"
 #include "../include/macro.h"
+#include "../include/exit_code.h"
 
 #ifndef NO_DEBUG_INFO
 #include "../screen/screen_basic.h"
@@ -37,47 +39,99 @@ SOFTWARE.
 
 #include "../exec/task.h"
 
+#include "../cpu/cpu.h"
+
 #define PAGING_ADDR_MSK         0xFFFFF000       
 #define PAGING_PAGE_SIZE        4096 /* bytes */
 #define PAGING_TABLE_SIZE       1024 /* entries */
 
-#define PAGING_TABLE_TYPE_DIR 0
-#define PAGING_TABLE_TYPE_TAB 1
+#define PAGING_LARGE_PAGE_SIZE  0x400000U /* 4 MiB, one directory entry with PSE */
+#define PAGING_LARGE_ADDR_MSK   0xFFC00000U
+#define PAGING_ATTR_MSK         0x00000FFFU
+
+/* directory entry of a page table (present, read/write) */
+#define PAGING_TABLE_ATTR       0x03
+
+/* what the identity map and freed memory look like */
+#define PAGING_DEFAULT_ATTR     (PAGE_REQ_ATTR_SUPERVISOR | PAGE_REQ_ATTR_READ_WRITE)
 
 #define PAGE_PRESENT 1
+#define PAGE_LARGE   0x80U /* PS bit, only in directory entries */
+
+/* accessed and dirty, the CPU sets them by itself so they're left out when comparing entries */
+#define PAGE_USED    0x60U
 
 uint32_t g_max_pages = 0;
+uint8_t g_paging_enabled = 0;
+uint8_t g_paging_pse = 0;
 
-typedef struct
-{
-    uint8_t pid;
-    uint16_t npages;
-} __attribute__ ((packed)) shadow_allocated;
+/* for the statistics */
+uint32_t g_paging_large_pages = 0;  /* 4 MiB pages in the directory */
+uint32_t g_paging_tables = 0;       /* page tables in use */
 
-shadow_allocated *shadow_t;
-uint32_t shadow_len = 0;
 uint32_t *page_dir = NULL;
 
 
 static uint32_t paging_convert_ptr_to_entry(uint32_t ptr, PAGE_REQ *req);
-static void *paging_find_free(uint32_t npages);
 static uint32_t paging_create_tables(void);
-static void paging_prepare_table(uint32_t *table, uint8_t type);
-static void paging_map_kernelspace(uint32_t end_of_kernel_space);
+static uint8_t paging_map_range(uint32_t pptr, uint32_t vptr, uint32_t npages, PAGE_REQ *req);
+static uint32_t *paging_get_table(uint32_t d_index);
+static void paging_free_table(uint32_t d_index);
 
 void paging_init(void)
 {
+    PAGE_REQ req = {PID_KERNEL, PAGING_DEFAULT_ATTR, 0};
+    uint32_t i, start, end;
+    uint32_t kernel_space_end;
+
+    /* has to be on before the first 4 MiB page goes in the directory */
+    if((g_paging_pse = CPU_has_feature(CPU_FEATURE_PSE)))
+        ASM_CPU_PSE_ENABLE();
+
+    kernel_space_end = paging_create_tables();
+
+    /* all usable memory after the kernel space is up for grabs, the holes in between 
+       (ACPI, MMIO, etc.) stay reserved */
+    for(i = 0; memory_get_usable(i, &start, &end); ++i)
+    {
+        start = (start < kernel_space_end) ? kernel_space_end : start;
 
-    uint32_t kernel_space_end = paging_create_tables();
-    paging_map_kernelspace(kernel_space_end);
+        if(start < end)
+            buddy_add_range(start, end);
+    }
+
+    /* identity map everything, the page tables (if any are needed) come from the buddy allocator */
+    i = paging_map_range(0, 0, g_max_pages, &req);
+    dbg_assert(i == EXIT_CODE_GLOBAL_SUCCESS);
     
     ASM_CPU_PAGING_ENABLE(page_dir);
+    g_paging_enabled = 1;
 
     #ifndef NO_DEBUG_INFO
+    print_value( "[PAGING] Free memory: %i KiB\n", buddy_get_free() * (PAGING_PAGE_SIZE / 1024));
+    paging_print_stats();
     print( "[PAGING] Hello paging world! :)\n\n");
     #endif
 }
 
+uint8_t paging_is_enabled(void)
+{
+    return g_paging_enabled;
+}
+
+void paging_print_stats(void)
+{
+#ifndef NO_DEBUG_INFO
+    /* what mapping the same memory with only 4 KiB pages would've cost */
+    uint32_t tables = HOW_MANY(g_max_pages, PAGING_TABLE_SIZE);
+
+    print_value( "[PAGING] 4 MiB pages: %i", g_paging_large_pages);
+    print_value( ", page tables: %i\n", g_paging_tables);
+    print_value( "[PAGING] Saved %i page tables", (tables > g_paging_tables) ? tables - g_paging_tables : 0);
+    print_value( " and %i TLB entries\n", g_paging_large_pages * (PAGING_TABLE_SIZE - 1));
+#endif
+}
+
 void *paging_vptr_to_pptr(void *vptr)
 {
     uint32_t pdindex = (uint32_t)vptr >> 22; /* same as vptr / PAGING_PAGE_SIZE / PAGING_TABLE_SIZE */
@@ -88,6 +142,9 @@ void *paging_vptr_to_pptr(void *vptr)
     uint32_t *pd = page_dir;
     uint32_t *pt = (uint32_t *) (pd[pdindex] & 0xFFFFF000);
     
+    if((pd[pdindex] & 0x01) && (pd[pdindex] & PAGE_LARGE))
+        return (void *) ((pd[pdindex] & PAGING_LARGE_ADDR_MSK) + ((uint32_t)vptr & ~PAGING_LARGE_ADDR_MSK));
+
     if((pd[pdindex] & 0x01) && (pt[ptindex] & 0x01))
         return (void *) ((pt[ptindex] & ((uint32_t)~0xFFF)) + ((uint32_t)vptr & 0xFFF)); 
 
@@ -98,23 +155,12 @@ void *paging_vptr_to_pptr(void *vptr)
 
 void paging_map(void *pptr, void *vptr, PAGE_REQ *req)
 {
-    uint32_t pdindex = (uint32_t)vptr >> 22;
-    uint32_t ptindex = (uint32_t) (((uint32_t)vptr) >> 12) & 0x03FF;
-
-    uint32_t *pd = page_dir;
-    uint32_t *pt = (uint32_t *) (pd[pdindex] & 0xFFFFF000);
-
-    pt[ptindex] = paging_convert_ptr_to_entry((uint32_t) pptr, req);
-
-    ASM_CPU_INVLPG((uint32_t *)pptr);
-    
+    paging_map_range(((uint32_t) pptr) & PAGING_ADDR_MSK, ((uint32_t) vptr) & PAGING_ADDR_MSK, 1, req);
 }
 
 void *valloc(PAGE_REQ *req)
 {   
     uint32_t npages;
-    uint32_t *ptable;
-    uint32_t page_id, t_index, d_index;
 
     /* just checking... */
     dbg_assert((uint32_t)page_dir);
@@ -125,77 +171,45 @@ void *valloc(PAGE_REQ *req)
     if((npages > g_max_pages) || (npages == 0))
         return NULL;
 
-    void * ptr = paging_find_free(npages);
-    dbg_assert(ptr);
-
-    page_id = ((uint32_t) ptr) >> 12;
-    d_index = page_id >> 10; /* same as page_id / PAGING_TABLE_SIZE */
-    t_index = page_id % PAGING_TABLE_SIZE;
-
-    ptable = (uint32_t *) (page_dir[d_index] & PAGING_ADDR_MSK);
-
-    ptable[t_index] = paging_convert_ptr_to_entry(ptable[t_index] & PAGING_ADDR_MSK, req);
-        
-    ASM_CPU_INVLPG((uint32_t *)ptable[t_index]);
-
-    /* update our information about this page */
-    for(uint32_t i = 0; i < npages; ++i)
-        shadow_t[page_id + i].pid = (req->pid);
+    /* the buddy allocator keeps track of who owns what */
+    void * ptr = buddy_alloc(npages, req->pid, (req->attr & PAGE_REQ_ATTR_ZERO) ? 1 : 0);
     
-    shadow_t[page_id].npages = npages;
+    if(!ptr)
+        return NULL;
+
+    /* every page gets the requested attributes, not just the first one */
+    if(paging_map_range((uint32_t) ptr, (uint32_t) ptr, npages, req) != EXIT_CODE_GLOBAL_SUCCESS)
+    {
+        buddy_free(ptr);
+        return NULL;
+    }
 
     return ptr;
 }
 
 void vfree(void *ptr)
 {
-    uint32_t d_index, t_index,
-            page_id = ((uint32_t) ptr) / PAGING_PAGE_SIZE;
-    uint32_t *ptable;
+    PAGE_REQ req = {PID_KERNEL, PAGING_DEFAULT_ATTR, 0};
+    uint32_t npages = buddy_get_npages(ptr);
 
-    d_index = page_id / PAGING_TABLE_SIZE;
-    t_index = page_id % PAGING_TABLE_SIZE;
+    /* not allocated (anymore) */
+    if(!npages)
+        return;
 
-    /* make page supervisor only 
-    TODO/FIXME: do not! 
-    */
-    ptable = (uint32_t *) (page_dir[d_index] & PAGING_ADDR_MSK);
-    ptable[t_index] = ptable[t_index] & ~(PAGE_REQ_ATTR_SUPERVISOR<<1);
+    /* back to what the rest of the identity map looks like, so 4 MiB pages can stay (or become) whole */
+    paging_map_range((uint32_t) ptr, (uint32_t) ptr, npages, &req);
     
-     /* remove the contents */
-    memset((char *)ptr, PAGING_PAGE_SIZE * shadow_t[page_id].npages, 0x00);
-
-    //* update our shadow map (RESV PID means unallocated) */
-    for(uint32_t i = 0; i < shadow_t[page_id].npages; i++)
-        shadow_t[page_id + i].pid = PID_RESV;
-}
-
-
-static void *paging_find_free(uint32_t npages)
-{
-    uint32_t index, cnt = 0;
-    for(uint32_t i = 0; i < shadow_len; ++i)
-    {
-        if(shadow_t[i].pid != PID_RESV)
-        { cnt = 0; continue; }
-
-        if(!cnt)
-            index = i;
-        
-        if(cnt++ == npages)
-            return (void *) (index << 12); // same as index * PAGE_SIZE
-    }
-
-    return NULL;
+    /* the contents are removed later on, by whoever needs the pages zeroed or when we're idle */
+    buddy_free(ptr);
 }
 
 static uint32_t paging_convert_ptr_to_entry(uint32_t ptr, PAGE_REQ *req)
 {
     /* remove the attributes so that we only enable the things we should */
-    uint32_t temp = ptr & ~((PAGE_REQ_ATTR_SUPERVISOR | PAGE_REQ_ATTR_READ_ONLY) << 1);   
+    uint32_t temp = ptr & ~((PAGE_REQ_ATTR_SUPERVISOR | PAGE_REQ_ATTR_READ_ONLY | PAGE_REQ_ATTR_NO_CACHE) << 1);   
 
     /* now enable the things we do need. */ 
-    temp = (uint32_t) (temp | (uint32_t)((req->attr) << 1U) | PAGE_PRESENT);
+    temp = (uint32_t) (temp | (uint32_t)((req->attr & (PAGE_REQ_ATTR_SUPERVISOR | PAGE_REQ_ATTR_READ_WRITE | PAGE_REQ_ATTR_NO_CACHE)) << 1U) | PAGE_PRESENT);
 
     return temp;
 }
@@ -203,70 +217,140 @@ static uint32_t paging_convert_ptr_to_entry(uint32_t ptr, PAGE_REQ *req)
 /* returns: end of the tables */
 static uint32_t paging_create_tables(void)
 {
-    /* I like spagetthi :) */
-
-    uint32_t available_mem, page_tables;
-    uint32_t i, table_loc, amount_mem; /* for-loop */
+    uint32_t i, amount_mem;
 
     page_dir = memory_paging_tables_loc();
 
-    available_mem = (page_dir[0] * 1000);
+    /* map up to the end of the highest usable region, whatever is in between */
+    g_max_pages = memory_get_top() / PAGING_PAGE_SIZE;
 
-    /* here's some math; first up: the amount of page tables required to map all of the memory available */
-    page_tables = (available_mem / PAGING_PAGE_SIZE); /* # of pages */
+    /* only the directory lives here, page tables are allocated when something needs them */
+    amount_mem = PAGING_TABLE_SIZE * sizeof(uint32_t); /* in bytes */
 
-    g_max_pages = page_tables;
-
-    page_tables = HOW_MANY(page_tables, PAGING_TABLE_SIZE); /* # page tables */
-
-    /* next: how much memory is needed for them. */
-    amount_mem = (PAGING_TABLE_SIZE + (page_tables * PAGING_TABLE_SIZE)) * sizeof(uint32_t); /* in bytes */
-    
-    paging_prepare_table(page_dir, PAGING_TABLE_TYPE_DIR);
-    
-    /* put the tables where we need them and fill them with adresses/pages */
-    for(i = 1; i <= page_tables; ++i)
-    {
-        table_loc = (uint32_t) ((i * 0x1000) + ((uint32_t) page_dir));
-        page_dir[i - 1] = (uint32_t) table_loc | 0x03;
+    /* the buddy allocator's page information goes right after the directory */
+    amount_mem += buddy_init((void *) (((uint32_t) page_dir) + amount_mem), g_max_pages);
 
-        paging_prepare_table((uint32_t *) table_loc, PAGING_TABLE_TYPE_TAB);      
-    }
+    /* the tables had better not be in a hole */
+    dbg_assert(memory_is_usable((uint32_t) page_dir, ((uint32_t) page_dir) + amount_mem));
 
-    /* allocate a shadow map for all of the pages */
-    shadow_len = available_mem / PAGING_PAGE_SIZE;
-    shadow_t = (shadow_allocated *) kmalloc(shadow_len * sizeof(shadow_allocated));
-    memset((char *)shadow_t, shadow_len * sizeof(shadow_allocated), (char) PID_RESV);
+    for(i = 0; i < PAGING_TABLE_SIZE; ++i)
+        page_dir[i] = (uint32_t) 0x02;
 
     return (((uint32_t)page_dir) + amount_mem);
 }
 
-static void paging_prepare_table(uint32_t *table, uint8_t type)
+/* maps npages pages from pptr to vptr in one go, with 4 MiB pages wherever they fit.
+   Only the pages that actually change get invalidated. */
+static uint8_t paging_map_range(uint32_t pptr, uint32_t vptr, uint32_t npages, PAGE_REQ *req)
 {
-    uint32_t i;
-    static uint32_t previous_end = 0;
+    uint32_t entry, d_index, t_index;
+    uint32_t *ptable;
+    uint8_t flush = 0;
 
-    if (type == PAGING_TABLE_TYPE_DIR)
-        for(i = 0; i < 1024; ++i)
-            table[i] = (uint32_t) 0x02;
-    else
+    while(npages)
     {
-        for(i = 0; i < 1024; ++i)
-            table[i] = (uint32_t ) ((previous_end + i * 0x1000) | 3);
-
-        previous_end = table[1023];
+        d_index = vptr >> 22;
+
+        if(g_paging_pse && (npages >= PAGING_TABLE_SIZE) && !(vptr & ~PAGING_LARGE_ADDR_MSK) && !(pptr & ~PAGING_LARGE_ADDR_MSK))
+        {
+            entry = paging_convert_ptr_to_entry(pptr, req) | PAGE_LARGE;
+
+            if((page_dir[d_index] & ~PAGE_USED) != entry)
+            {
+                if((page_dir[d_index] & PAGE_PRESENT) && !(page_dir[d_index] & PAGE_LARGE))
+                {
+                    /* 1024 small pages could be cached, cheaper to throw the whole TLB away */
+                    paging_free_table(d_index);
+                    flush = 1;
+                }
+                else if(page_dir[d_index] & PAGE_PRESENT)
+                    ASM_CPU_INVLPG((void *) vptr);
+                
+                if(!(page_dir[d_index] & PAGE_LARGE) || !(page_dir[d_index] & PAGE_PRESENT))
+                    g_paging_large_pages++;
+
+                page_dir[d_index] = entry;
+            }
+
+            pptr += PAGING_LARGE_PAGE_SIZE;
+            vptr += PAGING_LARGE_PAGE_SIZE;
+            npages -= PAGING_TABLE_SIZE;
+            continue;
+        }
+
+        entry = paging_convert_ptr_to_entry(pptr, req);
+
+        /* already part of a 4 MiB page that maps it just like this, don't split it up for nothing */
+        if((page_dir[d_index] & PAGE_LARGE) && ((page_dir[d_index] & PAGING_ATTR_MSK & ~(PAGE_LARGE | PAGE_USED)) == (entry & PAGING_ATTR_MSK & ~PAGE_USED))
+            && (((page_dir[d_index] & PAGING_LARGE_ADDR_MSK) | (vptr & ~PAGING_LARGE_ADDR_MSK)) == pptr))
+        {
+            pptr += PAGING_PAGE_SIZE;
+            vptr += PAGING_PAGE_SIZE;
+            npages--;
+            continue;
+        }
+
+        if(!(ptable = paging_get_table(d_index)))
+            return EXIT_CODE_OUT_OF_MEMORY;
+
+        t_index = (vptr >> 12) & 0x03FF;
+
+        if((ptable[t_index] & ~PAGE_USED) != entry)
+        {
+            /* pages that weren't present can't be in the TLB */
+            if(ptable[t_index] & PAGE_PRESENT)
+                ASM_CPU_INVLPG((void *) vptr);
+
+            ptable[t_index] = entry;
+        }
+
+        pptr += PAGING_PAGE_SIZE;
+        vptr += PAGING_PAGE_SIZE;
+        npages--;
     }
+
+    if(flush)
+        ASM_CPU_FLUSH_TLB();
+
+    return EXIT_CODE_GLOBAL_SUCCESS;
 }
 
-static void paging_map_kernelspace(uint32_t end_of_kernel_space)
+/* returns the page table for directory entry d_index, a 4 MiB page gets split up into 
+   a table that maps the exact same memory */
+static uint32_t *paging_get_table(uint32_t d_index)
 {
-    PAGE_REQ req = {PID_KERNEL, PAGE_REQ_ATTR_SUPERVISOR | PAGE_REQ_ATTR_READ_WRITE, PAGING_PAGE_SIZE};
-    uint32_t i;
-    uint32_t pages = end_of_kernel_space >> 12; /* same as end_of_kernel_space / PAGING_PAGE_SIZE */
+    uint32_t i, base, attr;
+    uint32_t *ptable;
 
-    for(i = 0; i < pages; ++i)
+    if((page_dir[d_index] & PAGE_PRESENT) && !(page_dir[d_index] & PAGE_LARGE))
+        return (uint32_t *) (page_dir[d_index] & PAGING_ADDR_MSK);
+
+    /* everything is identity mapped, so this can be used right away (a new table starts out empty) */
+    if(!(ptable = (uint32_t *) buddy_alloc(1, PID_KERNEL, !(page_dir[d_index] & PAGE_LARGE))))
+        return NULL;
+
+    if(page_dir[d_index] & PAGE_LARGE)
     {
-        paging_map((void *) (i << 12), (void *) (i << 12), &req);
-        shadow_t[i].pid = PID_KERNEL;
+        base = page_dir[d_index] & PAGING_LARGE_ADDR_MSK;
+        /* bit 7 of a table entry is PAT, and the small pages haven't been touched yet */
+        attr = page_dir[d_index] & PAGING_ATTR_MSK & ~(PAGE_LARGE | PAGE_USED);
+
+        for(i = 0; i < PAGING_TABLE_SIZE; ++i)
+            ptable[i] = (base + i * PAGING_PAGE_SIZE) | attr;
+
+        g_paging_large_pages--;
     }
+
+    /* same translation as before, no need to invalidate anything */
+    page_dir[d_index] = ((uint32_t) ptable) | PAGING_TABLE_ATTR;
+    g_paging_tables++;
+
+    return ptable;
+}
+
+static void paging_free_table(uint32_t d_index)
+{
+    buddy_free((void *) (page_dir[d_index] & PAGING_ADDR_MSK));
+    page_dir[d_index] = (uint32_t) 0x02;
+    g_paging_tables--;
 }
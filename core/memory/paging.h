@@ -29,6 +29,8 @@ SOFTWARE.
 #define PAGE_REQ_ATTR_READ_WRITE    1U << 0
 #define PAGE_REQ_ATTR_READ_ONLY     !PAGE_REQ_ATTR_READ_WRITE
 #define PAGE_REQ_ATTR_SUPERVISOR    1U << 1
+#define PAGE_REQ_ATTR_NO_CACHE      1U << 3 /* for memory mapped I/O */
+#define PAGE_REQ_ATTR_ZERO          1U << 7 /* not a page attribute, valloc() hands out zeroed memory */
 
 typedef struct
 {
@@ -39,6 +41,8 @@ typedef struct
 
 
 void paging_init(void);
+unsigned char paging_is_enabled(void);
+void paging_print_stats(void);
 void *paging_vptr_to_pptr(void *vptr);
 void paging_map(void *pptr, void *vptr, PAGE_REQ *req);
 
@@ -46,6 +50,8 @@ void *valloc(PAGE_REQ *req);
 void vfree(void *ptr);
 
 extern void ASM_CPU_PAGING_ENABLE(unsigned int *table);
-extern void ASM_CPU_INVLPG(void *paddr);
+extern void ASM_CPU_INVLPG(void *vaddr);
+extern void ASM_CPU_FLUSH_TLB(void);
+extern void ASM_CPU_PSE_ENABLE(void);
 
 #endif
\ No newline at end of file
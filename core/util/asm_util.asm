@@ -0,0 +1,406 @@
+;MIT license
+;Copyright (c) 2019-2021 Maarten Vermeulen
+
+;Permission is hereby granted, free of charge, to any person obtaining a copy
+;of this software and associated documentation files (the "Software"), to deal
+;in the Software without restriction, including without limitation the rights
+;to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+;copies of the Software, and to permit persons to whom the Software is
+;furnished to do so, subject to the following conditions:
+;
+;The above copyright notice and this permission notice shall be included in all
+;copies or substantial portions of the Software.
+;
+;THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+;IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+;FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+;AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+;LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+;OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+;SOFTWARE.
+
+
+; memcpy/memset/memcmp kernels, util.c picks the ones to use at boot (util_mem_init).
+; The rep versions work on any cpu, the SSE2 ones need cr4.OSFXSR to be set.
+
+; copies bigger than this bypass the cache (non-temporal stores), they'd only push everything
+; else out of it anyway
+%define MEM_NT_THRESHOLD    0x40000
+
+; below this the SSE2 loops aren't worth the alignment work
+%define MEM_SSE2_MIN        128
+
+section .text
+
+bits 32
+
+global ASM_MEMCPY_REP
+ASM_MEMCPY_REP:
+; copies memory using rep movsd
+;   input:
+;       - destination
+;       - source
+;       - size (in bytes)
+;   output:
+;       - N/A
+
+    push ebp
+    mov ebp, esp
+    push esi
+    push edi
+
+    mov edi, [ebp + 8]
+    mov esi, [ebp + 12]
+    mov ecx, [ebp + 16]
+    cld
+
+    cmp ecx, 8
+    jb .bytes
+
+    ; align the destination to a dword
+    mov edx, edi
+    neg edx
+    and edx, 3
+    sub ecx, edx
+    xchg ecx, edx
+    rep movsb
+    mov ecx, edx
+
+    shr ecx, 2
+    rep movsd
+    mov ecx, edx
+    and ecx, 3
+
+    .bytes:
+    rep movsb
+
+    pop edi
+    pop esi
+    mov esp, ebp
+    pop ebp
+ret
+
+global ASM_MEMSET_REP
+ASM_MEMSET_REP:
+; fills memory using rep stosd
+;   input:
+;       - destination
+;       - size (in bytes)
+;       - value (byte)
+;   output:
+;       - N/A
+
+    push ebp
+    mov ebp, esp
+    push edi
+
+    mov edi, [ebp + 8]
+    mov ecx, [ebp + 12]
+    movzx eax, BYTE [ebp + 16]
+    imul eax, eax, 0x01010101
+    cld
+
+    cmp ecx, 8
+    jb .bytes
+
+    ; align the destination to a dword
+    mov edx, edi
+    neg edx
+    and edx, 3
+    sub ecx, edx
+    xchg ecx, edx
+    rep stosb
+    mov ecx, edx
+
+    shr ecx, 2
+    rep stosd
+    mov ecx, edx
+    and ecx, 3
+
+    .bytes:
+    rep stosb
+
+    pop edi
+    mov esp, ebp
+    pop ebp
+ret
+
+global ASM_MEMCMP_REP
+ASM_MEMCMP_REP:
+; compares memory using repe cmpsd
+;   input:
+;       - pointer to the first block
+;       - pointer to the second block
+;       - size (in bytes)
+;   output:
+;       - difference between the first bytes that differ, 0 if equal (in eax)
+
+    push ebp
+    mov ebp, esp
+    push esi
+    push edi
+
+    mov esi, [ebp + 8]
+    mov edi, [ebp + 12]
+    mov ecx, [ebp + 16]
+    cld
+
+    mov edx, ecx
+    shr ecx, 2
+    jz .tail
+
+    repe cmpsd
+    je .tail
+
+    ; one of the bytes in this dword is different
+    sub esi, 4
+    sub edi, 4
+    mov ecx, 4
+    jmp .compare
+
+    .tail:
+    mov ecx, edx
+    and ecx, 3
+
+    .compare:
+    xor eax, eax
+    test ecx, ecx
+    jz .done
+
+    repe cmpsb
+    je .done
+
+    movzx eax, BYTE [esi - 1]
+    movzx edx, BYTE [edi - 1]
+    sub eax, edx
+
+    .done:
+    pop edi
+    pop esi
+    mov esp, ebp
+    pop ebp
+ret
+
+global ASM_MEMCPY_SSE2
+ASM_MEMCPY_SSE2:
+; copies memory 64 bytes at a time using SSE2
+;   input:
+;       - destination
+;       - source
+;       - size (in bytes)
+;   output:
+;       - N/A
+
+    push ebp
+    mov ebp, esp
+    push esi
+    push edi
+
+    mov edi, [ebp + 8]
+    mov esi, [ebp + 12]
+    mov ecx, [ebp + 16]
+    cld
+
+    cmp ecx, MEM_SSE2_MIN
+    jb .tail
+
+    ; align the destination to 16 bytes, the source may stay unaligned
+    mov edx, edi
+    neg edx
+    and edx, 15
+    sub ecx, edx
+    xchg ecx, edx
+    rep movsb
+    mov ecx, edx
+
+    mov edx, ecx
+    shr edx, 6
+    and ecx, 63
+
+    cmp DWORD [ebp + 16], MEM_NT_THRESHOLD
+    jae .stream
+
+    .loop:
+    movdqu xmm0, [esi]
+    movdqu xmm1, [esi + 16]
+    movdqu xmm2, [esi + 32]
+    movdqu xmm3, [esi + 48]
+    movdqa [edi], xmm0
+    movdqa [edi + 16], xmm1
+    movdqa [edi + 32], xmm2
+    movdqa [edi + 48], xmm3
+    add esi, 64
+    add edi, 64
+    dec edx
+    jnz .loop
+    jmp .tail
+
+    .stream:
+    movdqu xmm0, [esi]
+    movdqu xmm1, [esi + 16]
+    movdqu xmm2, [esi + 32]
+    movdqu xmm3, [esi + 48]
+    movntdq [edi], xmm0
+    movntdq [edi + 16], xmm1
+    movntdq [edi + 32], xmm2
+    movntdq [edi + 48], xmm3
+    add esi, 64
+    add edi, 64
+    dec edx
+    jnz .stream
+
+    ; non-temporal stores aren't ordered
+    sfence
+
+    .tail:
+    mov edx, ecx
+    shr ecx, 2
+    rep movsd
+    mov ecx, edx
+    and ecx, 3
+    rep movsb
+
+    pop edi
+    pop esi
+    mov esp, ebp
+    pop ebp
+ret
+
+global ASM_MEMSET_SSE2
+ASM_MEMSET_SSE2:
+; fills memory 64 bytes at a time using SSE2
+;   input:
+;       - destination
+;       - size (in bytes)
+;       - value (byte)
+;   output:
+;       - N/A
+
+    push ebp
+    mov ebp, esp
+    push edi
+
+    mov edi, [ebp + 8]
+    mov ecx, [ebp + 12]
+    movzx eax, BYTE [ebp + 16]
+    imul eax, eax, 0x01010101
+    cld
+
+    cmp ecx, MEM_SSE2_MIN
+    jb .tail
+
+    movd xmm0, eax
+    pshufd xmm0, xmm0, 0
+
+    ; align the destination to 16 bytes
+    mov edx, edi
+    neg edx
+    and edx, 15
+    sub ecx, edx
+    xchg ecx, edx
+    rep stosb
+    mov ecx, edx
+
+    mov edx, ecx
+    shr edx, 6
+    and ecx, 63
+
+    cmp DWORD [ebp + 12], MEM_NT_THRESHOLD
+    jae .stream
+
+    .loop:
+    movdqa [edi], xmm0
+    movdqa [edi + 16], xmm0
+    movdqa [edi + 32], xmm0
+    movdqa [edi + 48], xmm0
+    add edi, 64
+    dec edx
+    jnz .loop
+    jmp .tail
+
+    .stream:
+    movntdq [edi], xmm0
+    movntdq [edi + 16], xmm0
+    movntdq [edi + 32], xmm0
+    movntdq [edi + 48], xmm0
+    add edi, 64
+    dec edx
+    jnz .stream
+
+    sfence
+
+    .tail:
+    mov edx, ecx
+    shr ecx, 2
+    rep stosd
+    mov ecx, edx
+    and ecx, 3
+    rep stosb
+
+    pop edi
+    mov esp, ebp
+    pop ebp
+ret
+
+global ASM_MEMCMP_SSE2
+ASM_MEMCMP_SSE2:
+; compares memory 16 bytes at a time using SSE2
+;   input:
+;       - pointer to the first block
+;       - pointer to the second block
+;       - size (in bytes)
+;   output:
+;       - difference between the first bytes that differ, 0 if equal (in eax)
+
+    push ebp
+    mov ebp, esp
+    push esi
+    push edi
+
+    mov esi, [ebp + 8]
+    mov edi, [ebp + 12]
+    mov ecx, [ebp + 16]
+    cld
+
+    .loop:
+    cmp ecx, 16
+    jb .tail
+
+    movdqu xmm0, [esi]
+    movdqu xmm1, [edi]
+    pcmpeqb xmm0, xmm1
+    pmovmskb eax, xmm0
+    xor eax, 0xFFFF
+    jnz .differs
+
+    add esi, 16
+    add edi, 16
+    sub ecx, 16
+    jmp .loop
+
+    .differs:
+    ; every bit in eax is a byte that's different, we want the first one
+    bsf edx, eax
+    movzx eax, BYTE [esi + edx]
+    movzx edx, BYTE [edi + edx]
+    sub eax, edx
+    jmp .done
+
+    .tail:
+    xor eax, eax
+    test ecx, ecx
+    jz .done
+
+    repe cmpsb
+    je .done
+
+    movzx eax, BYTE [esi - 1]
+    movzx edx, BYTE [edi - 1]
+    sub eax, edx
+
+    .done:
+    pop edi
+    pop esi
+    mov esp, ebp
+    pop ebp
+ret
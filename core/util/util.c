@@ -32,6 +32,8 @@ SOFTWARE.
 
 #include "../memory/memory.h"
 
+#include "../cpu/cpu.h"
+
 #define UTIL_POOL_SIZE		32
 
 // --> memory pool for util
@@ -39,6 +41,12 @@ SOFTWARE.
 // the memory module hasn't been initialized yet
 char utilPool[UTIL_POOL_SIZE];
 
+// --> the mem* functions used, the rep movsd/stosd ones
+// work on anything so they're used until util_mem_init()
+void (*util_memcpy)(char *, const char *, size_t) = ASM_MEMCPY_REP;
+void (*util_memset)(char *, size_t, char) = ASM_MEMSET_REP;
+int (*util_memcmp)(const void *, const void *, size_t) = ASM_MEMCMP_REP;
+
 static size_t __strxspn(const char *s, const char *map, char parity);
 
 unsigned int strlen(const char *str)
@@ -203,10 +211,20 @@ unsigned int hex_digit_count(uint32_t value)
 	return 2;
 }
 
+/* picks the fastest mem* functions the cpu can do, call after CPU_init() */
+void util_mem_init(void)
+{
+	if(!CPU_sse2_usable())
+		return;
+
+	util_memcpy = ASM_MEMCPY_SSE2;
+	util_memset = ASM_MEMSET_SSE2;
+	util_memcmp = ASM_MEMCMP_SSE2;
+}
+
 void memset(char *start, size_t size, char val)
 {
-	while(size--)
-		start[size] = val;
+	util_memset(start, size, val);
 }
 
 void sleep(uint32_t timeIn_ms)
@@ -268,15 +286,30 @@ unsigned char strchr(char *str, char ch)
 
 void memcpy(char *destination, char *source, size_t size)
 {
-	uint32_t i;
-	
-	for(i = 0; i < size; ++i)
-		*(destination + i) = *(source + i);
+	util_memcpy(destination, source, size);
+}
 
+/* FNV-1a over the name, seed tells equal names apart (the directory they're in) */
+uint32_t name_hash(uint32_t seed, const char *name, uint32_t len)
+{
+	uint32_t h = 2166136261u ^ seed;
+
+	while(len--)
+	{
+		h ^= (uint8_t) *(name++);
+		h *= 16777619u;
+	}
+
+	return h;
 }
 
 
 /* LIB C stuff */
+int memcmp(const void *ptr1, const void *ptr2, size_t size)
+{
+	return util_memcmp(ptr1, ptr2, size);
+}
+
 char *strtok(char *s, const char *delim)
 {
 	static char *holder;
@@ -38,6 +38,7 @@ unsigned char strdigit_toInt(const char digit);
 unsigned int digit_count(unsigned int value);
 unsigned int hex_digit_count(unsigned int value);
 
+void util_mem_init(void);
 void memset(char *start, unsigned int size, char val);
 
 void sleep(unsigned int timeIn_ms);
@@ -46,9 +47,19 @@ unsigned int find_in_str(char *o, const char *fnd);
 
 unsigned char strchr(char *str, char ch);
 void memcpy(char *destination, char *source, unsigned int size);
+int memcmp(const void *ptr1, const void *ptr2, unsigned int size);
+unsigned int name_hash(unsigned int seed, const char *name, unsigned int len);
 
 char *strtok(char *s, const char *delim);
 char *strsep(char **stringp, const char *delim);
 char *strpbrk(const char *s, const char *accept);
 
+/* the memcpy/memset/memcmp kernels (asm_util.asm) */
+extern void ASM_MEMCPY_REP(char *destination, const char *source, unsigned int size);
+extern void ASM_MEMSET_REP(char *start, unsigned int size, char val);
+extern int ASM_MEMCMP_REP(const void *ptr1, const void *ptr2, unsigned int size);
+extern void ASM_MEMCPY_SSE2(char *destination, const char *source, unsigned int size);
+extern void ASM_MEMSET_SSE2(char *start, unsigned int size, char val);
+extern int ASM_MEMCMP_SSE2(const void *ptr1, const void *ptr2, unsigned int size);
+
 #endif
\ No newline at end of file